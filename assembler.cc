@@ -0,0 +1,2454 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "assembler.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+
+// ----------------------------------------------------------------------
+// Lexer
+
+enum struct TokenKind : uint8_t {
+  end = 0,
+  name,     // a mnemonic, register, label, directive or size
+  number,
+  punct     // a single character: , [ ] ( ) + - * : $ % and anything else
+};
+
+struct Token {
+  TokenKind kind = TokenKind::end;
+  string_view text;
+  uint64_t value = 0;
+};
+
+static bool
+isNameStart( char c ) {
+  return ( 'a' <= c && c <= 'z' ) || ( 'A' <= c && c <= 'Z' ) || c == '_' || c == '.';
+}
+
+static bool
+isNameChar( char c ) {
+  return isNameStart( c ) || ( '0' <= c && c <= '9' );
+}
+
+// the value of a digit in base, or base when c isn't one
+static uint64_t
+digit( char c, uint64_t base ) {
+  uint64_t d = base;
+
+  if( '0' <= c && c <= '9' ) {
+    d = c - '0';
+  }
+  else if( 'a' <= c && c <= 'f' ) {
+    d = c - 'a' + 10;
+  }
+  else if( 'A' <= c && c <= 'F' ) {
+    d = c - 'A' + 10;
+  }
+
+  return d < base ? d : base;
+}
+
+// Splits one line into tokens that point into the line. Blanks and comments are skipped;
+// inComment carries an unfinished /* */ from one line to the next.
+class Lexer {
+public:
+  Lexer( const char* p, const char* end, bool& inComment )
+    : p{ p }, end{ end }, inComment{ inComment } {
+    token = scan();
+  }
+
+  const Token&
+  peek() const {
+    return token;
+  }
+
+  Token
+  next() {
+    auto t = token;
+    token = scan();
+    return t;
+  }
+
+  // consume the next token when it's the character c
+  bool
+  accept( char c ) {
+    if( token.kind == TokenKind::punct && token.text[ 0 ] == c ) {
+      next();
+      return true;
+    }
+
+    return false;
+  }
+
+  void
+  expect( char c ) {
+    if( !accept( c ) ) {
+      throw "unexpected token";
+    }
+  }
+
+  bool
+  atEnd() const {
+    return token.kind == TokenKind::end;
+  }
+
+private:
+  void
+  skip() {
+    while( p < end ) {
+      if( inComment ) {
+        auto close = p;
+
+        while( close + 1 < end && !( close[ 0 ] == '*' && close[ 1 ] == '/' ) ) {
+          close++;
+        }
+
+        inComment = end <= close + 1;
+        p = inComment ? end : close + 2;
+        continue;
+      }
+
+      auto c = *p;
+
+      if( c == ' ' || c == '\t' || c == '\r' ) {
+        p++;
+      }
+      else if( c == '/' && p + 1 < end && p[ 1 ] == '*' ) {
+        inComment = true;
+        p += 2;
+      }
+      else if( c == ';' || c == '#' || ( c == '/' && p + 1 < end && p[ 1 ] == '/' ) ) {
+        p = end;
+      }
+      else {
+        break;
+      }
+    }
+  }
+
+  Token
+  scan() {
+    skip();
+
+    Token t;
+
+    if( p == end ) {
+      return t;
+    }
+
+    auto start = p;
+
+    if( isNameStart( *p ) ) {
+      while( p < end && isNameChar( *p ) ) {
+        p++;
+      }
+
+      t.kind = TokenKind::name;
+    }
+    else if( '0' <= *p && *p <= '9' ) {
+      uint64_t base = 10;
+
+      if( *p == '0' && p + 2 < end && ( p[ 1 ] == 'x' || p[ 1 ] == 'b' ) ) {
+        base = p[ 1 ] == 'x' ? 16 : 2;
+        p += 2;
+      }
+
+      auto digits = p;
+
+      for( ; p < end && digit( *p, base ) < base; p++ ) {
+        t.value = t.value * base + digit( *p, base );
+      }
+
+      if( p == digits ) {
+        throw "bad number";
+      }
+
+      t.kind = TokenKind::number;
+
+      // the 1to8 of a {1to8} broadcast is a name
+      if( p < end && isNameChar( *p ) ) {
+        auto to = p;
+
+        while( p < end && isNameChar( *p ) ) {
+          p++;
+        }
+
+        if( base != 10 || p - to < 3 || to[ 0 ] != 't' || to[ 1 ] != 'o' ||
+            !all_of( to + 2, p, []( char c ) { return '0' <= c && c <= '9'; } ) ) {
+          throw "bad number";
+        }
+
+        t.kind = TokenKind::name;
+      }
+    }
+    else {
+      p++;
+      t.kind = TokenKind::punct;
+    }
+
+    t.text = string_view( start, p - start );
+    return t;
+  }
+
+  const char* p;
+  const char* end;
+  bool& inComment;
+  Token token;
+};
+
+// ----------------------------------------------------------------------
+// Operands
+
+enum struct OperandKind : uint8_t {
+  none = 0,
+  reg,
+  xmm,
+  ymm,
+  zmm,
+  k,        // an opmask register
+  imm,
+  mem,
+  label     // a branch target, or a rip relative memory operand
+};
+
+struct Operand {
+  OperandKind kind = OperandKind::none;
+  OpSize size = OpSize::b64;
+  bool sized = false;           // a general purpose register, or memory with a size given
+  Register reg = Register::r0;  // also the number of a vector or opmask register
+  int64_t imm = 0;
+  Mem mem{ Register::r0 };
+  string_view name;
+  uint8_t vector = 0;           // 16, 32 or 64 for memory after xmmword, ymmword or zmmword
+  Mask mask;                    // {k1} and {z} after a destination
+  bool broadcast = false;       // {1to8} and the like after a memory operand
+};
+
+// the parts of a memory operand, before they're checked and made into a Mem
+struct Address {
+  bool hasBase = false;
+  bool hasIndex = false;
+  bool rip = false;
+  Register base = Register::r0;
+  Register index = Register::r0;
+  uint64_t scale = 1;
+  int64_t disp = 0;
+  string_view label;
+};
+
+// number of a register named prefix followed by 0 to count - 1, or -1
+static int
+registerNumber( string_view name, string_view prefix, int count = 16 ) {
+  if( name.size() <= prefix.size() || name.size() > prefix.size() + 2 ||
+      name.substr( 0, prefix.size() ) != prefix ) {
+    return -1;
+  }
+
+  auto n = 0;
+
+  for( auto c : name.substr( prefix.size() ) ) {
+    if( c < '0' || '9' < c ) {
+      return -1;
+    }
+
+    n = n * 10 + c - '0';
+  }
+
+  return n < count ? n : -1;
+}
+
+// Fill in op when name is a register: rax - rdi and r0 - r15 with their 32, 16 and 8
+// bit names, xmm0 - xmm15, ymm0 - ymm15, zmm0 - zmm31 or k0 - k7.
+static bool
+parseRegister( string_view name, Operand& op ) {
+  static const char* const legacy[ 4 ][ 8 ] = {
+    { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil" },
+    { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" },
+    { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" },
+    { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi" }
+  };
+
+  if( auto n = registerNumber( name, "xmm" ); 0 <= n ) {
+    op.kind = OperandKind::xmm;
+    op.reg = static_cast< Register >( n );
+    return true;
+  }
+
+  if( auto n = registerNumber( name, "ymm" ); 0 <= n ) {
+    op.kind = OperandKind::ymm;
+    op.reg = static_cast< Register >( n );
+    return true;
+  }
+
+  if( auto n = registerNumber( name, "zmm", 32 ); 0 <= n ) {
+    op.kind = OperandKind::zmm;
+    op.reg = static_cast< Register >( n );
+    return true;
+  }
+
+  if( auto n = registerNumber( name, "k", 8 ); 0 <= n ) {
+    op.kind = OperandKind::k;
+    op.reg = static_cast< Register >( n );
+    return true;
+  }
+
+  auto size = OpSize::b64;
+  auto base = name;
+
+  if( 2 < name.size() && name[ 0 ] == 'r' ) {
+    switch( name.back() ) {
+    case 'd':
+      size = OpSize::b32;
+      base.remove_suffix( 1 );
+      break;
+    case 'w':
+      size = OpSize::b16;
+      base.remove_suffix( 1 );
+      break;
+    case 'b':
+      size = OpSize::b8;
+      base.remove_suffix( 1 );
+      break;
+    default:
+      break;
+    }
+  }
+
+  if( auto n = registerNumber( base, "r" ); 0 <= n ) {
+    op.kind = OperandKind::reg;
+    op.reg = static_cast< Register >( n );
+    op.size = size;
+    op.sized = true;
+    return true;
+  }
+
+  for( auto s = 0; s < 4; s++ ) {
+    for( auto r = 0; r < 8; r++ ) {
+      if( name == legacy[ s ][ r ] ) {
+        op.kind = OperandKind::reg;
+        op.reg = static_cast< Register >( r );
+        op.size = static_cast< OpSize >( s );
+        op.sized = true;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// a base or index register
+static Register
+addressRegister( string_view name ) {
+  Operand op;
+
+  if( !parseRegister( name, op ) || op.kind != OperandKind::reg ||
+      op.size != OpSize::b64 ) {
+    throw "addresses need 64 bit registers";
+  }
+
+  return op.reg;
+}
+
+static bool
+sizeName( string_view name, OpSize& size ) {
+  static const char* const names[] = { "byte", "word", "dword", "qword" };
+
+  for( auto s = 0; s < 4; s++ ) {
+    if( name == names[ s ] ) {
+      size = static_cast< OpSize >( s );
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// the size an AT&T mnemonic suffix stands for
+static bool
+suffixSize( char c, OpSize& size ) {
+  switch( c ) {
+  case 'b':
+    size = OpSize::b8;
+    return true;
+  case 'w':
+    size = OpSize::b16;
+    return true;
+  case 'l':
+    size = OpSize::b32;
+    return true;
+  case 'q':
+    size = OpSize::b64;
+    return true;
+  default:
+    return false;
+  }
+}
+
+static int64_t
+signedNumber( Lexer& lexer ) {
+  auto negative = lexer.accept( '-' );
+
+  if( !negative ) {
+    lexer.accept( '+' );
+  }
+
+  auto t = lexer.next();
+
+  if( t.kind != TokenKind::number ) {
+    throw "expected a number";
+  }
+
+  return negative ? -static_cast< int64_t >( t.value ) : static_cast< int64_t >( t.value );
+}
+
+static Scale
+makeScale( uint64_t scale ) {
+  switch( scale ) {
+  case 1:
+    return Scale::x1;
+  case 2:
+    return Scale::x2;
+  case 4:
+    return Scale::x4;
+  case 8:
+    return Scale::x8;
+  default:
+    throw "scale must be 1, 2, 4 or 8";
+  }
+}
+
+// ----------------------------------------------------------------------
+// Instructions
+
+enum struct Ins : uint8_t {
+  basic = 0,    // code is the BasicOpClass
+  mov,
+  movq,         // mov with a 64 bit size, or movq between an xmm and a register
+  lea,
+  imul,
+  idiv,
+  shift,        // code is the ShiftOp
+  compl_,       // code is the ComplOp
+  idec,         // code is the IDecOp
+  push,
+  pop,
+  jmp,
+  call,
+  jcc,          // code is the CondTest
+  cmovcc,
+  setcc,
+  loop,         // code is 0 for loop, 1 for loope, 2 for loopne
+  ret,
+  syscall,
+  nop,
+  pause,
+  fence,        // code is 0 for mfence, 1 for lfence, 2 for sfence
+  vzeroupper,
+  string,       // code is the instruction's byte opcode, size comes from the mnemonic
+  movsd,        // movs or movsd depending on the operands
+  cmpsd,        // cmps or cmpsd depending on the operands
+  prefix,       // code is 0 for rep, 1 for repne, 2 for lock
+  xchg,
+  xadd,
+  cmpxchg,
+  cmpxchg16b,
+  bitCount,     // code is 0 for popcnt, 1 for lzcnt, 2 for tzcnt
+  cvtsi2sd,
+  cvtsd2si,
+  sse,          // an entry in sseForms
+  sseImm,       // an entry in sseImmForms
+  blendv,       // code is 0 for blendvpd, 1 for blendvps
+  cmp,          // an entry in cmpForms, code is the SDcmp or 8 to take it from an immediate
+  avx,          // an entry in avxForms
+  avxMove,      // an entry in avxMoves
+  avxScalar,    // an entry in avxScalars
+  avxImm,       // an entry in avxImmForms
+  vblend,       // code is 0 for vblendpd, 1 for vblendps
+  vblendv,      // code is 0 for vblendvpd, 1 for vblendvps
+  vcmp,         // form is 0 for vcmpsd, 1 for vcmppd, 2 for vcmpps, code as for cmp
+  vmovsd,
+  vcomisd,
+  vcvtsi2sd,
+  vcvtsd2si,
+  vbroadcast,   // code is 0 for vbroadcastsd, 1 for vbroadcastss
+  vpbroadcast,  // code is 0 for vpbroadcastd, 1 for vpbroadcastq
+  fma,          // an entry in fmaForms, code is the FmaOp
+  bmi,          // an entry in bmiForms
+  bls,          // an entry in blsForms
+  rorx,
+  kmov,         // code is 0 - 3 for kmovb, kmovw, kmovd and kmovq
+  prefetch,     // code is the PrefetchHint, or 4 for prefetchw
+  movnti
+};
+
+struct InsInfo {
+  Ins ins;
+  uint8_t code = 0;
+  OpSize size = OpSize::b64;
+  uint8_t form = 0;   // the entry in a table of forms
+};
+
+// two operand SSE instructions, and the moves, which can also store
+struct SseForms {
+  size_t (*rr)( XmmReg, XmmReg, Code& );
+  size_t (*rm)( XmmReg, const Mem&, Code& );
+  size_t (*mr)( const Mem&, XmmReg, Code& );
+  uint8_t bytes;   // the size of a memory operand
+};
+
+// two operand SSE instructions with an immediate: the blends and shuffles
+struct SseImmForms {
+  size_t (*rri)( XmmReg, XmmReg, uint8_t, Code& );
+  size_t (*rmi)( XmmReg, const Mem&, uint8_t, Code& );
+};
+
+// the SSE compares, which take their predicate as an SDcmp
+struct CmpForms {
+  size_t (*rr)( XmmReg, XmmReg, SDcmp, Code& );
+  size_t (*rm)( XmmReg, const Mem&, SDcmp, Code& );
+};
+
+// three operand VEX instructions on ymm registers, and their EVEX forms on zmm
+// registers, which take a mask and a broadcast
+struct AvxForms {
+  size_t (*rrr)( YmmReg, YmmReg, YmmReg, Code& ) = nullptr;
+  size_t (*rrm)( YmmReg, YmmReg, const Mem&, Code& ) = nullptr;
+  size_t (*zzz)( ZmmReg, ZmmReg, ZmmReg, Code&, Mask ) = nullptr;
+  size_t (*zzm)( ZmmReg, ZmmReg, const Mem&, Code&, Mask, bool ) = nullptr;
+};
+
+// two operand VEX instructions on ymm registers, and the moves, with their EVEX forms;
+// zmb is a load that can broadcast
+struct AvxMoves {
+  size_t (*rr)( YmmReg, YmmReg, Code& ) = nullptr;
+  size_t (*rm)( YmmReg, const Mem&, Code& ) = nullptr;
+  size_t (*mr)( const Mem&, YmmReg, Code& ) = nullptr;
+  size_t (*zz)( ZmmReg, ZmmReg, Code&, Mask ) = nullptr;
+  size_t (*zm)( ZmmReg, const Mem&, Code&, Mask ) = nullptr;
+  size_t (*mz)( const Mem&, ZmmReg, Code&, Mask ) = nullptr;
+  size_t (*zmb)( ZmmReg, const Mem&, Code&, Mask, bool ) = nullptr;
+};
+
+// VEX instructions on ymm registers with an immediate: the shifts and vpermq
+struct AvxImmForms {
+  size_t (*rri)( YmmReg, YmmReg, uint8_t, Code& );
+  size_t (*rmi)( YmmReg, const Mem&, uint8_t, Code& );
+};
+
+// fused multiply add, by element type; only the packed ones have ymm and zmm forms
+struct FmaForms {
+  size_t (*xxx)( FmaOp, XmmReg, XmmReg, XmmReg, Code& ) = nullptr;
+  size_t (*xxm)( FmaOp, XmmReg, XmmReg, const Mem&, Code& ) = nullptr;
+  size_t (*yyy)( FmaOp, YmmReg, YmmReg, YmmReg, Code& ) = nullptr;
+  size_t (*yym)( FmaOp, YmmReg, YmmReg, const Mem&, Code& ) = nullptr;
+  size_t (*zzz)( FmaOp, ZmmReg, ZmmReg, ZmmReg, Code&, Mask ) = nullptr;
+  size_t (*zzm)( FmaOp, ZmmReg, ZmmReg, const Mem&, Code&, Mask, bool ) = nullptr;
+};
+
+// three operand BMI instructions: rrm for andn, pdep, pext and mulx, whose last
+// operand is the one in memory, rmr for the ones whose last operand is a count or a
+// control
+struct BmiForms {
+  size_t (*rrr)( Register, Register, Register, Code& );
+  size_t (*rrm)( Register, Register, const Mem&, Code& );
+  size_t (*rmr)( Register, const Mem&, Register, Code& );
+};
+
+// the BMI instructions on the lowest set bit
+struct BlsForms {
+  size_t (*rr)( Register, Register, Code& );
+  size_t (*rm)( Register, const Mem&, Code& );
+};
+
+// three operand VEX scalar double instructions
+struct AvxScalars {
+  size_t (*rrr)( XmmReg, XmmReg, XmmReg, Code& );
+  size_t (*rrm)( XmmReg, XmmReg, const Mem&, Code& );
+};
+
+static const pair< const char*, SseForms >
+sseForms[] = {
+  { "movsd", { makeMovSD, makeMovSD, makeMovSD, 8 } },
+  { "movss", { makeMovSS, makeMovSS, makeMovSS, 4 } },
+  { "movapd", { makeMovAPD, makeMovAPD, makeMovAPD, 16 } },
+  { "movaps", { makeMovAPS, makeMovAPS, makeMovAPS, 16 } },
+  { "movupd", { makeMovUPD, makeMovUPD, makeMovUPD, 16 } },
+  { "movups", { makeMovUPS, makeMovUPS, makeMovUPS, 16 } },
+  { "movntpd", { nullptr, nullptr, makeMovNTPD, 16 } },
+  { "movntps", { nullptr, nullptr, makeMovNTPS, 16 } },
+  { "movntdq", { nullptr, nullptr, makeMovNTDQ, 16 } },
+  { "addsd", { makeAddSD, makeAddSD, nullptr, 8 } },
+  { "subsd", { makeSubSD, makeSubSD, nullptr, 8 } },
+  { "mulsd", { makeMulSD, makeMulSD, nullptr, 8 } },
+  { "divsd", { makeDivSD, makeDivSD, nullptr, 8 } },
+  { "sqrtsd", { makeSqrtSD, makeSqrtSD, nullptr, 8 } },
+  { "maxsd", { makeMaxSD, makeMaxSD, nullptr, 8 } },
+  { "minsd", { makeMinSD, makeMinSD, nullptr, 8 } },
+  { "comisd", { makeComiSD, makeComiSD, nullptr, 8 } },
+  { "addss", { makeAddSS, makeAddSS, nullptr, 4 } },
+  { "subss", { makeSubSS, makeSubSS, nullptr, 4 } },
+  { "mulss", { makeMulSS, makeMulSS, nullptr, 4 } },
+  { "divss", { makeDivSS, makeDivSS, nullptr, 4 } },
+  { "sqrtss", { makeSqrtSS, makeSqrtSS, nullptr, 4 } },
+  { "maxss", { makeMaxSS, makeMaxSS, nullptr, 4 } },
+  { "minss", { makeMinSS, makeMinSS, nullptr, 4 } },
+  { "addpd", { makeAddPD, makeAddPD, nullptr, 16 } },
+  { "addps", { makeAddPS, makeAddPS, nullptr, 16 } },
+  { "subpd", { makeSubPD, makeSubPD, nullptr, 16 } },
+  { "subps", { makeSubPS, makeSubPS, nullptr, 16 } },
+  { "mulpd", { makeMulPD, makeMulPD, nullptr, 16 } },
+  { "mulps", { makeMulPS, makeMulPS, nullptr, 16 } },
+  { "divpd", { makeDivPD, makeDivPD, nullptr, 16 } },
+  { "divps", { makeDivPS, makeDivPS, nullptr, 16 } },
+  { "sqrtpd", { makeSqrtPD, makeSqrtPD, nullptr, 16 } },
+  { "sqrtps", { makeSqrtPS, makeSqrtPS, nullptr, 16 } },
+  { "maxpd", { makeMaxPD, makeMaxPD, nullptr, 16 } },
+  { "maxps", { makeMaxPS, makeMaxPS, nullptr, 16 } },
+  { "minpd", { makeMinPD, makeMinPD, nullptr, 16 } },
+  { "minps", { makeMinPS, makeMinPS, nullptr, 16 } },
+  { "andpd", { makeAndPD, makeAndPD, nullptr, 16 } },
+  { "andps", { makeAndPS, makeAndPS, nullptr, 16 } },
+  { "andnpd", { makeAndNPD, makeAndNPD, nullptr, 16 } },
+  { "andnps", { makeAndNPS, makeAndNPS, nullptr, 16 } },
+  { "orpd", { makeOrPD, makeOrPD, nullptr, 16 } },
+  { "orps", { makeOrPS, makeOrPS, nullptr, 16 } },
+  { "xorpd", { makeXorPD, makeXorPD, nullptr, 16 } },
+  { "xorps", { makeXorPS, makeXorPS, nullptr, 16 } },
+  { "unpcklpd", { makeUnpckLPD, makeUnpckLPD, nullptr, 16 } },
+  { "unpckhpd", { makeUnpckHPD, makeUnpckHPD, nullptr, 16 } },
+  { "unpcklps", { makeUnpckLPS, makeUnpckLPS, nullptr, 16 } },
+  { "unpckhps", { makeUnpckHPS, makeUnpckHPS, nullptr, 16 } },
+  { "cvtsd2ss", { makeCvtSD2SS, makeCvtSD2SS, nullptr, 8 } },
+  { "cvtss2sd", { makeCvtSS2SD, makeCvtSS2SD, nullptr, 4 } },
+  { "cvtpd2ps", { makeCvtPD2PS, makeCvtPD2PS, nullptr, 16 } },
+  { "cvtps2pd", { makeCvtPS2PD, makeCvtPS2PD, nullptr, 8 } }
+};
+
+static const pair< const char*, SseImmForms >
+sseImmForms[] = {
+  { "blendpd", { makeBlendPD, makeBlendPD } },
+  { "blendps", { makeBlendPS, makeBlendPS } },
+  { "shufpd", { makeShufPD, makeShufPD } },
+  { "shufps", { makeShufPS, makeShufPS } }
+};
+
+static const pair< const char*, CmpForms >
+cmpForms[] = {
+  { "sd", { makeCmpSD, makeCmpSD } },
+  { "ss", { makeCmpSS, makeCmpSS } },
+  { "pd", { makeCmpPD, makeCmpPD } },
+  { "ps", { makeCmpPS, makeCmpPS } }
+};
+
+// the predicates of the compare aliases, in SDcmp order
+static const char* const predicates[] = { "eq", "lt", "le", "unord", "neq", "nlt", "nle",
+                                          "ord" };
+
+static const pair< const char*, AvxForms >
+avxForms[] = {
+  { "vaddpd", { makeVAddPD, makeVAddPD, makeVAddPD, makeVAddPD } },
+  { "vaddps", { makeVAddPS, makeVAddPS, makeVAddPS, makeVAddPS } },
+  { "vsubpd", { makeVSubPD, makeVSubPD, makeVSubPD, makeVSubPD } },
+  { "vsubps", { makeVSubPS, makeVSubPS, makeVSubPS, makeVSubPS } },
+  { "vmulpd", { makeVMulPD, makeVMulPD, makeVMulPD, makeVMulPD } },
+  { "vmulps", { makeVMulPS, makeVMulPS, makeVMulPS, makeVMulPS } },
+  { "vdivpd", { makeVDivPD, makeVDivPD, makeVDivPD, makeVDivPD } },
+  { "vdivps", { makeVDivPS, makeVDivPS, makeVDivPS, makeVDivPS } },
+  { "vminpd", { makeVMinPD, makeVMinPD, makeVMinPD, makeVMinPD } },
+  { "vminps", { makeVMinPS, makeVMinPS, makeVMinPS, makeVMinPS } },
+  { "vmaxpd", { makeVMaxPD, makeVMaxPD, makeVMaxPD, makeVMaxPD } },
+  { "vmaxps", { makeVMaxPS, makeVMaxPS, makeVMaxPS, makeVMaxPS } },
+  { "vandpd", { makeVAndPD, makeVAndPD } },
+  { "vandps", { makeVAndPS, makeVAndPS } },
+  { "vandnpd", { makeVAndNPD, makeVAndNPD } },
+  { "vandnps", { makeVAndNPS, makeVAndNPS } },
+  { "vorpd", { makeVOrPD, makeVOrPD } },
+  { "vorps", { makeVOrPS, makeVOrPS } },
+  { "vxorpd", { makeVXorPD, makeVXorPD } },
+  { "vxorps", { makeVXorPS, makeVXorPS } },
+  { "vpaddd", { makeVPAddD, makeVPAddD, makeVPAddD, makeVPAddD } },
+  { "vpaddq", { makeVPAddQ, makeVPAddQ, makeVPAddQ, makeVPAddQ } },
+  { "vpsubd", { makeVPSubD, makeVPSubD, makeVPSubD, makeVPSubD } },
+  { "vpsubq", { makeVPSubQ, makeVPSubQ, makeVPSubQ, makeVPSubQ } },
+  { "vpmulld", { makeVPMulLD, makeVPMulLD } },
+  { "vpmuludq", { makeVPMulUDQ, makeVPMulUDQ } },
+  { "vpand", { makeVPAnd, makeVPAnd } },
+  { "vpandn", { makeVPAndN, makeVPAndN } },
+  { "vpor", { makeVPOr, makeVPOr } },
+  { "vpxor", { makeVPXor, makeVPXor } },
+  { "vpcmpeqd", { makeVPCmpEqD, makeVPCmpEqD } },
+  { "vpcmpeqq", { makeVPCmpEqQ, makeVPCmpEqQ } },
+  { "vpcmpgtd", { makeVPCmpGtD, makeVPCmpGtD } },
+  { "vpandd", { nullptr, nullptr, makeVPAndD, makeVPAndD } },
+  { "vpandq", { nullptr, nullptr, makeVPAndQ, makeVPAndQ } },
+  { "vpord", { nullptr, nullptr, makeVPOrD, makeVPOrD } },
+  { "vporq", { nullptr, nullptr, makeVPOrQ, makeVPOrQ } },
+  { "vpxord", { nullptr, nullptr, makeVPXorD, makeVPXorD } },
+  { "vpxorq", { nullptr, nullptr, makeVPXorQ, makeVPXorQ } }
+};
+
+static const pair< const char*, AvxMoves >
+avxMoves[] = {
+  { "vmovapd", { makeVMovAPD, makeVMovAPD, makeVMovAPD, makeVMovAPD, makeVMovAPD,
+                  makeVMovAPD } },
+  { "vmovaps", { makeVMovAPS, makeVMovAPS, makeVMovAPS, makeVMovAPS, makeVMovAPS,
+                  makeVMovAPS } },
+  { "vmovupd", { makeVMovUPD, makeVMovUPD, makeVMovUPD, makeVMovUPD, makeVMovUPD,
+                  makeVMovUPD } },
+  { "vmovups", { makeVMovUPS, makeVMovUPS, makeVMovUPS, makeVMovUPS, makeVMovUPS,
+                  makeVMovUPS } },
+  { "vmovdqa", { makeVMovDQA, makeVMovDQA, makeVMovDQA } },
+  { "vmovdqu", { makeVMovDQU, makeVMovDQU, makeVMovDQU } },
+  { "vmovdqu32", { nullptr, nullptr, nullptr, makeVMovDQU32, makeVMovDQU32,
+                    makeVMovDQU32 } },
+  { "vmovdqu64", { nullptr, nullptr, nullptr, makeVMovDQU64, makeVMovDQU64,
+                    makeVMovDQU64 } },
+  { "vmovntpd", { nullptr, nullptr, makeVMovNTPD } },
+  { "vmovntps", { nullptr, nullptr, makeVMovNTPS } },
+  { "vmovntdq", { nullptr, nullptr, makeVMovNTDQ } },
+  { "vsqrtpd", { makeVSqrtPD, makeVSqrtPD, nullptr, makeVSqrtPD, nullptr, nullptr,
+                  makeVSqrtPD } },
+  { "vsqrtps", { makeVSqrtPS, makeVSqrtPS, nullptr, makeVSqrtPS, nullptr, nullptr,
+                  makeVSqrtPS } }
+};
+
+static const pair< const char*, AvxScalars >
+avxScalars[] = {
+  { "vaddsd", { makeVAddSD, makeVAddSD } },
+  { "vsubsd", { makeVSubSD, makeVSubSD } },
+  { "vmulsd", { makeVMulSD, makeVMulSD } },
+  { "vdivsd", { makeVDivSD, makeVDivSD } },
+  { "vsqrtsd", { makeVSqrtSD, makeVSqrtSD } },
+  { "vmaxsd", { makeVMaxSD, makeVMaxSD } },
+  { "vminsd", { makeVMinSD, makeVMinSD } }
+};
+
+static const pair< const char*, AvxImmForms >
+avxImmForms[] = {
+  { "vpslld", { makeVPSllD, nullptr } },
+  { "vpsrld", { makeVPSrlD, nullptr } },
+  { "vpsrad", { makeVPSraD, nullptr } },
+  { "vpsllq", { makeVPSllQ, nullptr } },
+  { "vpsrlq", { makeVPSrlQ, nullptr } },
+  { "vpermq", { makeVPermQ, makeVPermQ } }
+};
+
+static const pair< const char*, FmaForms >
+fmaForms[] = {
+  { "sd", { makeVFmaSD, makeVFmaSD } },
+  { "ss", { makeVFmaSS, makeVFmaSS } },
+  { "pd", { makeVFmaPD, makeVFmaPD, makeVFmaPD, makeVFmaPD, makeVFmaPD, makeVFmaPD } },
+  { "ps", { makeVFmaPS, makeVFmaPS, makeVFmaPS, makeVFmaPS, makeVFmaPS, makeVFmaPS } }
+};
+
+static const pair< const char*, FmaOp >
+fmaOps[] = {
+  { "vfmadd132", FmaOp::madd132 }, { "vfmadd213", FmaOp::madd213 },
+  { "vfmadd231", FmaOp::madd231 }, { "vfmsub132", FmaOp::msub132 },
+  { "vfmsub213", FmaOp::msub213 }, { "vfmsub231", FmaOp::msub231 },
+  { "vfnmadd132", FmaOp::nmadd132 }, { "vfnmadd213", FmaOp::nmadd213 },
+  { "vfnmadd231", FmaOp::nmadd231 }
+};
+
+static const pair< const char*, BmiForms >
+bmiForms[] = {
+  { "andn", { makeAndN, makeAndN, nullptr } },
+  { "pdep", { makePDep, makePDep, nullptr } },
+  { "pext", { makePExt, makePExt, nullptr } },
+  { "mulx", { makeMulX, makeMulX, nullptr } },
+  { "bextr", { makeBExtr, nullptr, makeBExtr } },
+  { "bzhi", { makeBzhi, nullptr, makeBzhi } },
+  { "shlx", { makeShlX, nullptr, makeShlX } },
+  { "shrx", { makeShrX, nullptr, makeShrX } },
+  { "sarx", { makeSarX, nullptr, makeSarX } }
+};
+
+static const pair< const char*, BlsForms >
+blsForms[] = {
+  { "blsr", { makeBlsR, makeBlsR } },
+  { "blsi", { makeBlsI, makeBlsI } },
+  { "blsmsk", { makeBlsMsk, makeBlsMsk } }
+};
+
+// every mnemonic, built the first time it's needed
+static const map< string, InsInfo, less<> >&
+mnemonics() {
+  static const auto table = [] {
+    map< string, InsInfo, less<> > t;
+
+    static const char* const basic[] = { "add", "or", "adc", "sbb", "and", "sub", "xor",
+                                         "cmp" };
+
+    for( auto i = 0; i < 8; i++ ) {
+      t[ basic[ i ] ] = { Ins::basic, static_cast< uint8_t >( i ) };
+    }
+
+    static const pair< const char*, CondTest > conditions[] = {
+      { "o", CondTest::Ov }, { "no", CondTest::NO }, { "b", CondTest::B },
+      { "c", CondTest::B }, { "nae", CondTest::NAE }, { "nb", CondTest::NB },
+      { "nc", CondTest::NB }, { "ae", CondTest::AE }, { "e", CondTest::E },
+      { "z", CondTest::Z }, { "ne", CondTest::NE }, { "nz", CondTest::NZ },
+      { "be", CondTest::BE }, { "na", CondTest::NA }, { "nbe", CondTest::NBE },
+      { "a", CondTest::A }, { "s", CondTest::S }, { "ns", CondTest::NS },
+      { "p", CondTest::P }, { "pe", CondTest::PE }, { "np", CondTest::NP },
+      { "po", CondTest::PO }, { "l", CondTest::L }, { "nge", CondTest::NGE },
+      { "nl", CondTest::NL }, { "ge", CondTest::GE }, { "le", CondTest::LE },
+      { "ng", CondTest::NG }, { "nle", CondTest::NLE }, { "g", CondTest::G }
+    };
+
+    for( auto& c : conditions ) {
+      auto code = static_cast< uint8_t >( c.second );
+
+      t[ string( "j" ) + c.first ] = { Ins::jcc, code };
+      t[ string( "cmov" ) + c.first ] = { Ins::cmovcc, code };
+      t[ string( "set" ) + c.first ] = { Ins::setcc, code };
+    }
+
+    // the string instructions with their byte, word, dword and qword suffixes
+    static const pair< const char*, uint8_t > strings[] = {
+      { "movs", 0xa5 }, { "stos", 0xab }, { "lods", 0xad }, { "cmps", 0xa7 },
+      { "scas", 0xaf }
+    };
+
+    for( auto& s : strings ) {
+      auto name = string( s.first );
+
+      t[ name + "b" ] = { Ins::string, s.second, OpSize::b8 };
+      t[ name + "w" ] = { Ins::string, s.second, OpSize::b16 };
+      t[ name + "d" ] = { Ins::string, s.second, OpSize::b32 };
+      t[ name + "l" ] = { Ins::string, s.second, OpSize::b32 };
+      t[ name + "q" ] = { Ins::string, s.second, OpSize::b64 };
+    }
+
+    t[ "movsd" ] = { Ins::movsd, 0xa5, OpSize::b32 };
+    t[ "cmpsd" ] = { Ins::cmpsd, 0xa7, OpSize::b32 };
+
+    t[ "mov" ] = { Ins::mov };
+    t[ "movq" ] = { Ins::movq };
+    t[ "lea" ] = { Ins::lea };
+    t[ "imul" ] = { Ins::imul };
+    t[ "idiv" ] = { Ins::idiv };
+    t[ "shl" ] = { Ins::shift, static_cast< uint8_t >( ShiftOp::left ) };
+    t[ "sal" ] = { Ins::shift, static_cast< uint8_t >( ShiftOp::left ) };
+    t[ "shr" ] = { Ins::shift, static_cast< uint8_t >( ShiftOp::right ) };
+    t[ "not" ] = { Ins::compl_, static_cast< uint8_t >( ComplOp::_not ) };
+    t[ "neg" ] = { Ins::compl_, static_cast< uint8_t >( ComplOp::_neg ) };
+    t[ "inc" ] = { Ins::idec, static_cast< uint8_t >( IDecOp::inc ) };
+    t[ "dec" ] = { Ins::idec, static_cast< uint8_t >( IDecOp::dec ) };
+    t[ "push" ] = { Ins::push };
+    t[ "pop" ] = { Ins::pop };
+    t[ "jmp" ] = { Ins::jmp };
+    t[ "call" ] = { Ins::call };
+    t[ "loop" ] = { Ins::loop, 0 };
+    t[ "loope" ] = { Ins::loop, 1 };
+    t[ "loopz" ] = { Ins::loop, 1 };
+    t[ "loopne" ] = { Ins::loop, 2 };
+    t[ "loopnz" ] = { Ins::loop, 2 };
+    t[ "ret" ] = { Ins::ret };
+    t[ "syscall" ] = { Ins::syscall };
+    t[ "nop" ] = { Ins::nop };
+    t[ "pause" ] = { Ins::pause };
+    t[ "mfence" ] = { Ins::fence, 0 };
+    t[ "lfence" ] = { Ins::fence, 1 };
+    t[ "sfence" ] = { Ins::fence, 2 };
+    t[ "vzeroupper" ] = { Ins::vzeroupper };
+    t[ "rep" ] = { Ins::prefix, 0 };
+    t[ "repe" ] = { Ins::prefix, 0 };
+    t[ "repz" ] = { Ins::prefix, 0 };
+    t[ "repne" ] = { Ins::prefix, 1 };
+    t[ "repnz" ] = { Ins::prefix, 1 };
+    t[ "lock" ] = { Ins::prefix, 2 };
+    t[ "xchg" ] = { Ins::xchg };
+    t[ "xadd" ] = { Ins::xadd };
+    t[ "cmpxchg" ] = { Ins::cmpxchg };
+    t[ "cmpxchg16b" ] = { Ins::cmpxchg16b };
+    t[ "popcnt" ] = { Ins::bitCount, 0 };
+    t[ "lzcnt" ] = { Ins::bitCount, 1 };
+    t[ "tzcnt" ] = { Ins::bitCount, 2 };
+    t[ "cvtsi2sd" ] = { Ins::cvtsi2sd };
+    t[ "cvtsd2si" ] = { Ins::cvtsd2si };
+
+    for( auto i = 0u; i < size( sseForms ); i++ ) {
+      t.emplace( sseForms[ i ].first, InsInfo{ Ins::sse, 0, OpSize::b64,
+                                               static_cast< uint8_t >( i ) } );
+    }
+
+    for( auto i = 0u; i < size( avxForms ); i++ ) {
+      t[ avxForms[ i ].first ] = { Ins::avx, 0, OpSize::b64, static_cast< uint8_t >( i ) };
+    }
+
+    for( auto i = 0u; i < size( avxMoves ); i++ ) {
+      t[ avxMoves[ i ].first ] = { Ins::avxMove, 0, OpSize::b64, static_cast< uint8_t >( i ) };
+    }
+
+    for( auto i = 0u; i < size( avxScalars ); i++ ) {
+      t[ avxScalars[ i ].first ] = { Ins::avxScalar, 0, OpSize::b64,
+                                     static_cast< uint8_t >( i ) };
+    }
+
+    for( auto i = 0u; i < size( sseImmForms ); i++ ) {
+      t[ sseImmForms[ i ].first ] = { Ins::sseImm, 0, OpSize::b64,
+                                      static_cast< uint8_t >( i ) };
+    }
+
+    for( auto i = 0u; i < size( avxImmForms ); i++ ) {
+      t[ avxImmForms[ i ].first ] = { Ins::avxImm, 0, OpSize::b64,
+                                      static_cast< uint8_t >( i ) };
+    }
+
+    for( auto i = 0u; i < size( bmiForms ); i++ ) {
+      t[ bmiForms[ i ].first ] = { Ins::bmi, 0, OpSize::b64, static_cast< uint8_t >( i ) };
+    }
+
+    for( auto i = 0u; i < size( blsForms ); i++ ) {
+      t[ blsForms[ i ].first ] = { Ins::bls, 0, OpSize::b64, static_cast< uint8_t >( i ) };
+    }
+
+    // vfmadd132sd to vfnmadd231ps
+    for( auto& op : fmaOps ) {
+      for( auto i = 0u; i < size( fmaForms ); i++ ) {
+        t[ string( op.first ) + fmaForms[ i ].first ] = {
+          Ins::fma, static_cast< uint8_t >( op.second ), OpSize::b64,
+          static_cast< uint8_t >( i ) };
+      }
+    }
+
+    // cmpss, cmppd and cmpps with a predicate operand, and the aliases like cmpltsd and
+    // vcmpnlepd that name it; cmpsd is also the string compare, so it has its own entry
+    static const char* const vcmpTypes[] = { "sd", "pd", "ps" };
+
+    for( auto i = 1u; i < size( cmpForms ); i++ ) {
+      t[ string( "cmp" ) + cmpForms[ i ].first ] = { Ins::cmp, 8, OpSize::b64,
+                                                     static_cast< uint8_t >( i ) };
+    }
+
+    for( auto i = 0u; i < size( vcmpTypes ); i++ ) {
+      t[ string( "vcmp" ) + vcmpTypes[ i ] ] = { Ins::vcmp, 8, OpSize::b64,
+                                                 static_cast< uint8_t >( i ) };
+    }
+
+    for( auto p = 0u; p < size( predicates ); p++ ) {
+      auto code = static_cast< uint8_t >( p );
+
+      for( auto i = 0u; i < size( cmpForms ); i++ ) {
+        t[ string( "cmp" ) + predicates[ p ] + cmpForms[ i ].first ] = {
+          Ins::cmp, code, OpSize::b64, static_cast< uint8_t >( i ) };
+      }
+
+      for( auto i = 0u; i < size( vcmpTypes ); i++ ) {
+        t[ string( "vcmp" ) + predicates[ p ] + vcmpTypes[ i ] ] = {
+          Ins::vcmp, code, OpSize::b64, static_cast< uint8_t >( i ) };
+      }
+    }
+
+    t[ "blendvpd" ] = { Ins::blendv, 0 };
+    t[ "blendvps" ] = { Ins::blendv, 1 };
+    t[ "vblendpd" ] = { Ins::vblend, 0 };
+    t[ "vblendps" ] = { Ins::vblend, 1 };
+    t[ "vblendvpd" ] = { Ins::vblendv, 0 };
+    t[ "vblendvps" ] = { Ins::vblendv, 1 };
+    t[ "vmovsd" ] = { Ins::vmovsd };
+    t[ "vcomisd" ] = { Ins::vcomisd };
+    t[ "vcvtsi2sd" ] = { Ins::vcvtsi2sd };
+    t[ "vcvtsd2si" ] = { Ins::vcvtsd2si };
+    t[ "vbroadcastsd" ] = { Ins::vbroadcast, 0 };
+    t[ "vbroadcastss" ] = { Ins::vbroadcast, 1 };
+    t[ "vpbroadcastd" ] = { Ins::vpbroadcast, 0 };
+    t[ "vpbroadcastq" ] = { Ins::vpbroadcast, 1 };
+    t[ "rorx" ] = { Ins::rorx };
+    t[ "kmovb" ] = { Ins::kmov, 0 };
+    t[ "kmovw" ] = { Ins::kmov, 1 };
+    t[ "kmovd" ] = { Ins::kmov, 2 };
+    t[ "kmovq" ] = { Ins::kmov, 3 };
+    t[ "prefetchnta" ] = { Ins::prefetch, static_cast< uint8_t >( PrefetchHint::nta ) };
+    t[ "prefetcht0" ] = { Ins::prefetch, static_cast< uint8_t >( PrefetchHint::t0 ) };
+    t[ "prefetcht1" ] = { Ins::prefetch, static_cast< uint8_t >( PrefetchHint::t1 ) };
+    t[ "prefetcht2" ] = { Ins::prefetch, static_cast< uint8_t >( PrefetchHint::t2 ) };
+    t[ "prefetchw" ] = { Ins::prefetch, 4 };
+    t[ "movnti" ] = { Ins::movnti };
+
+    return t;
+  }();
+
+  return table;
+}
+
+// true when the operands are exactly of the kinds given
+static bool
+shape( const Operand* ops, size_t n, initializer_list< OperandKind > kinds ) {
+  if( n != kinds.size() ) {
+    return false;
+  }
+
+  for( auto k : kinds ) {
+    if( ops++->kind != k ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// The operand size of an integer instruction: the size of its registers, or of its
+// memory operand when it has no register.
+static OpSize
+operandSize( const Operand* ops, size_t n ) {
+  auto size = OpSize::b64;
+  auto sized = false;
+
+  for( size_t i = 0; i < n; i++ ) {
+    if( ops[ i ].sized ) {
+      if( sized && ops[ i ].size != size ) {
+        throw "operand sizes don't match";
+      }
+
+      size = ops[ i ].size;
+      sized = true;
+    }
+  }
+
+  if( !sized ) {
+    throw "operand size is ambiguous";
+  }
+
+  return size;
+}
+
+// Immediates are sign extended from 32 bits for a 64 bit operation; a narrower one takes
+// any value that fits its size, signed or not.
+static int32_t
+imm32( const Operand& op, OpSize size ) {
+  auto bits = 8 << static_cast< int >( size );
+  auto low = bits == 64 ? INT32_MIN : -( int64_t{ 1 } << ( bits - 1 ) );
+  auto high = bits == 64 ? INT32_MAX : ( int64_t{ 1 } << bits ) - 1;
+
+  if( op.imm < low || high < op.imm ) {
+    throw "immediate doesn't fit";
+  }
+
+  return static_cast< int32_t >( op.imm );
+}
+
+static void
+needs64( OpSize size ) {
+  if( size != OpSize::b64 ) {
+    throw "only 64 bit operands are supported";
+  }
+}
+
+// The size a vector instruction reads or writes in memory, or 0 when it isn't checked:
+// fixed for the scalar forms, otherwise the width of the widest register.
+static size_t
+vectorBytes( const InsInfo& info, const Operand* ops, size_t n ) {
+  // cmpForms and fmaForms both start with sd and ss
+  static const size_t scalarBytes[] = { 8, 4 };
+  size_t width = 0;
+
+  for( size_t i = 0; i < n; i++ ) {
+    auto kind = ops[ i ].kind;
+    size_t bytes = kind == OperandKind::xmm ? 16 : kind == OperandKind::ymm ? 32
+                 : kind == OperandKind::zmm ? 64 : 0;
+
+    width = max( width, bytes );
+  }
+
+  switch( info.ins ) {
+  case Ins::sse:
+    return sseForms[ info.form ].second.bytes;
+  case Ins::cmp:
+    return info.form < 2 ? scalarBytes[ info.form ] : 16;
+  case Ins::fma:
+    return info.form < 2 ? scalarBytes[ info.form ] : width;
+  case Ins::vcmp:
+    return info.form == 0 ? 8 : width;
+  case Ins::movsd:
+  case Ins::cmpsd:
+  case Ins::cvtsd2si:
+  case Ins::vcvtsd2si:
+  case Ins::vmovsd:
+  case Ins::vcomisd:
+  case Ins::avxScalar:
+    return n == 0 ? 0 : 8;
+  case Ins::vbroadcast:
+    return info.code == 0 ? 8 : 4;
+  case Ins::vpbroadcast:
+    return info.code == 0 ? 4 : 8;
+  case Ins::sseImm:
+  case Ins::blendv:
+  case Ins::avx:
+  case Ins::avxMove:
+  case Ins::avxImm:
+  case Ins::vblend:
+  case Ins::vblendv:
+    return width;
+  default:
+    return 0;
+  }
+}
+
+static XmmReg
+xmm( const Operand& op ) {
+  return static_cast< XmmReg >( op.reg );
+}
+
+static YmmReg
+ymm( const Operand& op ) {
+  return static_cast< YmmReg >( op.reg );
+}
+
+static ZmmReg
+zmm( const Operand& op ) {
+  return static_cast< ZmmReg >( op.reg );
+}
+
+static KReg
+kreg( const Operand& op ) {
+  return static_cast< KReg >( op.reg );
+}
+
+static uint8_t
+imm8( const Operand& op ) {
+  if( op.imm < INT8_MIN || UINT8_MAX < op.imm ) {
+    throw "immediate doesn't fit";
+  }
+
+  return static_cast< uint8_t >( op.imm );
+}
+
+static Mem
+memory( const Address& a, Assembler& assembler ) {
+  if( a.disp < INT32_MIN || INT32_MAX < a.disp ) {
+    throw "displacement doesn't fit in 32 bits";
+  }
+
+  auto disp = static_cast< int32_t >( a.disp );
+
+  if( !a.label.empty() ) {
+    if( a.hasBase || a.hasIndex ) {
+      throw "a label can only be added to rip";
+    }
+
+    return Mem( assembler.label( a.label ), disp );
+  }
+
+  if( a.rip ) {
+    throw "rip relative addresses need a label";
+  }
+
+  if( a.hasBase && a.hasIndex ) {
+    return Mem( a.base, a.index, makeScale( a.scale ), disp );
+  }
+
+  if( a.hasBase ) {
+    return Mem( a.base, disp );
+  }
+
+  if( a.hasIndex ) {
+    return Mem( a.index, makeScale( a.scale ), disp );
+  }
+
+  // [disp32]
+  auto m = Mem( Register::r0, disp );
+  m.hasBase = false;
+  return m;
+}
+
+static size_t
+makeStringIns( uint8_t op, OpSize size, Code& where ) {
+  switch( op ) {
+  case 0xa5:
+    return makeMovS( where, size );
+  case 0xab:
+    return makeStoS( where, size );
+  case 0xad:
+    return makeLodS( where, size );
+  case 0xa7:
+    return makeCmpS( where, size );
+  default:
+    return makeScaS( where, size );
+  }
+}
+
+static size_t
+makeSseIns( const SseForms& forms, Operand* ops, size_t n, Code& where ) {
+  using K = OperandKind;
+
+  if( shape( ops, n, { K::xmm, K::xmm } ) && forms.rr ) {
+    return forms.rr( xmm( ops[ 0 ] ), xmm( ops[ 1 ] ), where );
+  }
+
+  if( shape( ops, n, { K::xmm, K::mem } ) && forms.rm ) {
+    return forms.rm( xmm( ops[ 0 ] ), ops[ 1 ].mem, where );
+  }
+
+  if( shape( ops, n, { K::mem, K::xmm } ) && forms.mr ) {
+    return forms.mr( ops[ 0 ].mem, xmm( ops[ 1 ] ), where );
+  }
+
+  return 0;
+}
+
+// The predicate of a compare: the one an alias like cmpltsd names, or for the generic
+// forms the immediate that ends the operands, which is then dropped from them.
+static bool
+comparePredicate( uint8_t code, const Operand* ops, size_t& n, SDcmp& predicate ) {
+  if( code < 8 ) {
+    predicate = static_cast< SDcmp >( code );
+    return true;
+  }
+
+  if( n == 0 || ops[ n - 1 ].kind != OperandKind::imm ) {
+    return false;
+  }
+
+  if( ops[ n - 1 ].imm < 0 || 7 < ops[ n - 1 ].imm ) {
+    throw "compare predicates are 0 - 7";
+  }
+
+  predicate = static_cast< SDcmp >( ops[ --n ].imm );
+  return true;
+}
+
+static size_t
+makeCmpIns( const CmpForms& forms, uint8_t code, Operand* ops, size_t n, Code& where ) {
+  using K = OperandKind;
+  SDcmp predicate;
+
+  if( !comparePredicate( code, ops, n, predicate ) ) {
+    return 0;
+  }
+
+  if( shape( ops, n, { K::xmm, K::xmm } ) ) {
+    return forms.rr( xmm( ops[ 0 ] ), xmm( ops[ 1 ] ), predicate, where );
+  }
+
+  if( shape( ops, n, { K::xmm, K::mem } ) ) {
+    return forms.rm( xmm( ops[ 0 ] ), ops[ 1 ].mem, predicate, where );
+  }
+
+  return 0;
+}
+
+static void
+check( size_t length ) {
+  if( length == 0 ) {
+    throw "operands don't fit the instruction";
+  }
+}
+
+// ----------------------------------------------------------------------
+// Assembler
+
+Assembler::Assembler( Code& where, Syntax syntax )
+  : where{ where }, syntax{ syntax } {
+  mnemonics();
+}
+
+void
+Assembler::feed( const char* text, size_t length ) {
+  auto p = text;
+  auto end = text + length;
+
+  while( p < end ) {
+    auto newline = static_cast< const char* >( memchr( p, '\n', end - p ) );
+
+    if( newline == nullptr ) {
+      partial.append( p, end );
+      return;
+    }
+
+    lineNumber++;
+
+    if( partial.empty() ) {
+      assembleLine( p, newline );
+    }
+    else {
+      partial.append( p, newline );
+      assembleLine( partial.data(), partial.data() + partial.size() );
+      partial.clear();
+    }
+
+    p = newline + 1;
+  }
+}
+
+void
+Assembler::finish() {
+  if( !partial.empty() ) {
+    lineNumber++;
+    assembleLine( partial.data(), partial.data() + partial.size() );
+    partial.clear();
+  }
+
+  if( inComment ) {
+    throw "unterminated comment";
+  }
+
+  for( auto& l : labels ) {
+    if( !where.isBound( l.second ) ) {
+      throw "undefined label";
+    }
+  }
+
+  where.resolve();
+}
+
+Label
+Assembler::label( string_view name ) {
+  auto i = labels.find( name );
+
+  if( i == labels.end() ) {
+    i = labels.emplace( string( name ), where.newLabel() ).first;
+  }
+
+  return i->second;
+}
+
+void
+Assembler::assembleLine( const char* p, const char* end ) {
+  Lexer lexer( p, end, inComment );
+
+  while( lexer.peek().kind == TokenKind::name ) {
+    auto name = lexer.next().text;
+
+    if( lexer.accept( ':' ) ) {
+      auto l = label( name );
+
+      if( where.isBound( l ) ) {
+        throw "label defined twice";
+      }
+
+      where.bind( l );
+      continue;
+    }
+
+    if( name[ 0 ] == '.' ) {
+      directive( name, lexer );
+    }
+    else {
+      instruction( name, lexer );
+    }
+
+    break;
+  }
+
+  if( !lexer.atEnd() ) {
+    throw "unexpected token";
+  }
+}
+
+void
+Assembler::directive( string_view name, Lexer& lexer ) {
+  if( name == ".intel_syntax" || name == ".att_syntax" ) {
+    syntax = name == ".intel_syntax" ? Syntax::intel : Syntax::att;
+
+    if( lexer.peek().text == "prefix" || lexer.peek().text == "noprefix" ) {
+      lexer.next();
+    }
+  }
+  else if( name == ".align" || name == ".p2align" ) {
+    auto n = lexer.next();
+
+    if( n.kind != TokenKind::number || ( name == ".p2align" && 15 < n.value ) ) {
+      throw "bad alignment";
+    }
+
+    auto alignment = name == ".p2align" ? size_t{ 1 } << n.value : n.value;
+
+    if( alignment == 0 || ( alignment & ( alignment - 1 ) ) != 0 ) {
+      throw "alignment must be a power of 2";
+    }
+
+    makeNop( ( alignment - where.size() % alignment ) % alignment, where );
+  }
+  else if( name == ".text" || name == ".globl" || name == ".global" || name == ".type" ||
+           name == ".size" || name == ".file" ) {
+    while( !lexer.atEnd() ) {
+      lexer.next();
+    }
+  }
+  else {
+    throw "unknown directive";
+  }
+}
+
+size_t
+Assembler::operands( Lexer& lexer, Operand* ops ) {
+  size_t n = 0;
+
+  if( lexer.atEnd() ) {
+    return 0;
+  }
+
+  do {
+    if( n == 4 ) {
+      throw "too many operands";
+    }
+
+    operand( lexer, ops[ n++ ] );
+  } while( lexer.accept( ',' ) );
+
+  // AT&T puts the destination last
+  if( syntax == Syntax::att ) {
+    reverse( ops, ops + n );
+  }
+
+  return n;
+}
+
+// an operand, then the AVX-512 decorations that may follow it: {k1} and {z} after a
+// destination, {1to8} and the like after a memory operand
+void
+Assembler::operand( Lexer& lexer, Operand& op ) {
+  if( syntax == Syntax::intel ) {
+    intelOperand( lexer, op );
+  }
+  else {
+    attOperand( lexer, op );
+  }
+
+  while( lexer.accept( '{' ) ) {
+    if( syntax == Syntax::att ) {
+      lexer.accept( '%' );
+    }
+
+    auto t = lexer.next();
+    Operand k;
+
+    if( t.text == "z" ) {
+      op.mask.zero = true;
+    }
+    else if( parseRegister( t.text, k ) && k.kind == OperandKind::k ) {
+      op.mask.k = static_cast< KReg >( k.reg );
+    }
+    else if( op.kind == OperandKind::mem && t.text.substr( 0, 3 ) == "1to" ) {
+      op.broadcast = true;
+    }
+    else {
+      throw "expected {k1}, {z} or a {1to8} broadcast";
+    }
+
+    lexer.expect( '}' );
+  }
+}
+
+// rax, 42, label, [base + index*scale + disp], [rip + label + disp], with an optional
+// byte, word, dword, qword, xmmword, ymmword or zmmword ptr before a memory operand
+void
+Assembler::intelOperand( Lexer& lexer, Operand& op ) {
+  auto& t = lexer.peek();
+  auto ptr = false;
+
+  if( t.kind == TokenKind::name ) {
+    auto vector = t.text == "xmmword" || t.text == "ymmword" || t.text == "zmmword";
+
+    if( vector || sizeName( t.text, op.size ) ) {
+      op.sized = !vector;
+      op.vector = !vector ? 0 : t.text[ 0 ] == 'x' ? 16 : t.text[ 0 ] == 'y' ? 32 : 64;
+      ptr = true;
+      lexer.next();
+
+      if( lexer.peek().text == "ptr" ) {
+        lexer.next();
+      }
+    }
+    else if( parseRegister( t.text, op ) ) {
+      lexer.next();
+      return;
+    }
+    else {
+      op.kind = OperandKind::label;
+      op.name = lexer.next().text;
+      return;
+    }
+  }
+
+  if( !lexer.accept( '[' ) ) {
+    if( ptr ) {
+      throw "expected a memory operand";
+    }
+
+    op.kind = OperandKind::imm;
+    op.imm = signedNumber( lexer );
+    return;
+  }
+
+  Address a;
+
+  do {
+    auto negative = lexer.accept( '-' );
+    auto term = lexer.next();
+
+    if( term.kind == TokenKind::number ) {
+      auto value = static_cast< int64_t >( term.value );
+
+      if( lexer.accept( '*' ) ) {
+        a.index = addressRegister( lexer.next().text );
+        a.hasIndex = true;
+        a.scale = term.value;
+      }
+      else {
+        a.disp += negative ? -value : value;
+      }
+
+      continue;
+    }
+
+    if( term.kind != TokenKind::name || negative ) {
+      throw "bad address";
+    }
+
+    Operand reg;
+
+    if( term.text == "rip" ) {
+      a.rip = true;
+    }
+    else if( !parseRegister( term.text, reg ) ) {
+      a.label = term.text;
+    }
+    else if( lexer.accept( '*' ) || a.hasBase ) {
+      if( a.hasIndex ) {
+        throw "too many registers in an address";
+      }
+
+      a.index = addressRegister( term.text );
+      a.hasIndex = true;
+
+      if( lexer.peek().kind == TokenKind::number ) {
+        a.scale = lexer.next().value;
+      }
+    }
+    else {
+      a.base = addressRegister( term.text );
+      a.hasBase = true;
+    }
+  } while( lexer.accept( '+' ) || lexer.peek().text == "-" );
+
+  lexer.expect( ']' );
+
+  op.kind = OperandKind::mem;
+  op.mem = memory( a, *this );
+}
+
+// %rax, $42, label, disp(base, index, scale), label(%rip), and * before the target of an
+// indirect jmp or call
+void
+Assembler::attOperand( Lexer& lexer, Operand& op ) {
+  lexer.accept( '*' );
+
+  if( lexer.accept( '$' ) ) {
+    op.kind = OperandKind::imm;
+    op.imm = signedNumber( lexer );
+    return;
+  }
+
+  if( lexer.accept( '%' ) ) {
+    if( !parseRegister( lexer.next().text, op ) ) {
+      throw "unknown register";
+    }
+
+    return;
+  }
+
+  Address a;
+  auto& t = lexer.peek();
+
+  if( t.kind == TokenKind::name ) {
+    a.label = lexer.next().text;
+  }
+  else if( t.kind == TokenKind::number || t.text == "-" || t.text == "+" ) {
+    a.disp = signedNumber( lexer );
+  }
+  else if( t.text != "(" ) {
+    throw "bad operand";
+  }
+
+  if( !lexer.accept( '(' ) ) {
+    if( !a.label.empty() ) {
+      op.kind = OperandKind::label;
+      op.name = a.label;
+      return;
+    }
+
+    op.kind = OperandKind::mem;
+    op.mem = memory( a, *this );
+    return;
+  }
+
+  auto hasIndex = lexer.accept( ',' );
+
+  if( !hasIndex ) {
+    lexer.expect( '%' );
+
+    auto base = lexer.next().text;
+
+    if( base == "rip" ) {
+      a.rip = true;
+    }
+    else {
+      a.base = addressRegister( base );
+      a.hasBase = true;
+    }
+
+    hasIndex = lexer.accept( ',' );
+  }
+
+  if( hasIndex ) {
+    lexer.expect( '%' );
+    a.index = addressRegister( lexer.next().text );
+    a.hasIndex = true;
+
+    if( lexer.accept( ',' ) ) {
+      auto scale = lexer.next();
+
+      if( scale.kind != TokenKind::number ) {
+        throw "expected a number";
+      }
+
+      a.scale = scale.value;
+    }
+  }
+
+  lexer.expect( ')' );
+
+  // a rip relative label is a memory operand, even for a jmp or call
+  if( a.rip && !a.label.empty() ) {
+    a.hasBase = false;
+  }
+
+  op.kind = OperandKind::mem;
+  op.mem = memory( a, *this );
+}
+
+void
+Assembler::instruction( string_view mnemonic, Lexer& lexer ) {
+  auto& table = mnemonics();
+  auto i = table.find( mnemonic );
+  auto suffix = OpSize::b64;
+  auto hasSuffix = false;
+
+  // movl, shlq and the like
+  if( i == table.end() && syntax == Syntax::att && 1 < mnemonic.size() &&
+      suffixSize( mnemonic.back(), suffix ) ) {
+    i = table.find( mnemonic.substr( 0, mnemonic.size() - 1 ) );
+    hasSuffix = true;
+  }
+
+  if( i == table.end() ) {
+    throw "unknown instruction";
+  }
+
+  auto info = i->second;
+
+  if( info.ins == Ins::prefix ) {
+    if( info.code == 2 ) {
+      makeLock( where );
+    }
+    else if( info.code == 1 ) {
+      makeRepNE( where );
+    }
+    else {
+      makeRep( where );
+    }
+
+    if( lexer.peek().kind == TokenKind::name ) {
+      instruction( lexer.next().text, lexer );
+    }
+
+    return;
+  }
+
+  Operand ops[ 4 ];
+  auto n = operands( lexer, ops );
+
+  auto branch = info.ins == Ins::jmp || info.ins == Ins::call || info.ins == Ins::jcc ||
+                info.ins == Ins::loop;
+
+  for( size_t j = 0; j < n; j++ ) {
+    auto& op = ops[ j ];
+
+    // outside a branch a label is a rip relative memory operand
+    if( op.kind == OperandKind::label && !branch ) {
+      op.kind = OperandKind::mem;
+      op.mem = Mem( label( op.name ) );
+    }
+
+    if( op.kind == OperandKind::mem && hasSuffix ) {
+      op.size = suffix;
+      op.sized = true;
+    }
+  }
+
+  using K = OperandKind;
+
+  auto& a = ops[ 0 ];
+  auto& b = ops[ 1 ];
+  auto& c = ops[ 2 ];
+  auto& d = ops[ 3 ];
+  size_t length = 0;
+
+  // The AVX-512 decorations: a mask on the destination and a broadcast from memory.
+  // Only the zmm forms take them, so they're refused before anything is emitted.
+  auto mask = a.mask;
+  auto broadcast = false;
+  auto evex = false;
+
+  for( size_t j = 0; j < n; j++ ) {
+    if( 0 < j && ( ops[ j ].mask.k != KReg::k0 || ops[ j ].mask.zero ) ) {
+      throw "only the destination takes a mask";
+    }
+
+    broadcast = broadcast || ops[ j ].broadcast;
+    evex = evex || ops[ j ].kind == K::zmm || ops[ j ].kind == K::k;
+  }
+
+  if( !evex && ( mask.k != KReg::k0 || mask.zero || broadcast ) ) {
+    throw "only the zmm forms take a mask or a broadcast";
+  }
+
+  // a memory operand given a size has to have the one the instruction uses; a broadcast
+  // reads a single element
+  if( auto bytes = vectorBytes( info, ops, n ); bytes != 0 && !broadcast ) {
+    for( size_t j = 0; j < n; j++ ) {
+      auto& op = ops[ j ];
+      auto given = op.sized ? size_t{ 1 } << static_cast< int >( op.size ) : op.vector;
+
+      if( op.kind == K::mem && given != 0 && given != bytes ) {
+        throw "operand sizes don't match";
+      }
+    }
+  }
+
+  switch( info.ins ) {
+  case Ins::basic: {
+    auto op = static_cast< BasicOpClass >( info.code );
+    auto size = operandSize( ops, n );
+
+    if( shape( ops, n, { K::reg, K::reg } ) ) {
+      length = makeBasicIns( op, a.reg, b.reg, where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      length = makeBasicIns( op, a.reg, b.mem, where, size );
+    }
+    else if( shape( ops, n, { K::mem, K::reg } ) ) {
+      length = makeBasicIns( op, a.mem, b.reg, where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::imm } ) ) {
+      length = makeBasicIns( op, a.reg, imm32( b, size ), where, size );
+    }
+    else if( shape( ops, n, { K::mem, K::imm } ) ) {
+      length = makeBasicIns( op, a.mem, imm32( b, size ), where, size );
+    }
+    break;
+  }
+
+  case Ins::movq:
+    if( shape( ops, n, { K::xmm, K::reg } ) && b.size == OpSize::b64 ) {
+      length = makeMovQ( xmm( a ), b.reg, where );
+      break;
+    }
+
+    if( shape( ops, n, { K::reg, K::xmm } ) && a.size == OpSize::b64 ) {
+      length = makeMovQ( a.reg, xmm( b ), where );
+      break;
+    }
+
+    for( size_t j = 0; j < n; j++ ) {
+      if( ops[ j ].kind == K::mem ) {
+        ops[ j ].size = OpSize::b64;
+        ops[ j ].sized = true;
+      }
+    }
+
+    [[fallthrough]];
+
+  case Ins::mov: {
+    auto size = operandSize( ops, n );
+
+    if( shape( ops, n, { K::reg, K::reg } ) ) {
+      length = makeMov( a.reg, b.reg, where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      length = makeMov( a.reg, b.mem, where, size );
+    }
+    else if( shape( ops, n, { K::mem, K::reg } ) ) {
+      length = makeMov( a.mem, b.reg, where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::imm } ) ) {
+      auto imm = size == OpSize::b64 ? b.imm : imm32( b, size );
+      length = makeMov( a.reg, imm, where, size );
+    }
+    else if( shape( ops, n, { K::mem, K::imm } ) ) {
+      length = makeMov( a.mem, imm32( b, size ), where, size );
+    }
+    break;
+  }
+
+  case Ins::lea:
+    if( shape( ops, n, { K::reg, K::mem } ) ) {
+      length = makeLea( a.reg, b.mem, where, a.size );
+    }
+    break;
+
+  case Ins::imul: {
+    auto size = operandSize( ops, n );
+
+    if( shape( ops, n, { K::reg } ) ) {
+      length = makeMul( a.reg, where, size );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = makeMul( a.mem, where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::reg } ) ) {
+      length = makeMul( a.reg, b.reg, where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      length = makeMul( a.reg, b.mem, where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::reg, K::imm } ) ) {
+      length = makeMul( a.reg, b.reg, imm32( c, size ), where, size );
+    }
+    else if( shape( ops, n, { K::reg, K::mem, K::imm } ) ) {
+      length = makeMul( a.reg, b.mem, imm32( c, size ), where, size );
+    }
+    break;
+  }
+
+  case Ins::idiv: {
+    auto size = operandSize( ops, n );
+
+    if( shape( ops, n, { K::reg } ) ) {
+      length = makeDiv( a.reg, where, size );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = makeDiv( a.mem, where, size );
+    }
+    break;
+  }
+
+  case Ins::shift: {
+    auto op = static_cast< ShiftOp >( info.code );
+    auto size = operandSize( ops, n );
+    auto byOne = n == 1 || ( n == 2 && b.kind == K::imm && b.imm == 1 );
+
+    if( n == 2 && b.kind == K::imm && ( b.imm < 0 || 63 < b.imm ) ) {
+      throw "shift count must be 0 - 63";
+    }
+
+    if( a.kind == K::reg && ( n == 1 || b.kind == K::imm ) ) {
+      length = byOne ? makeShift( op, a.reg, where, size )
+                     : makeShift( op, a.reg, static_cast< uint8_t >( b.imm ), where, size );
+    }
+    else if( a.kind == K::mem && ( n == 1 || b.kind == K::imm ) ) {
+      length = byOne ? makeShift( op, a.mem, where, size )
+                     : makeShift( op, a.mem, static_cast< uint8_t >( b.imm ), where, size );
+    }
+    break;
+  }
+
+  case Ins::compl_: {
+    auto op = static_cast< ComplOp >( info.code );
+    auto size = operandSize( ops, n );
+
+    if( shape( ops, n, { K::reg } ) ) {
+      length = makeCompl( op, a.reg, where, size );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = makeCompl( op, a.mem, where, size );
+    }
+    break;
+  }
+
+  case Ins::idec: {
+    auto op = static_cast< IDecOp >( info.code );
+    auto size = operandSize( ops, n );
+
+    if( shape( ops, n, { K::reg } ) ) {
+      length = makeIDec( op, a.reg, where, size );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = makeIDec( op, a.mem, where, size );
+    }
+    break;
+  }
+
+  case Ins::push:
+    if( shape( ops, n, { K::reg } ) ) {
+      needs64( a.size );
+      length = makePush( a.reg, where );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = makePush( a.mem, where );
+    }
+    else if( shape( ops, n, { K::imm } ) ) {
+      length = makePush( static_cast< uint32_t >( imm32( a, OpSize::b64 ) ), where );
+    }
+    break;
+
+  case Ins::pop:
+    if( shape( ops, n, { K::reg } ) ) {
+      needs64( a.size );
+      length = makePop( a.reg, where );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = makePop( a.mem, where );
+    }
+    break;
+
+  case Ins::jmp:
+  case Ins::call: {
+    auto jmp = info.ins == Ins::jmp;
+
+    if( shape( ops, n, { K::label } ) ) {
+      length = jmp ? makeJmp( label( a.name ), where ) : makeCall( label( a.name ), where );
+    }
+    else if( shape( ops, n, { K::reg } ) ) {
+      needs64( a.size );
+      length = jmp ? makeJmp( a.reg, where ) : makeCall( a.reg, where );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = jmp ? makeJmp( a.mem, where ) : makeCall( a.mem, where );
+    }
+    break;
+  }
+
+  case Ins::jcc:
+    if( shape( ops, n, { K::label } ) ) {
+      length = makeJcc( static_cast< CondTest >( info.code ), label( a.name ), where );
+    }
+    break;
+
+  case Ins::loop:
+    if( shape( ops, n, { K::label } ) ) {
+      auto target = label( a.name );
+
+      length = info.code == 0 ? makeLoop( target, where )
+             : info.code == 1 ? makeLoopE( target, where ) : makeLoopNE( target, where );
+    }
+    break;
+
+  case Ins::cmovcc: {
+    auto test = static_cast< CondTest >( info.code );
+
+    needs64( operandSize( ops, n ) );
+
+    if( shape( ops, n, { K::reg, K::reg } ) ) {
+      length = makeCmovcc( test, a.reg, b.reg, where );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      length = makeCmovcc( test, a.reg, b.mem, where );
+    }
+    break;
+  }
+
+  case Ins::setcc: {
+    auto test = static_cast< CondTest >( info.code );
+
+    if( shape( ops, n, { K::reg } ) && a.size == OpSize::b8 ) {
+      length = makeSetcc( test, a.reg, where );
+    }
+    else if( shape( ops, n, { K::mem } ) ) {
+      length = makeSetcc( test, a.mem, where );
+    }
+    break;
+  }
+
+  case Ins::bitCount:
+    needs64( operandSize( ops, n ) );
+
+    if( shape( ops, n, { K::reg, K::reg } ) ) {
+      length = info.code == 0 ? makePopCnt( a.reg, b.reg, where )
+             : info.code == 1 ? makeLzCnt( a.reg, b.reg, where )
+                              : makeTzCnt( a.reg, b.reg, where );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      length = info.code == 0 ? makePopCnt( a.reg, b.mem, where )
+             : info.code == 1 ? makeLzCnt( a.reg, b.mem, where )
+                              : makeTzCnt( a.reg, b.mem, where );
+    }
+    break;
+
+  case Ins::xchg:
+  case Ins::xadd:
+  case Ins::cmpxchg: {
+    // xchg is symmetric; keep the memory operand first
+    if( info.ins == Ins::xchg && shape( ops, n, { K::reg, K::mem } ) ) {
+      swap( a, b );
+    }
+
+    needs64( operandSize( ops, n ) );
+
+    if( shape( ops, n, { K::reg, K::reg } ) ) {
+      length = info.ins == Ins::xchg ? makeXchg( a.reg, b.reg, where )
+             : info.ins == Ins::xadd ? makeXadd( a.reg, b.reg, where )
+                                     : makeCmpXchg( a.reg, b.reg, where );
+    }
+    else if( shape( ops, n, { K::mem, K::reg } ) ) {
+      length = info.ins == Ins::xchg ? makeXchg( a.mem, b.reg, where )
+             : info.ins == Ins::xadd ? makeXadd( a.mem, b.reg, where )
+                                     : makeCmpXchg( a.mem, b.reg, where );
+    }
+    break;
+  }
+
+  case Ins::cmpxchg16b:
+    if( shape( ops, n, { K::mem } ) ) {
+      length = makeCmpXchg16B( a.mem, where );
+    }
+    break;
+
+  case Ins::ret:
+  case Ins::syscall:
+  case Ins::nop:
+  case Ins::pause:
+  case Ins::fence:
+  case Ins::vzeroupper:
+    if( n != 0 ) {
+      break;
+    }
+
+    switch( info.ins ) {
+    case Ins::ret:
+      length = makeRet( where );
+      break;
+    case Ins::syscall:
+      length = makeSysCall( where );
+      break;
+    case Ins::nop:
+      length = makeNop( 1, where );
+      break;
+    case Ins::pause:
+      length = makePause( where );
+      break;
+    case Ins::vzeroupper:
+      length = makeVZeroUpper( where );
+      break;
+    default:
+      length = info.code == 0 ? makeMFence( where )
+             : info.code == 1 ? makeLFence( where ) : makeSFence( where );
+      break;
+    }
+    break;
+
+  case Ins::movsd:
+  case Ins::cmpsd:
+    // with operands these are the scalar double move and compare
+    if( n == 0 ) {
+      length = makeStringIns( info.code, info.size, where );
+    }
+    else if( info.ins == Ins::movsd ) {
+      length = makeSseIns( sseForms[ 0 ].second, ops, n, where );
+    }
+    else {
+      length = makeCmpIns( cmpForms[ 0 ].second, 8, ops, n, where );
+    }
+    break;
+
+  case Ins::string:
+    if( n == 0 ) {
+      length = makeStringIns( info.code, info.size, where );
+    }
+    break;
+
+  case Ins::cvtsi2sd:
+    if( shape( ops, n, { K::xmm, K::reg } ) ) {
+      length = makeCvtSi2Sd( xmm( a ), b.reg, where, b.size );
+    }
+    else if( shape( ops, n, { K::xmm, K::mem } ) ) {
+      length = makeCvtSi2Sd( xmm( a ), b.mem, where, operandSize( ops, n ) );
+    }
+    break;
+
+  case Ins::cvtsd2si:
+    if( shape( ops, n, { K::reg, K::xmm } ) ) {
+      needs64( a.size );
+      length = makeCvtSd2Si( a.reg, xmm( b ), where );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      needs64( a.size );
+      length = makeCvtSd2Si( a.reg, b.mem, where );
+    }
+    break;
+
+  case Ins::sse:
+    length = makeSseIns( sseForms[ info.form ].second, ops, n, where );
+    break;
+
+  case Ins::sseImm: {
+    auto& forms = sseImmForms[ info.form ].second;
+
+    if( shape( ops, n, { K::xmm, K::xmm, K::imm } ) ) {
+      length = forms.rri( xmm( a ), xmm( b ), imm8( c ), where );
+    }
+    else if( shape( ops, n, { K::xmm, K::mem, K::imm } ) ) {
+      length = forms.rmi( xmm( a ), b.mem, imm8( c ), where );
+    }
+    break;
+  }
+
+  case Ins::blendv:
+    // the selector is always xmm0, which may be written as a last operand
+    if( n == 3 && c.kind == K::xmm && c.reg == Register::r0 ) {
+      n--;
+    }
+
+    if( shape( ops, n, { K::xmm, K::xmm } ) ) {
+      length = info.code == 0 ? makeBlendVPD( xmm( a ), xmm( b ), where )
+                              : makeBlendVPS( xmm( a ), xmm( b ), where );
+    }
+    else if( shape( ops, n, { K::xmm, K::mem } ) ) {
+      length = info.code == 0 ? makeBlendVPD( xmm( a ), b.mem, where )
+                              : makeBlendVPS( xmm( a ), b.mem, where );
+    }
+    break;
+
+  case Ins::cmp:
+    length = makeCmpIns( cmpForms[ info.form ].second, info.code, ops, n, where );
+    break;
+
+  case Ins::vcmp: {
+    SDcmp predicate;
+
+    if( !comparePredicate( info.code, ops, n, predicate ) ) {
+      break;
+    }
+
+    auto pd = info.form == 1;
+
+    if( info.form == 0 ) {
+      if( shape( ops, n, { K::xmm, K::xmm, K::xmm } ) ) {
+        length = makeVCmpSD( xmm( a ), xmm( b ), xmm( c ), predicate, where );
+      }
+      else if( shape( ops, n, { K::xmm, K::xmm, K::mem } ) ) {
+        length = makeVCmpSD( xmm( a ), xmm( b ), c.mem, predicate, where );
+      }
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::ymm } ) ) {
+      length = pd ? makeVCmpPD( ymm( a ), ymm( b ), ymm( c ), predicate, where )
+                  : makeVCmpPS( ymm( a ), ymm( b ), ymm( c ), predicate, where );
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::mem } ) ) {
+      length = pd ? makeVCmpPD( ymm( a ), ymm( b ), c.mem, predicate, where )
+                  : makeVCmpPS( ymm( a ), ymm( b ), c.mem, predicate, where );
+    }
+    else if( shape( ops, n, { K::k, K::zmm, K::zmm } ) ) {
+      length = pd ? makeVCmpPD( kreg( a ), zmm( b ), zmm( c ), predicate, where, mask )
+                  : makeVCmpPS( kreg( a ), zmm( b ), zmm( c ), predicate, where, mask );
+    }
+    else if( shape( ops, n, { K::k, K::zmm, K::mem } ) ) {
+      length = pd ? makeVCmpPD( kreg( a ), zmm( b ), c.mem, predicate, where, mask,
+                                broadcast )
+                  : makeVCmpPS( kreg( a ), zmm( b ), c.mem, predicate, where, mask,
+                                broadcast );
+    }
+    break;
+  }
+
+  case Ins::avx: {
+    auto& forms = avxForms[ info.form ].second;
+
+    if( shape( ops, n, { K::ymm, K::ymm, K::ymm } ) && forms.rrr ) {
+      length = forms.rrr( ymm( a ), ymm( b ), ymm( c ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::mem } ) && forms.rrm ) {
+      length = forms.rrm( ymm( a ), ymm( b ), c.mem, where );
+    }
+    else if( shape( ops, n, { K::zmm, K::zmm, K::zmm } ) && forms.zzz ) {
+      length = forms.zzz( zmm( a ), zmm( b ), zmm( c ), where, mask );
+    }
+    else if( shape( ops, n, { K::zmm, K::zmm, K::mem } ) && forms.zzm ) {
+      length = forms.zzm( zmm( a ), zmm( b ), c.mem, where, mask, broadcast );
+    }
+    break;
+  }
+
+  case Ins::avxMove: {
+    auto& forms = avxMoves[ info.form ].second;
+
+    if( shape( ops, n, { K::ymm, K::ymm } ) && forms.rr ) {
+      length = forms.rr( ymm( a ), ymm( b ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::mem } ) && forms.rm ) {
+      length = forms.rm( ymm( a ), b.mem, where );
+    }
+    else if( shape( ops, n, { K::mem, K::ymm } ) && forms.mr ) {
+      length = forms.mr( a.mem, ymm( b ), where );
+    }
+    else if( shape( ops, n, { K::zmm, K::zmm } ) && forms.zz ) {
+      length = forms.zz( zmm( a ), zmm( b ), where, mask );
+    }
+    else if( shape( ops, n, { K::zmm, K::mem } ) && forms.zmb ) {
+      length = forms.zmb( zmm( a ), b.mem, where, mask, broadcast );
+    }
+    else if( shape( ops, n, { K::zmm, K::mem } ) && forms.zm && !broadcast ) {
+      length = forms.zm( zmm( a ), b.mem, where, mask );
+    }
+    else if( shape( ops, n, { K::mem, K::zmm } ) && forms.mz && !broadcast ) {
+      length = forms.mz( a.mem, zmm( b ), where, mask );
+    }
+    break;
+  }
+
+  case Ins::avxScalar: {
+    auto& forms = avxScalars[ info.form ].second;
+
+    if( shape( ops, n, { K::xmm, K::xmm, K::xmm } ) ) {
+      length = forms.rrr( xmm( a ), xmm( b ), xmm( c ), where );
+    }
+    else if( shape( ops, n, { K::xmm, K::xmm, K::mem } ) ) {
+      length = forms.rrm( xmm( a ), xmm( b ), c.mem, where );
+    }
+    break;
+  }
+
+  case Ins::avxImm: {
+    auto& forms = avxImmForms[ info.form ].second;
+
+    if( shape( ops, n, { K::ymm, K::ymm, K::imm } ) && forms.rri ) {
+      length = forms.rri( ymm( a ), ymm( b ), imm8( c ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::mem, K::imm } ) && forms.rmi ) {
+      length = forms.rmi( ymm( a ), b.mem, imm8( c ), where );
+    }
+    break;
+  }
+
+  case Ins::vblend: {
+    auto pd = info.code == 0;
+
+    if( shape( ops, n, { K::ymm, K::ymm, K::ymm, K::imm } ) ) {
+      length = pd ? makeVBlendPD( ymm( a ), ymm( b ), ymm( c ), imm8( d ), where )
+                  : makeVBlendPS( ymm( a ), ymm( b ), ymm( c ), imm8( d ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::mem, K::imm } ) ) {
+      length = pd ? makeVBlendPD( ymm( a ), ymm( b ), c.mem, imm8( d ), where )
+                  : makeVBlendPS( ymm( a ), ymm( b ), c.mem, imm8( d ), where );
+    }
+    break;
+  }
+
+  case Ins::vblendv: {
+    auto pd = info.code == 0;
+
+    if( shape( ops, n, { K::xmm, K::xmm, K::xmm, K::xmm } ) ) {
+      length = pd ? makeVBlendVPD( xmm( a ), xmm( b ), xmm( c ), xmm( d ), where )
+                  : makeVBlendVPS( xmm( a ), xmm( b ), xmm( c ), xmm( d ), where );
+    }
+    else if( shape( ops, n, { K::xmm, K::xmm, K::mem, K::xmm } ) ) {
+      length = pd ? makeVBlendVPD( xmm( a ), xmm( b ), c.mem, xmm( d ), where )
+                  : makeVBlendVPS( xmm( a ), xmm( b ), c.mem, xmm( d ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::ymm, K::ymm } ) ) {
+      length = pd ? makeVBlendVPD( ymm( a ), ymm( b ), ymm( c ), ymm( d ), where )
+                  : makeVBlendVPS( ymm( a ), ymm( b ), ymm( c ), ymm( d ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::mem, K::ymm } ) ) {
+      length = pd ? makeVBlendVPD( ymm( a ), ymm( b ), c.mem, ymm( d ), where )
+                  : makeVBlendVPS( ymm( a ), ymm( b ), c.mem, ymm( d ), where );
+    }
+    break;
+  }
+
+  case Ins::vmovsd:
+    if( shape( ops, n, { K::xmm, K::xmm, K::xmm } ) ) {
+      length = makeVMovSD( xmm( a ), xmm( b ), xmm( c ), where );
+    }
+    else if( shape( ops, n, { K::xmm, K::mem } ) ) {
+      length = makeVMovSD( xmm( a ), b.mem, where );
+    }
+    else if( shape( ops, n, { K::mem, K::xmm } ) ) {
+      length = makeVMovSD( a.mem, xmm( b ), where );
+    }
+    break;
+
+  case Ins::vcomisd:
+    if( shape( ops, n, { K::xmm, K::xmm } ) ) {
+      length = makeVComiSD( xmm( a ), xmm( b ), where );
+    }
+    else if( shape( ops, n, { K::xmm, K::mem } ) ) {
+      length = makeVComiSD( xmm( a ), b.mem, where );
+    }
+    break;
+
+  case Ins::vcvtsi2sd:
+    if( shape( ops, n, { K::xmm, K::xmm, K::reg } ) ) {
+      length = makeVCvtSi2Sd( xmm( a ), xmm( b ), c.reg, where, c.size );
+    }
+    else if( shape( ops, n, { K::xmm, K::xmm, K::mem } ) ) {
+      length = makeVCvtSi2Sd( xmm( a ), xmm( b ), c.mem, where, operandSize( ops, n ) );
+    }
+    break;
+
+  case Ins::vcvtsd2si:
+    if( shape( ops, n, { K::reg, K::xmm } ) ) {
+      needs64( a.size );
+      length = makeVCvtSd2Si( a.reg, xmm( b ), where );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      needs64( a.size );
+      length = makeVCvtSd2Si( a.reg, b.mem, where );
+    }
+    break;
+
+  case Ins::vbroadcast: {
+    auto sd = info.code == 0;
+
+    if( shape( ops, n, { K::ymm, K::xmm } ) ) {
+      length = sd ? makeVBroadcastSD( ymm( a ), xmm( b ), where )
+                  : makeVBroadcastSS( ymm( a ), xmm( b ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::mem } ) ) {
+      length = sd ? makeVBroadcastSD( ymm( a ), b.mem, where )
+                  : makeVBroadcastSS( ymm( a ), b.mem, where );
+    }
+    else if( shape( ops, n, { K::zmm, K::xmm } ) ) {
+      length = sd ? makeVBroadcastSD( zmm( a ), xmm( b ), where, mask )
+                  : makeVBroadcastSS( zmm( a ), xmm( b ), where, mask );
+    }
+    else if( shape( ops, n, { K::zmm, K::mem } ) && !broadcast ) {
+      length = sd ? makeVBroadcastSD( zmm( a ), b.mem, where, mask )
+                  : makeVBroadcastSS( zmm( a ), b.mem, where, mask );
+    }
+    break;
+  }
+
+  case Ins::vpbroadcast: {
+    auto d32 = info.code == 0;
+
+    if( shape( ops, n, { K::ymm, K::xmm } ) ) {
+      length = d32 ? makeVPBroadcastD( ymm( a ), xmm( b ), where )
+                   : makeVPBroadcastQ( ymm( a ), xmm( b ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::mem } ) ) {
+      length = d32 ? makeVPBroadcastD( ymm( a ), b.mem, where )
+                   : makeVPBroadcastQ( ymm( a ), b.mem, where );
+    }
+    break;
+  }
+
+  case Ins::fma: {
+    auto& forms = fmaForms[ info.form ].second;
+    auto op = static_cast< FmaOp >( info.code );
+
+    if( shape( ops, n, { K::xmm, K::xmm, K::xmm } ) ) {
+      length = forms.xxx( op, xmm( a ), xmm( b ), xmm( c ), where );
+    }
+    else if( shape( ops, n, { K::xmm, K::xmm, K::mem } ) ) {
+      length = forms.xxm( op, xmm( a ), xmm( b ), c.mem, where );
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::ymm } ) && forms.yyy ) {
+      length = forms.yyy( op, ymm( a ), ymm( b ), ymm( c ), where );
+    }
+    else if( shape( ops, n, { K::ymm, K::ymm, K::mem } ) && forms.yym ) {
+      length = forms.yym( op, ymm( a ), ymm( b ), c.mem, where );
+    }
+    else if( shape( ops, n, { K::zmm, K::zmm, K::zmm } ) && forms.zzz ) {
+      length = forms.zzz( op, zmm( a ), zmm( b ), zmm( c ), where, mask );
+    }
+    else if( shape( ops, n, { K::zmm, K::zmm, K::mem } ) && forms.zzm ) {
+      length = forms.zzm( op, zmm( a ), zmm( b ), c.mem, where, mask, broadcast );
+    }
+    break;
+  }
+
+  case Ins::bmi: {
+    auto& forms = bmiForms[ info.form ].second;
+
+    needs64( operandSize( ops, n ) );
+
+    if( shape( ops, n, { K::reg, K::reg, K::reg } ) ) {
+      length = forms.rrr( a.reg, b.reg, c.reg, where );
+    }
+    else if( shape( ops, n, { K::reg, K::reg, K::mem } ) && forms.rrm ) {
+      length = forms.rrm( a.reg, b.reg, c.mem, where );
+    }
+    else if( shape( ops, n, { K::reg, K::mem, K::reg } ) && forms.rmr ) {
+      length = forms.rmr( a.reg, b.mem, c.reg, where );
+    }
+    break;
+  }
+
+  case Ins::bls: {
+    auto& forms = blsForms[ info.form ].second;
+
+    needs64( operandSize( ops, n ) );
+
+    if( shape( ops, n, { K::reg, K::reg } ) ) {
+      length = forms.rr( a.reg, b.reg, where );
+    }
+    else if( shape( ops, n, { K::reg, K::mem } ) ) {
+      length = forms.rm( a.reg, b.mem, where );
+    }
+    break;
+  }
+
+  case Ins::rorx:
+    needs64( operandSize( ops, n ) );
+
+    if( shape( ops, n, { K::reg, K::reg, K::imm } ) ) {
+      length = makeRorX( a.reg, b.reg, imm8( c ), where );
+    }
+    else if( shape( ops, n, { K::reg, K::mem, K::imm } ) ) {
+      length = makeRorX( a.reg, b.mem, imm8( c ), where );
+    }
+    break;
+
+  case Ins::kmov: {
+    static size_t (* const toK[])( KReg, Register, Code& ) = { makeKMovB, makeKMovW,
+                                                                makeKMovD, makeKMovQ };
+    static size_t (* const fromK[])( Register, KReg, Code& ) = { makeKMovB, makeKMovW,
+                                                                  makeKMovD, makeKMovQ };
+
+    if( mask.k != KReg::k0 || mask.zero ) {
+      break;
+    }
+
+    if( shape( ops, n, { K::k, K::reg } ) ) {
+      length = toK[ info.code ]( kreg( a ), b.reg, where );
+    }
+    else if( shape( ops, n, { K::reg, K::k } ) ) {
+      length = fromK[ info.code ]( a.reg, kreg( b ), where );
+    }
+    break;
+  }
+
+  case Ins::prefetch:
+    if( shape( ops, n, { K::mem } ) ) {
+      length = info.code == 4 ? makePrefetchW( a.mem, where )
+                              : makePrefetch( static_cast< PrefetchHint >( info.code ), a.mem,
+                                              where );
+    }
+    break;
+
+  case Ins::movnti:
+    if( shape( ops, n, { K::mem, K::reg } ) ) {
+      needs64( b.size );
+      length = makeMovNTI( a.mem, b.reg, where );
+    }
+    break;
+
+  case Ins::prefix:
+    break;
+  }
+
+  check( length );
+}
@@ -0,0 +1,116 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef ASSEMBLER_HH
+#define ASSEMBLER_HH
+
+#include "myAsm.hh"
+
+#include <map>
+#include <string>
+#include <string_view>
+
+enum struct Syntax {
+  intel = 0,  // mov rax, qword ptr [rbx + rcx*8 + 16]
+  att         // movq 16(%rbx,%rcx,8), %rax
+};
+
+class Lexer;
+struct Operand;
+
+// A single pass assembler for lower case Intel or AT&T syntax source. Text is fed in
+// chunks of any size; each complete line is lexed where it lies, without copying or
+// allocating, and goes straight to the make* encoders. A label may be used before it's
+// defined: the encoders record a fixup and finish() fills it in. Errors are thrown as
+// string literals, and line() tells where they happened.
+//
+// A line is any number of "label:" followed by an instruction or a directive. Comments
+// start with ; # or //, or are enclosed in /* */. rep, repe, repz, repne, repnz and lock
+// go before the instruction they prefix. The directives are .intel_syntax and
+// .att_syntax, which switch the syntax, .align n and .p2align n, which pad with nops,
+// and .text, .globl, .global, .type, .size and .file, which are ignored.
+//
+// The mnemonics are those of the make* encoders, in the operand forms they take:
+// integer, branch, string and atomic instructions, popcnt, lzcnt and tzcnt, the BMI1 and
+// BMI2 instructions, prefetch and movnti; SSE scalar and packed arithmetic, moves,
+// blends, shuffles and compares, with cmpltsd and the other predicate aliases; VEX on
+// ymm registers, the scalar double forms, FMA3 on xmm, ymm and zmm, and the AVX-512 zmm
+// forms with kmov. A memory operand may be sized with xmmword, ymmword or zmmword ptr,
+// which the encoders don't need. A zmm destination may carry {k1} and {z}, and a memory
+// source {1to8} or {1to16}, with AT&T writing the mask as {%k1}.
+//
+// Each instruction goes to the encoder that takes its operands, so it encodes the way that
+// encoder does: finish() may shorten jumps, which moves anything aligned after them.
+class Assembler {
+public:
+  explicit Assembler( Code& where, Syntax syntax = Syntax::intel );
+
+  // assemble every complete line in text; what follows the last newline is held until
+  // the next call or finish()
+  void
+  feed( const char* text, size_t length );
+
+  void
+  feed( string_view text ) {
+    feed( text.data(), text.size() );
+  }
+
+  // assemble the held line, check every label is defined, then resolve the buffer
+  void
+  finish();
+
+  // the line being assembled, counting from 1
+  size_t
+  line() const {
+    return lineNumber;
+  }
+
+  // the label called name, whether or not it's defined yet
+  Label
+  label( string_view name );
+
+private:
+  void
+  assembleLine( const char* p, const char* end );
+
+  void
+  directive( string_view name, Lexer& lexer );
+
+  void
+  instruction( string_view mnemonic, Lexer& lexer );
+
+  size_t
+  operands( Lexer& lexer, Operand* ops );
+
+  void
+  operand( Lexer& lexer, Operand& op );
+
+  void
+  intelOperand( Lexer& lexer, Operand& op );
+
+  void
+  attOperand( Lexer& lexer, Operand& op );
+
+  Code& where;
+  Syntax syntax;
+  string partial;               // the unfinished last line of the text fed so far
+  bool inComment = false;       // inside /* */ at the end of the last line
+  size_t lineNumber = 0;
+  map< string, Label, less<> > labels;
+};
+
+#endif
@@ -0,0 +1,223 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "batch.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+size_t
+FunctionCode::call( size_t target ) {
+  auto length = makeCall( 0, code );
+  auto after = code.newLabel();
+
+  code.bind( after );
+  calls.push_back( { after, target } );
+
+  return length;
+}
+
+// One worker's share of the functions. The owner takes from the front and thieves take
+// from the back, so a steal takes the work furthest from what the owner is doing.
+struct WorkQueue {
+  mutex lock;
+  deque< size_t > functions;
+};
+
+// the bytes a worker generated, one function after another, the calls in them and the
+// ranges of data, such as constant pools, between their instructions
+struct WorkerOutput {
+  vector< uint8_t > bytes;
+  vector< pair< size_t, size_t > > calls;   // end of the call in its function, target
+  vector< pair< size_t, size_t > > data;    // start and end in its function
+};
+
+// where one function's bytes, calls and data ranges are in its worker's output
+struct Generated {
+  size_t worker;
+  size_t start;
+  size_t length;
+  size_t firstCall;
+  size_t calls;
+  size_t firstData;
+  size_t data;
+};
+
+// the next function for worker self: its own first, otherwise one stolen from another
+static bool
+take( vector< WorkQueue >& queues, size_t self, size_t& function ) {
+  for( size_t k = 0; k < queues.size(); k++ ) {
+    auto& queue = queues[ ( self + k ) % queues.size() ];
+    lock_guard< mutex > guard( queue.lock );
+
+    if( !queue.functions.empty() ) {
+      if( k == 0 ) {
+        function = queue.functions.front();
+        queue.functions.pop_front();
+      }
+      else {
+        function = queue.functions.back();
+        queue.functions.pop_back();
+      }
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+Batch::Batch( size_t alignment )
+  : alignment{ alignment } {
+  if( alignment == 0 || ( alignment & ( alignment - 1 ) ) != 0 ) {
+    throw "Batch alignment must be a power of two";
+  }
+}
+
+size_t
+Batch::add( Generator generate ) {
+  generators.push_back( move( generate ) );
+  return generators.size() - 1;
+}
+
+void
+Batch::assemble( Code& where, size_t threads ) {
+  auto n = generators.size();
+
+  if( threads == 0 ) {
+    threads = max( 1u, thread::hardware_concurrency() );
+  }
+
+  threads = max( size_t{ 1 }, min( threads, n ) );
+
+  // hand out contiguous runs of functions; stealing evens out the rest
+  vector< WorkQueue > queues( threads );
+
+  for( size_t w = 0; w < threads; w++ ) {
+    for( auto f = w * n / threads; f < ( w + 1 ) * n / threads; f++ ) {
+      queues[ w ].functions.push_back( f );
+    }
+  }
+
+  vector< WorkerOutput > outputs( threads );
+  vector< Generated > generated( n );
+
+  atomic< bool > failed{ false };
+  mutex failureLock;
+  exception_ptr failure;
+
+  auto work = [&]( size_t self ) {
+    FunctionCode scratch;
+    auto& output = outputs[ self ];
+    size_t f;
+
+    while( !failed && take( queues, self, f ) ) {
+      try {
+        scratch.code.clear();
+        scratch.code.setShortest( false );
+        scratch.calls.clear();
+
+        generators[ f ]( scratch );
+        scratch.code.resolve();
+
+        auto& data = scratch.code.dataRanges();
+
+        generated[ f ] = { self, output.bytes.size(), scratch.code.size(), output.calls.size(),
+                           scratch.calls.size(), output.data.size(), data.size() };
+
+        output.bytes.insert( output.bytes.end(), scratch.code.begin(), scratch.code.end() );
+        output.data.insert( output.data.end(), data.begin(), data.end() );
+
+        for( auto& call : scratch.calls ) {
+          if( n <= call.second ) {
+            throw "call to a function that isn't in the batch";
+          }
+
+          output.calls.push_back( { scratch.code.offset( call.first ), call.second } );
+        }
+      }
+      catch( ... ) {
+        lock_guard< mutex > guard( failureLock );
+
+        if( !failure ) {
+          failure = current_exception();
+        }
+
+        failed = true;
+      }
+    }
+  };
+
+  // the calling thread is worker 0
+  vector< thread > workers;
+
+  for( size_t w = 1; w < threads; w++ ) {
+    workers.emplace_back( work, w );
+  }
+
+  work( 0 );
+
+  for( auto& worker : workers ) {
+    worker.join();
+  }
+
+  if( failure ) {
+    rethrow_exception( failure );
+  }
+
+  // lay the functions out in order, then point every call at its target
+  offsets.assign( n, 0 );
+
+  for( size_t f = 0; f < n; f++ ) {
+    auto& g = generated[ f ];
+
+    // a pool is only 16 byte aligned from the start of its function
+    auto align = g.data == 0 ? alignment : max< size_t >( alignment, 16 );
+
+    makeNop( ( align - where.size() % align ) % align, where );
+    offsets[ f ] = where.size();
+    where.append( outputs[ g.worker ].bytes.data() + g.start, g.length );
+
+    // the pools are now in the middle of where, which has to know to skip them
+    for( auto d = g.firstData; d < g.firstData + g.data; d++ ) {
+      auto& range = outputs[ g.worker ].data[ d ];
+      where.markData( offsets[ f ] + range.first, offsets[ f ] + range.second );
+    }
+  }
+
+  for( size_t f = 0; f < n; f++ ) {
+    auto& g = generated[ f ];
+
+    for( auto c = g.firstCall; c < g.firstCall + g.calls; c++ ) {
+      auto& call = outputs[ g.worker ].calls[ c ];
+      auto end = offsets[ f ] + call.first;
+      auto disp = static_cast< int64_t >( offsets[ call.second ] ) - static_cast< int64_t >( end );
+
+      if( disp < INT32_MIN || INT32_MAX < disp ) {
+        throw "call displacement doesn't fit in 32 bits";
+      }
+
+      for( auto i = 0; i < 4; i++ ) {
+        where[ end - 4 + i ] = static_cast< uint8_t >( disp >> ( 8 * i ) );
+      }
+    }
+  }
+}
@@ -0,0 +1,86 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef BATCH_HH
+#define BATCH_HH
+
+#include "myAsm.hh"
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+// The buffer one function of a Batch is generated into. The function calls the others
+// in the batch through call(), since their addresses aren't known until they're laid out.
+class FunctionCode {
+public:
+  Code code;
+
+  // call the function the batch numbered target; Batch::assemble() fills in the
+  // displacement
+  size_t
+  call( size_t target );
+
+private:
+  friend class Batch;
+
+  // a label bound just after each call, and the function it calls
+  vector< pair< Label, size_t > > calls;
+};
+
+// Generates many independent functions in parallel, then lays them out one after the
+// other, in the order they were added, in a single buffer. Each worker thread takes
+// functions from its own queue, and steals from the others' when that runs dry; it
+// generates each one into a buffer it reuses, resolves it, and keeps the bytes until the
+// merge. The output depends only on the generators, never on the number of threads or
+// on which thread ran what, so a generator must not depend on shared mutable state.
+class Batch {
+public:
+  using Generator = function< void( FunctionCode& ) >;
+
+  // every function starts at a multiple of alignment, padded with nops, or of 16 when
+  // it has constants and alignment is less, so its pool stays aligned
+  explicit Batch( size_t alignment = 16 );
+
+  // the number other functions call this one by
+  size_t
+  add( Generator generate );
+
+  size_t
+  size() const {
+    return generators.size();
+  }
+
+  // Generate every function on threads workers, one per core when threads is 0, and
+  // append them to where with every call between them filled in. An exception thrown by
+  // a generator is rethrown here once every worker has stopped.
+  void
+  assemble( Code& where, size_t threads = 0 );
+
+  // where function starts in the buffer passed to the last assemble()
+  size_t
+  offset( size_t function ) const {
+    return offsets[ function ];
+  }
+
+private:
+  size_t alignment;
+  vector< Generator > generators;
+  vector< size_t > offsets;
+};
+
+#endif
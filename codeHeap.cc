@@ -0,0 +1,365 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "codeHeap.hh"
+#include "decoder.hh"
+
+#include <cstring>
+#include <iterator>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t
+roundUp( size_t value, size_t to ) {
+  return ( value + to - 1 ) / to * to;
+}
+
+CodeHeap::CodeHeap( size_t regionSize, size_t alignment )
+  : alignment{ alignment },
+    pageSize{ static_cast< size_t >( getpagesize() ) } {
+  if( alignment == 0 || ( alignment & ( alignment - 1 ) ) != 0 || pageSize < alignment ) {
+    throw "CodeHeap alignment must be a power of two no larger than a page";
+  }
+
+  this->regionSize = roundUp( regionSize, pageSize );
+}
+
+CodeHeap::~CodeHeap() {
+  for( auto& region : regions ) {
+    munmap( region.base, region.size );
+  }
+}
+
+uint8_t*
+CodeHeap::allocate( size_t length ) {
+  length = roundUp( length ? length : 1, alignment );
+
+  for( auto& region : regions ) {
+    auto slot = allocateFrom( region, length );
+    if( slot ) {
+      return slot;
+    }
+  }
+
+  return allocateFrom( addRegion( length ), length );
+}
+
+uint8_t*
+CodeHeap::install( const Code& code ) {
+#ifndef NDEBUG
+  verifyDecodes( code );
+#endif
+
+  auto slot = allocate( code.size() );
+
+  memcpy( slot, code.data(), code.size() );
+
+  return slot;
+}
+
+void
+CodeHeap::free( void* slot ) {
+  auto s = slots.find( static_cast< uint8_t* >( slot ) );
+
+  if( s == slots.end() ) {
+    throw "attempt to free memory not allocated from this CodeHeap";
+  }
+
+  for( auto& region : regions ) {
+    if( region.base <= s->first && s->first < region.base + region.size ) {
+      auto offset = static_cast< size_t >( s->first - region.base );
+      auto length = s->second;
+
+      for( auto p = offset / pageSize; p <= ( offset + length - 1 ) / pageSize; p++ ) {
+        region.live[ p ]--;
+      }
+
+      release( region, offset, length );
+      break;
+    }
+  }
+
+  slots.erase( s );
+  frees++;
+}
+
+void
+CodeHeap::seal() {
+  auto changed = false;
+
+  for( auto& region : regions ) {
+    auto pages = region.state.size();
+
+    for( size_t p = 0; p < pages; p++ ) {
+      if( region.state[ p ] == PageState::sealed || region.live[ p ] == 0 ) {
+        continue;
+      }
+
+      auto last = p;
+      while( last + 1 < pages &&
+             region.state[ last + 1 ] == PageState::writable &&
+             0 < region.live[ last + 1 ] ) {
+        last++;
+      }
+
+      protect( region, p, last, PROT_READ | PROT_EXEC );
+      changed = true;
+      p = last;
+    }
+  }
+
+  if( changed ) {
+    seals++;
+  }
+}
+
+CodeHeapStats
+CodeHeap::stats() const {
+  CodeHeapStats s{};
+
+  s.regions = regions.size();
+  s.live = slots.size();
+  s.allocations = allocations;
+  s.frees = frees;
+  s.seals = seals;
+  s.protects = protects;
+
+  for( auto& region : regions ) {
+    s.reserved += region.size;
+    s.untouched += region.size - region.top;
+
+    for( auto& block : region.freeBlocks ) {
+      s.free += block.second;
+    }
+  }
+
+  for( auto& slot : slots ) {
+    s.used += slot.second;
+  }
+
+  return s;
+}
+
+uint8_t*
+CodeHeap::allocateFrom( Region& region, size_t length ) {
+  auto take = [ & ]( size_t offset ) {
+    auto first = offset / pageSize;
+    auto last = ( offset + length - 1 ) / pageSize;
+
+    // pages whose code has all been freed can be written again
+    for( auto p = first; p <= last; p++ ) {
+      if( region.state[ p ] == PageState::sealed ) {
+        auto end = p;
+        while( end < last && region.state[ end + 1 ] == PageState::sealed ) {
+          end++;
+        }
+        protect( region, p, end, PROT_READ | PROT_WRITE );
+        p = end;
+      }
+    }
+
+    for( auto p = first; p <= last; p++ ) {
+      region.live[ p ]++;
+    }
+
+    auto slot = region.base + offset;
+    slots[ slot ] = length;
+    allocations++;
+
+    return slot;
+  };
+
+  auto writable = [ & ]( size_t offset ) {
+    for( auto p = offset / pageSize; p <= ( offset + length - 1 ) / pageSize; p++ ) {
+      if( region.state[ p ] == PageState::sealed && 0 < region.live[ p ] ) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  for( auto block = region.freeBlocks.begin(); block != region.freeBlocks.end(); block++ ) {
+    if( length <= block->second && writable( block->first ) ) {
+      auto offset = block->first;
+      auto remaining = block->second - length;
+
+      region.freeBlocks.erase( block );
+      if( 0 < remaining ) {
+        region.freeBlocks[ offset + length ] = remaining;
+      }
+
+      return take( offset );
+    }
+  }
+
+  // the rest of a page that has been sealed can't be written until it empties
+  auto top = region.top;
+  auto page = top / pageSize;
+  if( top % pageSize != 0 &&
+      region.state[ page ] == PageState::sealed && 0 < region.live[ page ] ) {
+    auto next = roundUp( top, pageSize );
+    release( region, top, next - top );
+    region.top = top = next;
+  }
+
+  if( region.size < top + length ) {
+    return nullptr;
+  }
+
+  region.top = top + length;
+
+  return take( top );
+}
+
+CodeHeap::Region&
+CodeHeap::addRegion( size_t length ) {
+  auto size = roundUp( length, pageSize );
+  if( size < regionSize ) {
+    size = regionSize;
+  }
+
+  auto memory = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+  if( memory == MAP_FAILED ) {
+    throw "unable to map a CodeHeap region";
+  }
+
+  auto pages = size / pageSize;
+
+  regions.push_back( Region{ static_cast< uint8_t* >( memory ), size, 0,
+                             vector< uint32_t >( pages, 0 ),
+                             vector< PageState >( pages, PageState::writable ),
+                             {} } );
+
+  return regions.back();
+}
+
+void
+CodeHeap::protect( Region& region, size_t firstPage, size_t lastPage, int prot ) {
+  auto address = region.base + firstPage * pageSize;
+  auto length = ( lastPage - firstPage + 1 ) * pageSize;
+
+  if( mprotect( address, length, prot ) != 0 ) {
+    throw "unable to change CodeHeap page protection";
+  }
+
+  protects++;
+
+  auto state = ( prot & PROT_EXEC ) ? PageState::sealed : PageState::writable;
+  for( auto p = firstPage; p <= lastPage; p++ ) {
+    region.state[ p ] = state;
+  }
+}
+
+// return [offset, offset + length) to the free list, merging it with its neighbours
+void
+CodeHeap::release( Region& region, size_t offset, size_t length ) {
+  auto& blocks = region.freeBlocks;
+  auto next = blocks.lower_bound( offset );
+
+  if( next != blocks.end() && offset + length == next->first ) {
+    length += next->second;
+    next = blocks.erase( next );
+  }
+
+  if( next != blocks.begin() ) {
+    auto previous = std::prev( next );
+    if( previous->first + previous->second == offset ) {
+      offset = previous->first;
+      length += previous->second;
+      blocks.erase( previous );
+    }
+  }
+
+  if( offset + length == region.top ) {
+    region.top = offset;
+  }
+  else {
+    blocks[ offset ] = length;
+  }
+}
+
+// ----------------------------------------------------------------------
+// DualMappedRegion
+
+DualMappedRegion::DualMappedRegion( size_t size, size_t alignment )
+  : length{ roundUp( size + Code::maxInstruction, getpagesize() ) },
+    alignment{ alignment } {
+  fd = memfd_create( "myasm-code", MFD_CLOEXEC );
+  if( fd < 0 ) {
+    throw "unable to create a memfd for a DualMappedRegion";
+  }
+
+  if( ftruncate( fd, length ) != 0 ) {
+    close( fd );
+    throw "unable to size the memfd for a DualMappedRegion";
+  }
+
+  auto writable = mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  auto runnable = mmap( nullptr, length, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0 );
+
+  if( writable == MAP_FAILED || runnable == MAP_FAILED ) {
+    if( writable != MAP_FAILED ) {
+      munmap( writable, length );
+    }
+    if( runnable != MAP_FAILED ) {
+      munmap( runnable, length );
+    }
+    close( fd );
+    throw "unable to map a DualMappedRegion";
+  }
+
+  rw = static_cast< uint8_t* >( writable );
+  rx = static_cast< uint8_t* >( runnable );
+}
+
+DualMappedRegion::~DualMappedRegion() {
+  munmap( rw, length );
+  munmap( rx, length );
+  close( fd );
+}
+
+Code
+DualMappedRegion::writer() {
+  return Code{ rw + top, length - top };
+}
+
+uint8_t*
+DualMappedRegion::commit( const Code& code ) {
+  if( code.data() != rw + top ) {
+    throw "commit of a Code that isn't this region's current writer";
+  }
+
+#ifndef NDEBUG
+  verifyDecodes( code );
+#endif
+
+  auto slot = rx + top;
+  top = roundUp( top + code.size(), alignment );
+  if( length < top ) {
+    top = length;
+  }
+
+  return slot;
+}
+
+uint8_t*
+DualMappedRegion::executable( const uint8_t* writable ) const {
+  return rx + ( writable - rw );
+}
@@ -0,0 +1,150 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef CODEHEAP_HH
+#define CODEHEAP_HH
+
+#include "myAsm.hh"
+
+#include <map>
+
+// Occupancy counters for a CodeHeap. All sizes are in bytes.
+struct CodeHeapStats {
+  size_t regions;     // number of regions mapped
+  size_t reserved;    // address space mapped for all regions
+  size_t used;        // bytes held by live allocations, including alignment
+  size_t free;        // bytes returned by free() and available for reuse
+  size_t untouched;   // bytes never handed out
+  size_t live;        // allocations not yet freed
+  size_t allocations; // total calls to allocate()
+  size_t frees;       // total calls to free()
+  size_t seals;       // calls to seal() that changed any page
+  size_t protects;    // mprotect calls made
+};
+
+// A heap for generated functions. Large regions are mapped up front and carved into
+// aligned slots, so many small functions share a page. New slots are writable; a call
+// to seal() flips every page written since the last seal to read+execute in as few
+// mprotect calls as it can. A page is never writable and executable at once: space in
+// a sealed page is only reused after every function on that page has been freed.
+class CodeHeap {
+public:
+  explicit CodeHeap( size_t regionSize = 1 << 20, size_t alignment = 16 );
+  ~CodeHeap();
+
+  CodeHeap( const CodeHeap& ) = delete;
+  CodeHeap& operator=( const CodeHeap& ) = delete;
+
+  // a writable slot of at least length bytes, not executable until seal()
+  uint8_t*
+  allocate( size_t length );
+
+  // allocate a slot and copy code into it
+  uint8_t*
+  install( const Code& code );
+
+  void
+  free( void* slot );
+
+  // make everything written since the last seal read+execute
+  void
+  seal();
+
+  CodeHeapStats
+  stats() const;
+
+private:
+  enum struct PageState : uint8_t {
+    writable = 0,
+    sealed
+  };
+
+  struct Region {
+    uint8_t* base;
+    size_t size;
+    size_t top;                         // offset of the first untouched byte
+    vector< uint32_t > live;            // live allocations touching each page
+    vector< PageState > state;
+    map< size_t, size_t > freeBlocks;   // offset -> length
+  };
+
+  uint8_t*
+  allocateFrom( Region& region, size_t length );
+
+  Region&
+  addRegion( size_t length );
+
+  void
+  protect( Region& region, size_t firstPage, size_t lastPage, int prot );
+
+  void
+  release( Region& region, size_t offset, size_t length );
+
+  size_t regionSize;
+  size_t alignment;
+  size_t pageSize;
+
+  vector< Region > regions;
+  map< uint8_t*, size_t > slots;        // live allocation -> length
+
+  size_t allocations = 0;
+  size_t frees = 0;
+  size_t seals = 0;
+  size_t protects = 0;
+};
+
+// A code region backed by a memfd and mapped twice, once read+write and once
+// read+execute. Encoders write straight into the writable view through the Code
+// returned by writer(), and the function is called through the executable view, so
+// code is never copied and no page changes permission after the region is created.
+// Only one writer is outstanding at a time; commit() claims what it wrote.
+class DualMappedRegion {
+public:
+  // maps size bytes plus the maxInstruction a writer needs free before each instruction,
+  // rounded up to pages, so that size bytes of code fit
+  explicit DualMappedRegion( size_t size = 1 << 24, size_t alignment = 16 );
+  ~DualMappedRegion();
+
+  DualMappedRegion( const DualMappedRegion& ) = delete;
+  DualMappedRegion& operator=( const DualMappedRegion& ) = delete;
+
+  // a buffer over the unclaimed part of the writable view; an encoder throws when fewer
+  // than Code::maxInstruction bytes are left, whatever its length
+  Code
+  writer();
+
+  // claim the bytes written to code and return their executable address
+  uint8_t*
+  commit( const Code& code );
+
+  // the executable alias of an address in the writable view
+  uint8_t*
+  executable( const uint8_t* writable ) const;
+
+  size_t size() const { return length; }
+  size_t used() const { return top; }
+
+private:
+  int fd;
+  uint8_t* rw;
+  uint8_t* rx;
+  size_t length;
+  size_t alignment;
+  size_t top = 0;
+};
+
+#endif
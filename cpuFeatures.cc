@@ -0,0 +1,152 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "cpuFeatures.hh"
+
+#include <cpuid.h>
+
+// the register state the OS saves on a context switch, from XCR0
+static uint64_t
+xgetbv() {
+  uint32_t low, high;
+
+  asm volatile( "xgetbv" : "=a"( low ), "=d"( high ) : "c"( 0 ) );
+
+  return ( static_cast< uint64_t >( high ) << 32 ) | low;
+}
+
+static const uint64_t xcrAvx = 0x6;       // xmm and ymm state
+static const uint64_t xcrAvx512 = 0xe6;   // plus the opmasks and the rest of zmm
+
+enum struct CpuidReg {
+  ebx = 0,
+  ecx,
+  edx
+};
+
+// where cpuid reports each feature, and the OS state the feature's registers need
+struct CpuidBit {
+  CpuFeature feature;
+  uint32_t leaf;
+  CpuidReg reg;
+  int bit;
+  uint64_t xcr;
+};
+
+static const CpuidBit cpuidBits[] = {
+  { CpuFeature::sse41,    1,          CpuidReg::ecx, 19, 0 },
+  { CpuFeature::sse42,    1,          CpuidReg::ecx, 20, 0 },
+  { CpuFeature::popcnt,   1,          CpuidReg::ecx, 23, 0 },
+  { CpuFeature::avx,      1,          CpuidReg::ecx, 28, xcrAvx },
+  { CpuFeature::fma,      1,          CpuidReg::ecx, 12, xcrAvx },
+  { CpuFeature::bmi1,     7,          CpuidReg::ebx, 3,  0 },
+  { CpuFeature::avx2,     7,          CpuidReg::ebx, 5,  xcrAvx },
+  { CpuFeature::bmi2,     7,          CpuidReg::ebx, 8,  0 },
+  { CpuFeature::erms,     7,          CpuidReg::ebx, 9,  0 },
+  { CpuFeature::avx512f,  7,          CpuidReg::ebx, 16, xcrAvx512 },
+  { CpuFeature::avx512dq, 7,          CpuidReg::ebx, 17, xcrAvx512 },
+  { CpuFeature::avx512bw, 7,          CpuidReg::ebx, 30, xcrAvx512 },
+  { CpuFeature::avx512vl, 7,          CpuidReg::ebx, 31, xcrAvx512 },
+  { CpuFeature::fsrm,     7,          CpuidReg::edx, 4,  0 },
+  { CpuFeature::lzcnt,    0x80000001, CpuidReg::ecx, 5,  0 },
+};
+
+CpuFeatures::CpuFeatures() {
+  uint32_t eax, ebx, ecx, edx;
+
+  if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) {
+    return;
+  }
+
+  // bit 27 of leaf 1 ecx says the OS has enabled xgetbv
+  auto xcr = ( ( ecx >> 27 ) & 1 ) ? xgetbv() : 0;
+
+  for( auto& c : cpuidBits ) {
+    uint32_t regs[ 3 ];
+
+    if( !__get_cpuid_count( c.leaf, 0, &eax, &regs[ 0 ], &regs[ 1 ], &regs[ 2 ] ) ) {
+      continue;
+    }
+
+    auto present = ( regs[ static_cast< int >( c.reg ) ] >> c.bit ) & 1;
+
+    if( present && ( xcr & c.xcr ) == c.xcr ) {
+      enable( c.feature );
+    }
+  }
+}
+
+CpuFeatures::CpuFeatures( initializer_list< CpuFeature > features ) {
+  for( auto f : features ) {
+    enable( f );
+  }
+}
+
+const CpuFeatures&
+CpuFeatures::host() {
+  static const CpuFeatures probed;
+
+  return probed;
+}
+
+bool
+CpuFeatures::has( CpuFeature feature ) const {
+  return ( bits & bit( feature ) ) != 0;
+}
+
+bool
+CpuFeatures::has( initializer_list< CpuFeature > features ) const {
+  return covers( CpuFeatures( features ) );
+}
+
+bool
+CpuFeatures::covers( const CpuFeatures& needs ) const {
+  return ( bits & needs.bits ) == needs.bits;
+}
+
+CpuFeatures&
+CpuFeatures::enable( CpuFeature feature ) {
+  bits |= bit( feature );
+
+  return *this;
+}
+
+CpuFeatures&
+CpuFeatures::disable( CpuFeature feature ) {
+  bits &= ~bit( feature );
+
+  return *this;
+}
+
+const char*
+CpuFeatures::name( CpuFeature feature ) {
+  static const char* names[] = {
+    "sse4.1", "sse4.2", "popcnt", "lzcnt", "bmi1", "bmi2", "avx", "avx2", "fma",
+    "avx512f", "avx512dq", "avx512bw", "avx512vl", "erms", "fsrm"
+  };
+
+  if( CpuFeature::count <= feature ) {
+    throw "not a cpu feature";
+  }
+
+  return names[ static_cast< size_t >( feature ) ];
+}
+
+uint32_t
+CpuFeatures::bit( CpuFeature feature ) {
+  return 1u << static_cast< uint32_t >( feature );
+}
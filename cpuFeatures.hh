@@ -0,0 +1,118 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef CPUFEATURES_HH
+#define CPUFEATURES_HH
+
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Instruction set extensions a generator can choose to use
+enum struct CpuFeature {
+  sse41 = 0,
+  sse42,
+  popcnt,
+  lzcnt,
+  bmi1,
+  bmi2,
+  avx,
+  avx2,
+  fma,
+  avx512f,
+  avx512dq,
+  avx512bw,
+  avx512vl,
+  erms,   // fast rep movsb / rep stosb
+  fsrm,   // fast rep movsb for short copies
+  count
+};
+
+// The extensions a CPU supports. The default constructor probes the host with cpuid; AVX
+// and AVX-512 are only reported when the OS also saves their registers on a context
+// switch. A set can be built or trimmed by hand to generate code for another machine,
+// or to exercise the fallback paths on this one.
+class CpuFeatures {
+public:
+  CpuFeatures();
+  CpuFeatures( initializer_list< CpuFeature > features );
+
+  // the host's features, probed once
+  static const CpuFeatures&
+  host();
+
+  bool
+  has( CpuFeature feature ) const;
+
+  bool
+  has( initializer_list< CpuFeature > features ) const;
+
+  // true when this has every feature in needs
+  bool
+  covers( const CpuFeatures& needs ) const;
+
+  CpuFeatures&
+  enable( CpuFeature feature );
+
+  CpuFeatures&
+  disable( CpuFeature feature );
+
+  static const char*
+  name( CpuFeature feature );
+
+private:
+  static uint32_t
+  bit( CpuFeature feature );
+
+  uint32_t bits = 0;
+};
+
+// Chooses between versions of a generator by the features they need. Add versions best
+// first, ending with one that needs nothing; select() returns the first one the CPU can
+// run. For example
+//   Dispatch< size_t (*)( Code& ) > sum;
+//   sum.add( { CpuFeature::avx512f }, sum512 ).add( { CpuFeature::avx2 }, sum256 )
+//      .add( {}, sumScalar );
+//   sum.select()( code );
+template< typename F >
+class Dispatch {
+public:
+  Dispatch&
+  add( initializer_list< CpuFeature > needs, F version ) {
+    versions.push_back( { CpuFeatures( needs ), version } );
+    return *this;
+  }
+
+  const F&
+  select( const CpuFeatures& cpu = CpuFeatures::host() ) const {
+    for( auto& v : versions ) {
+      if( cpu.covers( v.first ) ) {
+        return v.second;
+      }
+    }
+
+    throw "no version the CPU can run";
+  }
+
+private:
+  vector< pair< CpuFeatures, F > > versions;
+};
+
+#endif
@@ -0,0 +1,1512 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "decoder.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+// ----------------------------------------------------------------------
+// Opcode tables
+
+// Where an operand comes from and how big it is, after the notation of the opcode maps in
+// the Intel manual. E is the ModR/M rm field, a general register or memory; G the reg
+// field; M rm as memory only; R rm as a register only; Z the low bits of the opcode; I an
+// immediate; J a branch displacement; X and Y the string operands at rsi and rdi. For
+// vectors V is the reg field, W rm, U rm as a register only, H the VEX vvvv field and L a
+// register in the top of an immediate byte; B is vvvv as a general register and K an
+// opmask. The sizes are b byte, w word, d dword, q qword, v the operand size, y dword or
+// qword by W, x the vector length, dq an xmm register, ss and sd a scalar element and h
+// half a vector.
+enum struct Spec : uint8_t {
+  none = 0,
+  Eb, Ew, Ed, Ev, Ey, Eq,
+  Gb, Gw, Gd, Gv, Gy,
+  M, Mb, My, Mx, Mdq,
+  Ry,
+  Zb, Zv, Zq,
+  Ib, Ibs, Ibq, Iw, Iz, Izq, Iv, One,
+  AL, CL, rAX,
+  Jb, Jz,
+  Xb, Xv, Yb, Yv,
+  Vx, Vdq, Wx, Wss, Wsd, Wsy, Wh, Ux, Hx, Hdq, Hr, Lx, X0,
+  By, KV, KE
+};
+
+static const pair< const char*, Spec > specNames[] = {
+  { "Eb", Spec::Eb }, { "Ew", Spec::Ew }, { "Ed", Spec::Ed }, { "Ev", Spec::Ev },
+  { "Ey", Spec::Ey }, { "Eq", Spec::Eq }, { "Gb", Spec::Gb }, { "Gw", Spec::Gw },
+  { "Gd", Spec::Gd }, { "Gv", Spec::Gv }, { "Gy", Spec::Gy }, { "M", Spec::M },
+  { "Mb", Spec::Mb }, { "My", Spec::My }, { "Mx", Spec::Mx }, { "Mdq", Spec::Mdq },
+  { "Ry", Spec::Ry }, { "Zb", Spec::Zb }, { "Zv", Spec::Zv }, { "Zq", Spec::Zq },
+  { "Ib", Spec::Ib }, { "Ibs", Spec::Ibs }, { "Ibq", Spec::Ibq }, { "Iw", Spec::Iw },
+  { "Iz", Spec::Iz }, { "Izq", Spec::Izq }, { "Iv", Spec::Iv }, { "1", Spec::One },
+  { "AL", Spec::AL }, { "CL", Spec::CL }, { "rAX", Spec::rAX }, { "Jb", Spec::Jb },
+  { "Jz", Spec::Jz }, { "Xb", Spec::Xb }, { "Xv", Spec::Xv }, { "Yb", Spec::Yb },
+  { "Yv", Spec::Yv }, { "Vx", Spec::Vx }, { "Vdq", Spec::Vdq }, { "Wx", Spec::Wx },
+  { "Wss", Spec::Wss }, { "Wsd", Spec::Wsd }, { "Wsy", Spec::Wsy }, { "Wh", Spec::Wh },
+  { "Ux", Spec::Ux }, { "Hx", Spec::Hx }, { "Hdq", Spec::Hdq }, { "Hr", Spec::Hr },
+  { "Lx", Spec::Lx }, { "X0", Spec::X0 }, { "By", Spec::By }, { "KV", Spec::KV },
+  { "KE", Spec::KE }
+};
+
+enum struct Encoding : uint8_t {
+  legacy = 0,
+  vex,
+  evex
+};
+
+// One table row. opcode reads like the Intel manual: an optional vex or evex, the
+// mandatory prefix, the map, the opcode byte, then /n for a group member picked by the
+// ModR/M reg field and r or m when only the register or the memory form exists. name is
+// used whatever W is unless nameW1 is given; a null name means only W1 is defined.
+struct Row {
+  const char* opcode;
+  const char* name;
+  const char* operands;
+  const char* nameW1;
+};
+
+static const Row rows[] = {
+  // one byte opcodes; the arithmetic, jcc, push, pop, mov and shift families are
+  // generated in buildTables()
+  { "63", "movsxd", "Gv,Ed", nullptr },
+  { "68", "push", "Izq", nullptr },
+  { "69", "imul", "Gv,Ev,Iz", nullptr },
+  { "6a", "push", "Ibq", nullptr },
+  { "6b", "imul", "Gv,Ev,Ibs", nullptr },
+  { "84", "test", "Eb,Gb", nullptr },
+  { "85", "test", "Ev,Gv", nullptr },
+  { "86", "xchg", "Eb,Gb", nullptr },
+  { "87", "xchg", "Ev,Gv", nullptr },
+  { "88", "mov", "Eb,Gb", nullptr },
+  { "89", "mov", "Ev,Gv", nullptr },
+  { "8a", "mov", "Gb,Eb", nullptr },
+  { "8b", "mov", "Gv,Ev", nullptr },
+  { "8d", "lea", "Gv,M", nullptr },
+  { "8f /0", "pop", "Eq", nullptr },
+  { "f3 90", "pause", "", nullptr },
+  { "98", "cwde", "", "cdqe" },
+  { "99", "cdq", "", "cqo" },
+  { "a4", "movs", "Yb,Xb", nullptr },
+  { "a5", "movs", "Yv,Xv", nullptr },
+  { "a6", "cmps", "Xb,Yb", nullptr },
+  { "a7", "cmps", "Xv,Yv", nullptr },
+  { "a8", "test", "AL,Ib", nullptr },
+  { "a9", "test", "rAX,Iz", nullptr },
+  { "aa", "stos", "Yb,AL", nullptr },
+  { "ab", "stos", "Yv,rAX", nullptr },
+  { "ac", "lods", "AL,Xb", nullptr },
+  { "ad", "lods", "rAX,Xv", nullptr },
+  { "ae", "scas", "AL,Yb", nullptr },
+  { "af", "scas", "rAX,Yv", nullptr },
+  { "c2", "ret", "Iw", nullptr },
+  { "c3", "ret", "", nullptr },
+  { "c6 /0", "mov", "Eb,Ib", nullptr },
+  { "c7 /0", "mov", "Ev,Iz", nullptr },
+  { "c9", "leave", "", nullptr },
+  { "cc", "int3", "", nullptr },
+  { "e0", "loopne", "Jb", nullptr },
+  { "e1", "loope", "Jb", nullptr },
+  { "e2", "loop", "Jb", nullptr },
+  { "e3", "jrcxz", "Jb", nullptr },
+  { "e8", "call", "Jz", nullptr },
+  { "e9", "jmp", "Jz", nullptr },
+  { "eb", "jmp", "Jb", nullptr },
+  { "f4", "hlt", "", nullptr },
+  { "f5", "cmc", "", nullptr },
+  { "f6 /0", "test", "Eb,Ib", nullptr },
+  { "f6 /2", "not", "Eb", nullptr },
+  { "f6 /3", "neg", "Eb", nullptr },
+  { "f6 /4", "mul", "Eb", nullptr },
+  { "f6 /5", "imul", "Eb", nullptr },
+  { "f6 /6", "div", "Eb", nullptr },
+  { "f6 /7", "idiv", "Eb", nullptr },
+  { "f7 /0", "test", "Ev,Iz", nullptr },
+  { "f7 /2", "not", "Ev", nullptr },
+  { "f7 /3", "neg", "Ev", nullptr },
+  { "f7 /4", "mul", "Ev", nullptr },
+  { "f7 /5", "imul", "Ev", nullptr },
+  { "f7 /6", "div", "Ev", nullptr },
+  { "f7 /7", "idiv", "Ev", nullptr },
+  { "f8", "clc", "", nullptr },
+  { "f9", "stc", "", nullptr },
+  { "fc", "cld", "", nullptr },
+  { "fd", "std", "", nullptr },
+  { "fe /0", "inc", "Eb", nullptr },
+  { "fe /1", "dec", "Eb", nullptr },
+  { "ff /0", "inc", "Ev", nullptr },
+  { "ff /1", "dec", "Ev", nullptr },
+  { "ff /2", "call", "Eq", nullptr },
+  { "ff /4", "jmp", "Eq", nullptr },
+  { "ff /6", "push", "Eq", nullptr },
+
+  // 0F; cmovcc, jcc and setcc are generated
+  { "0f 05", "syscall", "", nullptr },
+  { "0f 0b", "ud2", "", nullptr },
+  { "0f 0d /0 m", "prefetch", "Mb", nullptr },
+  { "0f 0d /1 m", "prefetchw", "Mb", nullptr },
+  { "0f 18 /0 m", "prefetchnta", "Mb", nullptr },
+  { "0f 18 /1 m", "prefetcht0", "Mb", nullptr },
+  { "0f 18 /2 m", "prefetcht1", "Mb", nullptr },
+  { "0f 18 /3 m", "prefetcht2", "Mb", nullptr },
+  { "0f 1f /0", "nop", "Ev", nullptr },
+  { "0f a2", "cpuid", "", nullptr },
+  { "0f ae /5 r", "lfence", "", nullptr },
+  { "0f ae /6 r", "mfence", "", nullptr },
+  { "0f ae /7 r", "sfence", "", nullptr },
+  { "0f ae /7 m", "clflush", "Mb", nullptr },
+  { "0f af", "imul", "Gv,Ev", nullptr },
+  { "0f b0", "cmpxchg", "Eb,Gb", nullptr },
+  { "0f b1", "cmpxchg", "Ev,Gv", nullptr },
+  { "0f b6", "movzx", "Gv,Eb", nullptr },
+  { "0f b7", "movzx", "Gv,Ew", nullptr },
+  { "f3 0f b8", "popcnt", "Gv,Ev", nullptr },
+  { "0f bc", "bsf", "Gv,Ev", nullptr },
+  { "f3 0f bc", "tzcnt", "Gv,Ev", nullptr },
+  { "0f bd", "bsr", "Gv,Ev", nullptr },
+  { "f3 0f bd", "lzcnt", "Gv,Ev", nullptr },
+  { "0f be", "movsx", "Gv,Eb", nullptr },
+  { "0f bf", "movsx", "Gv,Ew", nullptr },
+  { "0f c0", "xadd", "Eb,Gb", nullptr },
+  { "0f c1", "xadd", "Ev,Gv", nullptr },
+  { "0f c3", "movnti", "My,Gy", nullptr },
+  { "0f c7 /1 m", "cmpxchg8b", "Mdq", "cmpxchg16b" },
+
+  // SSE. An H operand only exists in the VEX form, so the legacy form skips it.
+  { "0f 10", "movups", "Vx,Wx", nullptr },
+  { "66 0f 10", "movupd", "Vx,Wx", nullptr },
+  { "f3 0f 10", "movss", "Vdq,Hr,Wss", nullptr },
+  { "f2 0f 10", "movsd", "Vdq,Hr,Wsd", nullptr },
+  { "0f 11", "movups", "Wx,Vx", nullptr },
+  { "66 0f 11", "movupd", "Wx,Vx", nullptr },
+  { "f3 0f 11", "movss", "Wss,Hr,Vdq", nullptr },
+  { "f2 0f 11", "movsd", "Wsd,Hr,Vdq", nullptr },
+  { "0f 14", "unpcklps", "Vx,Hx,Wx", nullptr },
+  { "66 0f 14", "unpcklpd", "Vx,Hx,Wx", nullptr },
+  { "0f 15", "unpckhps", "Vx,Hx,Wx", nullptr },
+  { "66 0f 15", "unpckhpd", "Vx,Hx,Wx", nullptr },
+  { "0f 28", "movaps", "Vx,Wx", nullptr },
+  { "66 0f 28", "movapd", "Vx,Wx", nullptr },
+  { "0f 29", "movaps", "Wx,Vx", nullptr },
+  { "66 0f 29", "movapd", "Wx,Vx", nullptr },
+  { "f3 0f 2a", "cvtsi2ss", "Vdq,Hdq,Ey", nullptr },
+  { "f2 0f 2a", "cvtsi2sd", "Vdq,Hdq,Ey", nullptr },
+  { "0f 2b", "movntps", "Mx,Vx", nullptr },
+  { "66 0f 2b", "movntpd", "Mx,Vx", nullptr },
+  { "f3 0f 2c", "cvttss2si", "Gy,Wss", nullptr },
+  { "f2 0f 2c", "cvttsd2si", "Gy,Wsd", nullptr },
+  { "f3 0f 2d", "cvtss2si", "Gy,Wss", nullptr },
+  { "f2 0f 2d", "cvtsd2si", "Gy,Wsd", nullptr },
+  { "0f 2e", "ucomiss", "Vdq,Wss", nullptr },
+  { "66 0f 2e", "ucomisd", "Vdq,Wsd", nullptr },
+  { "0f 2f", "comiss", "Vdq,Wss", nullptr },
+  { "66 0f 2f", "comisd", "Vdq,Wsd", nullptr },
+  { "0f 51", "sqrtps", "Vx,Wx", nullptr },
+  { "66 0f 51", "sqrtpd", "Vx,Wx", nullptr },
+  { "f3 0f 51", "sqrtss", "Vdq,Hdq,Wss", nullptr },
+  { "f2 0f 51", "sqrtsd", "Vdq,Hdq,Wsd", nullptr },
+  { "0f 54", "andps", "Vx,Hx,Wx", nullptr },
+  { "66 0f 54", "andpd", "Vx,Hx,Wx", nullptr },
+  { "0f 55", "andnps", "Vx,Hx,Wx", nullptr },
+  { "66 0f 55", "andnpd", "Vx,Hx,Wx", nullptr },
+  { "0f 56", "orps", "Vx,Hx,Wx", nullptr },
+  { "66 0f 56", "orpd", "Vx,Hx,Wx", nullptr },
+  { "0f 57", "xorps", "Vx,Hx,Wx", nullptr },
+  { "66 0f 57", "xorpd", "Vx,Hx,Wx", nullptr },
+  { "0f 5a", "cvtps2pd", "Vx,Wh", nullptr },
+  { "66 0f 5a", "cvtpd2ps", "Vdq,Wx", nullptr },
+  { "f3 0f 5a", "cvtss2sd", "Vdq,Hdq,Wss", nullptr },
+  { "f2 0f 5a", "cvtsd2ss", "Vdq,Hdq,Wsd", nullptr },
+  { "66 0f 66", "pcmpgtd", "Vx,Hx,Wx", nullptr },
+  { "66 0f 6e", "movd", "Vdq,Ey", "movq" },
+  { "66 0f 6f", "movdqa", "Vx,Wx", nullptr },
+  { "f3 0f 6f", "movdqu", "Vx,Wx", nullptr },
+  { "66 0f 72 /2 r", "psrld", "Hx,Ux,Ib", nullptr },
+  { "66 0f 72 /4 r", "psrad", "Hx,Ux,Ib", nullptr },
+  { "66 0f 72 /6 r", "pslld", "Hx,Ux,Ib", nullptr },
+  { "66 0f 73 /2 r", "psrlq", "Hx,Ux,Ib", nullptr },
+  { "66 0f 73 /6 r", "psllq", "Hx,Ux,Ib", nullptr },
+  { "66 0f 76", "pcmpeqd", "Vx,Hx,Wx", nullptr },
+  { "66 0f 7e", "movd", "Ey,Vdq", "movq" },
+  { "66 0f 7f", "movdqa", "Wx,Vx", nullptr },
+  { "f3 0f 7f", "movdqu", "Wx,Vx", nullptr },
+  { "0f c2", "cmpps", "Vx,Hx,Wx,Ib", nullptr },
+  { "66 0f c2", "cmppd", "Vx,Hx,Wx,Ib", nullptr },
+  { "f3 0f c2", "cmpss", "Vdq,Hdq,Wss,Ib", nullptr },
+  { "f2 0f c2", "cmpsd", "Vdq,Hdq,Wsd,Ib", nullptr },
+  { "0f c6", "shufps", "Vx,Hx,Wx,Ib", nullptr },
+  { "66 0f c6", "shufpd", "Vx,Hx,Wx,Ib", nullptr },
+  { "66 0f d4", "paddq", "Vx,Hx,Wx", nullptr },
+  { "66 0f db", "pand", "Vx,Hx,Wx", nullptr },
+  { "66 0f df", "pandn", "Vx,Hx,Wx", nullptr },
+  { "66 0f e7", "movntdq", "Mx,Vx", nullptr },
+  { "66 0f eb", "por", "Vx,Hx,Wx", nullptr },
+  { "66 0f ef", "pxor", "Vx,Hx,Wx", nullptr },
+  { "66 0f f4", "pmuludq", "Vx,Hx,Wx", nullptr },
+  { "66 0f fa", "psubd", "Vx,Hx,Wx", nullptr },
+  { "66 0f fb", "psubq", "Vx,Hx,Wx", nullptr },
+  { "66 0f fe", "paddd", "Vx,Hx,Wx", nullptr },
+  { "66 0f38 14", "blendvps", "Vx,Wx,X0", nullptr },
+  { "66 0f38 15", "blendvpd", "Vx,Wx,X0", nullptr },
+  { "66 0f38 29", "pcmpeqq", "Vx,Hx,Wx", nullptr },
+  { "66 0f38 40", "pmulld", "Vx,Hx,Wx", nullptr },
+  { "66 0f3a 0c", "blendps", "Vx,Hx,Wx,Ib", nullptr },
+  { "66 0f3a 0d", "blendpd", "Vx,Hx,Wx,Ib", nullptr },
+
+  // VEX
+  { "vex 0f 10", "vmovups", "Vx,Wx", nullptr },
+  { "vex 66 0f 10", "vmovupd", "Vx,Wx", nullptr },
+  { "vex f3 0f 10", "vmovss", "Vdq,Hr,Wss", nullptr },
+  { "vex f2 0f 10", "vmovsd", "Vdq,Hr,Wsd", nullptr },
+  { "vex 0f 11", "vmovups", "Wx,Vx", nullptr },
+  { "vex 66 0f 11", "vmovupd", "Wx,Vx", nullptr },
+  { "vex f3 0f 11", "vmovss", "Wss,Hr,Vdq", nullptr },
+  { "vex f2 0f 11", "vmovsd", "Wsd,Hr,Vdq", nullptr },
+  { "vex 0f 14", "vunpcklps", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f 14", "vunpcklpd", "Vx,Hx,Wx", nullptr },
+  { "vex 0f 15", "vunpckhps", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f 15", "vunpckhpd", "Vx,Hx,Wx", nullptr },
+  { "vex 0f 28", "vmovaps", "Vx,Wx", nullptr },
+  { "vex 66 0f 28", "vmovapd", "Vx,Wx", nullptr },
+  { "vex 0f 29", "vmovaps", "Wx,Vx", nullptr },
+  { "vex 66 0f 29", "vmovapd", "Wx,Vx", nullptr },
+  { "vex f3 0f 2a", "vcvtsi2ss", "Vdq,Hdq,Ey", nullptr },
+  { "vex f2 0f 2a", "vcvtsi2sd", "Vdq,Hdq,Ey", nullptr },
+  { "vex 0f 2b", "vmovntps", "Mx,Vx", nullptr },
+  { "vex 66 0f 2b", "vmovntpd", "Mx,Vx", nullptr },
+  { "vex f3 0f 2d", "vcvtss2si", "Gy,Wss", nullptr },
+  { "vex f2 0f 2d", "vcvtsd2si", "Gy,Wsd", nullptr },
+  { "vex 0f 2e", "vucomiss", "Vdq,Wss", nullptr },
+  { "vex 66 0f 2e", "vucomisd", "Vdq,Wsd", nullptr },
+  { "vex 0f 2f", "vcomiss", "Vdq,Wss", nullptr },
+  { "vex 66 0f 2f", "vcomisd", "Vdq,Wsd", nullptr },
+  { "vex 0f 51", "vsqrtps", "Vx,Wx", nullptr },
+  { "vex 66 0f 51", "vsqrtpd", "Vx,Wx", nullptr },
+  { "vex f3 0f 51", "vsqrtss", "Vdq,Hdq,Wss", nullptr },
+  { "vex f2 0f 51", "vsqrtsd", "Vdq,Hdq,Wsd", nullptr },
+  { "vex 0f 54", "vandps", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f 54", "vandpd", "Vx,Hx,Wx", nullptr },
+  { "vex 0f 55", "vandnps", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f 55", "vandnpd", "Vx,Hx,Wx", nullptr },
+  { "vex 0f 56", "vorps", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f 56", "vorpd", "Vx,Hx,Wx", nullptr },
+  { "vex 0f 57", "vxorps", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f 57", "vxorpd", "Vx,Hx,Wx", nullptr },
+  { "vex 0f 5a", "vcvtps2pd", "Vx,Wh", nullptr },
+  { "vex f3 0f 5a", "vcvtss2sd", "Vdq,Hdq,Wss", nullptr },
+  { "vex f2 0f 5a", "vcvtsd2ss", "Vdq,Hdq,Wsd", nullptr },
+  { "vex 66 0f 66", "vpcmpgtd", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f 6e", "vmovd", "Vdq,Ey", "vmovq" },
+  { "vex 66 0f 6f", "vmovdqa", "Vx,Wx", nullptr },
+  { "vex f3 0f 6f", "vmovdqu", "Vx,Wx", nullptr },
+  { "vex 66 0f 72 /2 r", "vpsrld", "Hx,Ux,Ib", nullptr },
+  { "vex 66 0f 72 /4 r", "vpsrad", "Hx,Ux,Ib", nullptr },
+  { "vex 66 0f 72 /6 r", "vpslld", "Hx,Ux,Ib", nullptr },
+  { "vex 66 0f 73 /2 r", "vpsrlq", "Hx,Ux,Ib", nullptr },
+  { "vex 66 0f 73 /6 r", "vpsllq", "Hx,Ux,Ib", nullptr },
+  { "vex 66 0f 76", "vpcmpeqd", "Vx,Hx,Wx", nullptr },
+  { "vex 0f 77", "vzeroupper", "", nullptr },
+  { "vex 66 0f 7e", "vmovd", "Ey,Vdq", "vmovq" },
+  { "vex 66 0f 7f", "vmovdqa", "Wx,Vx", nullptr },
+  { "vex f3 0f 7f", "vmovdqu", "Wx,Vx", nullptr },
+  { "vex 0f 92 r", "kmovw", "KV,Ry", nullptr },
+  { "vex 66 0f 92 r", "kmovb", "KV,Ry", nullptr },
+  { "vex f2 0f 92 r", "kmovd", "KV,Ry", "kmovq" },
+  { "vex 0f 93 r", "kmovw", "Gy,KE", nullptr },
+  { "vex 66 0f 93 r", "kmovb", "Gy,KE", nullptr },
+  { "vex f2 0f 93 r", "kmovd", "Gy,KE", "kmovq" },
+  { "vex 0f c2", "vcmpps", "Vx,Hx,Wx,Ib", nullptr },
+  { "vex 66 0f c2", "vcmppd", "Vx,Hx,Wx,Ib", nullptr },
+  { "vex f3 0f c2", "vcmpss", "Vdq,Hdq,Wss,Ib", nullptr },
+  { "vex f2 0f c2", "vcmpsd", "Vdq,Hdq,Wsd,Ib", nullptr },
+  { "vex 0f c6", "vshufps", "Vx,Hx,Wx,Ib", nullptr },
+  { "vex 66 0f c6", "vshufpd", "Vx,Hx,Wx,Ib", nullptr },
+  { "vex 66 0f d4", "vpaddq", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f db", "vpand", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f df", "vpandn", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f e7", "vmovntdq", "Mx,Vx", nullptr },
+  { "vex 66 0f eb", "vpor", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f ef", "vpxor", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f f4", "vpmuludq", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f fa", "vpsubd", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f fb", "vpsubq", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f fe", "vpaddd", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f38 18", "vbroadcastss", "Vx,Wss", nullptr },
+  { "vex 66 0f38 19", "vbroadcastsd", "Vx,Wsd", nullptr },
+  { "vex 66 0f38 29", "vpcmpeqq", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f38 40", "vpmulld", "Vx,Hx,Wx", nullptr },
+  { "vex 66 0f38 58", "vpbroadcastd", "Vx,Wss", nullptr },
+  { "vex 66 0f38 59", "vpbroadcastq", "Vx,Wsd", nullptr },
+  { "vex 66 0f3a 00", nullptr, "Vx,Wx,Ib", "vpermq" },
+  { "vex 66 0f3a 0c", "vblendps", "Vx,Hx,Wx,Ib", nullptr },
+  { "vex 66 0f3a 0d", "vblendpd", "Vx,Hx,Wx,Ib", nullptr },
+  { "vex 66 0f3a 4a", "vblendvps", "Vx,Hx,Wx,Lx", nullptr },
+  { "vex 66 0f3a 4b", "vblendvpd", "Vx,Hx,Wx,Lx", nullptr },
+  { "vex 0f38 f2", "andn", "Gy,By,Ey", nullptr },
+  { "vex 0f38 f3 /1", "blsr", "By,Ey", nullptr },
+  { "vex 0f38 f3 /2", "blsmsk", "By,Ey", nullptr },
+  { "vex 0f38 f3 /3", "blsi", "By,Ey", nullptr },
+  { "vex 0f38 f5", "bzhi", "Gy,Ey,By", nullptr },
+  { "vex f3 0f38 f5", "pext", "Gy,By,Ey", nullptr },
+  { "vex f2 0f38 f5", "pdep", "Gy,By,Ey", nullptr },
+  { "vex f2 0f38 f6", "mulx", "Gy,By,Ey", nullptr },
+  { "vex 0f38 f7", "bextr", "Gy,Ey,By", nullptr },
+  { "vex 66 0f38 f7", "shlx", "Gy,Ey,By", nullptr },
+  { "vex f3 0f38 f7", "sarx", "Gy,Ey,By", nullptr },
+  { "vex f2 0f38 f7", "shrx", "Gy,Ey,By", nullptr },
+  { "vex f2 0f3a f0", "rorx", "Gy,Ey,Ib", nullptr },
+
+  // EVEX; W picks the element size, which a broadcast memory operand uses
+  { "evex 0f 10", "vmovups", "Vx,Wx", nullptr },
+  { "evex 66 0f 10", "vmovupd", "Vx,Wx", nullptr },
+  { "evex 0f 11", "vmovups", "Wx,Vx", nullptr },
+  { "evex 66 0f 11", "vmovupd", "Wx,Vx", nullptr },
+  { "evex 0f 28", "vmovaps", "Vx,Wx", nullptr },
+  { "evex 66 0f 28", "vmovapd", "Vx,Wx", nullptr },
+  { "evex 0f 29", "vmovaps", "Wx,Vx", nullptr },
+  { "evex 66 0f 29", "vmovapd", "Wx,Vx", nullptr },
+  { "evex 0f 51", "vsqrtps", "Vx,Wx", nullptr },
+  { "evex 66 0f 51", "vsqrtpd", "Vx,Wx", nullptr },
+  { "evex 0f 58", "vaddps", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f 58", "vaddpd", "Vx,Hx,Wx", nullptr },
+  { "evex 0f 59", "vmulps", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f 59", "vmulpd", "Vx,Hx,Wx", nullptr },
+  { "evex 0f 5c", "vsubps", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f 5c", "vsubpd", "Vx,Hx,Wx", nullptr },
+  { "evex 0f 5d", "vminps", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f 5d", "vminpd", "Vx,Hx,Wx", nullptr },
+  { "evex 0f 5e", "vdivps", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f 5e", "vdivpd", "Vx,Hx,Wx", nullptr },
+  { "evex 0f 5f", "vmaxps", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f 5f", "vmaxpd", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f 6f", "vmovdqa32", "Vx,Wx", "vmovdqa64" },
+  { "evex f3 0f 6f", "vmovdqu32", "Vx,Wx", "vmovdqu64" },
+  { "evex 66 0f 7f", "vmovdqa32", "Wx,Vx", "vmovdqa64" },
+  { "evex f3 0f 7f", "vmovdqu32", "Wx,Vx", "vmovdqu64" },
+  { "evex 0f c2", "vcmpps", "KV,Hx,Wx,Ib", nullptr },
+  { "evex 66 0f c2", "vcmppd", "KV,Hx,Wx,Ib", nullptr },
+  { "evex 66 0f d4", nullptr, "Vx,Hx,Wx", "vpaddq" },
+  { "evex 66 0f db", "vpandd", "Vx,Hx,Wx", "vpandq" },
+  { "evex 66 0f eb", "vpord", "Vx,Hx,Wx", "vporq" },
+  { "evex 66 0f ef", "vpxord", "Vx,Hx,Wx", "vpxorq" },
+  { "evex 66 0f fa", "vpsubd", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f fb", nullptr, "Vx,Hx,Wx", "vpsubq" },
+  { "evex 66 0f fe", "vpaddd", "Vx,Hx,Wx", nullptr },
+  { "evex 66 0f38 18", "vbroadcastss", "Vx,Wss", nullptr },
+  { "evex 66 0f38 19", nullptr, "Vx,Wsd", "vbroadcastsd" },
+};
+
+static const char* const conditions[] = {
+  "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g"
+};
+
+static const char* const basicNames[] = {
+  "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"
+};
+
+static const char* const shiftNames[] = {
+  "rol", "ror", "rcl", "rcr", "shl", "shr", nullptr, "sar"
+};
+
+// vfmadd132ps and the rest: the FmaOp opcodes, packed then scalar, single then double
+static const char* const fmaNames[][ 4 ] = {
+  { "vfmadd132ps", "vfmadd132pd", "vfmadd132ss", "vfmadd132sd" },
+  { "vfmsub132ps", "vfmsub132pd", "vfmsub132ss", "vfmsub132sd" },
+  { "vfnmadd132ps", "vfnmadd132pd", "vfnmadd132ss", "vfnmadd132sd" },
+  { "vfmadd213ps", "vfmadd213pd", "vfmadd213ss", "vfmadd213sd" },
+  { "vfmsub213ps", "vfmsub213pd", "vfmsub213ss", "vfmsub213sd" },
+  { "vfnmadd213ps", "vfnmadd213pd", "vfnmadd213ss", "vfnmadd213sd" },
+  { "vfmadd231ps", "vfmadd231pd", "vfmadd231ss", "vfmadd231sd" },
+  { "vfmsub231ps", "vfmsub231pd", "vfmsub231ss", "vfmsub231sd" },
+  { "vfnmadd231ps", "vfnmadd231pd", "vfnmadd231ss", "vfnmadd231sd" }
+};
+
+static const uint8_t fmaOps[] = { 0x98, 0x9a, 0x9c, 0xa8, 0xaa, 0xac, 0xb8, 0xba, 0xbc };
+
+// add, mul, sub, min, div and max, 0F 58 - 5F without 5A and 5B, by mandatory prefix
+static const char* const arithmeticNames[][ 4 ] = {
+  { "addps", "addpd", "addss", "addsd" },
+  { "mulps", "mulpd", "mulss", "mulsd" },
+  { nullptr, nullptr, nullptr, nullptr },
+  { nullptr, nullptr, nullptr, nullptr },
+  { "subps", "subpd", "subss", "subsd" },
+  { "minps", "minpd", "minss", "minsd" },
+  { "divps", "divpd", "divss", "divsd" },
+  { "maxps", "maxpd", "maxss", "maxsd" }
+};
+
+static const char* const vexArithmeticNames[][ 4 ] = {
+  { "vaddps", "vaddpd", "vaddss", "vaddsd" },
+  { "vmulps", "vmulpd", "vmulss", "vmulsd" },
+  { nullptr, nullptr, nullptr, nullptr },
+  { nullptr, nullptr, nullptr, nullptr },
+  { "vsubps", "vsubpd", "vsubss", "vsubsd" },
+  { "vminps", "vminpd", "vminss", "vminsd" },
+  { "vdivps", "vdivpd", "vdivss", "vdivsd" },
+  { "vmaxps", "vmaxpd", "vmaxss", "vmaxsd" }
+};
+
+// a row, ready for decode()
+struct Def {
+  const char* name;
+  const char* nameW1;
+  Spec specs[ 4 ];
+  int8_t reg;       // the ModR/M reg field a group member needs, or -1
+  uint8_t mod;      // 0 either form, 1 memory only, 2 register only
+  bool modRm;
+};
+
+// Defs sorted by key(); those for one key are defs[ first[ k ] ] up to defs[ first[ k + 1 ] ]
+struct Tables {
+  vector< Def > defs;
+  vector< uint16_t > first;
+};
+
+static constexpr size_t
+key( Encoding encoding, uint8_t map, uint8_t prefix, uint8_t op ) {
+  return ( static_cast< size_t >( encoding ) << 12 ) | ( map << 10 ) | ( prefix << 8 ) | op;
+}
+
+static constexpr size_t keys = key( Encoding::evex, 3, 3, 0xff ) + 1;
+
+static bool
+needsModRm( Spec spec ) {
+  switch( spec ) {
+  case Spec::none:
+  case Spec::Zb: case Spec::Zv: case Spec::Zq:
+  case Spec::Ib: case Spec::Ibs: case Spec::Ibq: case Spec::Iw: case Spec::Iz: case Spec::Izq:
+  case Spec::Iv: case Spec::One:
+  case Spec::AL: case Spec::CL: case Spec::rAX:
+  case Spec::Jb: case Spec::Jz:
+  case Spec::Xb: case Spec::Xv: case Spec::Yb: case Spec::Yv:
+  case Spec::Hx: case Spec::Hdq: case Spec::Lx: case Spec::X0: case Spec::By:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// Turn opcode and operand text into a Def and the key it's filed under. The text is fixed,
+// so a mistake in it is a bug here rather than bad input.
+static pair< size_t, Def >
+parseRow( const char* opcode, const char* name, const char* operands, const char* nameW1 ) {
+  auto encoding = Encoding::legacy;
+  uint8_t map = 0;
+  uint8_t prefix = 0;
+  int op = -1;
+  Def def{ name, nameW1, {}, -1, 0, false };
+
+  istringstream words{ opcode };
+  string word;
+
+  while( words >> word ) {
+    if( word == "vex" ) {
+      encoding = Encoding::vex;
+    }
+    else if( word == "evex" ) {
+      encoding = Encoding::evex;
+    }
+    else if( word == "0f" ) {
+      map = 1;
+    }
+    else if( word == "0f38" ) {
+      map = 2;
+    }
+    else if( word == "0f3a" ) {
+      map = 3;
+    }
+    else if( word[ 0 ] == '/' ) {
+      def.reg = word[ 1 ] - '0';
+      def.modRm = true;
+    }
+    else if( word == "m" || word == "r" ) {
+      def.mod = word == "m" ? 1 : 2;
+      def.modRm = true;
+    }
+    else {
+      // a byte before the map or before the opcode is the mandatory prefix
+      if( 0 <= op ) {
+        prefix = op == 0x66 ? 1 : op == 0xf3 ? 2 : 3;
+      }
+
+      op = stoi( word, nullptr, 16 );
+    }
+  }
+
+  istringstream list{ operands };
+  auto n = 0;
+
+  while( getline( list, word, ',' ) ) {
+    for( auto& s : specNames ) {
+      if( word == s.first ) {
+        def.specs[ n ] = s.second;
+        def.modRm = def.modRm || needsModRm( s.second );
+      }
+    }
+
+    n++;
+  }
+
+  return { key( encoding, map, prefix, static_cast< uint8_t >( op ) ), def };
+}
+
+static Tables
+buildTables() {
+  vector< pair< size_t, Def > > all;
+
+  auto add = [&all]( const char* opcode, const char* name, const char* operands,
+                     const char* nameW1 = nullptr ) {
+    all.push_back( parseRow( opcode, name, operands, nameW1 ) );
+  };
+
+  for( auto& row : rows ) {
+    add( row.opcode, row.name, row.operands, row.nameW1 );
+  }
+
+  char opcode[ 32 ];
+
+  static const char* const basicForms[] = { "Eb,Gb", "Ev,Gv", "Gb,Eb", "Gv,Ev", "AL,Ib",
+                                            "rAX,Iz" };
+
+  for( auto i = 0; i < 8; i++ ) {
+    for( auto f = 0; f < 6; f++ ) {
+      snprintf( opcode, sizeof( opcode ), "%02x", i * 8 + f );
+      add( opcode, basicNames[ i ], basicForms[ f ] );
+    }
+
+    snprintf( opcode, sizeof( opcode ), "80 /%d", i );
+    add( opcode, basicNames[ i ], "Eb,Ib" );
+    snprintf( opcode, sizeof( opcode ), "81 /%d", i );
+    add( opcode, basicNames[ i ], "Ev,Iz" );
+    snprintf( opcode, sizeof( opcode ), "83 /%d", i );
+    add( opcode, basicNames[ i ], "Ev,Ibs" );
+
+    snprintf( opcode, sizeof( opcode ), "%02x", 0x50 + i );
+    add( opcode, "push", "Zq" );
+    snprintf( opcode, sizeof( opcode ), "%02x", 0x58 + i );
+    add( opcode, "pop", "Zq" );
+    snprintf( opcode, sizeof( opcode ), "%02x", 0x90 + i );
+    add( opcode, "xchg", "Zv,rAX" );
+    snprintf( opcode, sizeof( opcode ), "%02x", 0xb0 + i );
+    add( opcode, "mov", "Zb,Ib" );
+    snprintf( opcode, sizeof( opcode ), "%02x", 0xb8 + i );
+    add( opcode, "mov", "Zv,Iv", "movabs" );
+
+    static const char* const shiftForms[][ 2 ] = {
+      { "c0", "Eb,Ib" }, { "c1", "Ev,Ib" }, { "d0", "Eb,1" }, { "d1", "Ev,1" },
+      { "d2", "Eb,CL" }, { "d3", "Ev,CL" }
+    };
+
+    for( auto& form : shiftForms ) {
+      if( shiftNames[ i ] ) {
+        snprintf( opcode, sizeof( opcode ), "%s /%d", form[ 0 ], i );
+        add( opcode, shiftNames[ i ], form[ 1 ] );
+      }
+    }
+  }
+
+  // jcc, cmovcc and setcc keep their names for the program's lifetime
+  static string names[ 4 ][ 16 ];
+
+  for( auto c = 0; c < 16; c++ ) {
+    names[ 0 ][ c ] = string( "j" ) + conditions[ c ];
+    names[ 1 ][ c ] = string( "cmov" ) + conditions[ c ];
+    names[ 2 ][ c ] = string( "set" ) + conditions[ c ];
+
+    snprintf( opcode, sizeof( opcode ), "%02x", 0x70 + c );
+    add( opcode, names[ 0 ][ c ].c_str(), "Jb" );
+    snprintf( opcode, sizeof( opcode ), "0f %02x", 0x80 + c );
+    add( opcode, names[ 0 ][ c ].c_str(), "Jz" );
+    snprintf( opcode, sizeof( opcode ), "0f %02x", 0x40 + c );
+    add( opcode, names[ 1 ][ c ].c_str(), "Gv,Ev" );
+    snprintf( opcode, sizeof( opcode ), "0f %02x", 0x90 + c );
+    add( opcode, names[ 2 ][ c ].c_str(), "Eb" );
+  }
+
+  for( auto f = 0; f < 9; f++ ) {
+    for( auto encoding : { "vex", "evex" } ) {
+      snprintf( opcode, sizeof( opcode ), "%s 66 0f38 %02x", encoding, fmaOps[ f ] );
+      add( opcode, fmaNames[ f ][ 0 ], "Vx,Hx,Wx", fmaNames[ f ][ 1 ] );
+    }
+
+    snprintf( opcode, sizeof( opcode ), "vex 66 0f38 %02x", fmaOps[ f ] + 1 );
+    add( opcode, fmaNames[ f ][ 2 ], "Vdq,Hdq,Wsy", fmaNames[ f ][ 3 ] );
+  }
+
+  static const char* const prefixes[] = { "", "66 ", "f3 ", "f2 " };
+  static const char* const arithmeticForms[] = { "Vx,Hx,Wx", "Vx,Hx,Wx", "Vdq,Hdq,Wss",
+                                                 "Vdq,Hdq,Wsd" };
+
+  for( auto a = 0; a < 8; a++ ) {
+    for( auto pp = 0; arithmeticNames[ a ][ 0 ] && pp < 4; pp++ ) {
+      snprintf( opcode, sizeof( opcode ), "%s0f %02x", prefixes[ pp ], 0x58 + a );
+      add( opcode, arithmeticNames[ a ][ pp ], arithmeticForms[ pp ] );
+      snprintf( opcode, sizeof( opcode ), "vex %s0f %02x", prefixes[ pp ], 0x58 + a );
+      add( opcode, vexArithmeticNames[ a ][ pp ], arithmeticForms[ pp ] );
+    }
+  }
+
+  stable_sort( all.begin(), all.end(),
+               []( const pair< size_t, Def >& a, const pair< size_t, Def >& b ) {
+                 return a.first < b.first;
+               } );
+
+  Tables tables;
+  tables.first.assign( keys + 1, 0 );
+
+  for( auto& a : all ) {
+    tables.defs.push_back( a.second );
+    tables.first[ a.first + 1 ]++;
+  }
+
+  for( size_t k = 0; k < keys; k++ ) {
+    tables.first[ k + 1 ] += tables.first[ k ];
+  }
+
+  return tables;
+}
+
+static const Tables&
+tables() {
+  static const Tables built = buildTables();
+
+  return built;
+}
+
+// ----------------------------------------------------------------------
+// Decoding
+
+// what the prefixes, ModR/M, SIB and displacement say, gathered before the operands are
+// built
+struct Fields {
+  Encoding encoding = Encoding::legacy;
+  bool operandSize = false;     // a 66 prefix that isn't part of the opcode
+  bool rex = false;
+  bool w = false;
+  uint8_t r = 0;                // REX.R, or R and R' of EVEX, as register number bits
+  uint8_t x = 0;
+  uint8_t b = 0;
+  uint8_t vvvv = 0;
+  uint8_t width = 16;           // vector length in bytes
+  bool broadcast = false;
+  uint8_t segment = 0;
+
+  uint8_t mod = 0;
+  uint8_t reg = 0;              // ModR/M reg with R, R' applied
+  uint8_t rm = 0;               // ModR/M rm with B applied, or with B and X for EVEX
+  Mem mem{ Register::r0 };
+  uint8_t dispBytes = 0;
+};
+
+static const uint8_t*
+readBytes( const uint8_t* p, const uint8_t* end, size_t n, int64_t& value ) {
+  if( static_cast< size_t >( end - p ) < n ) {
+    return nullptr;
+  }
+
+  uint64_t v = 0;
+  for( size_t i = 0; i < n; i++ ) {
+    v |= static_cast< uint64_t >( p[ i ] ) << ( 8 * i );
+  }
+
+  // sign extend from n bytes
+  auto shift = 64 - 8 * n;
+  value = n ? static_cast< int64_t >( v << shift ) >> shift : 0;
+
+  return p + n;
+}
+
+// ModR/M, then any SIB and displacement
+static const uint8_t*
+readModRm( const uint8_t* p, const uint8_t* end, Fields& f ) {
+  if( p == end ) {
+    return nullptr;
+  }
+
+  auto m = *p++;
+
+  f.mod = m >> 6;
+  f.reg = ( ( m >> 3 ) & 7 ) | f.r;
+  f.rm = ( m & 7 ) | f.b;
+
+  if( f.mod == 3 ) {
+    // EVEX X is bit 4 of a register rm
+    if( f.encoding == Encoding::evex ) {
+      f.rm |= f.x << 1;
+    }
+
+    return p;
+  }
+
+  auto& mem = f.mem;
+  auto rm = m & 7;
+
+  if( rm == 4 ) {
+    if( p == end ) {
+      return nullptr;
+    }
+
+    auto sib = *p++;
+    auto index = ( ( sib >> 3 ) & 7 ) | ( f.x & 8 );
+
+    mem.scale = static_cast< Scale >( sib >> 6 );
+    mem.index = static_cast< Register >( index );
+    mem.hasIndex = index != 4;
+    mem.base = static_cast< Register >( ( sib & 7 ) | f.b );
+    mem.hasBase = ( sib & 7 ) != 5 || f.mod != 0;
+    f.dispBytes = mem.hasBase ? 0 : 4;
+  }
+  else if( rm == 5 && f.mod == 0 ) {
+    mem.hasBase = false;
+    mem.rip = true;
+    f.dispBytes = 4;
+  }
+  else {
+    mem.base = static_cast< Register >( f.rm );
+  }
+
+  if( f.mod == 1 ) {
+    f.dispBytes = 1;
+  }
+  else if( f.mod == 2 ) {
+    f.dispBytes = 4;
+  }
+
+  int64_t disp = 0;
+  p = readBytes( p, end, f.dispBytes, disp );
+  mem.disp = static_cast< int32_t >( disp );
+
+  return p;
+}
+
+// the next operand with everything but mem cleared; mem is only filled in for memory
+static DecodedOperand&
+addOperand( Instruction& ins, DecodedKind kind, uint8_t size ) {
+  auto& op = ins.operands[ ins.count++ ];
+
+  op.kind = kind;
+  op.size = size;
+  op.reg = 0;
+  op.highByte = false;
+  op.dispBytes = 0;
+  op.broadcast = 0;
+  op.segment = 0;
+  op.value = 0;
+
+  return op;
+}
+
+static void
+addRegister( Instruction& ins, const Fields& f, uint8_t reg, uint8_t size ) {
+  auto& op = addOperand( ins, DecodedKind::reg, size );
+
+  op.reg = reg;
+  op.highByte = size == 1 && !f.rex && 4 <= reg && reg < 8;
+}
+
+static DecodedKind
+vectorKind( uint8_t width ) {
+  return width == 64 ? DecodedKind::zmm : width == 32 ? DecodedKind::ymm : DecodedKind::xmm;
+}
+
+static void
+addVector( Instruction& ins, uint8_t reg, uint8_t width ) {
+  addOperand( ins, vectorKind( width ), width ).reg = reg;
+}
+
+// the rm operand as memory of size bytes; an EVEX disp8 counts in units of size
+static void
+addMemory( Instruction& ins, const Fields& f, uint8_t size ) {
+  auto& op = addOperand( ins, DecodedKind::mem, size );
+
+  op.mem = f.mem;
+  op.dispBytes = f.dispBytes;
+  op.segment = f.segment;
+
+  if( f.encoding == Encoding::evex && f.dispBytes == 1 ) {
+    op.mem.disp *= size;
+  }
+}
+
+// rm as a register of size or as memory
+static void
+addRm( Instruction& ins, const Fields& f, uint8_t size ) {
+  if( f.mod == 3 ) {
+    addRegister( ins, f, f.rm, size );
+  }
+  else {
+    addMemory( ins, f, size );
+  }
+}
+
+// rm as a vector register of width bytes, or memory of size bytes
+static void
+addVectorRm( Instruction& ins, const Fields& f, uint8_t width, uint8_t size ) {
+  if( f.mod == 3 ) {
+    addVector( ins, f.rm, width );
+  }
+  else {
+    addMemory( ins, f, size );
+  }
+}
+
+// rsi or rdi for the string ops
+static void
+addString( Instruction& ins, const Fields& f, Register base, uint8_t segment, uint8_t size ) {
+  auto& op = addOperand( ins, DecodedKind::mem, size );
+
+  op.mem = Mem( base );
+  op.segment = base == Register::rsi && f.segment ? f.segment : segment;
+}
+
+// an immediate of n bytes, extended to an operand of size bytes
+static const uint8_t*
+addImmediate( Instruction& ins, const uint8_t* p, const uint8_t* end, size_t n, uint8_t size,
+              bool sign ) {
+  int64_t value = 0;
+
+  p = readBytes( p, end, n, value );
+  if( p ) {
+    auto& op = addOperand( ins, DecodedKind::imm, size );
+    op.value = sign || n == 8 ? value : value & ( ( uint64_t( 1 ) << ( 8 * n ) ) - 1 );
+  }
+
+  return p;
+}
+
+size_t
+decode( const uint8_t* code, size_t size, Instruction& ins ) {
+  auto& t = tables();
+  auto end = code + min( size, CodeBuffer::maxInstruction );
+  auto p = code;
+  Fields f;
+
+  ins.count = 0;
+  ins.lock = false;
+  ins.rep = false;
+  ins.repne = false;
+  ins.mask = Mask();
+
+  uint8_t repeat = 0;   // the last of F2 and F3
+
+  for( ; p < end; p++ ) {
+    switch( *p ) {
+    case 0xf0:
+      ins.lock = true;
+      continue;
+    case 0xf2:
+    case 0xf3:
+      repeat = *p;
+      continue;
+    case 0x66:
+      f.operandSize = true;
+      continue;
+    case 0x26:
+    case 0x2e:
+    case 0x36:
+    case 0x3e:
+    case 0x64:
+    case 0x65:
+      f.segment = *p;
+      continue;
+    }
+
+    break;
+  }
+
+  if( p < end && ( *p & 0xf0 ) == 0x40 ) {
+    f.rex = true;
+    f.w = *p & 8;
+    f.r = ( *p & 4 ) << 1;
+    f.x = ( *p & 2 ) << 2;
+    f.b = ( *p & 1 ) << 3;
+    p++;
+  }
+
+  if( end - p < 1 ) {
+    return 0;
+  }
+
+  uint8_t map = 0;
+  uint8_t prefix = repeat == 0xf3 ? 2 : repeat == 0xf2 ? 3 : f.operandSize ? 1 : 0;
+  uint8_t op = *p++;
+
+  if( op == 0xc4 || op == 0xc5 || op == 0x62 ) {
+    // nothing but a segment override may come before VEX or EVEX
+    if( f.rex || prefix || ins.lock ) {
+      return 0;
+    }
+
+    auto n = op == 0xc5 ? 2 : op == 0xc4 ? 3 : 4;
+    if( end - p < n ) {
+      return 0;
+    }
+
+    auto p0 = p[ 0 ];
+    auto p1 = op == 0xc5 ? p0 : p[ 1 ];
+
+    f.r = ( ~p0 & 0x80 ) >> 4;
+    f.vvvv = ( ~p1 >> 3 ) & 0xf;
+    prefix = p1 & 3;
+    map = 1;
+
+    if( op == 0xc5 ) {
+      f.encoding = Encoding::vex;
+      f.width = p1 & 4 ? 32 : 16;
+    }
+    else {
+      f.x = ( ~p0 & 0x40 ) >> 3;
+      f.b = ( ~p0 & 0x20 ) >> 2;
+      f.w = p1 & 0x80;
+      map = op == 0x62 ? p0 & 3 : p0 & 0x1f;
+
+      if( op == 0xc4 ) {
+        f.encoding = Encoding::vex;
+        f.width = p1 & 4 ? 32 : 16;
+      }
+      else {
+        auto p2 = p[ 2 ];
+
+        // zeroing without a mask is undefined
+        if( ( p0 & 0x0c ) != 0 || ( p1 & 0x04 ) == 0 || ( p2 & 0x60 ) == 0x60 ||
+            ( p2 & 0x87 ) == 0x80 ) {
+          return 0;
+        }
+
+        f.encoding = Encoding::evex;
+        f.r |= ~p0 & 0x10;
+        f.vvvv |= ( ~p2 & 0x08 ) << 1;
+        f.width = 16 << ( ( p2 >> 5 ) & 3 );
+        f.broadcast = p2 & 0x10;
+        ins.mask = Mask( static_cast< KReg >( p2 & 7 ), p2 & 0x80 );
+      }
+    }
+
+    if( map < 1 || 3 < map ) {
+      return 0;
+    }
+
+    p += n - 1;
+    op = *p++;
+  }
+  else if( op == 0x0f ) {
+    if( p == end ) {
+      return 0;
+    }
+
+    map = 1;
+    op = *p++;
+
+    if( op == 0x38 || op == 0x3a ) {
+      if( p == end ) {
+        return 0;
+      }
+
+      map = op == 0x38 ? 2 : 3;
+      op = *p++;
+    }
+  }
+
+  auto k = key( f.encoding, map, prefix, op );
+
+  if( t.first[ k ] == t.first[ k + 1 ] && f.encoding == Encoding::legacy && prefix ) {
+    // the prefix isn't part of this opcode: F2 and F3 repeat, 66 changes the operand size
+    k = key( f.encoding, map, 0, op );
+    ins.rep = repeat == 0xf3;
+    ins.repne = repeat == 0xf2;
+  }
+  else if( prefix == 1 && f.encoding == Encoding::legacy ) {
+    f.operandSize = false;
+  }
+
+  auto first = t.first[ k ];
+  auto last = t.first[ k + 1 ];
+
+  if( first == last ) {
+    return 0;
+  }
+
+  if( t.defs[ first ].modRm ) {
+    p = readModRm( p, end, f );
+    if( !p ) {
+      return 0;
+    }
+  }
+
+  const Def* def = nullptr;
+  const char* name = nullptr;
+
+  for( auto d = first; d < last && !def; d++ ) {
+    auto& candidate = t.defs[ d ];
+
+    name = f.w && candidate.nameW1 ? candidate.nameW1 : candidate.name;
+
+    if( name && ( candidate.reg < 0 || candidate.reg == ( f.reg & 7 ) ) &&
+        ( candidate.mod != 1 || f.mod != 3 ) && ( candidate.mod != 2 || f.mod == 3 ) ) {
+      def = &candidate;
+    }
+  }
+
+  if( !def || ( f.broadcast && f.mod == 3 ) ) {
+    return 0;
+  }
+
+  ins.mnemonic = name;
+
+  // 90 is nop unless REX.B or 66 makes it an exchange
+  if( map == 0 && op == 0x90 && def->specs[ 0 ] == Spec::Zv && !f.b && !f.operandSize ) {
+    ins.mnemonic = "nop";
+    def = nullptr;
+  }
+
+  uint8_t v = f.w ? 8 : f.operandSize ? 2 : 4;    // the operand size
+  uint8_t y = f.w ? 8 : 4;
+  uint8_t q = f.operandSize ? 2 : 8;               // operands that default to 64 bits
+  auto vex = f.encoding != Encoding::legacy;
+  auto element = f.w ? 8 : 4;
+
+  for( auto s = 0; def && s < 4 && def->specs[ s ] != Spec::none; s++ ) {
+    switch( def->specs[ s ] ) {
+    case Spec::Eb: addRm( ins, f, 1 ); break;
+    case Spec::Ew: addRm( ins, f, 2 ); break;
+    case Spec::Ed: addRm( ins, f, 4 ); break;
+    case Spec::Ev: addRm( ins, f, v ); break;
+    case Spec::Ey: addRm( ins, f, y ); break;
+    case Spec::Eq: addRm( ins, f, q ); break;
+    case Spec::Gb: addRegister( ins, f, f.reg, 1 ); break;
+    case Spec::Gw: addRegister( ins, f, f.reg, 2 ); break;
+    case Spec::Gd: addRegister( ins, f, f.reg, 4 ); break;
+    case Spec::Gv: addRegister( ins, f, f.reg, v ); break;
+    case Spec::Gy: addRegister( ins, f, f.reg, y ); break;
+
+    case Spec::M:
+    case Spec::Mb:
+    case Spec::My:
+    case Spec::Mx:
+    case Spec::Mdq: {
+      if( f.mod == 3 ) {
+        return 0;
+      }
+
+      auto spec = def->specs[ s ];
+      addMemory( ins, f, spec == Spec::Mb ? 1 : spec == Spec::My ? y :
+                         spec == Spec::Mx ? f.width : spec == Spec::Mdq ? 2 * y : 0 );
+      break;
+    }
+
+    case Spec::Ry: addRegister( ins, f, f.rm, y ); break;
+    case Spec::Zb: addRegister( ins, f, ( op & 7 ) | f.b, 1 ); break;
+    case Spec::Zv: addRegister( ins, f, ( op & 7 ) | f.b, v ); break;
+    case Spec::Zq: addRegister( ins, f, ( op & 7 ) | f.b, q ); break;
+
+    case Spec::Ib: p = addImmediate( ins, p, end, 1, 1, false ); break;
+    case Spec::Ibs: p = addImmediate( ins, p, end, 1, v, true ); break;
+    case Spec::Ibq: p = addImmediate( ins, p, end, 1, q, true ); break;
+    case Spec::Iw: p = addImmediate( ins, p, end, 2, 2, false ); break;
+    case Spec::Iz: p = addImmediate( ins, p, end, v == 2 ? 2 : 4, v, true ); break;
+    case Spec::Izq: p = addImmediate( ins, p, end, q == 2 ? 2 : 4, q, true ); break;
+    case Spec::Iv: p = addImmediate( ins, p, end, v, v, false ); break;
+    case Spec::One: addOperand( ins, DecodedKind::imm, 0 ).value = 1; break;
+
+    case Spec::AL: addRegister( ins, f, 0, 1 ); break;
+    case Spec::CL: addRegister( ins, f, 1, 1 ); break;
+    case Spec::rAX: addRegister( ins, f, 0, v ); break;
+
+    case Spec::Jb:
+    case Spec::Jz: {
+      int64_t disp = 0;
+
+      p = readBytes( p, end, def->specs[ s ] == Spec::Jb ? 1 : 4, disp );
+      addOperand( ins, DecodedKind::rel, 8 ).value = disp;
+      break;
+    }
+
+    case Spec::Xb: addString( ins, f, Register::rsi, 0x3e, 1 ); break;
+    case Spec::Xv: addString( ins, f, Register::rsi, 0x3e, v ); break;
+    case Spec::Yb: addString( ins, f, Register::rdi, 0x26, 1 ); break;
+    case Spec::Yv: addString( ins, f, Register::rdi, 0x26, v ); break;
+
+    case Spec::Vx: addVector( ins, f.reg, f.width ); break;
+    case Spec::Vdq: addVector( ins, f.reg, 16 ); break;
+
+    case Spec::Wx:
+      if( f.broadcast ) {
+        addMemory( ins, f, element );
+        ins.operands[ ins.count - 1 ].broadcast = f.width / element;
+      }
+      else {
+        addVectorRm( ins, f, f.width, f.width );
+      }
+      break;
+
+    case Spec::Wss: addVectorRm( ins, f, 16, 4 ); break;
+    case Spec::Wsd: addVectorRm( ins, f, 16, 8 ); break;
+    case Spec::Wsy: addVectorRm( ins, f, 16, y ); break;
+    case Spec::Wh: addVectorRm( ins, f, max( f.width / 2, 16 ), f.width / 2 ); break;
+
+    case Spec::Ux:
+      if( f.mod != 3 ) {
+        return 0;
+      }
+      addVector( ins, f.rm, f.width );
+      break;
+
+    case Spec::Hx:
+      if( vex ) {
+        addVector( ins, f.vvvv, f.width );
+      }
+      break;
+
+    case Spec::Hdq:
+      if( vex ) {
+        addVector( ins, f.vvvv, 16 );
+      }
+      break;
+
+    case Spec::Hr:
+      if( vex && f.mod == 3 ) {
+        addVector( ins, f.vvvv, 16 );
+      }
+      break;
+
+    case Spec::Lx: {
+      int64_t is4 = 0;
+
+      p = readBytes( p, end, 1, is4 );
+      addVector( ins, ( is4 >> 4 ) & 0xf, f.width );
+      break;
+    }
+
+    case Spec::X0: addVector( ins, 0, 16 ); break;
+    case Spec::By: addRegister( ins, f, f.vvvv, y ); break;
+    case Spec::KV: addOperand( ins, DecodedKind::k, 8 ).reg = f.reg & 7; break;
+    case Spec::KE: addOperand( ins, DecodedKind::k, 8 ).reg = f.rm & 7; break;
+
+    case Spec::none:
+      break;
+    }
+
+    if( !p ) {
+      return 0;
+    }
+  }
+
+  // a broadcast needs a full vector memory operand to apply to
+  if( f.broadcast ) {
+    auto found = false;
+
+    for( auto o = 0; o < ins.count; o++ ) {
+      found = found || ins.operands[ o ].broadcast;
+    }
+
+    if( !found ) {
+      return 0;
+    }
+  }
+
+  ins.length = static_cast< uint8_t >( p - code );
+
+  for( auto o = 0; o < ins.count; o++ ) {
+    if( ins.operands[ o ].kind == DecodedKind::rel ) {
+      ins.operands[ o ].value += ins.length;
+    }
+  }
+
+  return ins.length;
+}
+
+// ----------------------------------------------------------------------
+// Text
+
+static const char* const registerNames[][ 16 ] = {
+  { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" },
+  { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+    "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" },
+  { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" },
+  { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" }
+};
+
+static const char* const highByteNames[] = { "ah", "ch", "dh", "bh" };
+
+// the predicates of cmpps and the rest, which objdump folds into the mnemonic; the
+// legacy forms have the first 8
+static const char* const predicates[] = {
+  "eq", "lt", "le", "unord", "neq", "nlt", "nle", "ord",
+  "eq_uq", "nge", "ngt", "false", "neq_oq", "ge", "gt", "true",
+  "eq_os", "lt_oq", "le_oq", "unord_s", "neq_us", "nlt_uq", "nle_uq", "ord_s",
+  "eq_us", "nge_uq", "ngt_uq", "false_os", "neq_os", "ge_oq", "gt_oq", "true_us"
+};
+
+static void
+hex( ostream& out, uint64_t value ) {
+  out << "0x" << std::hex << value << std::dec;
+}
+
+static const char*
+memorySize( uint8_t size, const char* mnemonic ) {
+  switch( size ) {
+  case 1: return "BYTE";
+  case 2: return "WORD";
+  case 4: return "DWORD";
+  case 8: return "QWORD";
+  case 16: return strcmp( mnemonic, "cmpxchg16b" ) == 0 ? "OWORD" : "XMMWORD";
+  case 32: return "YMMWORD";
+  case 64: return "ZMMWORD";
+  default: return nullptr;
+  }
+}
+
+static void
+formatOperand( ostream& out, const Instruction& ins, const DecodedOperand& op,
+               size_t address ) {
+  switch( op.kind ) {
+  case DecodedKind::reg:
+    if( op.highByte ) {
+      out << highByteNames[ op.reg - 4 ];
+    }
+    else {
+      out << registerNames[ op.size == 1 ? 0 : op.size == 2 ? 1 : op.size == 4 ? 2 : 3 ]
+                          [ op.reg ];
+    }
+    break;
+
+  case DecodedKind::xmm:
+    out << "xmm" << int( op.reg );
+    break;
+
+  case DecodedKind::ymm:
+    out << "ymm" << int( op.reg );
+    break;
+
+  case DecodedKind::zmm:
+    out << "zmm" << int( op.reg );
+    break;
+
+  case DecodedKind::k:
+    out << "k" << int( op.reg );
+    break;
+
+  case DecodedKind::mem: {
+    auto size = memorySize( op.size, ins.mnemonic );
+    auto& mem = op.mem;
+
+    if( size ) {
+      out << size << ( op.broadcast ? " BCST " : " PTR " );
+    }
+
+    if( op.segment ) {
+      static const char* const segments[] = { "es", "cs", "ss", "ds" };
+      out << ( op.segment == 0x64 ? "fs" : op.segment == 0x65 ? "gs"
+                                         : segments[ ( op.segment >> 3 ) & 3 ] ) << ":";
+    }
+
+    if( !mem.hasBase && !mem.hasIndex && !mem.rip ) {
+      hex( out, static_cast< uint32_t >( mem.disp ) );
+      break;
+    }
+
+    out << "[";
+
+    if( mem.rip ) {
+      out << "rip";
+    }
+    else if( mem.hasBase ) {
+      out << registerNames[ 3 ][ static_cast< int >( mem.base ) ];
+    }
+
+    if( mem.hasIndex ) {
+      out << ( mem.hasBase ? "+" : "" ) << registerNames[ 3 ][ static_cast< int >( mem.index ) ]
+          << "*" << ( 1 << static_cast< int >( mem.scale ) );
+    }
+
+    // objdump shows a negative RIP relative displacement as its 64 bit two's complement
+    if( op.dispBytes && ( mem.rip || 0 <= mem.disp ) ) {
+      out << "+";
+      hex( out, static_cast< int64_t >( mem.disp ) );
+    }
+    else if( op.dispBytes ) {
+      out << "-";
+      hex( out, -static_cast< int64_t >( mem.disp ) );
+    }
+
+    out << "]";
+    break;
+  }
+
+  case DecodedKind::imm:
+    if( op.size == 0 ) {
+      out << op.value;
+    }
+    else {
+      hex( out, op.size == 8 ? op.value : op.value & ( ( int64_t( 1 ) << ( 8 * op.size ) ) - 1 ) );
+    }
+    break;
+
+  case DecodedKind::rel:
+    hex( out, address + op.value );
+    break;
+
+  case DecodedKind::none:
+    break;
+  }
+}
+
+string
+format( const Instruction& ins, size_t address ) {
+  ostringstream out;
+  string mnemonic;
+  auto count = ins.count;
+
+  if( ins.lock ) {
+    mnemonic = "lock ";
+  }
+
+  if( ins.rep || ins.repne ) {
+    auto move = strcmp( ins.mnemonic, "movs" ) == 0 || strcmp( ins.mnemonic, "stos" ) == 0 ||
+                strcmp( ins.mnemonic, "lods" ) == 0;
+    mnemonic += ins.repne ? "repnz " : move ? "rep " : "repz ";
+  }
+
+  // cmppd xmm1, xmm2, 1 is cmpltpd xmm1, xmm2
+  auto vex = ins.mnemonic[ 0 ] == 'v';
+  auto& last = ins.operands[ count ? count - 1 : 0 ];
+
+  if( strlen( ins.mnemonic ) == 5u + vex && strncmp( ins.mnemonic + vex, "cmp", 3 ) == 0 &&
+      last.kind == DecodedKind::imm && last.value < ( vex ? 32 : 8 ) ) {
+    mnemonic += string( ins.mnemonic, 3 + vex ) + predicates[ last.value ] +
+                ( ins.mnemonic + 3 + vex );
+    count--;
+  }
+  else {
+    mnemonic += ins.mnemonic;
+  }
+
+  out << mnemonic;
+
+  if( count ) {
+    out << string( mnemonic.size() < 6 ? 6 - mnemonic.size() : 0, ' ' ) << " ";
+  }
+
+  auto rip = false;
+  int32_t disp = 0;
+
+  for( auto o = 0; o < count; o++ ) {
+    auto& op = ins.operands[ o ];
+
+    if( o ) {
+      out << ",";
+    }
+
+    formatOperand( out, ins, op, address );
+
+    if( o == 0 && ins.mask.k != KReg::k0 ) {
+      out << "{k" << static_cast< int >( ins.mask.k ) << "}";
+    }
+
+    if( o == 0 && ins.mask.zero ) {
+      out << "{z}";
+    }
+
+    if( op.kind == DecodedKind::mem && op.mem.rip ) {
+      rip = true;
+      disp = op.mem.disp;
+    }
+  }
+
+  if( rip ) {
+    out << "        # ";
+    hex( out, address + ins.length + disp );
+  }
+
+  return out.str();
+}
+
+void
+disassemble( const Code& code, ostream& out ) {
+  auto size = code.poolOffset();
+
+  // objdump's address width: the digits of the end address, plus one, rounded up to a
+  // multiple of 4
+  auto digits = 1;
+  while( digits < 16 && ( size >> ( 4 * digits ) ) != 0 ) {
+    digits++;
+  }
+  digits = ( digits / 4 + 1 ) * 4;
+
+  Instruction ins;
+
+  for( size_t at = 0; at < size; ) {
+    auto length = decode( code.data() + at, size - at, ins );
+
+    for( size_t line = 0; line < max< size_t >( length, 1 ); line += 7 ) {
+      ostringstream bytes;
+
+      for( auto i = line; i < min< size_t >( max< size_t >( length, 1 ), line + 7 ); i++ ) {
+        bytes << std::hex << setw( 2 ) << setfill( '0' ) << int( code[ at + i ] ) << " ";
+      }
+
+      out << std::hex << setw( digits ) << setfill( ' ' ) << at + line << std::dec << ":\t";
+
+      if( line == 0 ) {
+        out << left << setw( 21 ) << bytes.str() << right << "\t"
+            << ( length ? format( ins, at ) : "(bad)" );
+      }
+      else {
+        out << bytes.str();
+      }
+
+      out << "\n";
+    }
+
+    at += max< size_t >( length, 1 );
+  }
+}
+
+size_t
+verifyDecodes( const Code& code ) {
+  auto data = code.dataRanges();
+  size_t count = 0;
+  Instruction ins;
+
+  sort( data.begin(), data.end() );
+  data.emplace_back( code.size(), code.size() );
+
+  size_t at = 0;
+
+  // decode up to each range of data, which no instruction may run into, then skip it
+  for( auto& range : data ) {
+    for( ; at < range.first; count++ ) {
+      auto length = decode( code.data() + at, range.first - at, ins );
+
+      if( length == 0 ) {
+        throw "generated code doesn't decode";
+      }
+
+      at += length;
+    }
+
+    at = max( at, range.second );
+  }
+
+  return count;
+}
@@ -0,0 +1,93 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef DECODER_HH
+#define DECODER_HH
+
+#include "myAsm.hh"
+
+#include <ostream>
+#include <string>
+
+enum struct DecodedKind : uint8_t {
+  none = 0,
+  reg,      // a general register
+  xmm,
+  ymm,
+  zmm,
+  k,        // an AVX-512 opmask register
+  mem,
+  imm,
+  rel       // a branch target
+};
+
+// One operand of a decoded instruction. Registers are numbered the way the encoders
+// number them. size is in bytes: the width of a register, of the data a memory operand
+// reads or writes, or of the operand an immediate is extended to. It is 0 for a memory
+// operand that isn't accessed as data, like lea's or prefetch's.
+struct DecodedOperand {
+  DecodedKind kind = DecodedKind::none;
+  uint8_t size = 0;
+  uint8_t reg = 0;
+  bool highByte = false;   // ah, ch, dh or bh rather than spl, bpl, sil or dil
+  uint8_t dispBytes = 0;   // how the displacement of mem was encoded: 0, 1 or 4
+  uint8_t broadcast = 0;   // {1toN}: how many lanes the one element of mem goes to
+  uint8_t segment = 0;     // a segment override or implied segment: 0x26 es ... 0x65 gs
+  Mem mem{ Register::r0 };  // only meaningful for mem
+
+  // an immediate, sign extended when the encoding extends it; for a branch the target
+  // as an offset from the start of the instruction
+  int64_t value = 0;
+};
+
+// A decoded instruction. mnemonic is the Intel name; a predicate of cmpps and friends
+// stays an immediate, and string ops are movs, stos, lods, cmps and scas with explicit
+// operands, as objdump shows them.
+struct Instruction {
+  const char* mnemonic = nullptr;
+  uint8_t length = 0;
+  uint8_t count = 0;       // operands in use
+  bool lock = false;
+  bool rep = false;        // an F3 the opcode didn't use
+  bool repne = false;      // an F2 the opcode didn't use
+  Mask mask;               // the opmask of an EVEX instruction
+  DecodedOperand operands[ 4 ];
+};
+
+// Decode the instruction at code, with size bytes readable. Covers every instruction
+// the make* encoders produce, and the integer, SSE, AVX and AVX-512 instructions around
+// them. Returns the length, or 0 when the bytes aren't an instruction the decoder knows
+// or run past size. Nothing is allocated.
+size_t
+decode( const uint8_t* code, size_t size, Instruction& ins );
+
+// Intel syntax as objdump -M intel prints it; address is where the instruction starts,
+// for branch and RIP relative targets
+string
+format( const Instruction& ins, size_t address = 0 );
+
+// an objdump style listing of the code before the constant pool
+void
+disassemble( const Code& code, ostream& out );
+
+// Decode everything but the code's data ranges, its constant pools and their padding, and
+// throw when some of it doesn't decode. CodeHeap and DualMappedRegion run this on each
+// function when NDEBUG isn't defined. Returns the number of instructions.
+size_t
+verifyDecodes( const Code& code );
+
+#endif
@@ -0,0 +1,315 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "elfObject.hh"
+
+#include <cstring>
+#include <elf.h>
+
+Label
+ObjectFunction::reference( map< string, Label >& labels, const string& symbol ) {
+  auto found = labels.find( symbol );
+
+  if( found != labels.end() ) {
+    return found->second;
+  }
+
+  auto label = code.newLabel();
+  labels.emplace( symbol, label );
+
+  return label;
+}
+
+size_t
+ObjectFunction::call( const string& symbol ) {
+  return makeCall( reference( calls, symbol ), code );
+}
+
+Mem
+ObjectFunction::address( const string& symbol, int32_t disp ) {
+  return Mem{ reference( addresses, symbol ), disp };
+}
+
+// mov destination, [rip + symbol@GOTPCREL], with the REX.W 8B form the linker can relax
+size_t
+ObjectFunction::load( Register destination, const string& symbol ) {
+  return makeMov( destination, Mem{ reference( loads, symbol ) }, code );
+}
+
+static size_t
+roundUp( size_t value, size_t to ) {
+  return ( value + to - 1 ) / to * to;
+}
+
+void
+ElfObject::add( const string& name, ObjectFunction& function, bool global ) {
+  for( auto& s : symbols ) {
+    if( s.name == name ) {
+      throw "function added to an ElfObject twice";
+    }
+  }
+
+  auto& code = function.code;
+
+  // The stand-in labels only need to be bound for resolve(); the displacements it puts
+  // in their place are replaced by relocations.
+  map< size_t, pair< string, uint32_t > > external;
+
+  for( auto& c : function.calls ) {
+    external[ c.second.id ] = { c.first, R_X86_64_PLT32 };
+  }
+  for( auto& a : function.addresses ) {
+    external[ a.second.id ] = { a.first, R_X86_64_PC32 };
+  }
+  for( auto& l : function.loads ) {
+    external[ l.second.id ] = { l.first, R_X86_64_REX_GOTPCRELX };
+  }
+
+  for( auto& e : external ) {
+    if( !code.isBound( Label{ e.first } ) ) {
+      code.bind( Label{ e.first } );
+    }
+  }
+
+  // the end of the code, which resolve() may move, and the int3 padding before the
+  // pool follows
+  auto end = code.newLabel();
+  code.bind( end );
+
+  code.resolve();
+
+  makeNop( ( 16 - text.size() % 16 ) % 16, text );
+
+  auto start = text.size();
+  auto length = code.offset( end );
+  auto pool = code.poolOffset();
+  auto rodataStart = roundUp( rodata.size(), 16 );
+
+  text.append( code.data(), length );
+  rodata.resize( rodataStart );
+  rodata.insert( rodata.end(), code.begin() + pool, code.end() );
+
+  for( auto& f : code.references() ) {
+    auto field = start + f.start + f.field;
+    int64_t addend = f.addend - static_cast< int64_t >( f.length - f.field );
+    auto e = external.find( f.label );
+
+    if( e != external.end() ) {
+      if( f.width != 4 ) {
+        throw "a reference to another symbol needs a 32 bit displacement";
+      }
+
+      relocations.push_back( { field, e->second.second, e->second.first, addend } );
+    }
+    else {
+      auto target = code.offset( Label{ f.label } );
+
+      // a label in the code itself keeps its distance from the reference
+      if( target < pool || code.size() <= target ) {
+        continue;
+      }
+
+      relocations.push_back( { field, R_X86_64_PC32, "",
+                               addend + static_cast< int64_t >( rodataStart + target - pool ) } );
+    }
+
+    memset( text.data() + field, 0, 4 );
+  }
+
+  symbols.push_back( { name, global, start, length } );
+}
+
+// ----------------------------------------------------------------------
+// Writing the object
+
+namespace {
+
+enum Section {
+  textSection = 1,
+  rodataSection,
+  relaSection,
+  symtabSection,
+  strtabSection,
+  shstrtabSection,
+  noteSection,
+  sectionCount
+};
+
+// the symbol table starts with the null symbol, then .text's and .rodata's, the latter
+// for relocations into the pools
+const size_t rodataSymbol = 2;
+
+template< typename T >
+void
+append( vector< uint8_t >& bytes, const T& value ) {
+  auto p = reinterpret_cast< const uint8_t* >( &value );
+  bytes.insert( bytes.end(), p, p + sizeof( value ) );
+}
+
+// add a string to a string table and return its offset
+uint32_t
+addString( vector< uint8_t >& table, const string& s ) {
+  auto offset = table.size();
+  table.insert( table.end(), s.begin(), s.end() );
+  table.push_back( 0 );
+
+  return offset;
+}
+
+}
+
+void
+ElfObject::write( ostream& out ) const {
+  vector< uint8_t > strtab{ 0 };
+  vector< uint8_t > symtab;
+  map< string, size_t > index;
+
+  Elf64_Sym null{};
+  Elf64_Sym section{};
+  section.st_info = ELF64_ST_INFO( STB_LOCAL, STT_SECTION );
+
+  append( symtab, null );
+  section.st_shndx = textSection;
+  append( symtab, section );
+  section.st_shndx = rodataSection;
+  append( symtab, section );
+
+  // locals have to come before globals
+  auto count = rodataSymbol + 1;
+  size_t firstGlobal = 0;
+
+  for( auto global : { false, true } ) {
+    if( global ) {
+      firstGlobal = count;
+    }
+
+    for( auto& s : symbols ) {
+      if( s.global != global ) {
+        continue;
+      }
+
+      Elf64_Sym symbol{};
+      symbol.st_name = addString( strtab, s.name );
+      symbol.st_info = ELF64_ST_INFO( global ? STB_GLOBAL : STB_LOCAL, STT_FUNC );
+      symbol.st_shndx = textSection;
+      symbol.st_value = s.offset;
+      symbol.st_size = s.size;
+
+      append( symtab, symbol );
+      index[ s.name ] = count++;
+    }
+  }
+
+  vector< uint8_t > rela;
+
+  for( auto& r : relocations ) {
+    auto symbol = rodataSymbol;
+
+    if( !r.symbol.empty() ) {
+      auto found = index.find( r.symbol );
+
+      if( found == index.end() ) {
+        Elf64_Sym undefined{};
+        undefined.st_name = addString( strtab, r.symbol );
+        undefined.st_info = ELF64_ST_INFO( STB_GLOBAL, STT_NOTYPE );
+        undefined.st_shndx = SHN_UNDEF;
+
+        append( symtab, undefined );
+        found = index.emplace( r.symbol, count++ ).first;
+      }
+
+      symbol = found->second;
+    }
+
+    Elf64_Rela entry{};
+    entry.r_offset = r.offset;
+    entry.r_info = ELF64_R_INFO( symbol, r.type );
+    entry.r_addend = r.addend;
+
+    append( rela, entry );
+  }
+
+  vector< uint8_t > shstrtab{ 0 };
+  Elf64_Shdr headers[ sectionCount ] = {};
+
+  auto describe = [ & ]( Section s, const char* name, uint32_t type, uint64_t flags,
+                         uint64_t alignment ) {
+    headers[ s ].sh_name = addString( shstrtab, name );
+    headers[ s ].sh_type = type;
+    headers[ s ].sh_flags = flags;
+    headers[ s ].sh_addralign = alignment;
+  };
+
+  describe( textSection, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16 );
+  describe( rodataSection, ".rodata", SHT_PROGBITS, SHF_ALLOC, 16 );
+  describe( relaSection, ".rela.text", SHT_RELA, SHF_INFO_LINK, 8 );
+  describe( symtabSection, ".symtab", SHT_SYMTAB, 0, 8 );
+  describe( strtabSection, ".strtab", SHT_STRTAB, 0, 1 );
+  describe( shstrtabSection, ".shstrtab", SHT_STRTAB, 0, 1 );
+  // no executable stack needed
+  describe( noteSection, ".note.GNU-stack", SHT_PROGBITS, 0, 1 );
+
+  headers[ relaSection ].sh_link = symtabSection;
+  headers[ relaSection ].sh_info = textSection;
+  headers[ relaSection ].sh_entsize = sizeof( Elf64_Rela );
+  headers[ symtabSection ].sh_link = strtabSection;
+  headers[ symtabSection ].sh_info = firstGlobal;
+  headers[ symtabSection ].sh_entsize = sizeof( Elf64_Sym );
+
+  // the file header, each section's contents, then the section headers
+  vector< uint8_t > file( sizeof( Elf64_Ehdr ) );
+
+  auto place = [ & ]( Section s, const uint8_t* data, size_t size ) {
+    file.resize( roundUp( file.size(), headers[ s ].sh_addralign ) );
+    headers[ s ].sh_offset = file.size();
+    headers[ s ].sh_size = size;
+    file.insert( file.end(), data, data + size );
+  };
+
+  place( textSection, text.data(), text.size() );
+  place( rodataSection, rodata.data(), rodata.size() );
+  place( relaSection, rela.data(), rela.size() );
+  place( symtabSection, symtab.data(), symtab.size() );
+  place( strtabSection, strtab.data(), strtab.size() );
+  place( shstrtabSection, shstrtab.data(), shstrtab.size() );
+  place( noteSection, nullptr, 0 );
+
+  file.resize( roundUp( file.size(), 8 ) );
+
+  Elf64_Ehdr header{};
+  memcpy( header.e_ident, ELFMAG, SELFMAG );
+  header.e_ident[ EI_CLASS ] = ELFCLASS64;
+  header.e_ident[ EI_DATA ] = ELFDATA2LSB;
+  header.e_ident[ EI_VERSION ] = EV_CURRENT;
+  header.e_ident[ EI_OSABI ] = ELFOSABI_SYSV;
+  header.e_type = ET_REL;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_shoff = file.size();
+  header.e_ehsize = sizeof( Elf64_Ehdr );
+  header.e_shentsize = sizeof( Elf64_Shdr );
+  header.e_shnum = sectionCount;
+  header.e_shstrndx = shstrtabSection;
+
+  memcpy( file.data(), &header, sizeof( header ) );
+
+  for( auto& h : headers ) {
+    append( file, h );
+  }
+
+  out.write( reinterpret_cast< const char* >( file.data() ), file.size() );
+}
@@ -0,0 +1,100 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef ELFOBJECT_HH
+#define ELFOBJECT_HH
+
+#include "myAsm.hh"
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The buffer one function of an ElfObject is generated into. References to other symbols
+// go through call(), address() and load(), since where those end up is for the linker to
+// decide. Leave resolving code to ElfObject::add().
+class ObjectFunction {
+public:
+  Code code;
+
+  // call the function named symbol, defined in this object or elsewhere
+  size_t
+  call( const string& symbol );
+
+  // a RIP relative operand for the data at symbol + disp, which must end up in the same
+  // executable or shared library as this code
+  Mem
+  address( const string& symbol, int32_t disp = 0 );
+
+  // load the address of symbol from the global offset table, for data that may be in
+  // another shared library
+  size_t
+  load( Register destination, const string& symbol );
+
+private:
+  friend class ElfObject;
+
+  Label
+  reference( map< string, Label >& labels, const string& symbol );
+
+  // a label for each symbol referenced, standing in for it until add()
+  map< string, Label > calls;
+  map< string, Label > addresses;
+  map< string, Label > loads;
+};
+
+// An x86-64 ELF relocatable object built from generated functions, to be linked ahead of
+// time like anything a compiler produces. Functions are laid out one after another in
+// .text, each at a multiple of 16 and padded with nops, and their constant pools go in
+// .rodata. A call through ObjectFunction::call() gets an R_X86_64_PLT32 relocation, a
+// reference through address() or to a pool constant an R_X86_64_PC32, and a load() an
+// R_X86_64_REX_GOTPCRELX, which the linker turns into a lea when the symbol is local.
+// PC32 can't reach data in another shared library, so linking with -shared needs
+// load() for anything the object doesn't define. Symbols referenced but not added are
+// left undefined.
+class ElfObject {
+public:
+  // resolve function's code and add it as name, visible outside the object when global
+  void
+  add( const string& name, ObjectFunction& function, bool global = true );
+
+  void
+  write( ostream& out ) const;
+
+private:
+  struct Symbol {
+    string name;
+    bool global;
+    size_t offset;   // in .text
+    size_t size;
+  };
+
+  struct Relocation {
+    size_t offset;   // in .text
+    uint32_t type;
+    string symbol;   // empty for .rodata
+    int64_t addend;
+  };
+
+  Code text;
+  vector< uint8_t > rodata;
+  vector< Symbol > symbols;
+  vector< Relocation > relocations;
+};
+
+#endif
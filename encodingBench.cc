@@ -0,0 +1,303 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "encodingBench.hh"
+#include "myAsm.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+// ----------------------------------------------------------------------
+// Allocation counting
+
+// Every operator new in the program goes through here once this file is linked in; the
+// array forms and the nothrow forms default to calling these.
+static atomic< size_t > allocations{ 0 };
+
+void*
+operator new( size_t size ) {
+  allocations.fetch_add( 1, memory_order_relaxed );
+
+  if( auto p = malloc( size ? size : 1 ) ) {
+    return p;
+  }
+
+  throw bad_alloc{};
+}
+
+void
+operator delete( void* p ) noexcept {
+  free( p );
+}
+
+void
+operator delete( void* p, size_t ) noexcept {
+  free( p );
+}
+
+// ----------------------------------------------------------------------
+// Families
+
+namespace {
+
+const BasicOpClass basicOps[] = {
+  BasicOpClass::_add, BasicOpClass::_or, BasicOpClass::_adc, BasicOpClass::_sbb,
+  BasicOpClass::_and, BasicOpClass::_sub, BasicOpClass::_xor, BasicOpClass::_cmp
+};
+
+const OpSize sizes[] = { OpSize::b8, OpSize::b16, OpSize::b32, OpSize::b64 };
+
+const ShiftOp shiftOps[] = { ShiftOp::left, ShiftOp::right };
+
+Register
+reg( int r ) {
+  return static_cast< Register >( r );
+}
+
+XmmReg
+xmm( int r ) {
+  return static_cast< XmmReg >( r );
+}
+
+// a base, an index and a disp8 for every base; rsp can't be an index
+Mem
+mem( int r ) {
+  auto index = ( r + 1 ) % 16;
+  return Mem{ reg( r ), reg( index == 4 ? 5 : index ), Scale::x4, 0x40 };
+}
+
+// One sweep of a family emits every combination into code and returns how many
+// instructions that was.
+struct Family {
+  const char* name;
+  size_t (*sweep)( Code& code );
+};
+
+const Family families[] = {
+  { "basic r, imm", []( Code& code ) -> size_t {
+    for( auto op : basicOps ) {
+      for( auto size : sizes ) {
+        for( auto d = 0; d < 16; d++ ) {
+          makeBasicIns( op, reg( d ), 0x12345678, code, size );
+        }
+      }
+    }
+    return 8 * 4 * 16;
+  } },
+  { "basic m, imm", []( Code& code ) -> size_t {
+    for( auto op : basicOps ) {
+      for( auto size : sizes ) {
+        for( auto d = 0; d < 16; d++ ) {
+          makeBasicIns( op, mem( d ), 0x12345678, code, size );
+        }
+      }
+    }
+    return 8 * 4 * 16;
+  } },
+  { "basic r, r", []( Code& code ) -> size_t {
+    for( auto op : basicOps ) {
+      for( auto size : sizes ) {
+        for( auto d = 0; d < 16; d++ ) {
+          for( auto s = 0; s < 16; s++ ) {
+            makeBasicIns( op, reg( d ), reg( s ), code, size );
+          }
+        }
+      }
+    }
+    return 8 * 4 * 16 * 16;
+  } },
+  { "basic m, r", []( Code& code ) -> size_t {
+    for( auto op : basicOps ) {
+      for( auto size : sizes ) {
+        for( auto d = 0; d < 16; d++ ) {
+          for( auto s = 0; s < 16; s++ ) {
+            makeBasicIns( op, mem( d ), reg( s ), code, size );
+          }
+        }
+      }
+    }
+    return 8 * 4 * 16 * 16;
+  } },
+  { "basic r, m", []( Code& code ) -> size_t {
+    for( auto op : basicOps ) {
+      for( auto size : sizes ) {
+        for( auto d = 0; d < 16; d++ ) {
+          for( auto s = 0; s < 16; s++ ) {
+            makeBasicIns( op, reg( d ), mem( s ), code, size );
+          }
+        }
+      }
+    }
+    return 8 * 4 * 16 * 16;
+  } },
+  { "mul r", []( Code& code ) -> size_t {
+    for( auto size : sizes ) {
+      for( auto s = 0; s < 16; s++ ) {
+        makeMul( reg( s ), code, size );
+        makeMul( mem( s ), code, size );
+      }
+    }
+    return 4 * 16 * 2;
+  } },
+  { "mul r, r", []( Code& code ) -> size_t {
+    for( auto d = 0; d < 16; d++ ) {
+      for( auto s = 0; s < 16; s++ ) {
+        makeMul( reg( d ), reg( s ), code );
+        makeMul( reg( d ), reg( s ), 0x12345678, code );
+        makeMul( reg( d ), mem( s ), code );
+        makeMul( reg( d ), mem( s ), 0x12345678, code );
+      }
+    }
+    return 16 * 16 * 4;
+  } },
+  { "mov r, r", []( Code& code ) -> size_t {
+    for( auto size : sizes ) {
+      for( auto d = 0; d < 16; d++ ) {
+        for( auto s = 0; s < 16; s++ ) {
+          makeMov( reg( d ), reg( s ), code, size );
+        }
+      }
+    }
+    return 4 * 16 * 16;
+  } },
+  { "mov r, m", []( Code& code ) -> size_t {
+    for( auto size : sizes ) {
+      for( auto d = 0; d < 16; d++ ) {
+        for( auto s = 0; s < 16; s++ ) {
+          makeMov( reg( d ), mem( s ), code, size );
+          makeMov( mem( d ), reg( s ), code, size );
+        }
+      }
+    }
+    return 4 * 16 * 16 * 2;
+  } },
+  { "mov r, imm", []( Code& code ) -> size_t {
+    for( auto d = 0; d < 16; d++ ) {
+      makeMov( reg( d ), 0x123456789abcdef0, code );
+      makeMov( reg( d ), 0x12345678, code, OpSize::b32 );
+      makeMov( mem( d ), 0x12345678, code );
+    }
+    return 16 * 3;
+  } },
+  { "shift", []( Code& code ) -> size_t {
+    for( auto op : shiftOps ) {
+      for( auto size : sizes ) {
+        for( auto d = 0; d < 16; d++ ) {
+          makeShift( op, reg( d ), code, size );
+          makeShift( op, reg( d ), 5, code, size );
+          makeShift( op, mem( d ), code, size );
+          makeShift( op, mem( d ), 5, code, size );
+        }
+      }
+    }
+    return 2 * 4 * 16 * 4;
+  } },
+  // the scalar double encoders, which all go through makeSDIns in myAsm.cc
+  { "sd x, x", []( Code& code ) -> size_t {
+    for( auto d = 0; d < 16; d++ ) {
+      for( auto s = 0; s < 16; s++ ) {
+        makeMovSD( xmm( d ), xmm( s ), code );
+        makeAddSD( xmm( d ), xmm( s ), code );
+        makeSubSD( xmm( d ), xmm( s ), code );
+        makeMulSD( xmm( d ), xmm( s ), code );
+        makeDivSD( xmm( d ), xmm( s ), code );
+        makeSqrtSD( xmm( d ), xmm( s ), code );
+        makeMaxSD( xmm( d ), xmm( s ), code );
+        makeMinSD( xmm( d ), xmm( s ), code );
+        makeCmpSD( xmm( d ), xmm( s ), SDcmp::lt, code );
+        makeComiSD( xmm( d ), xmm( s ), code );
+      }
+    }
+    return 16 * 16 * 10;
+  } },
+  { "sd x, m", []( Code& code ) -> size_t {
+    for( auto d = 0; d < 16; d++ ) {
+      for( auto s = 0; s < 16; s++ ) {
+        makeMovSD( xmm( d ), mem( s ), code );
+        makeMovSD( mem( s ), xmm( d ), code );
+        makeAddSD( xmm( d ), mem( s ), code );
+        makeSubSD( xmm( d ), mem( s ), code );
+        makeMulSD( xmm( d ), mem( s ), code );
+        makeDivSD( xmm( d ), mem( s ), code );
+        makeSqrtSD( xmm( d ), mem( s ), code );
+        makeMaxSD( xmm( d ), mem( s ), code );
+        makeMinSD( xmm( d ), mem( s ), code );
+        makeCmpSD( xmm( d ), mem( s ), SDcmp::lt, code );
+        makeComiSD( xmm( d ), mem( s ), code );
+      }
+    }
+    return 16 * 16 * 11;
+  } },
+  { "nop", []( Code& code ) -> size_t {
+    for( auto length = 1; length <= 15; length++ ) {
+      makeNop( length, code );
+    }
+    return 15;
+  } },
+};
+
+}
+
+void
+runEncodingBench( ostream& out, double seconds, int trials ) {
+  using Clock = chrono::steady_clock;
+  Code code;
+
+  for( auto& family : families ) {
+    // one untimed sweep grows code to the size a sweep needs
+    family.sweep( code );
+    code.clear();
+
+    auto best = 0.0;
+    size_t instructions = 0;
+    size_t bytes = 0;
+    size_t allocated = 0;
+
+    for( auto trial = 0; trial < trials; trial++ ) {
+      size_t emitted = 0;
+      size_t written = 0;
+      auto before = allocations.load( memory_order_relaxed );
+      auto start = Clock::now();
+      auto elapsed = 0.0;
+
+      do {
+        emitted += family.sweep( code );
+        written += code.size();
+        code.clear();
+        elapsed = chrono::duration< double >( Clock::now() - start ).count();
+      } while( elapsed < seconds );
+
+      if( trial == 0 || emitted / elapsed > instructions / best ) {
+        best = elapsed;
+        instructions = emitted;
+        bytes = written;
+        allocated = allocations.load( memory_order_relaxed ) - before;
+      }
+    }
+
+    out << "{\"family\": \"" << family.name << "\", "
+        << "\"instructions\": " << instructions << ", "
+        << "\"bytes\": " << bytes << ", "
+        << "\"seconds\": " << best << ", "
+        << "\"instructionsPerSecond\": " << instructions / best << ", "
+        << "\"bytesPerSecond\": " << bytes / best << ", "
+        << "\"allocationsPerInstruction\": "
+        << static_cast< double >( allocated ) / instructions << "}\n";
+  }
+}
@@ -0,0 +1,34 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef ENCODINGBENCH_HH
+#define ENCODINGBENCH_HH
+
+#include <ostream>
+
+using namespace std;
+
+// Times each family of encoders over every combination of its registers and writes a line
+// of JSON per family to out: instructions and bytes emitted per second, and the heap
+// allocations made per instruction. Every family is swept repeatedly into one reused Code
+// for at least seconds, trials times; the fastest trial is reported, since on a shared
+// machine the slower ones measure the machine rather than the encoders. Allocations are
+// only counted when encodingBench.cc is linked in, which replaces operator new.
+void
+runEncodingBench( ostream& out, double seconds = 0.1, int trials = 5 );
+
+#endif
@@ -0,0 +1,227 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "firstCallBench.hh"
+#include "codeHeap.hh"
+#include "myAsm.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+enum struct Stage {
+  generate = 0,
+  install,
+  firstCall
+};
+
+const char* stageNames[] = { "generate", "install", "firstCall" };
+
+// instructions in each function timed, counting the mov and the ret
+const size_t sizes[] = { 2, 16, 256, 4096 };
+
+// nanoseconds each function spent in each stage
+struct Samples {
+  vector< double > stages[ 3 ];
+
+  void
+  add( Stage stage, Clock::time_point from, Clock::time_point to ) {
+    stages[ static_cast< int >( stage ) ].push_back(
+      chrono::duration< double, nano >( to - from ).count() );
+  }
+};
+
+// rax = 0, then an add of 1 for every instruction between the mov and the ret; the
+// function returns instructions - 2
+void
+generate( size_t instructions, Code& code ) {
+  makeMov( Register::rax, 0, code, OpSize::b32 );
+
+  for( size_t i = 2; i < instructions; i++ ) {
+    makeBasicIns( BasicOpClass::_add, Register::rax, 1, code );
+  }
+
+  makeRet( code );
+}
+
+void
+call( const uint8_t* function, size_t instructions ) {
+  if( reinterpret_cast< size_t (*)() >( function )() != instructions - 2 ) {
+    throw "generated function returned the wrong value";
+  }
+}
+
+// Copy each function into a CodeHeap and seal it. The Code is reused, as a generator
+// emitting function after function would, and every function stays live until the end,
+// as they do at startup.
+void
+runCodeHeap( size_t instructions, size_t iterations, Samples& samples ) {
+  CodeHeap heap;
+  Code code;
+  vector< uint8_t* > slots;
+
+  for( size_t i = 0; i < iterations; i++ ) {
+    auto start = Clock::now();
+    code.clear();
+    generate( instructions, code );
+
+    auto generated = Clock::now();
+    auto slot = heap.install( code );
+    heap.seal();
+
+    auto installed = Clock::now();
+    call( slot, instructions );
+
+    auto called = Clock::now();
+    samples.add( Stage::generate, start, generated );
+    samples.add( Stage::install, generated, installed );
+    samples.add( Stage::firstCall, installed, called );
+    slots.push_back( slot );
+  }
+
+  for( auto slot : slots ) {
+    heap.free( slot );
+  }
+}
+
+// Emit each function straight into a DualMappedRegion big enough for all of them and
+// commit it.
+void
+runDualMapped( size_t instructions, size_t bytes, size_t iterations, Samples& samples ) {
+  DualMappedRegion region( iterations * ( bytes + 16 ) + Code::maxInstruction );
+
+  for( size_t i = 0; i < iterations; i++ ) {
+    auto start = Clock::now();
+    auto code = region.writer();
+    generate( instructions, code );
+
+    auto generated = Clock::now();
+    auto function = region.commit( code );
+
+    auto installed = Clock::now();
+    call( function, instructions );
+
+    auto called = Clock::now();
+    samples.add( Stage::generate, start, generated );
+    samples.add( Stage::install, generated, installed );
+    samples.add( Stage::firstCall, installed, called );
+  }
+}
+
+// Run one series on each of threads threads, started together, and pool their samples.
+// An exception on any thread is rethrown once they have all finished.
+template< typename Series >
+Samples
+runThreads( size_t threads, Series series ) {
+  vector< Samples > samples( threads );
+  vector< exception_ptr > errors( threads );
+  vector< thread > workers;
+  atomic< size_t > ready{ 0 };
+
+  for( size_t t = 0; t < threads; t++ ) {
+    workers.emplace_back( [&, t] {
+      ready.fetch_add( 1 );
+      while( ready.load() < threads ) {
+        this_thread::yield();
+      }
+
+      try {
+        series( samples[ t ] );
+      } catch( ... ) {
+        errors[ t ] = current_exception();
+      }
+    } );
+  }
+
+  for( auto& worker : workers ) {
+    worker.join();
+  }
+
+  for( auto& error : errors ) {
+    if( error ) {
+      rethrow_exception( error );
+    }
+  }
+
+  Samples pooled;
+
+  for( auto& s : samples ) {
+    for( auto stage = 0; stage < 3; stage++ ) {
+      pooled.stages[ stage ].insert( pooled.stages[ stage ].end(), s.stages[ stage ].begin(),
+                                     s.stages[ stage ].end() );
+    }
+  }
+
+  return pooled;
+}
+
+double
+percentile( vector< double >& values, size_t p ) {
+  auto rank = min( values.size() * p / 100, values.size() - 1 );
+  nth_element( values.begin(), values.begin() + rank, values.end() );
+  return values[ rank ];
+}
+
+void
+report( ostream& out, const char* pipeline, size_t instructions, size_t bytes,
+        size_t threads, Samples& samples ) {
+  for( auto stage = 0; stage < 3; stage++ ) {
+    auto& values = samples.stages[ stage ];
+
+    out << "{\"pipeline\": \"" << pipeline << "\", "
+        << "\"instructions\": " << instructions << ", "
+        << "\"bytes\": " << bytes << ", "
+        << "\"threads\": " << threads << ", "
+        << "\"stage\": \"" << stageNames[ stage ] << "\", "
+        << "\"p50Ns\": " << percentile( values, 50 ) << ", "
+        << "\"p99Ns\": " << percentile( values, 99 ) << "}\n";
+  }
+}
+
+}
+
+void
+runFirstCallBench( ostream& out, size_t iterations, size_t threads ) {
+  if( threads == 0 ) {
+    threads = max( 2u, thread::hardware_concurrency() );
+  }
+
+  for( auto instructions : sizes ) {
+    Code sample;
+    generate( instructions, sample );
+    auto bytes = sample.size();
+
+    for( auto n : { size_t{ 1 }, threads } ) {
+      auto heap = runThreads( n, [&]( Samples& samples ) {
+        runCodeHeap( instructions, iterations, samples );
+      } );
+      report( out, "codeHeap", instructions, bytes, n, heap );
+
+      auto dual = runThreads( n, [&]( Samples& samples ) {
+        runDualMapped( instructions, bytes, iterations, samples );
+      } );
+      report( out, "dualMapped", instructions, bytes, n, dual );
+    }
+  }
+}
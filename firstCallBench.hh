@@ -0,0 +1,36 @@
+/*
+  The MyAsm programming language
+  Copyright 2019 Eric J. Deiman
+
+  This file is part of the MyAsm programming language.
+  The MyAsm programming language is free software: you can redistribute it
+  and/ormodify it under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the License, or (at your option) any
+  later version.
+
+  The MyAsm programming language is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License along with the
+  MyAsm programming language. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#ifndef FIRSTCALLBENCH_HH
+#define FIRSTCALLBENCH_HH
+
+#include <cstddef>
+#include <ostream>
+
+using namespace std;
+
+// Times the path from nothing to a running function: generating it, installing it where it
+// can execute, and calling it the first time. It goes through a CodeHeap (copy, then seal
+// with mprotect) and through a DualMappedRegion (emit in place, then commit), for functions
+// of several sizes, on one thread and on several at once. Every thread has its own heap or
+// region, so the threads only contend in the kernel. Each stage gets a line of JSON on out
+// with its p50 and p99 in nanoseconds over iterations functions per thread. Build with
+// NDEBUG, or install and commit include verifying the code.
+void
+runFirstCallBench( ostream& out, size_t iterations = 1000, size_t threads = 0 );
+
+#endif
@@ -17,14 +17,21 @@
 
 
 #include "myAsm.hh"
-
+#include "assembler.hh"
+#include "batch.hh"
+#include "codeHeap.hh"
+#include "cpuFeatures.hh"
+#include "decoder.hh"
+#include "elfObject.hh"
+#include "encodingBench.hh"
+#include "firstCallBench.hh"
+
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 
-#include <sys/mman.h>
-#include <unistd.h>
-
 enum struct ExOpCode {
   x0 = 0,
   x1,
@@ -58,13 +65,380 @@ enum struct BasicOperands {
   raxIz
 };
 
-enum struct Scale {
-  x1 = 0,
-  x2,
-  x4,
-  x8
-};
+// ----------------------------------------------------------------------
+// CodeBuffer
+
+CodeBuffer::CodeBuffer( size_t capacity )
+  : storage{ new uint8_t[ capacity ] },
+    start{ storage.get() },
+    cursor{ start },
+    limit{ start + capacity } {
+}
+
+CodeBuffer::CodeBuffer( uint8_t* memory, size_t capacity )
+  : start{ memory },
+    cursor{ memory },
+    limit{ memory + capacity } {
+}
+
+CodeBuffer::CodeBuffer( const CodeBuffer& other )
+  : CodeBuffer( other.capacity() ) {
+  memcpy( start, other.start, other.size() );
+  cursor = start + other.size();
+  labels = other.labels;
+  fixups = other.fixups;
+  constants = other.constants;
+  constantIndex = other.constantIndex;
+  pool = other.pool;
+  embedded = other.embedded;
+  shortestForm = other.shortestForm;
+  saved = other.saved;
+}
+
+CodeBuffer::CodeBuffer( CodeBuffer&& other ) noexcept
+  : storage{ std::move( other.storage ) },
+    start{ other.start },
+    cursor{ other.cursor },
+    limit{ other.limit },
+    labels{ std::move( other.labels ) },
+    fixups{ std::move( other.fixups ) },
+    constants{ std::move( other.constants ) },
+    constantIndex{ std::move( other.constantIndex ) },
+    pool{ other.pool },
+    embedded{ std::move( other.embedded ) },
+    shortestForm{ other.shortestForm },
+    saved{ other.saved } {
+  other.start = other.cursor = other.limit = nullptr;
+}
+
+CodeBuffer&
+CodeBuffer::operator=( const CodeBuffer& other ) {
+  if( this != &other ) {
+    clear();
+    append( other.start, other.size() );
+    labels = other.labels;
+    fixups = other.fixups;
+    constants = other.constants;
+    constantIndex = other.constantIndex;
+    pool = other.pool;
+    embedded = other.embedded;
+    shortestForm = other.shortestForm;
+    saved = other.saved;
+  }
+
+  return *this;
+}
+
+CodeBuffer&
+CodeBuffer::operator=( CodeBuffer&& other ) noexcept {
+  if( this != &other ) {
+    storage = std::move( other.storage );
+    start = other.start;
+    cursor = other.cursor;
+    limit = other.limit;
+    labels = std::move( other.labels );
+    fixups = std::move( other.fixups );
+    constants = std::move( other.constants );
+    constantIndex = std::move( other.constantIndex );
+    pool = other.pool;
+    embedded = other.embedded;
+    shortestForm = other.shortestForm;
+    saved = other.saved;
+    other.start = other.cursor = other.limit = nullptr;
+  }
+
+  return *this;
+}
+
+void
+CodeBuffer::append( const uint8_t* bytes, size_t length ) {
+  ensure( length );
+  memcpy( cursor, bytes, length );
+  cursor += length;
+}
+
+void
+CodeBuffer::reserve( size_t capacity ) {
+  if( this->capacity() < capacity ) {
+    grow( capacity - size() );
+  }
+}
+
+static const size_t unbound = ~size_t{ 0 };
+
+Label
+CodeBuffer::newLabel() {
+  labels.push_back( unbound );
+
+  return Label{ labels.size() - 1 };
+}
+
+void
+CodeBuffer::bind( Label label ) {
+  if( labels.at( label.id ) != unbound ) {
+    throw "attempt to bind a label twice";
+  }
+
+  labels[ label.id ] = size();
+}
+
+bool
+CodeBuffer::isBound( Label label ) const {
+  return labels.at( label.id ) != unbound;
+}
+
+size_t
+CodeBuffer::offset( Label label ) const {
+  if( !isBound( label ) ) {
+    throw "attempt to use the offset of an unbound label";
+  }
+
+  return labels[ label.id ];
+}
+
+static bool
+fitsInt8( int64_t value ) {
+  return -128 <= value && value <= 127;
+}
+
+size_t
+CodeBuffer::resolve() {
+  auto count = fixups.size();
+
+  // check every reference before anything moves, so a failed resolve() leaves the
+  // buffer as it was; constants are bound when the pool is placed
+  vector< bool > pooled( labels.size(), false );
+
+  for( auto& c : constants ) {
+    pooled[ c.label.id ] = true;
+  }
+
+  for( auto& f : fixups ) {
+    if( labels.at( f.label ) == unbound && !pooled[ f.label ] ) {
+      throw "reference to a label that was never bound";
+    }
+  }
+
+  // savedBefore[ i ] is the number of bytes saved by shortening fixups 0 .. i-1
+  vector< size_t > starts( count );
+  vector< uint8_t > saving( count, 0 );
+  vector< size_t > savedBefore( count + 1, 0 );
+
+  for( size_t i = 0; i < count; i++ ) {
+    starts[ i ] = fixups[ i ].start;
+  }
+
+  auto moved = [ & ]( size_t offset ) {
+    auto before = lower_bound( starts.begin(), starts.end(), offset ) - starts.begin();
+    return offset - savedBefore[ before ];
+  };
+
+  // Shortening a branch never moves two other points further apart, so once a branch
+  // fits in rel8 it keeps fitting; repeat until nothing else can be shortened.
+  auto changed = true;
+  while( changed ) {
+    changed = false;
+
+    for( size_t i = 0; i < count; i++ ) {
+      savedBefore[ i + 1 ] = savedBefore[ i ] + saving[ i ];
+    }
+
+    for( size_t i = 0; i < count; i++ ) {
+      auto& f = fixups[ i ];
+      if( !f.relaxable || saving[ i ] != 0 ) {
+        continue;
+      }
+
+      auto end = static_cast< int64_t >( moved( f.start ) ) + 2;
+      auto target = static_cast< int64_t >( moved( labels[ f.label ] ) );
+
+      if( fitsInt8( target - end ) ) {
+        saving[ i ] = f.length - 2;
+        changed = true;
+      }
+    }
+  }
+
+  for( size_t i = 0; i < count; i++ ) {
+    savedBefore[ i + 1 ] = savedBefore[ i ] + saving[ i ];
+  }
+
+  for( auto& l : labels ) {
+    if( l != unbound ) {
+      l = moved( l );
+    }
+  }
+
+  // a pool placed by an earlier resolve() moves with the code
+  pool = moved( pool );
+
+  for( auto& r : embedded ) {
+    r = { moved( r.first ), moved( r.second ) };
+  }
+
+  // close up the gaps left by shortened branches
+  size_t read = 0;
+  size_t write = 0;
+
+  for( size_t i = 0; i < count; i++ ) {
+    auto& f = fixups[ i ];
+
+    memmove( start + write, start + read, f.start - read );
+    write += f.start - read;
+    read = f.start;
+
+    if( saving[ i ] != 0 ) {
+      auto longForm = start[ read ];
+      start[ write ] = longForm == 0xe9 ? 0xeb : 0x70 | ( start[ read + 1 ] & 0xf );
+
+      read += f.length;
+      f = Fixup{ write, 2, 1, 1, false, f.label };
+    }
+    else {
+      memmove( start + write, start + read, f.length );
+      read += f.length;
+      f.start = write;
+    }
+
+    write += f.length;
+  }
+
+  auto tail = size() - read;
+  memmove( start + write, start + read, tail );
+  cursor = start + write + tail;
+
+  placeConstants();
+
+  for( auto& f : fixups ) {
+    auto disp = static_cast< int64_t >( labels[ f.label ] ) + f.addend -
+      static_cast< int64_t >( f.start + f.length );
+    auto field = start + f.start + f.field;
+
+    if( f.width == 1 ) {
+      if( !fitsInt8( disp ) ) {
+        throw "label is out of range of a rel8 displacement";
+      }
+      field[ 0 ] = disp & 0xff;
+    }
+    else {
+      for( auto b = 0; b < 4; b++ ) {
+        field[ b ] = disp & 0xff;
+        disp >>= 8;
+      }
+    }
+  }
+
+  saved += savedBefore[ count ];
+
+  return savedBefore[ count ];
+}
+
+Mem
+CodeBuffer::constant( double value ) {
+  uint64_t bits;
+  memcpy( &bits, &value, sizeof( bits ) );
+
+  return addConstant( 8, bits, 0 );
+}
+
+Mem
+CodeBuffer::constant( int64_t value ) {
+  return addConstant( 8, static_cast< uint64_t >( value ), 0 );
+}
+
+Mem
+CodeBuffer::constant( uint64_t low, uint64_t high ) {
+  return addConstant( 16, low, high );
+}
+
+Mem
+CodeBuffer::addConstant( uint8_t size, uint64_t low, uint64_t high ) {
+  auto key = make_tuple( size, low, high );
+  auto found = constantIndex.find( key );
+
+  if( found != constantIndex.end() ) {
+    return Mem{ constants[ found->second ].label };
+  }
+
+  auto label = newLabel();
+
+  constantIndex[ key ] = constants.size();
+  constants.push_back( Constant{ size, low, high, label } );
+
+  return Mem{ label };
+}
+
+size_t
+CodeBuffer::poolOffset() const {
+  return constants.empty() ? size() : pool;
+}
+
+// lay out any constants not yet placed after the code, padding with int3
+void
+CodeBuffer::placeConstants() {
+  auto placed = true;
+  for( auto& c : constants ) {
+    placed = placed && isBound( c.label );
+  }
+
+  if( placed ) {
+    return;
+  }
+
+  ensure( 15 + 16 * constants.size() );
+
+  auto padding = size();
+
+  while( size() % 16 != 0 ) {
+    push_back( 0xcc );
+  }
+
+  pool = size();
+
+  for( auto size : { 16, 8 } ) {
+    for( auto& c : constants ) {
+      if( c.size != size || isBound( c.label ) ) {
+        continue;
+      }
+
+      bind( c.label );
+
+      for( auto b = 0; b < 8; b++ ) {
+        push_back( ( c.low >> ( 8 * b ) ) & 0xff );
+      }
+      for( auto b = 0; size == 16 && b < 8; b++ ) {
+        push_back( ( c.high >> ( 8 * b ) ) & 0xff );
+      }
+    }
+  }
+
+  embedded.emplace_back( padding, size() );
+}
+
+void
+CodeBuffer::grow( size_t room ) {
+  if( !storage && start ) {
+    throw "code buffer over external memory is full";
+  }
+
+  auto length = size();
+  auto newCapacity = 2 * capacity();
+
+  if( newCapacity < length + room ) {
+    newCapacity = length + room;
+  }
+
+  unique_ptr< uint8_t[] > bigger{ new uint8_t[ newCapacity ] };
+
+  if( 0 < length ) {
+    memcpy( bigger.get(), start, length );
+  }
 
+  storage = std::move( bigger );
+  start = storage.get();
+  cursor = start + length;
+  limit = start + newCapacity;
+}
 
 uint8_t
 makeRex( bool x64, Register destination, Register index, Register source ) {
@@ -128,267 +502,450 @@ makeSIB( Scale scale, Register index, Register base ) {
 }
 
 size_t
-useIndr4r12( uint8_t x, Register r2, Code& where ) {
+makeImm32( int32_t imm, Code& where ) {
+  where.push_back( imm & 0xff );
+  where.push_back( ( imm >> 8 ) & 0xff );
+  where.push_back( ( imm >> 16 ) & 0xff );
+  where.push_back( ( imm >> 24 ) & 0xff );
+
+  return 4;
+}
 
-  where.push_back( makeModRxRm( Mode::ind, x, r2 ) );
-  where.push_back( makeSIB( Scale::x1, Register::r4, r2 ) );
+uint8_t
+makeRex( bool x64, Register reg, const Mem& m ) {
+  auto index = m.hasIndex ? m.index : Register::r0;
+  auto base = m.hasBase ? m.base : Register::r0;
 
-  return 2;
+  return makeRex( x64, reg, index, base );
 }
 
-size_t
-useIndr4r12( Register r1, Register r2, Code& where ) {
-  return useIndr4r12( static_cast< uint8_t >( r1 ), r2, where );
+uint8_t
+makeRex( bool x64, ExOpCode, const Mem& m ) {
+  return makeRex( x64, Register::r0, m );
 }
 
-size_t
-useIndr4r12( ExOpCode x, Register r2, Code& where ) {
-  return useIndr4r12( static_cast< uint8_t >( x ), r2, where );
+// true when a memory operand uses r8 - r15 and so needs a REX prefix
+bool
+needsRex( const Mem& m ) {
+  return ( m.hasBase && Register::r7 < m.base ) || ( m.hasIndex && Register::r7 < m.index );
 }
 
+// ModR/M, SIB and displacement for a memory operand. rsp and r12 as a base always need
+// a SIB, and rbp and r13 as a base always need a displacement, since those encodings
+// mean something else. EVEX compresses a disp8 by n, the size of the memory operand, so
+// a displacement only gets one byte when it is a multiple of n.
 size_t
-useIndr5r13( uint8_t x, Register r2, Code& where ) {
+makeIndirect( uint8_t x, const Mem& m, Code& where, uint8_t immBytes = 0, uint8_t n = 1 ) {
+  if( m.hasIndex && m.index == Register::rsp ) {
+    throw "rsp can't be used as an index register";
+  }
 
-  where.push_back( makeModRxRm( Mode::ind8, x, r2 ) );
-  where.push_back( 0 );
+  if( m.rip ) {
+    // the displacement is from the end of the instruction, after any immediate
+    where.push_back( makeModRxRm( Mode::ind, x, Register::r5 ) );
+    where.addFixup( { where.size(), static_cast< uint8_t >( 4 + immBytes ), 0, 4, false,
+                      m.label, m.disp } );
 
-  return 2;
-}
+    return makeImm32( 0, where ) + 1;
+  }
 
-size_t
-useIndr5r13( Register r1, Register r2, Code& where ) {
-  return useIndr5r13( static_cast< uint8_t >( r1 ), r2, where );
-}
+  if( !m.hasBase ) {
+    // [index * scale + disp32], or [disp32] when there's no index either
+    auto index = m.hasIndex ? m.index : Register::r4;
+    auto scale = m.hasIndex ? m.scale : Scale::x1;
 
-size_t
-useIndr5r13( ExOpCode x, Register r2, Code& where ) {
-  return useIndr5r13( static_cast< uint8_t >( x ), r2, where );
-}
+    where.push_back( makeModRxRm( Mode::ind, x, Register::r4 ) );
+    where.push_back( makeSIB( scale, index, Register::r5 ) );
 
-size_t
-makeIndirect( uint8_t x, Register reg, Code& where ) {
-  size_t length = 0;
+    return makeImm32( m.disp, where ) + 2;
+  }
 
-  if( reg == Register::r4 || reg == Register::r12 ) {
-    // use a SIB follows
-    length += useIndr4r12( x, reg, where );
+  auto b = static_cast< uint8_t >( m.base ) & 7;
+  auto mode = Mode::ind32;
+
+  if( m.disp == 0 && b != 5 ) {
+    mode = Mode::ind;
+  }
+  else if( m.disp % n == 0 && fitsInt8( m.disp / n ) ) {
+    mode = Mode::ind8;
   }
-  else if( reg == Register::r5 || reg == Register::r13 ) {
-    // normally means that a disp32 follows, so send an disp8 of zero
-    length += useIndr5r13( x, reg, where );
+
+  size_t length = 1;
+
+  if( m.hasIndex || b == 4 ) {
+    auto index = m.hasIndex ? m.index : Register::r4;
+
+    where.push_back( makeModRxRm( mode, x, Register::r4 ) );
+    where.push_back( makeSIB( m.scale, index, m.base ) );
+    length++;
   }
   else {
-    where.push_back( makeModRxRm( Mode::ind, x, reg ) );
+    where.push_back( makeModRxRm( mode, x, m.base ) );
+  }
+
+  if( mode == Mode::ind8 ) {
+    where.push_back( ( m.disp / n ) & 0xff );
     length++;
   }
+  else if( mode == Mode::ind32 ) {
+    length += makeImm32( m.disp, where );
+  }
 
   return length;
 }
 
 size_t
-makeIndirect( Register destination, Register source, Code& where ) {
-  return makeIndirect( static_cast< uint8_t >( destination ), source, where );
+makeIndirect( Register destination, const Mem& source, Code& where, uint8_t immBytes = 0 ) {
+  return makeIndirect( static_cast< uint8_t >( destination ), source, where, immBytes );
 }
 
 size_t
-makeIndirect( ExOpCode xop, Register source, Code& where ) {
-  return makeIndirect( static_cast< uint8_t >( xop ), source, where );
-  
+makeIndirect( ExOpCode xop, const Mem& source, Code& where, uint8_t immBytes = 0 ) {
+  return makeIndirect( static_cast< uint8_t >( xop ), source, where, immBytes );
+}
+
+// the byte form of most integer opcodes is one less than the word, dword and qword form
+static uint8_t
+sizedOp( uint8_t op, OpSize size ) {
+  return size == OpSize::b8 ? op - 1 : op;
+}
+
+// the size of the immediate that goes with an operation; 64 bit operations take a sign
+// extended imm32
+static uint8_t
+immBytes( OpSize size ) {
+  switch( size ) {
+  case OpSize::b8:
+    return 1;
+  case OpSize::b16:
+    return 2;
+  default:
+    return 4;
+  }
+}
+
+static size_t
+makeImm( int32_t imm, OpSize size, Code& where ) {
+  auto n = immBytes( size );
+
+  for( auto i = 0; i < n; i++ ) {
+    where.push_back( imm & 0xff );
+    imm >>= 8;
+  }
+
+  return n;
+}
+
+// true when reg is spl, bpl, sil or dil as a byte register. Those need a REX prefix,
+// since without one the same numbers mean ah, ch, dh and bh.
+static bool
+byteNeedsRex( OpSize size, Register reg ) {
+  return size == OpSize::b8 && Register::r3 < reg && reg < Register::r8;
+}
+
+// 66 for a 16 bit operation, then REX when it carries anything or force is set. REX.W
+// comes from size.
+static size_t
+makeSizePrefix( OpSize size, uint8_t rex, bool force, Code& where ) {
+  size_t c = 0;
+
+  if( size == OpSize::b16 ) {
+    where.push_back( 0x66 );
+    c++;
+  }
+
+  if( size == OpSize::b64 ) {
+    rex |= 0x08;
+  }
+
+  if( rex != 0x40 || force ) {
+    where.push_back( rex );
+    c++;
+  }
+
+  return c;
+}
+
+static size_t
+makeSizePrefix( OpSize size, Register reg, Register rm, Code& where ) {
+  return makeSizePrefix( size, makeRex( false, reg, Register::r0, rm ),
+                         byteNeedsRex( size, reg ) || byteNeedsRex( size, rm ), where );
+}
+
+static size_t
+makeSizePrefix( OpSize size, Register reg, const Mem& rm, Code& where ) {
+  return makeSizePrefix( size, makeRex( false, reg, rm ), byteNeedsRex( size, reg ), where );
 }
 
 size_t
-makeBasicIns( BasicOpClass op, Register destination, Register source, Code& where ) {
+makeBasicIns( BasicOpClass op, Register destination, Register source, Code& where,
+              OpSize size ) {
+  where.ensure();
+
   auto o = static_cast< uint8_t >( op );
   auto rands = static_cast< uint8_t >( BasicOperands::GvEv );
 
-  where.push_back( makeRex( true, destination, Register::r0, source ) );
-  where.push_back( ( o << 3 ) | rands );
+  auto c = makeSizePrefix( size, destination, source, where );
+  where.push_back( sizedOp( ( o << 3 ) | rands, size ) );
   where.push_back( makeModRxRm( destination, source ) );
 
-  return 3;
+  return c + 2;
 }
 
-size_t
-makeImm32( int32_t imm, Code& where ) {
-  where.push_back( imm & 0xff );
-  where.push_back( ( imm >> 8 ) & 0xff );
-  where.push_back( ( imm >> 16 ) & 0xff );
-  where.push_back( ( imm >> 24 ) & 0xff );
-
-  return 4;
+// in shortest mode, true when imm can be a sign-extended imm8
+static bool
+useImm8( int64_t imm, const Code& where ) {
+  return where.shortest() && fitsInt8( imm );
 }
 
 size_t
-makeBasicIns( BasicOpClass op, int32_t imm32, Code& where ) {
+makeBasicIns( BasicOpClass op, int32_t imm32, Code& where, OpSize size ) {
+  where.ensure();
+
+  if( size != OpSize::b8 && useImm8( imm32, where ) ) {
+    return makeBasicIns( op, Register::rax, imm32, where, size );
+  }
+
   auto o = static_cast< uint8_t >( op );
   auto rands = static_cast< uint8_t >( BasicOperands::raxIz );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, Register::r0 ) );
-  where.push_back( ( o << 3 ) | rands );
+  auto c = makeSizePrefix( size, Register::r0, Register::r0, where );
+  where.push_back( sizedOp( ( o << 3 ) | rands, size ) );
 
-  auto i = makeImm32( imm32, where );
+  auto i = makeImm( imm32, size, where );
 
-  return i + 2;
+  return c + i + 1;
 }
 
 size_t
-makeBasicIns( BasicOpClass op, Register destination, int32_t imm32, Code& where ) {
+makeBasicIns( BasicOpClass op, Register destination, int32_t imm32, Code& where,
+              OpSize size ) {
+  where.ensure();
+
+  auto xop = static_cast< ExOpCode >( op );
+
+  if( size != OpSize::b8 && useImm8( imm32, where ) ) {
+    auto c = makeSizePrefix( size, Register::r0, destination, where );
+    where.push_back( 0x83 );
+    where.push_back( makeModRxRm( xop, destination ) );
+    where.push_back( imm32 & 0xff );
+    where.addSaved( immBytes( size ) - ( destination == Register::rax ? 2 : 1 ) );
+
+    return c + 3;
+  }
+
   if( destination == Register::rax ) {
-    return makeBasicIns( op, imm32, where );
+    return makeBasicIns( op, imm32, where, size );
   }
-  
-  auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, destination ) );
-  where.push_back( 0x81 );
+  auto c = makeSizePrefix( size, Register::r0, destination, where );
+  where.push_back( sizedOp( 0x81, size ) );
   where.push_back( makeModRxRm( xop, destination ) );
 
-  auto i = makeImm32( imm32, where );
+  auto i = makeImm( imm32, size, where );
 
-  return i + 3;
+  return c + i + 2;
 }
 
 size_t
-makeBasicIns( BasicOpClass op, IndirectReg destination, int32_t imm32, Code& where ) {
-  auto dest = static_cast< Register >( destination );
+makeBasicIns( BasicOpClass op, const Mem& destination, int32_t imm32, Code& where,
+              OpSize size ) {
+  where.ensure();
+
   auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, dest ) );
-  where.push_back( 0x81 );
+  auto c = makeSizePrefix( size, Register::r0, destination, where );
+
+  if( size != OpSize::b8 && useImm8( imm32, where ) ) {
+    where.push_back( 0x83 );
 
-  auto i = makeIndirect( xop, dest, where );
-  auto j = makeImm32( imm32, where );
+    auto i = makeIndirect( xop, destination, where, 1 );
+    where.push_back( imm32 & 0xff );
+    where.addSaved( immBytes( size ) - 1 );
 
-  return i + j + 2;
+    return c + i + 2;
+  }
+
+  where.push_back( sizedOp( 0x81, size ) );
+
+  auto i = makeIndirect( xop, destination, where, immBytes( size ) );
+  auto j = makeImm( imm32, size, where );
+
+  return c + i + j + 1;
 }
 
-vector< uint8_t > opMRtx = { 0x01, 0x09, 0x11, 0x19, 0x21, 0x29, 0x31, 0x39 };
+const vector< uint8_t > opMRtx = { 0x01, 0x09, 0x11, 0x19, 0x21, 0x29, 0x31, 0x39 };
 
 // [destination] = [destination] op source
 size_t
-makeBasicIns( BasicOpClass op, IndirectReg destination, Register source, Code& where ) {
-  auto dest = static_cast< Register >( destination);
+makeBasicIns( BasicOpClass op, const Mem& destination, Register source, Code& where,
+              OpSize size ) {
+  where.ensure();
+
   auto o = static_cast< uint8_t >( op );
 
-  where.push_back( makeRex( true, dest, Register::r0, source ) );
-  where.push_back( opMRtx[ o ] );
+  auto c = makeSizePrefix( size, source, destination, where );
+  where.push_back( sizedOp( opMRtx[ o ], size ) );
 
-  auto i = makeIndirect( dest, source, where );
+  auto i = makeIndirect( source, destination, where );
 
-  return i + 2;
+  return c + i + 1;
 }
 
 // destination = destination op [source]
 size_t
-makeBasicIns( BasicOpClass op, Register destination, IndirectReg source, Code& where ) {
-  auto src = static_cast< Register >( source );
+makeBasicIns( BasicOpClass op, Register destination, const Mem& source, Code& where,
+              OpSize size ) {
+  where.ensure();
+
   auto o = static_cast< uint8_t >( op );
 
-  where.push_back( makeRex( true, src, Register::r0, destination ) );
-  where.push_back( opMRtx[ o ] + 2 );
-  where.push_back( makeModRxRm( Mode::ind, src, destination ) );
+  auto c = makeSizePrefix( size, destination, source, where );
+  where.push_back( sizedOp( opMRtx[ o ] + 2, size ) );
 
-  return 3;
+  auto i = makeIndirect( destination, source, where );
+
+  return c + i + 1;
 }
 
 size_t
-makeMul( Register source, Code& where ) {
+makeMul( Register source, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, source ) );
-  where.push_back( 0xf7 );
+  auto c = makeSizePrefix( size, Register::r0, source, where );
+  where.push_back( sizedOp( 0xf7, size ) );
   where.push_back( makeModRxRm( ExOpCode::x5, source ) );
 
-  return 3;
+  return c + 2;
 }
 
 size_t
-makeMul( IndirectReg source, Code& where ) {
-  auto src = static_cast< Register >( source );
+makeMul( const Mem& source, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, src ) );
-  where.push_back( 0xf7 );
+  auto c = makeSizePrefix( size, Register::r0, source, where );
+  where.push_back( sizedOp( 0xf7, size ) );
 
-  auto i = makeIndirect( ExOpCode::x5, src, where );
+  auto i = makeIndirect( ExOpCode::x5, source, where );
 
-  return i + 2;
+  return c + i + 1;
 }
 
 size_t
-makeMul( Register destination, Register source, Code& where ) {
-  if( destination == Register::rax ) {
-    return makeMul( source, where );
+makeMul( Register destination, Register source, Code& where, OpSize size ) {
+  where.ensure();
+
+  if( size == OpSize::b8 ) {
+    throw "imul has no byte form with two operands";
   }
 
-  where.push_back( makeRex( true, destination, Register::r0, source ) );
+  auto c = makeSizePrefix( size, destination, source, where );
   where.push_back( 0x0f );
   where.push_back( 0xaf );
   where.push_back( makeModRxRm( destination, source ) );
 
-  return 4;
+  return c + 3;
 }
 
 size_t
-makeMul( Register destination, IndirectReg source, Code& where ) {
-  auto src = static_cast< Register >( source );
+makeMul( Register destination, const Mem& source, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, destination, Register::r0, src ) );
+  if( size == OpSize::b8 ) {
+    throw "imul has no byte form with two operands";
+  }
+
+  auto c = makeSizePrefix( size, destination, source, where );
   where.push_back( 0x0f );
   where.push_back( 0xaf );
 
-  auto i = makeIndirect( destination, src, where );
+  auto i = makeIndirect( destination, source, where );
 
-  return i + 3;
+  return c + i + 2;
 }
 
 size_t
-makeMul( Register destination, Register source, int32_t imm, Code& where ) {
+makeMul( Register destination, Register source, int32_t imm, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, destination, Register::r0, source ) );
-  where.push_back( 0x69 );
-  where.push_back( makeModRxRm( destination, source ) );
+  if( size == OpSize::b8 ) {
+    throw "imul has no byte form with an immediate";
+  }
 
-  auto i = makeImm32( imm, where );
+  auto c = makeSizePrefix( size, destination, source, where );
 
-  return i + 3;
-}
+  if( useImm8( imm, where ) ) {
+    where.push_back( 0x6b );
+    where.push_back( makeModRxRm( destination, source ) );
+    where.push_back( imm & 0xff );
+    where.addSaved( immBytes( size ) - 1 );
 
-size_t
-makeMul( Register destination, IndirectReg source, int32_t imm, Code& where ) {
-  auto src = static_cast< Register >( source );
+    return c + 3;
+  }
 
-  where.push_back( makeRex( true, destination, Register::r0, src ) );
   where.push_back( 0x69 );
+  where.push_back( makeModRxRm( destination, source ) );
 
-  auto i = makeIndirect( destination, src, where );
-  auto j = makeImm32( imm, where );
+  auto i = makeImm( imm, size, where );
 
-  return i + j + 2;
+  return c + i + 2;
 }
 
 size_t
-makeDiv( Register source, Code& where ) {
+makeMul( Register destination, const Mem& source, int32_t imm, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, source ) );
-  where.push_back( 0xf7 );
-  where.push_back( makeModRxRm( ExOpCode::x7, source ) );
+  if( size == OpSize::b8 ) {
+    throw "imul has no byte form with an immediate";
+  }
 
-  return 3;
-}
+  auto c = makeSizePrefix( size, destination, source, where );
+
+  if( useImm8( imm, where ) ) {
+    where.push_back( 0x6b );
+
+    auto i = makeIndirect( destination, source, where, 1 );
+    where.push_back( imm & 0xff );
+    where.addSaved( immBytes( size ) - 1 );
+
+    return c + i + 2;
+  }
+
+  where.push_back( 0x69 );
+
+  auto i = makeIndirect( destination, source, where, immBytes( size ) );
+  auto j = makeImm( imm, size, where );
+
+  return c + i + j + 1;
+}
 
 size_t
-makeDiv( IndirectReg source, Code& where ) {
-  auto src = static_cast< Register >( source );
+makeDiv( Register source, Code& where, OpSize size ) {
+  where.ensure();
+
+  auto c = makeSizePrefix( size, Register::r0, source, where );
+  where.push_back( sizedOp( 0xf7, size ) );
+  where.push_back( makeModRxRm( ExOpCode::x7, source ) );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, src ) );
-  where.push_back( 0xf7 );
+  return c + 2;
+}
+
+size_t
+makeDiv( const Mem& source, Code& where, OpSize size ) {
+  where.ensure();
 
-  auto i = makeIndirect( ExOpCode::x7, src, where );
+  auto c = makeSizePrefix( size, Register::r0, source, where );
+  where.push_back( sizedOp( 0xf7, size ) );
 
-  return i + 2;
+  auto i = makeIndirect( ExOpCode::x7, source, where );
+
+  return c + i + 1;
 }
 
 size_t
 makeJcc( CondTest test, uint32_t disp, Code& where ) {
+  where.ensure();
+
   auto t = static_cast< uint8_t >( test );
 
   where.push_back( 0x0f );
@@ -401,6 +958,7 @@ makeJcc( CondTest test, uint32_t disp, Code& where ) {
 
 size_t
 makeJmp( uint32_t disp, Code& where ) {
+  where.ensure();
 
   where.push_back( 0xe9 );
 
@@ -411,6 +969,8 @@ makeJmp( uint32_t disp, Code& where ) {
 
 size_t
 makeJmp( Register r, Code& where ) {
+  where.ensure();
+
   size_t length = 0;
 
   if( Register::r7 < r ) {
@@ -424,6 +984,73 @@ makeJmp( Register r, Code& where ) {
   return length + 2;
 }
 
+size_t
+makeJmp( const Mem& target, Code& where ) {
+  where.ensure();
+
+  size_t length = 0;
+
+  if( needsRex( target ) ) {
+    where.push_back( makeRex( false, Register::r0, target ) );
+    length++;
+  }
+
+  where.push_back( 0xff );
+
+  return makeIndirect( ExOpCode::x4, target, where ) + length + 1;
+}
+
+// true when the label is already bound within rel8 reach of an instruction ending at end
+static bool
+nearLabel( Label target, size_t end, const Code& where ) {
+  return where.isBound( target ) &&
+    fitsInt8( static_cast< int64_t >( where.offset( target ) ) - static_cast< int64_t >( end ) );
+}
+
+size_t
+makeJcc( CondTest test, Label target, Code& where ) {
+  where.ensure();
+
+  auto t = static_cast< uint8_t >( test );
+  auto start = where.size();
+
+  if( nearLabel( target, start + 2, where ) ) {
+    where.push_back( 0x70 | t );
+    where.push_back( 0 );
+    where.addFixup( { start, 2, 1, 1, false, target.id } );
+
+    return 2;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( 0x80 | t );
+  makeImm32( 0, where );
+  where.addFixup( { start, 6, 2, 4, true, target.id } );
+
+  return 6;
+}
+
+size_t
+makeJmp( Label target, Code& where ) {
+  where.ensure();
+
+  auto start = where.size();
+
+  if( nearLabel( target, start + 2, where ) ) {
+    where.push_back( 0xeb );
+    where.push_back( 0 );
+    where.addFixup( { start, 2, 1, 1, false, target.id } );
+
+    return 2;
+  }
+
+  where.push_back( 0xe9 );
+  makeImm32( 0, where );
+  where.addFixup( { start, 5, 1, 4, true, target.id } );
+
+  return 5;
+}
+
 uint8_t
 combineOpReg( uint8_t op, Register reg ) {
   auto r = static_cast< uint8_t >( reg ) & 7;
@@ -432,41 +1059,81 @@ combineOpReg( uint8_t op, Register reg ) {
 }
 
 size_t
-makeMov( Register destination, Register source, Code& where ) {
+makeMov( Register destination, Register source, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, destination, Register::r0, source ) );
-  where.push_back( 0x8B );
+  auto c = makeSizePrefix( size, destination, source, where );
+  where.push_back( sizedOp( 0x8b, size ) );
   where.push_back( makeModRxRm( destination, source ) );
 
-  return 3;
+  return c + 2;
 }
 
 size_t
-makeMov( Register destination, IndirectReg source, Code& where ) {
-  auto src = static_cast< Register >( source );
+makeMov( Register destination, const Mem& source, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, destination, Register::r0, src ) );
-  where.push_back( 0x8B );
+  auto c = makeSizePrefix( size, destination, source, where );
+  where.push_back( sizedOp( 0x8b, size ) );
 
-  auto i = makeIndirect( destination, src, where );
+  auto i = makeIndirect( destination, source, where );
 
-  return i + 2;
+  return c + i + 1;
 }
 
 size_t
-makeMov( IndirectReg destination, Register source, Code& where ) {
-  auto dest = static_cast< Register >( destination );
+makeMov( const Mem& destination, Register source, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, source, Register::r0, dest ) );
-  where.push_back( 0x89 );
+  auto c = makeSizePrefix( size, source, destination, where );
+  where.push_back( sizedOp( 0x89, size ) );
 
-  auto i = makeIndirect( source, dest, where );
+  auto i = makeIndirect( source, destination, where );
 
-  return i + 2;
+  return c + i + 1;
 }
 
 size_t
-makeMov( Register destination, int64_t imm, Code& where ) {
+makeMov( Register destination, int64_t imm, Code& where, OpSize size ) {
+  where.ensure();
+
+  if( size != OpSize::b64 ) {
+    // an immediate the size of the register; writing the 32 bit register clears the
+    // upper half
+    auto c = makeSizePrefix( size, Register::r0, destination, where );
+    where.push_back( combineOpReg( size == OpSize::b8 ? 0xb0 : 0xb8, destination ) );
+
+    auto i = makeImm( static_cast< int32_t >( imm ), size, where );
+
+    return c + i + 1;
+  }
+
+  if( where.shortest() && 0 <= imm && imm <= 0xffffffff ) {
+    // writing the 32 bit register clears the upper half
+    size_t length = 0;
+
+    if( Register::r7 < destination ) {
+      where.push_back( makeRex( false, Register::r0, Register::r0, destination ) );
+      length++;
+    }
+    where.push_back( combineOpReg( 0xb8, destination ) );
+
+    auto i = makeImm32( static_cast< int32_t >( imm ), where );
+    where.addSaved( 10 - length - i - 1 );
+
+    return length + i + 1;
+  }
+
+  if( where.shortest() && INT32_MIN <= imm && imm <= INT32_MAX ) {
+    where.push_back( makeRex( true, Register::r0, Register::r0, destination ) );
+    where.push_back( 0xc7 );
+    where.push_back( makeModRxRm( ExOpCode::x0, destination ) );
+
+    auto i = makeImm32( static_cast< int32_t >( imm ), where );
+    where.addSaved( 3 );
+
+    return i + 3;
+  }
 
   where.push_back( makeRex( true, Register::r0, Register::r0, destination ) );
   where.push_back( combineOpReg( 0xb8, destination ) );
@@ -480,24 +1147,39 @@ makeMov( Register destination, int64_t imm, Code& where ) {
 }
 
 size_t
-makeMov( IndirectReg destination, int32_t imm, Code& where ) {
-  auto dest = static_cast< Register >( destination );
+makeMov( const Mem& destination, int32_t imm, Code& where, OpSize size ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, dest ) );
-  where.push_back( 0xc7 );
+  auto c = makeSizePrefix( size, Register::r0, destination, where );
+  where.push_back( sizedOp( 0xc7, size ) );
 
-  auto i = makeIndirect( ExOpCode::x0, dest, where );
+  auto i = makeIndirect( ExOpCode::x0, destination, where, immBytes( size ) );
+  auto j = makeImm( imm, size, where );
 
-  for( auto i = 0; i < 4; i++) {
-    where.push_back( imm & 0xff );
-    imm >>= 8;
+  return c + i + j + 1;
+}
+
+// lea computes the address without touching memory or the flags. A 32 bit lea still
+// adds with 64 bit registers and keeps the low half of the sum.
+size_t
+makeLea( Register destination, const Mem& source, Code& where, OpSize size ) {
+  if( size == OpSize::b8 ) {
+    throw "lea has no byte form";
   }
 
-  return i + 7;
+  where.ensure();
+
+  auto c = makeSizePrefix( size, destination, source, where );
+  where.push_back( 0x8d );
+
+  auto i = makeIndirect( destination, source, where );
+
+  return c + i + 1;
 }
 
 size_t
 makeCall( int32_t disp, Code& where ) {
+  where.ensure();
 
   where.push_back( 0xe8 );
 
@@ -508,6 +1190,8 @@ makeCall( int32_t disp, Code& where ) {
 
 size_t
 makeCall( Register r, Code& where ) {
+  where.ensure();
+
   size_t i = 0;
 
   if( Register::r7 < r ) {
@@ -520,28 +1204,63 @@ makeCall( Register r, Code& where ) {
   return 2 + i;
 }
 
+size_t
+makeCall( const Mem& target, Code& where ) {
+  where.ensure();
+
+  size_t i = 0;
+
+  if( needsRex( target ) ) {
+    where.push_back( makeRex( false, Register::r0, target ) );
+    i++;
+  }
+
+  where.push_back( 0xff );
+
+  return makeIndirect( ExOpCode::x2, target, where ) + i + 1;
+}
+
+size_t
+makeCall( Label target, Code& where ) {
+  where.ensure();
+
+  auto start = where.size();
+
+  where.push_back( 0xe8 );
+  makeImm32( 0, where );
+  where.addFixup( { start, 5, 1, 4, false, target.id } );
+
+  return 5;
+}
+
 size_t
 makeRet( Code& where ) {
+  where.ensure();
+
   where.push_back( 0xc3 );
   return 1;
 }
 
 // shl or shr by one
 size_t
-makeShift( ShiftOp op, Register reg, Code& where ) {
+makeShift( ShiftOp op, Register reg, Code& where, OpSize size ) {
+  where.ensure();
+
   auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, reg ) );
-  where.push_back( 0xd1 );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xd1, size ) );
   where.push_back( makeModRxRm( xop, reg ) );
 
-  return 3;
+  return c + 2;
 }
 
 size_t
-makeShift( ShiftOp op, Register reg, uint8_t imm8, Code& where ) {
+makeShift( ShiftOp op, Register reg, uint8_t imm8, Code& where, OpSize size ) {
+  where.ensure();
+
   if( imm8 == 1 ) {
-    return makeShift( op, reg, where );
+    return makeShift( op, reg, where, size );
   }
 
   if( 63 < imm8 ) {
@@ -550,84 +1269,88 @@ makeShift( ShiftOp op, Register reg, uint8_t imm8, Code& where ) {
 
   auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, reg ) );
-  where.push_back( 0xc1 );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xc1, size ) );
   where.push_back( makeModRxRm( xop, reg ) );
   where.push_back( imm8 & 0x3f );
 
-  return 4;
+  return c + 3;
 }
 
 // shl or shr by one
 size_t
-makeShift( ShiftOp op, IndirectReg reg, Code& where ) {
-  auto r = static_cast< Register >( reg );
+makeShift( ShiftOp op, const Mem& reg, Code& where, OpSize size ) {
+  where.ensure();
+
   auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, r ) );
-  where.push_back( 0xd1 );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xd1, size ) );
 
-  auto i = makeIndirect( xop, r, where );
+  auto i = makeIndirect( xop, reg, where );
 
-  return i + 2;
+  return c + i + 1;
 }
 
 size_t
-makeShift( ShiftOp op, IndirectReg reg, uint8_t imm8, Code& where ) {
+makeShift( ShiftOp op, const Mem& reg, uint8_t imm8, Code& where, OpSize size ) {
+  where.ensure();
+
   if( imm8 == 1 ) {
-    return makeShift( op, reg, where );
+    return makeShift( op, reg, where, size );
   }
 
   if( 63 < imm8 ) {
     return 0;
   }
-  auto r = static_cast< Register >( reg );
   auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, r ) );
-  where.push_back( 0xc1 );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xc1, size ) );
 
-  auto i = makeIndirect( xop, r, where );
+  auto i = makeIndirect( xop, reg, where, 1 );
 
   where.push_back( imm8 & 0x3f );
 
-  return i + 2;
+  return c + i + 2;
 }
 
 size_t
-makeCompl( ExOpCode op, Register reg, Code& where ) {
+makeCompl( ExOpCode op, Register reg, Code& where, OpSize size = OpSize::b64 ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, reg ) );
-  where.push_back( 0xf7 );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xf7, size ) );
   where.push_back( makeModRxRm( op, reg ) );
 
-  return 3;
+  return c + 2;
 }
 
 size_t
-makeCompl( ComplOp op, Register reg, Code& where ) {
-  return makeCompl( static_cast< ExOpCode >( op ), reg, where );
+makeCompl( ComplOp op, Register reg, Code& where, OpSize size ) {
+  return makeCompl( static_cast< ExOpCode >( op ), reg, where, size );
 }
 
 size_t
-makeCompl( ExOpCode op, IndirectReg reg, Code& where ) {
-  auto r = static_cast< Register >( reg );
+makeCompl( ExOpCode op, const Mem& reg, Code& where, OpSize size = OpSize::b64 ) {
+  where.ensure();
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, r ) );
-  where.push_back( 0xf7 );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xf7, size ) );
 
-  auto i = makeIndirect( op, r, where );
+  auto i = makeIndirect( op, reg, where );
 
-  return i + 2;
+  return c + i + 1;
 }
 
 size_t
-makeCompl( ComplOp op, IndirectReg reg, Code& where ) {
-  return makeCompl( static_cast< ExOpCode >( op ), reg, where );
+makeCompl( ComplOp op, const Mem& reg, Code& where, OpSize size ) {
+  return makeCompl( static_cast< ExOpCode >( op ), reg, where, size );
 }
 
 size_t
 makeSysCall( Code& where ) {
+  where.ensure();
 
   where.push_back( 0x0f );
   where.push_back( 0x05 );
@@ -637,6 +1360,8 @@ makeSysCall( Code& where ) {
 
 size_t
 makePush( Register reg, Code& where ) {
+  where.ensure();
+
   size_t length = 0;
 
   if( Register::r7 < reg ) {
@@ -649,34 +1374,46 @@ makePush( Register reg, Code& where ) {
 }
 
 size_t
-makePush( IndirectReg reg, Code& where ) {
-  auto r = static_cast< Register >( reg );
+makePush( const Mem& reg, Code& where ) {
+  where.ensure();
+
   size_t length = 0;
 
-  if( Register::r7 < r ) {
-    where.push_back( makeRex( false, Register::r0, Register::r0, r ) );
+  if( needsRex( reg ) ) {
+    where.push_back( makeRex( false, Register::r0, reg ) );
     length++;
   }
 
   where.push_back( 0xff );
 
-  auto i = makeIndirect( ExOpCode::x6, r, where );
+  auto i = makeIndirect( ExOpCode::x6, reg, where );
 
   return i + length + 1;
 }
 
 size_t
 makePush( uint32_t imm, Code& where ) {
+  where.ensure();
+
+  if( useImm8( static_cast< int32_t >( imm ), where ) ) {
+    where.push_back( 0x6a );
+    where.push_back( imm & 0xff );
+    where.addSaved( 3 );
+
+    return 2;
+  }
 
   where.push_back( 0x68 );
 
   auto i = makeImm32( imm, where );
 
-  return i + 4;
+  return i + 1;
 }
 
 size_t
 makePop( Register reg, Code& where ) {
+  where.ensure();
+
   size_t length = 0;
 
   if( Register::r7 < reg ) {
@@ -689,322 +1426,3792 @@ makePop( Register reg, Code& where ) {
 }
 
 size_t
-makePop( IndirectReg reg, Code& where ) {
-  auto r = static_cast< Register >( reg );
+makePop( const Mem& reg, Code& where ) {
+  where.ensure();
+
   size_t length = 0;
 
-  if( Register::r7 < r ) {
-    where.push_back( makeRex( false, Register::r0, Register::r0, r ) );
+  if( needsRex( reg ) ) {
+    where.push_back( makeRex( false, Register::r0, reg ) );
     length++;
   }
 
   where.push_back( 0x8f );
 
-  auto i = makeIndirect( ExOpCode::x0, r, where );
+  auto i = makeIndirect( ExOpCode::x0, reg, where );
 
   return i + length + 1;
 }
 
 size_t
-makeIDec( IDecOp op, Register reg, Code& where ) {
+makeIDec( IDecOp op, Register reg, Code& where, OpSize size ) {
+  where.ensure();
+
   auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, reg ) );
-  where.push_back( 0xff );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xff, size ) );
   where.push_back( makeModRxRm( xop, reg ) );
 
-  return 3;
+  return c + 2;
 }
 
 size_t
-makeIDec( IDecOp op, IndirectReg reg, Code& where ) {
-  auto r = static_cast< Register >( reg );
+makeIDec( IDecOp op, const Mem& reg, Code& where, OpSize size ) {
+  where.ensure();
+
   auto xop = static_cast< ExOpCode >( op );
 
-  where.push_back( makeRex( true, Register::r0, Register::r0, r ) );
-  where.push_back( 0xff );
+  auto c = makeSizePrefix( size, Register::r0, reg, where );
+  where.push_back( sizedOp( 0xff, size ) );
+
+  auto i = makeIndirect( xop, reg, where );
+
+  return c + i + 1;
+}
+
+// movs, stos, lods, cmps and scas take no operands; the byte form is one less than the
+// word, dword and qword form
+static size_t
+makeStringIns( uint8_t op, OpSize size, Code& where ) {
+  where.ensure();
+
+  auto c = makeSizePrefix( size, 0x40, false, where );
+  where.push_back( sizedOp( op, size ) );
+
+  return c + 1;
+}
+
+size_t
+makeMovS( Code& where, OpSize size ) {
+  return makeStringIns( 0xa5, size, where );
+}
+
+size_t
+makeStoS( Code& where, OpSize size ) {
+  return makeStringIns( 0xab, size, where );
+}
+
+size_t
+makeLodS( Code& where, OpSize size ) {
+  return makeStringIns( 0xad, size, where );
+}
+
+size_t
+makeCmpS( Code& where, OpSize size ) {
+  return makeStringIns( 0xa7, size, where );
+}
+
+size_t
+makeScaS( Code& where, OpSize size ) {
+  return makeStringIns( 0xaf, size, where );
+}
+
+size_t
+makeRep( Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xf3 );
+  return 1;
+}
+
+size_t
+makeRepNE( Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xf2 );
+  return 1;
+}
+
+size_t
+makeLock( Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xf0 );
+  return 1;
+}
+
+size_t
+makeLoop( uint8_t disp, Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xe2 );
+  where.push_back( disp );
+  return 2;
+}
+
+size_t
+makeLoopE( uint8_t disp, Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xe1 );
+  where.push_back( disp );
+  return 2;
+}
+
+size_t
+makeLoopNE( uint8_t disp, Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xe0 );
+  where.push_back( disp );
+  return 2;
+}
+
+size_t
+makeLoop( uint8_t op, Label target, Code& where ) {
+  where.ensure();
+
+  auto start = where.size();
+
+  if( where.isBound( target ) && !nearLabel( target, start + 2, where ) ) {
+    throw "loop target is out of range of a rel8 displacement";
+  }
+
+  where.push_back( op );
+  where.push_back( 0 );
+  where.addFixup( { start, 2, 1, 1, false, target.id } );
+
+  return 2;
+}
+
+size_t
+makeLoop( Label target, Code& where ) {
+  return makeLoop( 0xe2, target, where );
+}
+
+size_t
+makeLoopE( Label target, Code& where ) {
+  return makeLoop( 0xe1, target, where );
+}
+
+size_t
+makeLoopNE( Label target, Code& where ) {
+  return makeLoop( 0xe0, target, where );
+}
+
+// ----------------------------------------------------------------------
+// Some double precision floating point instruction
+
+enum struct XmmOp {
+  mov  = 0x10,
+  movStore,
+  unpckl = 0x14,
+  unpckh,
+  mova = 0x28,
+  movaStore,
+  movnt = 0x2b,
+  cvtsi2sd = 0x2a,
+  cvtsd2si = 0x2d,
+  comi = 0x2f,
+  sqrt = 0x51,
+  _and = 0x54,
+  _andn,
+  _or,
+  _xor,
+  add  = 0x58,
+  mul,
+  cvt,
+  sub  = 0x5c,
+  min,
+  div,
+  max,
+  movq = 0x6e,
+  movqStore = 0x7e,
+  cmp = 0xc2,
+  shuf = 0xc6,
+  movntdq = 0xe7
+};
+
+// The mandatory prefix picks the type of data an XmmOp works on
+enum struct XmmType {
+  ps = 0x00,  // packed single-precision
+  pd = 0x66,  // packed double-precision
+  ss = 0xf3,  // scalar single-precision
+  sd = 0xf2   // scalar double-precision
+};
+
+// the type prefix, then REX when it carries anything, then 0F op
+size_t
+makeXmmPrefix( XmmType type, uint8_t rex, XmmOp op, Code& where ) {
+  where.ensure();
+
+  size_t c = 0;
+
+  if( type != XmmType::ps ) {
+    where.push_back( static_cast< uint8_t >( type ) );
+    c++;
+  }
+
+  if( rex != 0x40 ) {
+    where.push_back( rex );
+    c++;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return c + 2;
+}
+
+size_t
+makeXmmIns( XmmType type, XmmReg destination, XmmReg source, XmmOp op, Code& where,
+            bool x64 = false ) {
+  auto d = static_cast< Register >( destination );
+  auto s = static_cast< Register> ( source );
+
+  auto c = makeXmmPrefix( type, makeRex( x64, d, Register::r0, s ), op, where );
+  where.push_back( makeModRxRm( d, s ) );
+
+  return c + 1; 
+}
+
+size_t
+makeXmmIns( XmmType type, XmmReg destination, const Mem& source, XmmOp op, Code& where,
+            bool x64 = false, uint8_t immBytes = 0 ) {
+  auto d = static_cast< Register >( destination );
+
+  auto c = makeXmmPrefix( type, makeRex( x64, d, source ), op, where );
+
+  auto i = makeIndirect( d, source, where, immBytes );
+
+  return c + i;
+}
+
+size_t
+makeSDIns( XmmReg destination, XmmReg source, XmmOp op, Code& where, bool x64 = false ) {
+  return makeXmmIns( XmmType::sd, destination, source, op, where, x64 );
+}
+
+size_t
+makeSDIns( XmmReg destination, const Mem& source, XmmOp op, Code& where, bool x64 = false,
+           uint8_t immBytes = 0 ) {
+  return makeXmmIns( XmmType::sd, destination, source, op, where, x64, immBytes );
+}
+
+// movsd move scalar double-precision floating point between memory and regs
+size_t
+makeMovSD( XmmReg destination, XmmReg source, Code& where  ) {
+  return makeSDIns( destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovSD( const Mem& destination, XmmReg source, Code& where ) {
+  return makeSDIns( source, destination, XmmOp::movStore, where );
+}
+
+// addsd
+size_t
+makeAddSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::add, where );
+}
+
+size_t
+makeAddSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::add, where );
+}
+
+// subsd
+size_t
+makeSubSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::sub, where );
+}
+
+size_t
+makeSubSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::sub, where );
+}
+
+// mulsd
+size_t
+makeMulSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::mul, where );
+}
+
+size_t
+makeMulSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::mul, where );
+}
+
+// divsd
+size_t
+makeDivSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::div, where );
+}
+
+size_t
+makeDivSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::div, where );
+}
+
+// sqrtsd square root of scalar double-precision float
+size_t
+makeSqrtSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeSqrtSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::sqrt, where );
+}
+
+
+// maxsd return the larger of 2 double-precision values
+size_t
+makeMaxSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::max, where );
+}
+
+size_t
+makeMaxSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::max, where );
+}
+
+// minsd return the smaller of 2 double-precision values
+size_t
+makeMinSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::min, where );
+}
+
+size_t
+makeMinSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSDIns( destination, source, XmmOp::min, where );
+}
+
+// cmpsd compare double-precision values with op determined by imm value and store
+//       true of false in destination register. Does not set EFLAGS
+size_t
+makeCmpSD( XmmReg destination, XmmReg source, SDcmp op, Code& where ) {
+  auto i = makeSDIns( destination, source, XmmOp::cmp, where );
+
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+size_t
+makeCmpSD( XmmReg destination, const Mem& source, SDcmp op, Code& where ) {
+  auto i =  makeSDIns( destination, source, XmmOp::cmp, where, false, 1 );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+// comisd compare double-precision values and set EFLAGS
+size_t
+makeComiSDprefix( uint8_t rex, Code& where ) {
+  where.ensure();
+
+  size_t c = 0;
+
+  where.push_back( 0x66 );
+
+  if( rex != 0x40 ) {
+    where.push_back( rex );
+    c++;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( 0x2f );
+
+  return c + 3;
+}
+
+size_t
+makeComiSD( XmmReg destination, XmmReg source, Code& where ) {
+  auto d = static_cast< Register >( destination );
+  auto s = static_cast< Register >( source );
+
+  auto i = makeComiSDprefix( makeRex( false, d, Register::r0, s ), where );
+  where.push_back( makeModRxRm( d, s ) );
+
+  return i + 1;
+}
+
+size_t
+makeComiSD( XmmReg destination, const Mem& source, Code& where ) {
+  auto d = static_cast< Register >( destination );
+
+  auto i = makeComiSDprefix( makeRex( false, d, source ), where );
+  auto j = makeIndirect( d, source, where );
+
+  return i + j;
+}
+
+// true when cvtsi2sd converts a 64 bit integer, which takes REX.W or VEX.W
+static bool
+convertsInt64( OpSize size ) {
+  if( size != OpSize::b32 && size != OpSize::b64 ) {
+    throw "cvtsi2sd has no byte or word form";
+  }
+
+  return size == OpSize::b64;
+}
+
+// cvtsi2sd convert an interger general purpose regisger to a double-precision value in
+//          an xmm register
+size_t
+makeCvtSi2Sd( XmmReg destination, Register source, Code& where, OpSize size ) {
+  auto s = static_cast< XmmReg >( source );
+  return makeSDIns( destination, s, XmmOp::cvtsi2sd, where, convertsInt64( size ) );
+}
+
+size_t
+makeCvtSi2Sd( XmmReg destination, const Mem& source, Code& where, OpSize size ) {
+  return makeSDIns( destination, source, XmmOp::cvtsi2sd, where, convertsInt64( size ) );
+}
+
+// cvtsd2si convert a double precision value in an xmm register to an interger in a
+//          general purpose register
+size_t
+makeCvtSd2Si( Register destination, XmmReg source, Code& where ) {
+  auto d = static_cast< XmmReg >( destination );
+  return makeSDIns( d, source, XmmOp::cvtsd2si, where, true );
+}
+
+size_t
+makeCvtSd2Si( Register destination, const Mem& source, Code& where ) {
+  auto d = static_cast< XmmReg >( destination );
+  return makeSDIns( d, source, XmmOp::cvtsd2si, where, true );
+}
+
+// movq move 64 bits between a general purpose register and an xmm register
+size_t
+makeMovQ( XmmReg destination, Register source, Code& where ) {
+  auto s = static_cast< XmmReg >( source );
+  return makeXmmIns( XmmType::pd, destination, s, XmmOp::movq, where, true );
+}
+
+size_t
+makeMovQ( Register destination, XmmReg source, Code& where ) {
+  auto d = static_cast< XmmReg >( destination );
+  return makeXmmIns( XmmType::pd, source, d, XmmOp::movqStore, where, true );
+}
+
+// ----------------------------------------------------------------------
+// Packed double, packed single and scalar single precision floating point instructions.
+// These share their opcodes with the scalar double forms above; the prefix picks the type.
+
+// movapd aligned packed double move; memory must be 16 byte aligned
+size_t
+makeMovAPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::mova, where );
+}
+
+size_t
+makeMovAPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::mova, where );
+}
+
+size_t
+makeMovAPD( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, source, destination, XmmOp::movaStore, where );
+}
+
+// movupd unaligned packed double move
+size_t
+makeMovUPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovUPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovUPD( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, source, destination, XmmOp::movStore, where );
+}
+
+// movaps aligned packed single move; memory must be 16 byte aligned
+size_t
+makeMovAPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::mova, where );
+}
+
+size_t
+makeMovAPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::mova, where );
+}
+
+size_t
+makeMovAPS( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, source, destination, XmmOp::movaStore, where );
+}
+
+// movups unaligned packed single move
+size_t
+makeMovUPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovUPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovUPS( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, source, destination, XmmOp::movStore, where );
+}
+
+// movss move scalar single-precision between memory and regs
+size_t
+makeMovSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::mov, where );
+}
+
+size_t
+makeMovSS( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, source, destination, XmmOp::movStore, where );
+}
+
+// addpd, addps, addss
+size_t
+makeAddPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::add, where );
+}
+
+size_t
+makeAddPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::add, where );
+}
+
+size_t
+makeAddPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::add, where );
+}
+
+size_t
+makeAddPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::add, where );
+}
+
+size_t
+makeAddSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::add, where );
+}
+
+size_t
+makeAddSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::add, where );
+}
+
+// subpd, subps, subss
+size_t
+makeSubPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::sub, where );
+}
+
+size_t
+makeSubPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::sub, where );
+}
+
+size_t
+makeSubPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::sub, where );
+}
+
+size_t
+makeSubPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::sub, where );
+}
+
+size_t
+makeSubSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::sub, where );
+}
+
+size_t
+makeSubSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::sub, where );
+}
+
+// mulpd, mulps, mulss
+size_t
+makeMulPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::mul, where );
+}
+
+size_t
+makeMulPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::mul, where );
+}
+
+size_t
+makeMulPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::mul, where );
+}
+
+size_t
+makeMulPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::mul, where );
+}
+
+size_t
+makeMulSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::mul, where );
+}
+
+size_t
+makeMulSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::mul, where );
+}
+
+// divpd, divps, divss
+size_t
+makeDivPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::div, where );
+}
+
+size_t
+makeDivPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::div, where );
+}
+
+size_t
+makeDivPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::div, where );
+}
+
+size_t
+makeDivPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::div, where );
+}
+
+size_t
+makeDivSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::div, where );
+}
+
+size_t
+makeDivSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::div, where );
+}
+
+// sqrtpd, sqrtps, sqrtss
+size_t
+makeSqrtPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeSqrtPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeSqrtPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeSqrtPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeSqrtSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeSqrtSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::sqrt, where );
+}
+
+// minpd, minps, minss
+size_t
+makeMinPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::min, where );
+}
+
+size_t
+makeMinPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::min, where );
+}
+
+size_t
+makeMinPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::min, where );
+}
+
+size_t
+makeMinPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::min, where );
+}
+
+size_t
+makeMinSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::min, where );
+}
+
+size_t
+makeMinSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::min, where );
+}
+
+// maxpd, maxps, maxss
+size_t
+makeMaxPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::max, where );
+}
+
+size_t
+makeMaxPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::max, where );
+}
+
+size_t
+makeMaxPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::max, where );
+}
+
+size_t
+makeMaxPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::max, where );
+}
+
+size_t
+makeMaxSS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::max, where );
+}
+
+size_t
+makeMaxSS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::max, where );
+}
+
+// andpd, andnpd, orpd, xorpd and their ps forms: bitwise logic on whole registers
+size_t
+makeAndPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_and, where );
+}
+
+size_t
+makeAndPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_and, where );
+}
+
+size_t
+makeAndPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_and, where );
+}
+
+size_t
+makeAndPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_and, where );
+}
+
+size_t
+makeAndNPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_andn, where );
+}
+
+size_t
+makeAndNPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_andn, where );
+}
+
+size_t
+makeAndNPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_andn, where );
+}
+
+size_t
+makeAndNPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_andn, where );
+}
+
+size_t
+makeOrPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_or, where );
+}
+
+size_t
+makeOrPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_or, where );
+}
+
+size_t
+makeOrPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_or, where );
+}
+
+size_t
+makeOrPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_or, where );
+}
+
+size_t
+makeXorPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_xor, where );
+}
+
+size_t
+makeXorPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::_xor, where );
+}
+
+size_t
+makeXorPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_xor, where );
+}
+
+size_t
+makeXorPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::_xor, where );
+}
+
+// unpcklpd, unpckhpd, unpcklps, unpckhps interleave the low or high halves of two regs
+size_t
+makeUnpckLPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::unpckl, where );
+}
+
+size_t
+makeUnpckLPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::unpckl, where );
+}
+
+size_t
+makeUnpckHPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::unpckh, where );
+}
+
+size_t
+makeUnpckHPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::unpckh, where );
+}
+
+size_t
+makeUnpckLPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::unpckl, where );
+}
+
+size_t
+makeUnpckLPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::unpckl, where );
+}
+
+size_t
+makeUnpckHPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::unpckh, where );
+}
+
+size_t
+makeUnpckHPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::unpckh, where );
+}
+
+// an XmmOp followed by an imm8
+size_t
+makeXmmImm( XmmType type, XmmReg destination, XmmReg source, XmmOp op, uint8_t imm,
+            Code& where ) {
+  auto i = makeXmmIns( type, destination, source, op, where );
+  where.push_back( imm );
+
+  return i + 1;
+}
+
+size_t
+makeXmmImm( XmmType type, XmmReg destination, const Mem& source, XmmOp op, uint8_t imm,
+            Code& where ) {
+  auto i = makeXmmIns( type, destination, source, op, where, false, 1 );
+  where.push_back( imm );
+
+  return i + 1;
+}
+
+// cmppd, cmpps, cmpss compare lanes with op determined by imm value and store all ones
+//                    or all zeros in each lane of destination
+size_t
+makeCmpPD( XmmReg destination, XmmReg source, SDcmp op, Code& where ) {
+  return makeXmmImm( XmmType::pd, destination, source, XmmOp::cmp,
+                     static_cast< uint8_t >( op ), where );
+}
+
+size_t
+makeCmpPD( XmmReg destination, const Mem& source, SDcmp op, Code& where ) {
+  return makeXmmImm( XmmType::pd, destination, source, XmmOp::cmp,
+                     static_cast< uint8_t >( op ), where );
+}
+
+size_t
+makeCmpPS( XmmReg destination, XmmReg source, SDcmp op, Code& where ) {
+  return makeXmmImm( XmmType::ps, destination, source, XmmOp::cmp,
+                     static_cast< uint8_t >( op ), where );
+}
+
+size_t
+makeCmpPS( XmmReg destination, const Mem& source, SDcmp op, Code& where ) {
+  return makeXmmImm( XmmType::ps, destination, source, XmmOp::cmp,
+                     static_cast< uint8_t >( op ), where );
+}
+
+size_t
+makeCmpSS( XmmReg destination, XmmReg source, SDcmp op, Code& where ) {
+  return makeXmmImm( XmmType::ss, destination, source, XmmOp::cmp,
+                     static_cast< uint8_t >( op ), where );
+}
+
+size_t
+makeCmpSS( XmmReg destination, const Mem& source, SDcmp op, Code& where ) {
+  return makeXmmImm( XmmType::ss, destination, source, XmmOp::cmp,
+                     static_cast< uint8_t >( op ), where );
+}
+
+// shufpd, shufps pick lanes from destination (low half) and source (high half) by imm
+size_t
+makeShufPD( XmmReg destination, XmmReg source, uint8_t select, Code& where ) {
+  return makeXmmImm( XmmType::pd, destination, source, XmmOp::shuf, select, where );
+}
+
+size_t
+makeShufPD( XmmReg destination, const Mem& source, uint8_t select, Code& where ) {
+  return makeXmmImm( XmmType::pd, destination, source, XmmOp::shuf, select, where );
+}
+
+size_t
+makeShufPS( XmmReg destination, XmmReg source, uint8_t select, Code& where ) {
+  return makeXmmImm( XmmType::ps, destination, source, XmmOp::shuf, select, where );
+}
+
+size_t
+makeShufPS( XmmReg destination, const Mem& source, uint8_t select, Code& where ) {
+  return makeXmmImm( XmmType::ps, destination, source, XmmOp::shuf, select, where );
+}
+
+// cvtss2sd widen a single-precision value to double-precision
+size_t
+makeCvtSS2SD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::cvt, where );
+}
+
+size_t
+makeCvtSS2SD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ss, destination, source, XmmOp::cvt, where );
+}
+
+// cvtsd2ss narrow a double-precision value to single-precision
+size_t
+makeCvtSD2SS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::sd, destination, source, XmmOp::cvt, where );
+}
+
+size_t
+makeCvtSD2SS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::sd, destination, source, XmmOp::cvt, where );
+}
+
+// cvtps2pd widen the low 2 single-precision lanes to double-precision
+size_t
+makeCvtPS2PD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::cvt, where );
+}
+
+size_t
+makeCvtPS2PD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::ps, destination, source, XmmOp::cvt, where );
+}
+
+// cvtpd2ps narrow 2 double-precision lanes to single-precision
+size_t
+makeCvtPD2PS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::cvt, where );
+}
+
+size_t
+makeCvtPD2PS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeXmmIns( XmmType::pd, destination, source, XmmOp::cvt, where );
+}
+
+// ----------------------------------------------------------------------
+// VEX encoded AVX and AVX2 instructions. The VEX prefix stands in for the mandatory
+// prefix, REX and the 0F escape, and adds a second source register (vvvv) and a bit (L)
+// choosing between xmm and ymm registers.
+
+// the opcode map an op byte is looked up in
+enum struct VexMap {
+  _0f = 1,
+  _0f38,
+  _0f3a
+};
+
+// opcodes only reached through the VEX forms
+enum struct VexOp {
+  permq = 0x00,         // 0F3A
+  broadcastss = 0x18,   // 0F38
+  broadcastsd,
+  pcmpeqq = 0x29,
+  pmulld = 0x40,
+  pbroadcastd = 0x58,
+  pbroadcastq,
+  pcmpgtd = 0x66,       // 0F
+  movdq = 0x6f,
+  shiftd = 0x72,
+  shiftq,
+  pcmpeqd = 0x76,
+  zeroupper,
+  movdqStore = 0x7f,
+  paddq = 0xd4,
+  pand = 0xdb,
+  pandn = 0xdf,
+  por = 0xeb,
+  pxor = 0xef,
+  pmuludq = 0xf4,
+  psubd = 0xfa,
+  psubq,
+  paddd = 0xfe
+};
+
+// the pp field of a VEX prefix stands for the mandatory prefix
+uint8_t
+vexPP( XmmType type ) {
+  switch( type ) {
+  case XmmType::pd:
+    return 1;
+  case XmmType::ss:
+    return 2;
+  case XmmType::sd:
+    return 3;
+  default:
+    return 0;
+  }
+}
+
+// rex carries the R, X and B bits as it would for a legacy encoding; VEX stores them
+// inverted. The 2 byte C5 form is used when X, B and W are clear and the map is 0F.
+size_t
+makeVexPrefix( XmmType type, VexMap map, bool w, bool l, uint8_t vvvv, uint8_t rex,
+               uint8_t op, Code& where ) {
+  where.ensure();
+
+  uint8_t last = ( ( ~vvvv & 0xf ) << 3 ) | ( static_cast< uint8_t >( l ) << 2 ) | vexPP( type );
+  uint8_t R = ( ~rex & 0x4 ) << 5;
+
+  if( map == VexMap::_0f && !w && ( rex & 0x3 ) == 0 ) {
+    where.push_back( 0xc5 );
+    where.push_back( R | last );
+    where.push_back( op );
+
+    return 3;
+  }
+
+  uint8_t XB = ( ~rex & 0x3 ) << 5;
+
+  where.push_back( 0xc4 );
+  where.push_back( R | XB | static_cast< uint8_t >( map ) );
+  where.push_back( ( static_cast< uint8_t >( w ) << 7 ) | last );
+  where.push_back( op );
+
+  return 4;
+}
+
+// destination = source1 op source2; a source1 of 0 encodes an unused vvvv
+size_t
+makeVexIns( XmmType type, VexMap map, uint8_t op, bool l, uint8_t destination,
+            uint8_t source1, uint8_t source2, Code& where, bool w = false ) {
+  auto d = static_cast< Register >( destination );
+  auto s = static_cast< Register >( source2 );
+
+  auto c = makeVexPrefix( type, map, w, l, source1, makeRex( w, d, Register::r0, s ), op,
+                          where );
+  where.push_back( makeModRxRm( d, s ) );
+
+  return c + 1;
+}
+
+size_t
+makeVexIns( XmmType type, VexMap map, uint8_t op, bool l, uint8_t destination,
+            uint8_t source1, const Mem& source2, Code& where, bool w = false,
+            uint8_t immBytes = 0 ) {
+  auto d = static_cast< Register >( destination );
+
+  auto c = makeVexPrefix( type, map, w, l, source1, makeRex( w, d, source2 ), op, where );
+  auto i = makeIndirect( d, source2, where, immBytes );
+
+  return c + i;
+}
+
+size_t
+makeVSDIns( XmmReg destination, XmmReg source1, XmmReg source2, XmmOp op, Code& where ) {
+  return makeVexIns( XmmType::sd, VexMap::_0f, static_cast< uint8_t >( op ), false,
+                     static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                     static_cast< uint8_t >( source2 ), where );
+}
+
+size_t
+makeVSDIns( XmmReg destination, XmmReg source1, const Mem& source2, XmmOp op, Code& where,
+            uint8_t immBytes = 0 ) {
+  return makeVexIns( XmmType::sd, VexMap::_0f, static_cast< uint8_t >( op ), false,
+                     static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                     source2, where, false, immBytes );
+}
+
+// 256 bit floating point forms
+size_t
+makeYmmIns( XmmType type, YmmReg destination, YmmReg source1, YmmReg source2, XmmOp op,
+            Code& where ) {
+  return makeVexIns( type, VexMap::_0f, static_cast< uint8_t >( op ), true,
+                     static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                     static_cast< uint8_t >( source2 ), where );
+}
+
+size_t
+makeYmmIns( XmmType type, YmmReg destination, YmmReg source1, const Mem& source2, XmmOp op,
+            Code& where, uint8_t immBytes = 0 ) {
+  return makeVexIns( type, VexMap::_0f, static_cast< uint8_t >( op ), true,
+                     static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                     source2, where, false, immBytes );
+}
+
+// 256 bit integer forms, which all take the 66 prefix
+size_t
+makeYmmInt( VexMap map, VexOp op, YmmReg destination, YmmReg source1, YmmReg source2,
+            Code& where, bool w = false ) {
+  return makeVexIns( XmmType::pd, map, static_cast< uint8_t >( op ), true,
+                     static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                     static_cast< uint8_t >( source2 ), where, w );
+}
+
+size_t
+makeYmmInt( VexMap map, VexOp op, YmmReg destination, YmmReg source1, const Mem& source2,
+            Code& where, bool w = false, uint8_t immBytes = 0 ) {
+  return makeVexIns( XmmType::pd, map, static_cast< uint8_t >( op ), true,
+                     static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                     source2, where, w, immBytes );
+}
+
+// vmovsd: the register form merges the low lane of source2 into source1
+size_t
+makeVMovSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::mov, where );
+}
+
+size_t
+makeVMovSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeVSDIns( destination, XmmReg::xmm0, source, XmmOp::mov, where );
+}
+
+size_t
+makeVMovSD( const Mem& destination, XmmReg source, Code& where ) {
+  return makeVSDIns( source, XmmReg::xmm0, destination, XmmOp::movStore, where );
+}
+
+// vaddsd
+size_t
+makeVAddSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::add, where );
+}
+
+size_t
+makeVAddSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::add, where );
+}
+
+// vsubsd
+size_t
+makeVSubSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::sub, where );
+}
+
+size_t
+makeVSubSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::sub, where );
+}
+
+// vmulsd
+size_t
+makeVMulSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::mul, where );
+}
+
+size_t
+makeVMulSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::mul, where );
+}
+
+// vdivsd
+size_t
+makeVDivSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::div, where );
+}
+
+size_t
+makeVDivSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::div, where );
+}
+
+// vsqrtsd
+size_t
+makeVSqrtSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::sqrt, where );
+}
+
+size_t
+makeVSqrtSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::sqrt, where );
+}
+
+// vmaxsd
+size_t
+makeVMaxSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::max, where );
+}
+
+size_t
+makeVMaxSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::max, where );
+}
+
+// vminsd
+size_t
+makeVMinSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::min, where );
+}
+
+size_t
+makeVMinSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeVSDIns( destination, source1, source2, XmmOp::min, where );
+}
+
+// vcmpsd
+size_t
+makeVCmpSD( XmmReg destination, XmmReg source1, XmmReg source2, SDcmp op, Code& where ) {
+  auto i = makeVSDIns( destination, source1, source2, XmmOp::cmp, where );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+size_t
+makeVCmpSD( XmmReg destination, XmmReg source1, const Mem& source2, SDcmp op, Code& where ) {
+  auto i = makeVSDIns( destination, source1, source2, XmmOp::cmp, where, 1 );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+// vcomisd
+size_t
+makeVComiSD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f, static_cast< uint8_t >( XmmOp::comi ), false,
+                     static_cast< uint8_t >( destination ), 0, static_cast< uint8_t >( source ),
+                     where );
+}
+
+size_t
+makeVComiSD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f, static_cast< uint8_t >( XmmOp::comi ), false,
+                     static_cast< uint8_t >( destination ), 0, source, where );
+}
+
+// vcvtsi2sd convert a 64 bit integer into the low lane of destination
+size_t
+makeVCvtSi2Sd( XmmReg destination, XmmReg source1, Register source2, Code& where,
+               OpSize size ) {
+  return makeVexIns( XmmType::sd, VexMap::_0f, static_cast< uint8_t >( XmmOp::cvtsi2sd ),
+                     false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                     where, convertsInt64( size ) );
+}
+
+size_t
+makeVCvtSi2Sd( XmmReg destination, XmmReg source1, const Mem& source2, Code& where,
+               OpSize size ) {
+  return makeVexIns( XmmType::sd, VexMap::_0f, static_cast< uint8_t >( XmmOp::cvtsi2sd ),
+                     false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where,
+                     convertsInt64( size ) );
+}
+
+// vcvtsd2si convert the low lane of source to a 64 bit integer
+size_t
+makeVCvtSd2Si( Register destination, XmmReg source, Code& where ) {
+  return makeVexIns( XmmType::sd, VexMap::_0f, static_cast< uint8_t >( XmmOp::cvtsd2si ),
+                     false, static_cast< uint8_t >( destination ), 0,
+                     static_cast< uint8_t >( source ), where, true );
+}
+
+size_t
+makeVCvtSd2Si( Register destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::sd, VexMap::_0f, static_cast< uint8_t >( XmmOp::cvtsd2si ),
+                     false, static_cast< uint8_t >( destination ), 0, source, where, true );
+}
+
+// vzeroupper clear the upper halves of all ymm registers
+size_t
+makeVZeroUpper( Code& where ) {
+  return makeVexPrefix( XmmType::ps, VexMap::_0f, false, false, 0, 0x40,
+                        static_cast< uint8_t >( VexOp::zeroupper ), where );
+}
+
+// vmovapd aligned packed double move; memory must be 32 byte aligned
+size_t
+makeVMovAPD( YmmReg destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, YmmReg::ymm0, source, XmmOp::mova, where );
+}
+
+size_t
+makeVMovAPD( YmmReg destination, const Mem& source, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, YmmReg::ymm0, source, XmmOp::mova, where );
+}
+
+size_t
+makeVMovAPD( const Mem& destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::pd, source, YmmReg::ymm0, destination, XmmOp::movaStore, where );
+}
+
+// vmovupd unaligned packed double move
+size_t
+makeVMovUPD( YmmReg destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, YmmReg::ymm0, source, XmmOp::mov, where );
+}
+
+size_t
+makeVMovUPD( YmmReg destination, const Mem& source, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, YmmReg::ymm0, source, XmmOp::mov, where );
+}
+
+size_t
+makeVMovUPD( const Mem& destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::pd, source, YmmReg::ymm0, destination, XmmOp::movStore, where );
+}
+
+// vmovaps aligned packed single move; memory must be 32 byte aligned
+size_t
+makeVMovAPS( YmmReg destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, YmmReg::ymm0, source, XmmOp::mova, where );
+}
+
+size_t
+makeVMovAPS( YmmReg destination, const Mem& source, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, YmmReg::ymm0, source, XmmOp::mova, where );
+}
+
+size_t
+makeVMovAPS( const Mem& destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::ps, source, YmmReg::ymm0, destination, XmmOp::movaStore, where );
+}
+
+// vmovups unaligned packed single move
+size_t
+makeVMovUPS( YmmReg destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, YmmReg::ymm0, source, XmmOp::mov, where );
+}
+
+size_t
+makeVMovUPS( YmmReg destination, const Mem& source, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, YmmReg::ymm0, source, XmmOp::mov, where );
+}
+
+size_t
+makeVMovUPS( const Mem& destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::ps, source, YmmReg::ymm0, destination, XmmOp::movStore, where );
+}
+
+// vaddpd, vaddps
+size_t
+makeVAddPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::add, where );
+}
+
+size_t
+makeVAddPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::add, where );
+}
+
+size_t
+makeVAddPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::add, where );
+}
+
+size_t
+makeVAddPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::add, where );
+}
+
+// vsubpd, vsubps
+size_t
+makeVSubPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::sub, where );
+}
+
+size_t
+makeVSubPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::sub, where );
+}
+
+size_t
+makeVSubPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::sub, where );
+}
+
+size_t
+makeVSubPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::sub, where );
+}
+
+// vmulpd, vmulps
+size_t
+makeVMulPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::mul, where );
+}
+
+size_t
+makeVMulPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::mul, where );
+}
+
+size_t
+makeVMulPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::mul, where );
+}
+
+size_t
+makeVMulPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::mul, where );
+}
+
+// vdivpd, vdivps
+size_t
+makeVDivPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::div, where );
+}
+
+size_t
+makeVDivPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::div, where );
+}
+
+size_t
+makeVDivPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::div, where );
+}
+
+size_t
+makeVDivPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::div, where );
+}
+
+// vminpd, vminps
+size_t
+makeVMinPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::min, where );
+}
+
+size_t
+makeVMinPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::min, where );
+}
+
+size_t
+makeVMinPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::min, where );
+}
+
+size_t
+makeVMinPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::min, where );
+}
+
+// vmaxpd, vmaxps
+size_t
+makeVMaxPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::max, where );
+}
+
+size_t
+makeVMaxPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::max, where );
+}
+
+size_t
+makeVMaxPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::max, where );
+}
+
+size_t
+makeVMaxPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::max, where );
+}
+
+// vandpd, vandps
+size_t
+makeVAndPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_and, where );
+}
+
+size_t
+makeVAndPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_and, where );
+}
+
+size_t
+makeVAndPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_and, where );
+}
+
+size_t
+makeVAndPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_and, where );
+}
+
+// vandnpd, vandnps
+size_t
+makeVAndNPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_andn, where );
+}
+
+size_t
+makeVAndNPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_andn, where );
+}
+
+size_t
+makeVAndNPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_andn, where );
+}
+
+size_t
+makeVAndNPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_andn, where );
+}
+
+// vorpd, vorps
+size_t
+makeVOrPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_or, where );
+}
+
+size_t
+makeVOrPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_or, where );
+}
+
+size_t
+makeVOrPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_or, where );
+}
+
+size_t
+makeVOrPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_or, where );
+}
+
+// vxorpd, vxorps
+size_t
+makeVXorPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_xor, where );
+}
+
+size_t
+makeVXorPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::_xor, where );
+}
+
+size_t
+makeVXorPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_xor, where );
+}
+
+size_t
+makeVXorPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::_xor, where );
+}
+
+// vsqrtpd, vsqrtps
+size_t
+makeVSqrtPD( YmmReg destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, YmmReg::ymm0, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeVSqrtPD( YmmReg destination, const Mem& source, Code& where ) {
+  return makeYmmIns( XmmType::pd, destination, YmmReg::ymm0, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeVSqrtPS( YmmReg destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, YmmReg::ymm0, source, XmmOp::sqrt, where );
+}
+
+size_t
+makeVSqrtPS( YmmReg destination, const Mem& source, Code& where ) {
+  return makeYmmIns( XmmType::ps, destination, YmmReg::ymm0, source, XmmOp::sqrt, where );
+}
+
+// vcmppd, vcmpps
+size_t
+makeVCmpPD( YmmReg destination, YmmReg source1, YmmReg source2, SDcmp op, Code& where ) {
+  auto i = makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::cmp, where );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+size_t
+makeVCmpPD( YmmReg destination, YmmReg source1, const Mem& source2, SDcmp op, Code& where ) {
+  auto i = makeYmmIns( XmmType::pd, destination, source1, source2, XmmOp::cmp, where, 1 );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+size_t
+makeVCmpPS( YmmReg destination, YmmReg source1, YmmReg source2, SDcmp op, Code& where ) {
+  auto i = makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::cmp, where );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+size_t
+makeVCmpPS( YmmReg destination, YmmReg source1, const Mem& source2, SDcmp op, Code& where ) {
+  auto i = makeYmmIns( XmmType::ps, destination, source1, source2, XmmOp::cmp, where, 1 );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+// vbroadcastsd, vbroadcastss copy one scalar into every lane; the register forms are AVX2
+size_t
+makeVBroadcastSD( YmmReg destination, XmmReg source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastsd ), true,
+                     static_cast< uint8_t >( destination ), 0, static_cast< uint8_t >( source ),
+                     where );
+}
+
+size_t
+makeVBroadcastSD( YmmReg destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastsd ), true,
+                     static_cast< uint8_t >( destination ), 0, source, where );
+}
+
+size_t
+makeVBroadcastSS( YmmReg destination, XmmReg source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastss ), true,
+                     static_cast< uint8_t >( destination ), 0, static_cast< uint8_t >( source ),
+                     where );
+}
+
+size_t
+makeVBroadcastSS( YmmReg destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastss ), true,
+                     static_cast< uint8_t >( destination ), 0, source, where );
+}
+
+// AVX2 256 bit integer instructions
+
+// vmovdqa aligned integer move; memory must be 32 byte aligned
+size_t
+makeVMovDQA( YmmReg destination, YmmReg source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f, static_cast< uint8_t >( VexOp::movdq ), true,
+                     static_cast< uint8_t >( destination ), 0, static_cast< uint8_t >( source ),
+                     where );
+}
+
+size_t
+makeVMovDQA( YmmReg destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f, static_cast< uint8_t >( VexOp::movdq ), true,
+                     static_cast< uint8_t >( destination ), 0, source, where );
+}
+
+size_t
+makeVMovDQA( const Mem& destination, YmmReg source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f, static_cast< uint8_t >( VexOp::movdqStore ),
+                     true, static_cast< uint8_t >( source ), 0, destination, where );
+}
+
+// vmovdqu unaligned integer move
+size_t
+makeVMovDQU( YmmReg destination, YmmReg source, Code& where ) {
+  return makeVexIns( XmmType::ss, VexMap::_0f, static_cast< uint8_t >( VexOp::movdq ), true,
+                     static_cast< uint8_t >( destination ), 0, static_cast< uint8_t >( source ),
+                     where );
+}
+
+size_t
+makeVMovDQU( YmmReg destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::ss, VexMap::_0f, static_cast< uint8_t >( VexOp::movdq ), true,
+                     static_cast< uint8_t >( destination ), 0, source, where );
+}
+
+size_t
+makeVMovDQU( const Mem& destination, YmmReg source, Code& where ) {
+  return makeVexIns( XmmType::ss, VexMap::_0f, static_cast< uint8_t >( VexOp::movdqStore ),
+                     true, static_cast< uint8_t >( source ), 0, destination, where );
+}
+
+// vpaddd
+size_t
+makeVPAddD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::paddd, destination, source1, source2, where );
+}
+
+size_t
+makeVPAddD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::paddd, destination, source1, source2, where );
+}
+
+// vpaddq
+size_t
+makeVPAddQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::paddq, destination, source1, source2, where );
+}
+
+size_t
+makeVPAddQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::paddq, destination, source1, source2, where );
+}
+
+// vpsubd
+size_t
+makeVPSubD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::psubd, destination, source1, source2, where );
+}
+
+size_t
+makeVPSubD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::psubd, destination, source1, source2, where );
+}
+
+// vpsubq
+size_t
+makeVPSubQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::psubq, destination, source1, source2, where );
+}
+
+size_t
+makeVPSubQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::psubq, destination, source1, source2, where );
+}
+
+// vpmulld keep the low 32 bits of each product
+size_t
+makeVPMulLD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f38, VexOp::pmulld, destination, source1, source2, where );
+}
+
+size_t
+makeVPMulLD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f38, VexOp::pmulld, destination, source1, source2, where );
+}
+
+// vpmuludq multiply the even unsigned dwords into qwords
+size_t
+makeVPMulUDQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pmuludq, destination, source1, source2, where );
+}
+
+size_t
+makeVPMulUDQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pmuludq, destination, source1, source2, where );
+}
+
+// vpand
+size_t
+makeVPAnd( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pand, destination, source1, source2, where );
+}
+
+size_t
+makeVPAnd( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pand, destination, source1, source2, where );
+}
+
+// vpandn
+size_t
+makeVPAndN( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pandn, destination, source1, source2, where );
+}
+
+size_t
+makeVPAndN( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pandn, destination, source1, source2, where );
+}
+
+// vpor
+size_t
+makeVPOr( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::por, destination, source1, source2, where );
+}
+
+size_t
+makeVPOr( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::por, destination, source1, source2, where );
+}
+
+// vpxor
+size_t
+makeVPXor( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pxor, destination, source1, source2, where );
+}
+
+size_t
+makeVPXor( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pxor, destination, source1, source2, where );
+}
+
+// vpcmpeqd
+size_t
+makeVPCmpEqD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pcmpeqd, destination, source1, source2, where );
+}
+
+size_t
+makeVPCmpEqD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pcmpeqd, destination, source1, source2, where );
+}
+
+// vpcmpeqq
+size_t
+makeVPCmpEqQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f38, VexOp::pcmpeqq, destination, source1, source2, where );
+}
+
+size_t
+makeVPCmpEqQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f38, VexOp::pcmpeqq, destination, source1, source2, where );
+}
+
+// vpcmpgtd signed compare
+size_t
+makeVPCmpGtD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pcmpgtd, destination, source1, source2, where );
+}
+
+size_t
+makeVPCmpGtD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeYmmInt( VexMap::_0f, VexOp::pcmpgtd, destination, source1, source2, where );
+}
+
+// vpslld, vpsrld, vpsrad, vpsllq, vpsrlq shift each lane by an immediate count. The
+// destination goes in vvvv and the ModR/M reg field picks the shift.
+size_t
+makeVShiftImm( VexOp op, uint8_t shift, YmmReg destination, YmmReg source, uint8_t count,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f, static_cast< uint8_t >( op ), true, shift,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source ),
+                       where );
+  where.push_back( count );
+
+  return i + 1;
+}
+
+size_t
+makeVPSllD( YmmReg destination, YmmReg source, uint8_t count, Code& where ) {
+  return makeVShiftImm( VexOp::shiftd, 6, destination, source, count, where );
+}
+
+size_t
+makeVPSrlD( YmmReg destination, YmmReg source, uint8_t count, Code& where ) {
+  return makeVShiftImm( VexOp::shiftd, 2, destination, source, count, where );
+}
+
+size_t
+makeVPSraD( YmmReg destination, YmmReg source, uint8_t count, Code& where ) {
+  return makeVShiftImm( VexOp::shiftd, 4, destination, source, count, where );
+}
+
+size_t
+makeVPSllQ( YmmReg destination, YmmReg source, uint8_t count, Code& where ) {
+  return makeVShiftImm( VexOp::shiftq, 6, destination, source, count, where );
+}
+
+size_t
+makeVPSrlQ( YmmReg destination, YmmReg source, uint8_t count, Code& where ) {
+  return makeVShiftImm( VexOp::shiftq, 2, destination, source, count, where );
+}
+
+// vpbroadcastd, vpbroadcastq copy the low lane of source into every lane
+size_t
+makeVPBroadcastD( YmmReg destination, XmmReg source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::pbroadcastd ), true,
+                     static_cast< uint8_t >( destination ), 0, static_cast< uint8_t >( source ),
+                     where );
+}
+
+size_t
+makeVPBroadcastD( YmmReg destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::pbroadcastd ), true,
+                     static_cast< uint8_t >( destination ), 0, source, where );
+}
+
+size_t
+makeVPBroadcastQ( YmmReg destination, XmmReg source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::pbroadcastq ), true,
+                     static_cast< uint8_t >( destination ), 0, static_cast< uint8_t >( source ),
+                     where );
+}
+
+size_t
+makeVPBroadcastQ( YmmReg destination, const Mem& source, Code& where ) {
+  return makeVexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::pbroadcastq ), true,
+                     static_cast< uint8_t >( destination ), 0, source, where );
+}
+
+// vpermq each 2 bit field of select picks the source qword for that lane
+size_t
+makeVPermQ( YmmReg destination, YmmReg source, uint8_t select, Code& where ) {
+  auto i = makeYmmInt( VexMap::_0f3a, VexOp::permq, destination, YmmReg::ymm0, source, where,
+                       true );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+size_t
+makeVPermQ( YmmReg destination, const Mem& source, uint8_t select, Code& where ) {
+  auto i = makeYmmInt( VexMap::_0f3a, VexOp::permq, destination, YmmReg::ymm0, source, where,
+                       true, 1 );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+// FMA3 fused multiply add. The packed op is the FmaOp, the scalar op the one after it,
+// and W picks double over single precision.
+size_t
+makeFmaIns( FmaOp op, bool scalar, bool x64, bool l, uint8_t destination, uint8_t source1,
+            uint8_t source2, Code& where ) {
+  auto o = static_cast< uint8_t >( op ) + static_cast< uint8_t >( scalar );
+
+  return makeVexIns( XmmType::pd, VexMap::_0f38, o, l, destination, source1, source2, where,
+                     x64 );
+}
+
+size_t
+makeFmaIns( FmaOp op, bool scalar, bool x64, bool l, uint8_t destination, uint8_t source1,
+            const Mem& source2, Code& where ) {
+  auto o = static_cast< uint8_t >( op ) + static_cast< uint8_t >( scalar );
+
+  return makeVexIns( XmmType::pd, VexMap::_0f38, o, l, destination, source1, source2, where,
+                     x64 );
+}
+
+size_t
+makeVFmaSD( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeFmaIns( op, true, true, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                     where );
+}
+
+size_t
+makeVFmaSD( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeFmaIns( op, true, true, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makeVFmaSS( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeFmaIns( op, true, false, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                     where );
+}
+
+size_t
+makeVFmaSS( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeFmaIns( op, true, false, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makeVFmaPD( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeFmaIns( op, false, true, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                     where );
+}
+
+size_t
+makeVFmaPD( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeFmaIns( op, false, true, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makeVFmaPD( FmaOp op, YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeFmaIns( op, false, true, true, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                     where );
+}
+
+size_t
+makeVFmaPD( FmaOp op, YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeFmaIns( op, false, true, true, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makeVFmaPS( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where ) {
+  return makeFmaIns( op, false, false, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                     where );
+}
+
+size_t
+makeVFmaPS( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where ) {
+  return makeFmaIns( op, false, false, false, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makeVFmaPS( FmaOp op, YmmReg destination, YmmReg source1, YmmReg source2, Code& where ) {
+  return makeFmaIns( op, false, false, true, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                     where );
+}
+
+size_t
+makeVFmaPS( FmaOp op, YmmReg destination, YmmReg source1, const Mem& source2, Code& where ) {
+  return makeFmaIns( op, false, false, true, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+// ----------------------------------------------------------------------
+// EVEX encoded AVX-512 instructions. EVEX widens VEX with a fifth bit for each register
+// number, an opmask with a zeroing bit, an embedded broadcast bit and a second length bit.
+// Everything here works on 512 bit zmm registers.
+
+// the 4 byte EVEX prefix. reg and vvvv are 5 bit register numbers; x and b are bits 4 and
+// 3 of a register rm, or the REX X and B bits of a memory operand
+size_t
+makeEvexPrefix( XmmType type, VexMap map, bool w, uint8_t reg, uint8_t vvvv, uint8_t x,
+                uint8_t b, Mask mask, bool broadcast, uint8_t op, Code& where ) {
+  where.ensure();
+
+  uint8_t p0 = ( ( ~reg & 0x8 ) << 4 ) | ( ( ~x & 1 ) << 6 ) | ( ( ~b & 1 ) << 5 ) |
+               ( ~reg & 0x10 ) | static_cast< uint8_t >( map );
+  uint8_t p1 = ( static_cast< uint8_t >( w ) << 7 ) | ( ( ~vvvv & 0xf ) << 3 ) | 0x4 |
+               vexPP( type );
+  uint8_t p2 = ( static_cast< uint8_t >( mask.zero ) << 7 ) | ( 2 << 5 ) |
+               ( static_cast< uint8_t >( broadcast ) << 4 ) | ( ( ~vvvv & 0x10 ) >> 1 ) |
+               static_cast< uint8_t >( mask.k );
+
+  where.push_back( 0x62 );
+  where.push_back( p0 );
+  where.push_back( p1 );
+  where.push_back( p2 );
+  where.push_back( op );
+
+  return 5;
+}
+
+size_t
+makeEvexIns( XmmType type, VexMap map, uint8_t op, bool w, uint8_t destination,
+             uint8_t source1, uint8_t source2, Code& where, Mask mask ) {
+  auto c = makeEvexPrefix( type, map, w, destination, source1, source2 >> 4, source2 >> 3,
+                           mask, false, op, where );
+  where.push_back( makeModRxRm( destination, static_cast< Register >( source2 ) ) );
+
+  return c + 1;
+}
+
+// n is the size of the memory operand, which scales a one byte displacement
+size_t
+makeEvexIns( XmmType type, VexMap map, uint8_t op, bool w, uint8_t destination,
+             uint8_t source1, const Mem& source2, Code& where, Mask mask, bool broadcast,
+             uint8_t n, uint8_t immBytes = 0 ) {
+  auto rex = makeRex( false, Register::r0, source2 );
+
+  auto c = makeEvexPrefix( type, map, w, destination, source1, rex >> 1, rex, mask, broadcast,
+                           op, where );
+  auto i = makeIndirect( destination, source2, where, immBytes, n );
+
+  return c + i;
+}
+
+// the memory operand size of a full vector op: the whole register, or one element when
+// it is broadcast
+uint8_t
+evexN( bool w, bool broadcast ) {
+  if( broadcast ) {
+    return w ? 8 : 4;
+  }
+
+  return 64;
+}
+
+size_t
+makeZmmIns( XmmType type, bool w, uint8_t op, ZmmReg destination, ZmmReg source1,
+            ZmmReg source2, Code& where, Mask mask ) {
+  return makeEvexIns( type, VexMap::_0f, op, w, static_cast< uint8_t >( destination ),
+                      static_cast< uint8_t >( source1 ), static_cast< uint8_t >( source2 ),
+                      where, mask );
+}
+
+size_t
+makeZmmIns( XmmType type, bool w, uint8_t op, ZmmReg destination, ZmmReg source1,
+            const Mem& source2, Code& where, Mask mask, bool broadcast = false,
+            uint8_t immBytes = 0 ) {
+  return makeEvexIns( type, VexMap::_0f, op, w, static_cast< uint8_t >( destination ),
+                      static_cast< uint8_t >( source1 ), source2, where, mask, broadcast,
+                      evexN( w, broadcast ), immBytes );
+}
+
+// a store can only merge
+size_t
+makeZmmStore( XmmType type, bool w, uint8_t op, const Mem& destination, ZmmReg source,
+              Code& where, Mask mask ) {
+  if( mask.zero ) {
+    throw "a store can't use a zeroing mask";
+  }
+
+  return makeZmmIns( type, w, op, source, ZmmReg::zmm0, destination, where, mask );
+}
+
+// vmovapd, vmovaps need 64 byte aligned memory
+size_t
+makeVMovAPD( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::mova ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovAPD( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::mova ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovAPD( const Mem& destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmStore( XmmType::pd, true, static_cast< uint8_t >( XmmOp::movaStore ), destination,
+                       source, where, mask );
+}
+
+size_t
+makeVMovUPD( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::mov ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovUPD( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::mov ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovUPD( const Mem& destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmStore( XmmType::pd, true, static_cast< uint8_t >( XmmOp::movStore ), destination,
+                       source, where, mask );
+}
+
+size_t
+makeVMovAPS( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::mova ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovAPS( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::mova ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovAPS( const Mem& destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmStore( XmmType::ps, false, static_cast< uint8_t >( XmmOp::movaStore ), destination,
+                       source, where, mask );
+}
+
+size_t
+makeVMovUPS( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::mov ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovUPS( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::mov ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovUPS( const Mem& destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmStore( XmmType::ps, false, static_cast< uint8_t >( XmmOp::movStore ), destination,
+                       source, where, mask );
+}
+
+// vmovdqu32, vmovdqu64 unaligned integer moves
+size_t
+makeVMovDQU32( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ss, false, static_cast< uint8_t >( VexOp::movdq ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovDQU32( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ss, false, static_cast< uint8_t >( VexOp::movdq ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovDQU32( const Mem& destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmStore( XmmType::ss, false, static_cast< uint8_t >( VexOp::movdqStore ), destination,
+                       source, where, mask );
+}
+
+size_t
+makeVMovDQU64( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ss, true, static_cast< uint8_t >( VexOp::movdq ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovDQU64( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ss, true, static_cast< uint8_t >( VexOp::movdq ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVMovDQU64( const Mem& destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmStore( XmmType::ss, true, static_cast< uint8_t >( VexOp::movdqStore ), destination,
+                       source, where, mask );
+}
+
+// vaddpd, vaddps
+size_t
+makeVAddPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::add ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVAddPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::add ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVAddPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::add ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVAddPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::add ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+// vsubpd, vsubps
+size_t
+makeVSubPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::sub ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVSubPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::sub ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVSubPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::sub ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVSubPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::sub ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+// vmulpd, vmulps
+size_t
+makeVMulPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::mul ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVMulPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::mul ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVMulPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::mul ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVMulPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::mul ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+// vdivpd, vdivps
+size_t
+makeVDivPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::div ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVDivPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::div ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVDivPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::div ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVDivPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::div ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+// vminpd, vminps
+size_t
+makeVMinPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::min ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVMinPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::min ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVMinPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::min ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVMinPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::min ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+// vmaxpd, vmaxps
+size_t
+makeVMaxPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::max ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVMaxPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::max ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVMaxPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::max ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVMaxPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::max ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+// vsqrtpd, vsqrtps
+size_t
+makeVSqrtPD( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::sqrt ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVSqrtPD( ZmmReg destination, const Mem& source, Code& where, Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( XmmOp::sqrt ), destination,
+                     ZmmReg::zmm0, source, where, mask, broadcast );
+}
+
+size_t
+makeVSqrtPS( ZmmReg destination, ZmmReg source, Code& where, Mask mask ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::sqrt ), destination,
+                     ZmmReg::zmm0, source, where, mask );
+}
+
+size_t
+makeVSqrtPS( ZmmReg destination, const Mem& source, Code& where, Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::ps, false, static_cast< uint8_t >( XmmOp::sqrt ), destination,
+                     ZmmReg::zmm0, source, where, mask, broadcast );
+}
+
+// fused multiply add on 8 doubles or 16 singles
+size_t
+makeVFmaPD( FmaOp op, ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( op ), true,
+                      static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                      static_cast< uint8_t >( source2 ), where, mask );
+}
+
+size_t
+makeVFmaPD( FmaOp op, ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( op ), true,
+                      static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                      source2, where, mask, broadcast, evexN( true, broadcast ) );
+}
+
+size_t
+makeVFmaPS( FmaOp op, ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( op ), false,
+                      static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                      static_cast< uint8_t >( source2 ), where, mask );
+}
+
+size_t
+makeVFmaPS( FmaOp op, ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( op ), false,
+                      static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                      source2, where, mask, broadcast, evexN( false, broadcast ) );
+}
+
+// vcmppd, vcmpps set one bit of destination per lane
+size_t
+makeZmmCmp( XmmType type, bool w, KReg destination, ZmmReg source1, ZmmReg source2,
+            SDcmp op, Code& where, Mask mask ) {
+  if( mask.zero ) {
+    throw "a compare into an opmask can't use a zeroing mask";
+  }
+
+  auto i = makeZmmIns( type, w, static_cast< uint8_t >( XmmOp::cmp ),
+                       static_cast< ZmmReg >( destination ), source1, source2, where, mask );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+size_t
+makeZmmCmp( XmmType type, bool w, KReg destination, ZmmReg source1, const Mem& source2,
+            SDcmp op, Code& where, Mask mask, bool broadcast ) {
+  if( mask.zero ) {
+    throw "a compare into an opmask can't use a zeroing mask";
+  }
+
+  auto i = makeZmmIns( type, w, static_cast< uint8_t >( XmmOp::cmp ),
+                       static_cast< ZmmReg >( destination ), source1, source2, where, mask,
+                       broadcast, 1 );
+  where.push_back( static_cast< uint8_t >( op ) );
+
+  return i + 1;
+}
+
+size_t
+makeVCmpPD( KReg destination, ZmmReg source1, ZmmReg source2, SDcmp op, Code& where,
+            Mask mask ) {
+  return makeZmmCmp( XmmType::pd, true, destination, source1, source2, op, where, mask );
+}
+
+size_t
+makeVCmpPD( KReg destination, ZmmReg source1, const Mem& source2, SDcmp op, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmCmp( XmmType::pd, true, destination, source1, source2, op, where, mask,
+                     broadcast );
+}
+
+size_t
+makeVCmpPS( KReg destination, ZmmReg source1, ZmmReg source2, SDcmp op, Code& where,
+            Mask mask ) {
+  return makeZmmCmp( XmmType::ps, false, destination, source1, source2, op, where, mask );
+}
+
+size_t
+makeVCmpPS( KReg destination, ZmmReg source1, const Mem& source2, SDcmp op, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmCmp( XmmType::ps, false, destination, source1, source2, op, where, mask,
+                     broadcast );
+}
+
+// vbroadcastsd, vbroadcastss copy one scalar into every lane
+size_t
+makeVBroadcastSD( ZmmReg destination, XmmReg source, Code& where, Mask mask ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastsd ),
+                      true, static_cast< uint8_t >( destination ), 0,
+                      static_cast< uint8_t >( source ), where, mask );
+}
+
+size_t
+makeVBroadcastSD( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastsd ),
+                      true, static_cast< uint8_t >( destination ), 0, source, where, mask,
+                      false, 8 );
+}
+
+size_t
+makeVBroadcastSS( ZmmReg destination, XmmReg source, Code& where, Mask mask ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastss ),
+                      false, static_cast< uint8_t >( destination ), 0,
+                      static_cast< uint8_t >( source ), where, mask );
+}
+
+size_t
+makeVBroadcastSS( ZmmReg destination, const Mem& source, Code& where, Mask mask ) {
+  return makeEvexIns( XmmType::pd, VexMap::_0f38, static_cast< uint8_t >( VexOp::broadcastss ),
+                      false, static_cast< uint8_t >( destination ), 0, source, where, mask,
+                      false, 4 );
+}
+
+// integer lane-wise ops on dword (D) or qword (Q) lanes
+size_t
+makeVPAddD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::paddd ), destination,
+                     source1, source2, where, mask );
+}
+
+size_t
+makeVPAddD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::paddd ), destination,
+                     source1, source2, where, mask, broadcast );
+}
+
+size_t
+makeVPAddQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::paddq ), destination,
+                     source1, source2, where, mask );
+}
+
+size_t
+makeVPAddQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::paddq ), destination,
+                     source1, source2, where, mask, broadcast );
+}
+
+size_t
+makeVPSubD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::psubd ), destination,
+                     source1, source2, where, mask );
+}
+
+size_t
+makeVPSubD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::psubd ), destination,
+                     source1, source2, where, mask, broadcast );
+}
+
+size_t
+makeVPSubQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::psubq ), destination,
+                     source1, source2, where, mask );
+}
+
+size_t
+makeVPSubQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::psubq ), destination,
+                     source1, source2, where, mask, broadcast );
+}
+
+size_t
+makeVPAndD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::pand ), destination,
+                     source1, source2, where, mask );
+}
+
+size_t
+makeVPAndD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::pand ), destination,
+                     source1, source2, where, mask, broadcast );
+}
+
+size_t
+makeVPAndQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::pand ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVPAndQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::pand ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVPOrD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+           Mask mask ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::por ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVPOrD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+           Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::por ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVPOrQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+           Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::por ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVPOrQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+           Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::por ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+size_t
+makeVPXorD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::pxor ), destination,
+                     source1, source2, where, mask );
+}
+
+size_t
+makeVPXorD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, false, static_cast< uint8_t >( VexOp::pxor ), destination,
+                     source1, source2, where, mask, broadcast );
+}
+
+size_t
+makeVPXorQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::pxor ), destination, source1,
+                     source2, where, mask );
+}
+
+size_t
+makeVPXorQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask, bool broadcast ) {
+  return makeZmmIns( XmmType::pd, true, static_cast< uint8_t >( VexOp::pxor ), destination, source1,
+                     source2, where, mask, broadcast );
+}
+
+// kmovb, kmovw, kmovd, kmovq move between an opmask and a general purpose register
+size_t
+makeKMov( XmmType type, bool w, KReg destination, Register source, Code& where ) {
+  return makeVexIns( type, VexMap::_0f, 0x92, false, static_cast< uint8_t >( destination ), 0,
+                     static_cast< uint8_t >( source ), where, w );
+}
+
+size_t
+makeKMov( XmmType type, bool w, Register destination, KReg source, Code& where ) {
+  return makeVexIns( type, VexMap::_0f, 0x93, false, static_cast< uint8_t >( destination ), 0,
+                     static_cast< uint8_t >( source ), where, w );
+}
+
+size_t
+makeKMovB( KReg destination, Register source, Code& where ) {
+  return makeKMov( XmmType::pd, false, destination, source, where );
+}
+
+size_t
+makeKMovB( Register destination, KReg source, Code& where ) {
+  return makeKMov( XmmType::pd, false, destination, source, where );
+}
+
+size_t
+makeKMovW( KReg destination, Register source, Code& where ) {
+  return makeKMov( XmmType::ps, false, destination, source, where );
+}
+
+size_t
+makeKMovW( Register destination, KReg source, Code& where ) {
+  return makeKMov( XmmType::ps, false, destination, source, where );
+}
+
+size_t
+makeKMovD( KReg destination, Register source, Code& where ) {
+  return makeKMov( XmmType::sd, false, destination, source, where );
+}
+
+size_t
+makeKMovD( Register destination, KReg source, Code& where ) {
+  return makeKMov( XmmType::sd, false, destination, source, where );
+}
+
+size_t
+makeKMovQ( KReg destination, Register source, Code& where ) {
+  return makeKMov( XmmType::sd, true, destination, source, where );
+}
+
+size_t
+makeKMovQ( Register destination, KReg source, Code& where ) {
+  return makeKMov( XmmType::sd, true, destination, source, where );
+}
+
+// ----------------------------------------------------------------------
+// Bit manipulation. BMI1 and BMI2 are VEX encoded with W set for 64 bit operands.
+
+size_t
+makeBmiIns( XmmType type, VexMap map, uint8_t op, uint8_t reg, uint8_t vvvv, Register source,
+            Code& where ) {
+  return makeVexIns( type, map, op, false, reg, vvvv, static_cast< uint8_t >( source ), where,
+                     true );
+}
+
+size_t
+makeBmiIns( XmmType type, VexMap map, uint8_t op, uint8_t reg, uint8_t vvvv,
+            const Mem& source, Code& where, uint8_t immBytes = 0 ) {
+  return makeVexIns( type, map, op, false, reg, vvvv, source, where, true, immBytes );
+}
+
+// andn destination = ~source1 & source2
+size_t
+makeAndN( Register destination, Register source1, Register source2, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf2, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makeAndN( Register destination, Register source1, const Mem& source2, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf2, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+// bextr extract a bit field from source; control bits 7:0 are the start, 15:8 the length
+size_t
+makeBExtr( Register destination, Register source, Register control, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( control ), source, where );
+}
+
+size_t
+makeBExtr( Register destination, const Mem& source, Register control, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( control ), source, where );
+}
+
+// blsr clear the lowest set bit
+size_t
+makeBlsR( Register destination, Register source, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf3, 1,
+                     static_cast< uint8_t >( destination ), source, where );
+}
+
+size_t
+makeBlsR( Register destination, const Mem& source, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf3, 1,
+                     static_cast< uint8_t >( destination ), source, where );
+}
+
+// blsi keep only the lowest set bit
+size_t
+makeBlsI( Register destination, Register source, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf3, 3,
+                     static_cast< uint8_t >( destination ), source, where );
+}
+
+size_t
+makeBlsI( Register destination, const Mem& source, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf3, 3,
+                     static_cast< uint8_t >( destination ), source, where );
+}
+
+// blsmsk set every bit up to and including the lowest set bit
+size_t
+makeBlsMsk( Register destination, Register source, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf3, 2,
+                     static_cast< uint8_t >( destination ), source, where );
+}
+
+size_t
+makeBlsMsk( Register destination, const Mem& source, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf3, 2,
+                     static_cast< uint8_t >( destination ), source, where );
+}
+
+// bzhi clear the bits of source from bit index up
+size_t
+makeBzhi( Register destination, Register source, Register index, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf5, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( index ), source, where );
+}
+
+size_t
+makeBzhi( Register destination, const Mem& source, Register index, Code& where ) {
+  return makeBmiIns( XmmType::ps, VexMap::_0f38, 0xf5, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( index ), source, where );
+}
+
+// pdep scatter the low bits of source1 to the set bit positions of the mask source2
+size_t
+makePDep( Register destination, Register source1, Register source2, Code& where ) {
+  return makeBmiIns( XmmType::sd, VexMap::_0f38, 0xf5, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makePDep( Register destination, Register source1, const Mem& source2, Code& where ) {
+  return makeBmiIns( XmmType::sd, VexMap::_0f38, 0xf5, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+// pext gather the bits of source1 at the set bit positions of the mask source2
+size_t
+makePExt( Register destination, Register source1, Register source2, Code& where ) {
+  return makeBmiIns( XmmType::ss, VexMap::_0f38, 0xf5, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+size_t
+makePExt( Register destination, Register source1, const Mem& source2, Code& where ) {
+  return makeBmiIns( XmmType::ss, VexMap::_0f38, 0xf5, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( source1 ), source2, where );
+}
+
+// mulx high:low = rdx * source
+size_t
+makeMulX( Register high, Register low, Register source, Code& where ) {
+  return makeBmiIns( XmmType::sd, VexMap::_0f38, 0xf6, static_cast< uint8_t >( high ),
+                     static_cast< uint8_t >( low ), source, where );
+}
+
+size_t
+makeMulX( Register high, Register low, const Mem& source, Code& where ) {
+  return makeBmiIns( XmmType::sd, VexMap::_0f38, 0xf6, static_cast< uint8_t >( high ),
+                     static_cast< uint8_t >( low ), source, where );
+}
+
+// shlx, shrx, sarx shift by the count in a register
+size_t
+makeShlX( Register destination, Register source, Register count, Code& where ) {
+  return makeBmiIns( XmmType::pd, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( count ), source, where );
+}
+
+size_t
+makeShlX( Register destination, const Mem& source, Register count, Code& where ) {
+  return makeBmiIns( XmmType::pd, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( count ), source, where );
+}
+
+size_t
+makeShrX( Register destination, Register source, Register count, Code& where ) {
+  return makeBmiIns( XmmType::sd, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( count ), source, where );
+}
+
+size_t
+makeShrX( Register destination, const Mem& source, Register count, Code& where ) {
+  return makeBmiIns( XmmType::sd, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( count ), source, where );
+}
+
+size_t
+makeSarX( Register destination, Register source, Register count, Code& where ) {
+  return makeBmiIns( XmmType::ss, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( count ), source, where );
+}
+
+size_t
+makeSarX( Register destination, const Mem& source, Register count, Code& where ) {
+  return makeBmiIns( XmmType::ss, VexMap::_0f38, 0xf7, static_cast< uint8_t >( destination ),
+                     static_cast< uint8_t >( count ), source, where );
+}
+
+// rorx rotate right by an immediate
+size_t
+makeRorX( Register destination, Register source, uint8_t count, Code& where ) {
+  auto i = makeBmiIns( XmmType::sd, VexMap::_0f3a, 0xf0, static_cast< uint8_t >( destination ),
+                       0, source, where );
+  where.push_back( count );
+
+  return i + 1;
+}
+
+size_t
+makeRorX( Register destination, const Mem& source, uint8_t count, Code& where ) {
+  auto i = makeBmiIns( XmmType::sd, VexMap::_0f3a, 0xf0, static_cast< uint8_t >( destination ),
+                       0, source, where, 1 );
+  where.push_back( count );
+
+  return i + 1;
+}
+
+// popcnt, lzcnt and tzcnt are F3, REX.W, 0F op
+size_t
+makeBitCount( uint8_t op, Register destination, Register source, Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xf3 );
+  where.push_back( makeRex( true, destination, Register::r0, source ) );
+  where.push_back( 0x0f );
+  where.push_back( op );
+  where.push_back( makeModRxRm( destination, source ) );
+
+  return 5;
+}
+
+size_t
+makeBitCount( uint8_t op, Register destination, const Mem& source, Code& where ) {
+  where.ensure();
+
+  where.push_back( 0xf3 );
+  where.push_back( makeRex( true, destination, source ) );
+  where.push_back( 0x0f );
+  where.push_back( op );
+
+  return makeIndirect( destination, source, where ) + 4;
+}
+
+// popcnt count the set bits
+size_t
+makePopCnt( Register destination, Register source, Code& where ) {
+  return makeBitCount( 0xb8, destination, source, where );
+}
+
+size_t
+makePopCnt( Register destination, const Mem& source, Code& where ) {
+  return makeBitCount( 0xb8, destination, source, where );
+}
+
+// lzcnt count the leading zero bits
+size_t
+makeLzCnt( Register destination, Register source, Code& where ) {
+  return makeBitCount( 0xbd, destination, source, where );
+}
+
+size_t
+makeLzCnt( Register destination, const Mem& source, Code& where ) {
+  return makeBitCount( 0xbd, destination, source, where );
+}
+
+// tzcnt count the trailing zero bits
+size_t
+makeTzCnt( Register destination, Register source, Code& where ) {
+  return makeBitCount( 0xbc, destination, source, where );
+}
+
+size_t
+makeTzCnt( Register destination, const Mem& source, Code& where ) {
+  return makeBitCount( 0xbc, destination, source, where );
+}
+
+// ----------------------------------------------------------------------
+// Branchless selects
+
+// cmovcc destination = source when test holds
+size_t
+makeCmovcc( CondTest test, Register destination, Register source, Code& where ) {
+  where.ensure();
+
+  where.push_back( makeRex( true, destination, Register::r0, source ) );
+  where.push_back( 0x0f );
+  where.push_back( 0x40 | static_cast< uint8_t >( test ) );
+  where.push_back( makeModRxRm( destination, source ) );
+
+  return 4;
+}
+
+size_t
+makeCmovcc( CondTest test, Register destination, const Mem& source, Code& where ) {
+  where.ensure();
+
+  where.push_back( makeRex( true, destination, source ) );
+  where.push_back( 0x0f );
+  where.push_back( 0x40 | static_cast< uint8_t >( test ) );
+
+  return makeIndirect( destination, source, where ) + 3;
+}
+
+// setcc set a byte to 1 when test holds. Without a REX prefix the byte registers 4 - 7 are
+// ah, ch, dh and bh, so spl, bpl, sil and dil need an empty one.
+size_t
+makeSetcc( CondTest test, Register reg, Code& where ) {
+  where.ensure();
+
+  size_t c = 0;
+
+  if( Register::r3 < reg ) {
+    where.push_back( makeRex( false, Register::r0, Register::r0, reg ) );
+    c++;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( 0x90 | static_cast< uint8_t >( test ) );
+  where.push_back( makeModRxRm( 0, reg ) );
+
+  return c + 3;
+}
+
+size_t
+makeSetcc( CondTest test, const Mem& reg, Code& where ) {
+  where.ensure();
+
+  size_t c = 0;
+
+  if( needsRex( reg ) ) {
+    where.push_back( makeRex( false, Register::r0, reg ) );
+    c++;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( 0x90 | static_cast< uint8_t >( test ) );
+
+  return makeIndirect( 0, reg, where ) + c + 2;
+}
+
+// the SSE4.1 blends are 66, REX when it carries anything, then 0F 38 op or 0F 3A op
+size_t
+makeSse41Prefix( VexMap map, uint8_t rex, uint8_t op, Code& where ) {
+  where.ensure();
+
+  size_t c = 0;
+
+  where.push_back( 0x66 );
+
+  if( rex != 0x40 ) {
+    where.push_back( rex );
+    c++;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( map == VexMap::_0f38 ? 0x38 : 0x3a );
+  where.push_back( op );
+
+  return c + 4;
+}
+
+size_t
+makeSse41Ins( VexMap map, uint8_t op, XmmReg destination, XmmReg source, Code& where ) {
+  auto d = static_cast< Register >( destination );
+  auto s = static_cast< Register >( source );
+
+  auto c = makeSse41Prefix( map, makeRex( false, d, Register::r0, s ), op, where );
+  where.push_back( makeModRxRm( d, s ) );
+
+  return c + 1;
+}
+
+size_t
+makeSse41Ins( VexMap map, uint8_t op, XmmReg destination, const Mem& source, Code& where,
+              uint8_t immBytes = 0 ) {
+  auto d = static_cast< Register >( destination );
+
+  auto c = makeSse41Prefix( map, makeRex( false, d, source ), op, where );
+
+  return c + makeIndirect( d, source, where, immBytes );
+}
+
+// blendpd, blendps take lane i from source when bit i of select is set
+size_t
+makeBlendPD( XmmReg destination, XmmReg source, uint8_t select, Code& where ) {
+  auto i = makeSse41Ins( VexMap::_0f3a, 0x0d, destination, source, where );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+size_t
+makeBlendPD( XmmReg destination, const Mem& source, uint8_t select, Code& where ) {
+  auto i = makeSse41Ins( VexMap::_0f3a, 0x0d, destination, source, where, 1 );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+size_t
+makeBlendPS( XmmReg destination, XmmReg source, uint8_t select, Code& where ) {
+  auto i = makeSse41Ins( VexMap::_0f3a, 0x0c, destination, source, where );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+size_t
+makeBlendPS( XmmReg destination, const Mem& source, uint8_t select, Code& where ) {
+  auto i = makeSse41Ins( VexMap::_0f3a, 0x0c, destination, source, where, 1 );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+// blendvpd, blendvps select on the sign bits of xmm0
+size_t
+makeBlendVPD( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSse41Ins( VexMap::_0f38, 0x15, destination, source, where );
+}
+
+size_t
+makeBlendVPD( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSse41Ins( VexMap::_0f38, 0x15, destination, source, where );
+}
+
+size_t
+makeBlendVPS( XmmReg destination, XmmReg source, Code& where ) {
+  return makeSse41Ins( VexMap::_0f38, 0x14, destination, source, where );
+}
+
+size_t
+makeBlendVPS( XmmReg destination, const Mem& source, Code& where ) {
+  return makeSse41Ins( VexMap::_0f38, 0x14, destination, source, where );
+}
+
+// vblendvpd, vblendvps name the mask register in the high nibble of a trailing imm8
+size_t
+makeVBlendVPD( XmmReg destination, XmmReg source1, XmmReg source2, XmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4b, false,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       static_cast< uint8_t >( source2 ), where );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendVPD( XmmReg destination, XmmReg source1, const Mem& source2, XmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4b, false,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       source2, where, false, 1 );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendVPD( YmmReg destination, YmmReg source1, YmmReg source2, YmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4b, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       static_cast< uint8_t >( source2 ), where );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendVPD( YmmReg destination, YmmReg source1, const Mem& source2, YmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4b, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       source2, where, false, 1 );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendVPS( XmmReg destination, XmmReg source1, XmmReg source2, XmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4a, false,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       static_cast< uint8_t >( source2 ), where );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendVPS( XmmReg destination, XmmReg source1, const Mem& source2, XmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4a, false,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       source2, where, false, 1 );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendVPS( YmmReg destination, YmmReg source1, YmmReg source2, YmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4a, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       static_cast< uint8_t >( source2 ), where );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendVPS( YmmReg destination, YmmReg source1, const Mem& source2, YmmReg mask,
+               Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x4a, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       source2, where, false, 1 );
+  where.push_back( static_cast< uint8_t >( mask ) << 4 );
+
+  return i + 1;
+}
+
+// vblendpd, vblendps take lane i from source2 when bit i of select is set
+size_t
+makeVBlendPD( YmmReg destination, YmmReg source1, YmmReg source2, uint8_t select,
+              Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x0d, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       static_cast< uint8_t >( source2 ), where );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendPD( YmmReg destination, YmmReg source1, const Mem& source2, uint8_t select,
+              Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x0d, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       source2, where, false, 1 );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendPS( YmmReg destination, YmmReg source1, YmmReg source2, uint8_t select,
+              Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x0c, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       static_cast< uint8_t >( source2 ), where );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+size_t
+makeVBlendPS( YmmReg destination, YmmReg source1, const Mem& source2, uint8_t select,
+              Code& where ) {
+  auto i = makeVexIns( XmmType::pd, VexMap::_0f3a, 0x0c, true,
+                       static_cast< uint8_t >( destination ), static_cast< uint8_t >( source1 ),
+                       source2, where, false, 1 );
+  where.push_back( select );
+
+  return i + 1;
+}
+
+// ----------------------------------------------------------------------
+// Cache control for streaming kernels
+
+// prefetch hint the cache line holding memory into the level named by hint
+size_t
+makePrefetch( PrefetchHint hint, const Mem& memory, Code& where ) {
+  where.ensure();
+
+  size_t c = 0;
+
+  if( needsRex( memory ) ) {
+    where.push_back( makeRex( false, Register::r0, memory ) );
+    c++;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( 0x18 );
+
+  return makeIndirect( static_cast< uint8_t >( hint ), memory, where ) + c + 2;
+}
+
+// prefetchw fetch the cache line in a state ready to be written
+size_t
+makePrefetchW( const Mem& memory, Code& where ) {
+  where.ensure();
+
+  size_t c = 0;
+
+  if( needsRex( memory ) ) {
+    where.push_back( makeRex( false, Register::r0, memory ) );
+    c++;
+  }
+
+  where.push_back( 0x0f );
+  where.push_back( 0x0d );
+
+  return makeIndirect( 1, memory, where ) + c + 2;
+}
+
+// movnti store a 64 bit register around the cache
+size_t
+makeMovNTI( const Mem& destination, Register source, Code& where ) {
+  where.ensure();
+
+  where.push_back( makeRex( true, source, destination ) );
+  where.push_back( 0x0f );
+  where.push_back( 0xc3 );
+
+  return makeIndirect( source, destination, where ) + 3;
+}
 
-  auto i = makeIndirect( xop, r, where );
+// movntpd, movntps, movntdq store an xmm register around the cache
+size_t
+makeMovNTPD( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, source, destination, XmmOp::movnt, where );
+}
 
-  return i + 2;
+size_t
+makeMovNTPS( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::ps, source, destination, XmmOp::movnt, where );
 }
 
 size_t
-makeMovS( Code& where ) {
-  where.push_back( 0xa4 );
-  return 1;
+makeMovNTDQ( const Mem& destination, XmmReg source, Code& where ) {
+  return makeXmmIns( XmmType::pd, source, destination, XmmOp::movntdq, where );
 }
 
+// vmovntpd, vmovntps, vmovntdq store a ymm register around the cache
 size_t
-makeRep( Code& where ) {
-  where.push_back( 0xf3 );
-  return 1;
+makeVMovNTPD( const Mem& destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::pd, source, YmmReg::ymm0, destination, XmmOp::movnt, where );
 }
 
 size_t
-makeLoop( uint8_t disp, Code& where ) {
-  where.push_back( 0xe2 );
-  where.push_back( disp );
-  return 2;
+makeVMovNTPS( const Mem& destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::ps, source, YmmReg::ymm0, destination, XmmOp::movnt, where );
 }
 
 size_t
-makeLoopE( uint8_t disp, Code& where ) {
-  where.push_back( 0xe1 );
-  where.push_back( disp );
-  return 2;
+makeVMovNTDQ( const Mem& destination, YmmReg source, Code& where ) {
+  return makeYmmIns( XmmType::pd, source, YmmReg::ymm0, destination, XmmOp::movntdq, where );
 }
 
+// sfence order every earlier store, including non-temporal ones, before any later store
 size_t
-makeLoopNE( uint8_t disp, Code& where ) {
-  where.push_back( 0xe0 );
-  where.push_back( disp );
-  return 2;
+makeSFence( Code& where ) {
+  where.ensure();
+
+  where.push_back( 0x0f );
+  where.push_back( 0xae );
+  where.push_back( 0xf8 );
+
+  return 3;
 }
 
 // ----------------------------------------------------------------------
-// Some double precision floating point instruction
-
-enum struct XmmOp {
-  mov  = 0x10,
-  cvtsi2sd = 0x2a,
-  cvtsd2si = 0x2d,
-  sqrt = 0x51,
-  add  = 0x58,
-  mul,
-  sub  = 0x5c,
-  min,
-  div,
-  max,
-  cmp = 0xc2
-};
+// Atomics and fences
 
+// the 64 bit op encodings shared by xchg, xadd and cmpxchg; escape adds a 0F first
 size_t
-makeSDInsPrefix( XmmReg destination, XmmReg source, XmmOp op, Code& where, bool x64 = false ) {
-  auto s = static_cast< Register >( source );
-  auto d = static_cast< Register >( destination );
-  size_t c = 0;
+makeAtomicIns( bool escape, uint8_t op, Register destination, Register source, Code& where ) {
+  where.ensure();
 
-  where.push_back( 0xf2 );
+  where.push_back( makeRex( true, source, Register::r0, destination ) );
 
-  if( x64 && !( Register::r7 < s || Register::r7 < d ) ) {
-    where.push_back( makeRex( x64, Register::r0, Register::r0, Register::r0 ) );
-    c++;
-  }
-  else {
-    if( Register::r7 < s || Register::r7 < d ) {
-      where.push_back( makeRex( x64, d, Register::r0, s ) );
-      c++;
-    }
+  if( escape ) {
+    where.push_back( 0x0f );
   }
 
-  where.push_back( 0x0f );
-  where.push_back( static_cast< uint8_t >( op ) );
+  where.push_back( op );
+  where.push_back( makeModRxRm( source, destination ) );
 
-  return c + 3;
+  return 3 + escape;
 }
 
 size_t
-makeSDIns( XmmReg destination, XmmReg source, XmmOp op, Code& where, bool x64 = false ) {
-  auto d = static_cast< Register >( destination );
-  auto s = static_cast< Register> ( source );;
-
-  auto c = makeSDInsPrefix( destination, source, op, where, x64 );
-  where.push_back( makeModRxRm( d, s ) );
-
-  return c + 1; 
-}
+makeAtomicIns( bool escape, uint8_t op, const Mem& destination, Register source,
+               Code& where ) {
+  where.ensure();
 
-size_t
-makeSDIns( XmmReg destination, IndirectReg source, XmmOp op, Code& where, bool x64 = false ) {
-  auto xmmS = static_cast< XmmReg >( source );
-  auto d = static_cast< Register >( destination );
-  auto s = static_cast< Register >( source );
+  where.push_back( makeRex( true, source, destination ) );
 
-  auto c = makeSDInsPrefix( destination, xmmS, op, where, x64 );
+  if( escape ) {
+    where.push_back( 0x0f );
+  }
 
-  auto i = makeIndirect( d, s, where );
+  where.push_back( op );
 
-  return c + i;
+  return makeIndirect( source, destination, where ) + 2 + escape;
 }
 
-// movsd move scalar double-precision floating point between memory and regs
+// xchg swap two registers, or a register and memory
 size_t
-makeMovSD( XmmReg destination, XmmReg source, Code& where  ) {
-  return makeSDIns( destination, source, XmmOp::mov, where );
+makeXchg( Register destination, Register source, Code& where ) {
+  return makeAtomicIns( false, 0x87, destination, source, where );
 }
 
 size_t
-makeMovSD( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::mov, where );
+makeXchg( const Mem& destination, Register source, Code& where ) {
+  return makeAtomicIns( false, 0x87, destination, source, where );
 }
 
-// addsd
+// xadd exchange and add
 size_t
-makeAddSD( XmmReg destination, XmmReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::add, where );
+makeXadd( Register destination, Register source, Code& where ) {
+  return makeAtomicIns( true, 0xc1, destination, source, where );
 }
 
 size_t
-makeAddSD( XmmReg destination, IndirectReg source, Code& where ){
-  return makeSDIns( destination, source, XmmOp::add, where );
+makeXadd( const Mem& destination, Register source, Code& where ) {
+  return makeAtomicIns( true, 0xc1, destination, source, where );
 }
 
-// subsd
+// cmpxchg compare with rax and exchange
 size_t
-makeSubSD( XmmReg destination, XmmReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::sub, where );
+makeCmpXchg( Register destination, Register source, Code& where ) {
+  return makeAtomicIns( true, 0xb1, destination, source, where );
 }
 
 size_t
-makeSubSD( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::sub, where );
+makeCmpXchg( const Mem& destination, Register source, Code& where ) {
+  return makeAtomicIns( true, 0xb1, destination, source, where );
 }
 
-// mulsd
+// cmpxchg16b compare rdx:rax and exchange with rcx:rbx
 size_t
-makeMulSD( XmmReg destination, XmmReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::mul, where );
-}
+makeCmpXchg16B( const Mem& destination, Code& where ) {
+  where.ensure();
 
-size_t
-makeMulSD( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::mul, where );
+  where.push_back( makeRex( true, ExOpCode::x1, destination ) );
+  where.push_back( 0x0f );
+  where.push_back( 0xc7 );
+
+  return makeIndirect( ExOpCode::x1, destination, where ) + 3;
 }
 
-// divsd
+// mfence, lfence and sfence are 0F AE with a fixed ModR/M byte
 size_t
-makeDivSD( XmmReg destination, XmmReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::div, where );
+makeFence( uint8_t modRm, Code& where ) {
+  where.ensure();
+
+  where.push_back( 0x0f );
+  where.push_back( 0xae );
+  where.push_back( modRm );
+
+  return 3;
 }
 
 size_t
-makeDivSD( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::div, where );
+makeMFence( Code& where ) {
+  return makeFence( 0xf0, where );
 }
 
-// sqrtsd square root of scalar double-precision float
 size_t
-makeSqrtSD( XmmReg destination, XmmReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::sqrt, where );
+makeLFence( Code& where ) {
+  return makeFence( 0xe8, where );
 }
 
+// pause
 size_t
-makeSqrtSD( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::sqrt, where );
-}
+makePause( Code& where ) {
+  where.ensure();
 
+  where.push_back( 0xf3 );
+  where.push_back( 0x90 );
 
-// maxsd return the larger of 2 double-precision values
-size_t
-makeMaxSD( XmmReg destination, XmmReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::max, where );
+  return 2;
 }
 
-size_t
-makeMaxSD( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::max, where );
-}
+// ----------------------------------------------------------------------
+// Block copy and fill
+
+// the widest move the unrolled copy and fill use for size bytes: a ymm or xmm register,
+// or a general purpose register of 8, 4, 2 or 1 bytes
+static size_t
+pieceWidth( size_t size, const CpuFeatures& cpu ) {
+  if( 32 <= size && cpu.has( CpuFeature::avx ) ) {
+    return 32;
+  }
 
-// minsd return the smaller of 2 double-precision values
-size_t
-makeMinSD( XmmReg destination, XmmReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::min, where );
+  size_t width = 16;
+
+  while( size < width ) {
+    width /= 2;
+  }
+
+  return width;
 }
 
-size_t
-makeMinSD( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::min, where );
+static OpSize
+pieceSize( size_t width ) {
+  switch( width ) {
+  case 1:
+    return OpSize::b8;
+  case 2:
+    return OpSize::b16;
+  case 4:
+    return OpSize::b32;
+  default:
+    return OpSize::b64;
+  }
 }
 
-// cmpsd compare double-precision values with op determined by imm value and store
-//       true of false in destination register. Does not set EFLAGS
-size_t
-makeCmpSD( XmmReg destination, XmmReg source, SDcmp op, Code& where ) {
-  auto i = makeSDIns( destination, source, XmmOp::cmp, where );
+// a general purpose register for the pieces that isn't one of the operands
+static Register
+scratchReg( Register destination, Register source ) {
+  auto r = Register::rax;
 
-  where.push_back( static_cast< uint8_t >( op ) );
+  while( r == destination || r == source ) {
+    r = static_cast< Register >( static_cast< uint8_t >( r ) + 1 );
+  }
 
-  return i + 1;
+  return r;
 }
 
-size_t
-makeCmpSD( XmmReg destination, IndirectReg source, SDcmp op, Code& where ) {
-  auto i =  makeSDIns( destination, source, XmmOp::cmp, where );
-  where.push_back( static_cast< uint8_t >( op ) );
+// cover size bytes with moves of width bytes, the last one overlapping the one before it
+// when size isn't a multiple of width; piece( offset ) emits one
+template< typename Piece >
+static size_t
+makePieces( size_t size, size_t width, Piece piece ) {
+  size_t c = 0;
+  size_t offset = 0;
 
-  return i + 1;
+  for( ; offset + width <= size; offset += width ) {
+    c += piece( static_cast< int32_t >( offset ) );
+  }
+
+  if( offset < size ) {
+    c += piece( static_cast< int32_t >( size - width ) );
+  }
+
+  return c;
 }
 
-// comisd compare double-precision values and set EFLAGS
-size_t
-makeComiSDprefix( XmmReg destination, XmmReg source, Code& where ) {
-  auto s = static_cast< Register >( source );
-  auto d = static_cast< Register >( destination );
+// unrolled copies and fills stop at eight of the widest vector
+static bool
+unrolls( size_t size, const CpuFeatures& cpu ) {
+  return size <= ( cpu.has( CpuFeature::avx ) ? 256u : 128u );
+}
+
+// rdi = destination and rsi = source, without losing either when they're swapped
+static size_t
+makeStringRegs( Register destination, Register source, Code& where ) {
+  if( destination == Register::rsi && source == Register::rdi ) {
+    return makeXchg( Register::rdi, Register::rsi, where );
+  }
+
   size_t c = 0;
 
-  if( Register::r7 < s || Register::r7 < d ) {
-    where.push_back( makeRex( false, d, Register::r0, s ) );
-    c++;
+  if( source == Register::rdi ) {
+    c += makeMov( Register::rsi, source, where );
+    source = Register::rsi;
   }
-  where.push_back( 0x66 );
-  where.push_back( 0x0f );
-  where.push_back( 0x2f );
 
-  return c + 3;
-}
+  if( destination != Register::rdi ) {
+    c += makeMov( Register::rdi, destination, where );
+  }
 
-size_t
-makeComiSD( XmmReg destination, XmmReg source, Code& where ) {
-  auto d = static_cast< Register >( destination );
-  auto s = static_cast< Register >( source );
+  if( source != Register::rsi ) {
+    c += makeMov( Register::rsi, source, where );
+  }
 
-  auto i = makeComiSDprefix( destination, source, where );
-  where.push_back( makeModRxRm( d, s ) );
+  return c;
+}
 
-  return i + 1;
+// rcx = count, without REX.W when it fits in 32 bits
+static size_t
+makeCount( size_t count, Code& where ) {
+  auto size = count >> 32 ? OpSize::b64 : OpSize::b32;
+  return makeMov( Register::rcx, static_cast< int64_t >( count ), where, size );
 }
 
 size_t
-makeComiSD( XmmReg destination, IndirectReg source, Code& where ) {
-  auto xmmS = static_cast< XmmReg >( source );
-  auto d = static_cast< Register >( destination );
-  auto s = static_cast< Register >( source );
+makeMemCpy( Register destination, Register source, size_t size, Code& where,
+            const CpuFeatures& cpu ) {
+  if( size == 0 ) {
+    return 0;
+  }
+
+  if( unrolls( size, cpu ) ) {
+    auto width = pieceWidth( size, cpu );
+    auto t = scratchReg( destination, source );
+
+    return makePieces( size, width, [&]( int32_t offset ) {
+      auto d = Mem( destination, offset );
+      auto s = Mem( source, offset );
+
+      switch( width ) {
+      case 32:
+        return makeVMovDQU( YmmReg::ymm0, s, where ) + makeVMovDQU( d, YmmReg::ymm0, where );
+      case 16:
+        return makeMovUPS( XmmReg::xmm0, s, where ) + makeMovUPS( d, XmmReg::xmm0, where );
+      default:
+        return makeMov( t, s, where, pieceSize( width ) ) +
+               makeMov( d, t, where, pieceSize( width ) );
+      }
+    } );
+  }
 
-  auto i = makeComiSDprefix( destination, xmmS, where );
-  auto j = makeIndirect( d, s, where );
+  auto c = makeStringRegs( destination, source, where );
 
-  return i + j;
+  if( cpu.has( CpuFeature::erms ) ) {
+    c += makeCount( size, where );
+    c += makeRep( where );
+    return c + makeMovS( where );
+  }
+
+  c += makeCount( size / 8, where );
+  c += makeRep( where );
+  c += makeMovS( where, OpSize::b64 );
+
+  // rdi and rsi are past the last whole qword; finish with the qword that ends the block
+  if( auto tail = static_cast< int32_t >( size % 8 ) ) {
+    c += makeMov( Register::rax, Mem( Register::rsi, tail - 8 ), where );
+    c += makeMov( Mem( Register::rdi, tail - 8 ), Register::rax, where );
+  }
+
+  return c;
 }
 
-// cvtsi2sd convert an interger general purpose regisger to a double-precision value in
-//          an xmm register
 size_t
-makeCvtSi2Sd( XmmReg destination, Register source, Code& where ) {
-  auto s = static_cast< XmmReg >( source );
-  return makeSDIns( destination, s, XmmOp::cvtsi2sd, where, true );
+makeMemCpy( Code& where, const CpuFeatures& cpu ) {
+  if( cpu.has( CpuFeature::erms ) ) {
+    return makeRep( where ) + makeMovS( where );
+  }
+
+  auto c = makeMov( Register::rax, Register::rcx, where );
+  c += makeShift( ShiftOp::right, Register::rcx, 3, where );
+  c += makeRep( where );
+  c += makeMovS( where, OpSize::b64 );
+  c += makeMov( Register::rcx, Register::rax, where, OpSize::b32 );
+  c += makeBasicIns( BasicOpClass::_and, Register::rcx, 7, where, OpSize::b32 );
+  c += makeRep( where );
+
+  return c + makeMovS( where );
 }
 
-size_t
-makeCvtSi2Sd( XmmReg destination, IndirectReg source, Code& where ) {
-  return makeSDIns( destination, source, XmmOp::cvtsi2sd, where );
+// reg = value in every byte of the low width bytes
+static size_t
+makeFillPattern( Register reg, uint8_t value, size_t width, Code& where ) {
+  if( value == 0 ) {
+    return makeBasicIns( BasicOpClass::_xor, reg, reg, where, OpSize::b32 );
+  }
+
+  auto pattern = 0x0101010101010101ull * value;
+  auto size = width < 8 ? OpSize::b32 : OpSize::b64;
+
+  return makeMov( reg, static_cast< int64_t >( pattern ), where, size );
 }
 
-// cvtsd2si convert a double precision value in an xmm register to an interger in a
-//          general purpose register
 size_t
-makeCvtSd2Si( Register destination, XmmReg source, Code& where ) {
-  auto d = static_cast< XmmReg >( destination );
-  return makeSDIns( d, source, XmmOp::cvtsd2si, where, true );
+makeMemSet( Register destination, uint8_t value, size_t size, Code& where,
+            const CpuFeatures& cpu ) {
+  if( size == 0 ) {
+    return 0;
+  }
+
+  if( unrolls( size, cpu ) ) {
+    auto width = pieceWidth( size, cpu );
+    auto t = scratchReg( destination, destination );
+
+    auto c = makeFillPattern( t, value, width, where );
+
+    if( width == 32 ) {
+      c += makeMovQ( XmmReg::xmm0, t, where );
+      c += makeVPBroadcastQ( YmmReg::ymm0, XmmReg::xmm0, where );
+    }
+    else if( width == 16 ) {
+      c += makeMovQ( XmmReg::xmm0, t, where );
+      c += makeUnpckLPD( XmmReg::xmm0, XmmReg::xmm0, where );
+    }
+
+    c += makePieces( size, width, [&]( int32_t offset ) {
+      auto d = Mem( destination, offset );
+
+      switch( width ) {
+      case 32:
+        return makeVMovDQU( d, YmmReg::ymm0, where );
+      case 16:
+        return makeMovUPS( d, XmmReg::xmm0, where );
+      default:
+        return makeMov( d, t, where, pieceSize( width ) );
+      }
+    } );
+
+    return c;
+  }
+
+  size_t c = 0;
+
+  if( destination != Register::rdi ) {
+    c += makeMov( Register::rdi, destination, where );
+  }
+
+  if( cpu.has( CpuFeature::erms ) ) {
+    c += makeFillPattern( Register::rax, value, 1, where );
+    c += makeCount( size, where );
+    c += makeRep( where );
+    return c + makeStoS( where );
+  }
+
+  c += makeFillPattern( Register::rax, value, 8, where );
+  c += makeCount( size / 8, where );
+  c += makeRep( where );
+  c += makeStoS( where, OpSize::b64 );
+
+  // rdi is past the last whole qword; finish with the qword that ends the block
+  if( auto tail = static_cast< int32_t >( size % 8 ) ) {
+    c += makeMov( Mem( Register::rdi, tail - 8 ), Register::rax, where );
+  }
+
+  return c;
 }
 
 size_t
-makeCvtSd2Si( Register destination, IndirectReg source, Code& where ) {
-  auto d = static_cast< XmmReg >( destination );
-  return makeSDIns( d, source, XmmOp::cvtsd2si, where, true );
+makeMemSet( Code& where, const CpuFeatures& cpu ) {
+  if( cpu.has( CpuFeature::erms ) ) {
+    return makeRep( where ) + makeStoS( where );
+  }
+
+  // spread al over rax, then store qwords and the bytes left over
+  auto c = makeBasicIns( BasicOpClass::_and, Register::rax, 0xff, where, OpSize::b32 );
+  c += makeMov( Register::rdx, static_cast< int64_t >( 0x0101010101010101 ), where );
+  c += makeMul( Register::rax, Register::rdx, where );
+  c += makeMov( Register::rdx, Register::rcx, where );
+  c += makeShift( ShiftOp::right, Register::rcx, 3, where );
+  c += makeRep( where );
+  c += makeStoS( where, OpSize::b64 );
+  c += makeMov( Register::rcx, Register::rdx, where, OpSize::b32 );
+  c += makeBasicIns( BasicOpClass::_and, Register::rcx, 7, where, OpSize::b32 );
+  c += makeRep( where );
+
+  return c + makeStoS( where );
 }
 
-vector< vector< uint8_t > >
+const vector< vector< uint8_t > >
 nopTable = {
   vector< uint8_t >{},
   vector< uint8_t >{ 0x90 },
@@ -1023,17 +5230,15 @@ makeNop( size_t length, Code& where ) {
   auto left = length;
   auto nopTableSize = nopTable.size() - 1;
 
+  where.ensure( length );
+
   while( nopTableSize <  left ) {
-    where.insert( where.end(),
-                  nopTable[ nopTableSize ].begin(),
-                  nopTable[ nopTableSize ].end() );
+    where.append( nopTable[ nopTableSize ].data(), nopTableSize );
     left -= nopTableSize;
   }
 
   if( 0 < left ) {
-    where.insert( where.end(),
-                  nopTable[ left ].begin(),
-                  nopTable[ left ].end() );
+    where.append( nopTable[ left ].data(), left );
   }
 
   return length;
@@ -1047,16 +5252,19 @@ makeNop( size_t length, Code& where ) {
 int
 main( int, char ** ) {
 
-  // g++ -o myasm myAsm.cc ; ./myasm ;  objdump -M intel -m i386:x86-64 -b binary -D test.bin > test.asm
+  // g++ -o myasm myAsm.cc assembler.cc batch.cc codeHeap.cc cpuFeatures.cc decoder.cc elfObject.cc -pthread ; ./myasm
 
 #define ENCODING_TEST
 
 #ifdef RUNTEST
-  auto memory = mmap( nullptr, getpagesize(), PROT_READ | PROT_WRITE,
-                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
-  auto current = static_cast< uint8_t * >( memory );
-
+#ifdef DUALMAP
+  // the encoders write straight into the writable view of the region
+  DualMappedRegion region;
+  auto machineCode = region.writer();
+#else
+  CodeHeap heap;
   Code machineCode;
+#endif
 
   makePush( Register::rbp, machineCode );
   makeMov( Register::rbp, Register::rsp, machineCode );
@@ -1073,17 +5281,174 @@ main( int, char ** ) {
   makePop( Register::rbp, machineCode );
   makeRet( machineCode );
 
-  auto mcode = machineCode.data();
+#ifdef DUALMAP
+  auto memory = region.commit( machineCode );
+#else
+  auto memory = heap.install( machineCode );
+  heap.seal();
+#endif
+
+  auto fn = reinterpret_cast< double (*)() >( memory );
+
+  cout << "And the answer to life, the universe, and everyting is " << fn() << endl;
+#endif
+
+#ifdef CPUINFO
+  for( auto f = 0; f < static_cast< int >( CpuFeature::count ); f++ ) {
+    auto feature = static_cast< CpuFeature >( f );
 
-  for( unsigned i = 0; i < machineCode.size(); i++ ) {
-    *current++ = *mcode++;
+    cout << setw( 10 ) << CpuFeatures::name( feature ) << " "
+         << ( CpuFeatures::host().has( feature ) ? "yes" : "no" ) << endl;
   }
+#endif
 
-  mprotect( memory, getpagesize(), PROT_READ | PROT_EXEC );
+#ifdef ASSEMBLE
+  // play.s through the assembler a chunk at a time, into play.bin
+  Code assembled;
+  Assembler assembler( assembled, Syntax::att );
+  ifstream source{ "play.s", ios::binary };
+  char chunk[ 4096 ];
 
-  auto fn = reinterpret_cast< double (*)() >( memory );
+  try {
+    while( source.read( chunk, sizeof( chunk ) ) || 0 < source.gcount() ) {
+      assembler.feed( chunk, source.gcount() );
+    }
 
-  cout << "And the answer to life, the universe, and everyting is " << fn() << endl;
+    assembler.finish();
+  }
+  catch( const char* error ) {
+    cerr << "play.s:" << assembler.line() << ": " << error << endl;
+    return 1;
+  }
+
+  ofstream bin{ "play.bin", ios::binary };
+
+  for( auto i : assembled ) {
+    bin << i;
+  }
+#endif
+
+#ifdef IMUL_TEST
+  // two operand imul writes only its destination, so rdx survives it:
+  // ( 6 * 7 + 100 ) * 7 + 100 = 1094 in both syntaxes
+  const pair< Syntax, const char* > imulSources[] = {
+    { Syntax::intel, "mov rdx, 100\n mov rax, 6\n mov rcx, 7\n imul rax, rcx\n"
+                     "add rax, rdx\n push rcx\n imul rax, qword ptr [rsp]\n pop rcx\n"
+                     "add rax, rdx\n ret\n" },
+    { Syntax::att, "movq $100, %rdx\n movq $6, %rax\n movq $7, %rcx\n imulq %rcx, %rax\n"
+                   "addq %rdx, %rax\n pushq %rcx\n imulq (%rsp), %rax\n popq %rcx\n"
+                   "addq %rdx, %rax\n ret\n" }
+  };
+  CodeHeap imulHeap;
+
+  for( auto& source : imulSources ) {
+    Code imulCode;
+    Assembler imulAssembler( imulCode, source.first );
+
+    imulAssembler.feed( source.second );
+    imulAssembler.finish();
+
+    auto imul = reinterpret_cast< long (*)() >( imulHeap.install( imulCode ) );
+    imulHeap.seal();
+
+    cout << "( 6 * 7 + 100 ) * 7 + 100 = " << imul() << endl;
+  }
+#endif
+
+#ifdef BATCH
+  // function i returns i plus what function i - 1 returns, so the last returns the sum
+  Batch batch;
+
+  for( auto i = 0; i < 1000; i++ ) {
+    batch.add( [i]( FunctionCode& f ) {
+      makeMov( Register::rax, 0, f.code );
+
+      if( 0 < i ) {
+        f.call( i - 1 );
+      }
+
+      makeBasicIns( BasicOpClass::_add, Register::rax, i, f.code );
+      makeRet( f.code );
+    } );
+  }
+
+  CodeHeap batchHeap;
+  Code functions;
+
+  batch.assemble( functions );
+
+  auto batchMemory = batchHeap.install( functions );
+  batchHeap.seal();
+
+  auto sum = reinterpret_cast< long (*)() >( batchMemory + batch.offset( batch.size() - 1 ) );
+
+  cout << "0 + 1 + ... + 999 = " << sum() << endl;
+
+  // each function loads its result from its own pool, which lands in the middle of the
+  // merged buffer
+  Batch constants;
+
+  for( auto i = 0; i < 4; i++ ) {
+    constants.add( [i]( FunctionCode& f ) {
+      makeMovSD( XmmReg::xmm0, f.code.constant( i + 0.1 ), f.code );
+      makeRet( f.code );
+    } );
+  }
+
+  DualMappedRegion constantsRegion;
+  auto pooled = constantsRegion.writer();
+
+  constants.assemble( pooled );
+
+  auto pooledMemory = constantsRegion.commit( pooled );
+  auto installed = batchHeap.install( pooled );
+  batchHeap.seal();
+
+  for( size_t i = 0; i < constants.size(); i++ ) {
+    auto committed = reinterpret_cast< double (*)() >( pooledMemory + constants.offset( i ) );
+    auto copied = reinterpret_cast< double (*)() >( installed + constants.offset( i ) );
+
+    cout << "function " << i << " returns " << committed() << " and " << copied() << endl;
+  }
+#endif
+
+#ifdef ENCODING_BENCH
+  // g++ -O2 -DENCODING_BENCH -o encodingBench myAsm.cc assembler.cc batch.cc codeHeap.cc cpuFeatures.cc decoder.cc elfObject.cc encodingBench.cc -pthread ; ./encodingBench > encoding.json
+  runEncodingBench( cout );
+#endif
+
+#ifdef FIRSTCALL_BENCH
+  // g++ -O2 -DNDEBUG -DFIRSTCALL_BENCH -o firstCallBench myAsm.cc assembler.cc batch.cc codeHeap.cc cpuFeatures.cc decoder.cc elfObject.cc firstCallBench.cc -pthread ; ./firstCallBench > firstCall.json
+  runFirstCallBench( cout );
+#endif
+
+#ifdef ELF_OBJECT
+  // generated.o defines hypotenuse( a, b ), which calls sqrt from libm, and scale( x ),
+  // which multiplies by a constant and counts its calls in a counter defined elsewhere.
+  // It reaches the counter through the GOT, so it links into a shared library as well:
+  // cc -o demo demo.c generated.o -lm
+  ElfObject object;
+  ObjectFunction hypotenuse;
+
+  makeMulSD( XmmReg::xmm0, XmmReg::xmm0, hypotenuse.code );
+  makeMulSD( XmmReg::xmm1, XmmReg::xmm1, hypotenuse.code );
+  makeAddSD( XmmReg::xmm0, XmmReg::xmm1, hypotenuse.code );
+  makeBasicIns( BasicOpClass::_sub, Register::rsp, 8, hypotenuse.code );
+  hypotenuse.call( "sqrt" );
+  makeBasicIns( BasicOpClass::_add, Register::rsp, 8, hypotenuse.code );
+  makeRet( hypotenuse.code );
+  object.add( "hypotenuse", hypotenuse );
+
+  ObjectFunction scale;
+
+  scale.load( Register::rax, "counter" );
+  makeBasicIns( BasicOpClass::_add, Mem( Register::rax ), 1, scale.code );
+  makeMulSD( XmmReg::xmm0, scale.code.constant( 2.5 ), scale.code );
+  makeRet( scale.code );
+  object.add( "scale", scale );
+
+  ofstream objectFile{ "generated.o", ios::binary };
+  object.write( objectFile );
 #endif
 
 #ifdef ENCODING_TEST
@@ -1153,6 +5518,9 @@ main( int, char ** ) {
   for( auto i : code ) {
     ofs << i;
   }
+
+  ofstream listing{ "test.asm" };
+  disassemble( code, listing );
 #endif
 
   return 0;
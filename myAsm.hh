@@ -18,7 +18,14 @@
 #ifndef MYASM_HH
 #define MYASM_HH
 
+#include "cpuFeatures.hh"
+
+#include <cstdint>
+#include <map>
 #include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 using namespace std;
@@ -77,6 +84,58 @@ enum struct IndirectReg {
   rdi
 };
 
+// A position in a CodeBuffer that branches can refer to before the position is known.
+struct Label {
+  size_t id;
+};
+
+enum struct Scale {
+  x1 = 0,
+  x2,
+  x4,
+  x8
+};
+
+// A memory operand, [ base + index * scale + disp ]. Either the base or the index may
+// be left out. An IndirectReg converts to a Mem holding just a base, so every encoder
+// that takes a Mem also takes an IndirectReg. The shortest of no displacement, disp8
+// or disp32 is picked when the operand is encoded. A Mem made from a Label is RIP
+// relative; resolve() fills in its displacement.
+struct Mem {
+  Mem( IndirectReg base )
+    : base{ static_cast< Register >( base ) } {
+  }
+
+  // [ base + disp ]
+  explicit Mem( Register base, int32_t disp = 0 )
+    : base{ base }, disp{ disp } {
+  }
+
+  // [ base + index * scale + disp ]
+  Mem( Register base, Register index, Scale scale, int32_t disp = 0 )
+    : base{ base }, index{ index }, scale{ scale }, disp{ disp }, hasIndex{ true } {
+  }
+
+  // [ index * scale + disp ]
+  Mem( Register index, Scale scale, int32_t disp )
+    : index{ index }, scale{ scale }, disp{ disp }, hasBase{ false }, hasIndex{ true } {
+  }
+
+  // [ rip + label + disp ]
+  explicit Mem( Label target, int32_t disp = 0 )
+    : disp{ disp }, hasBase{ false }, rip{ true }, label{ target.id } {
+  }
+
+  Register base = Register::r0;
+  Register index = Register::r0;
+  Scale scale = Scale::x1;
+  int32_t disp = 0;
+  bool hasBase = true;
+  bool hasIndex = false;
+  bool rip = false;
+  size_t label = 0;
+};
+
 enum struct XmmReg {
   xmm0 = 0,
   xmm1,
@@ -96,6 +155,83 @@ enum struct XmmReg {
   xmm15,
 };
 
+// the 256 bit AVX registers; the low half of each is the xmm register of the same number
+enum struct YmmReg {
+  ymm0 = 0,
+  ymm1,
+  ymm2,
+  ymm3,
+  ymm4,
+  ymm5,
+  ymm6,
+  ymm7,
+  ymm8,
+  ymm9,
+  ymm10,
+  ymm11,
+  ymm12,
+  ymm13,
+  ymm14,
+  ymm15,
+};
+
+// the 512 bit AVX-512 registers; zmm16 - zmm31 are only reachable with an EVEX prefix
+enum struct ZmmReg {
+  zmm0 = 0,
+  zmm1,
+  zmm2,
+  zmm3,
+  zmm4,
+  zmm5,
+  zmm6,
+  zmm7,
+  zmm8,
+  zmm9,
+  zmm10,
+  zmm11,
+  zmm12,
+  zmm13,
+  zmm14,
+  zmm15,
+  zmm16,
+  zmm17,
+  zmm18,
+  zmm19,
+  zmm20,
+  zmm21,
+  zmm22,
+  zmm23,
+  zmm24,
+  zmm25,
+  zmm26,
+  zmm27,
+  zmm28,
+  zmm29,
+  zmm30,
+  zmm31,
+};
+
+// AVX-512 opmask registers
+enum struct KReg {
+  k0 = 0,
+  k1,
+  k2,
+  k3,
+  k4,
+  k5,
+  k6,
+  k7,
+};
+
+// An AVX-512 write mask. k0 means every lane is written. Lanes the mask leaves out keep
+// their old value, or are cleared when zero is set.
+struct Mask {
+  Mask( KReg k = KReg::k0, bool zero = false ) : k( k ), zero( zero ) {}
+
+  KReg k;
+  bool zero;
+};
+
 enum struct BasicOpClass {
   _add = 0,
   _or,
@@ -138,63 +274,283 @@ enum struct CondTest {
   G = NLE   // greater than
 };
 
-using Code = vector< uint8_t >;
+// A buffer of machine code that grows in bulk. Every encoder calls ensure() once when
+// it starts an instruction; the bytes of that instruction are then stored with no
+// further capacity checks, so a buffer never reallocates in the middle of one.
+class CodeBuffer {
+public:
+  // the longest legal x86-64 instruction
+  static constexpr size_t maxInstruction = 15;
+
+  explicit CodeBuffer( size_t capacity = 4096 );
+
+  // write into memory owned by someone else; such a buffer never grows. Each encoder
+  // ensures maxInstruction bytes before it knows its length, so the last
+  // maxInstruction - 1 bytes of capacity can only be filled by append().
+  CodeBuffer( uint8_t* memory, size_t capacity );
+
+  CodeBuffer( const CodeBuffer& );
+  CodeBuffer( CodeBuffer&& ) noexcept;
+
+  CodeBuffer& operator=( const CodeBuffer& );
+  CodeBuffer& operator=( CodeBuffer&& ) noexcept;
+
+  // make sure at least room more bytes can be stored without reallocating
+  void
+  ensure( size_t room = maxInstruction ) {
+    if( static_cast< size_t >( limit - cursor ) < room ) {
+      grow( room );
+    }
+  }
+
+  // store one byte with no bounds check; only valid after ensure()
+  void
+  push_back( uint8_t byte ) {
+    *cursor++ = byte;
+  }
+
+  // store length bytes, growing the buffer if needed
+  void
+  append( const uint8_t* bytes, size_t length );
+
+  void
+  reserve( size_t capacity );
+
+  void
+  clear() {
+    cursor = start;
+    labels.clear();
+    fixups.clear();
+    constants.clear();
+    constantIndex.clear();
+    pool = 0;
+    embedded.clear();
+    saved = 0;
+  }
+
+  // In shortest mode the encoders use a sign-extended imm8, or a shorter form of mov,
+  // whenever the immediate fits, and count the bytes that saves.
+  void
+  setShortest( bool on ) {
+    shortestForm = on;
+  }
+
+  bool
+  shortest() const {
+    return shortestForm;
+  }
+
+  // bytes saved by shorter immediates and by resolve()
+  size_t
+  bytesSaved() const {
+    return saved;
+  }
+
+  void
+  addSaved( size_t bytes ) {
+    saved += bytes;
+  }
+
+  // labels
+
+  Label
+  newLabel();
+
+  // the label refers to the current end of the buffer
+  void
+  bind( Label label );
+
+  bool
+  isBound( Label label ) const;
+
+  size_t
+  offset( Label label ) const;
+
+  // A reference from an instruction to a label. The encoders record one for every
+  // branch to a label; resolve() fills in the displacements.
+  struct Fixup {
+    size_t start;     // offset of the instruction
+    uint8_t length;   // length of the instruction
+    uint8_t field;    // offset of the displacement within the instruction
+    uint8_t width;    // bytes of displacement, 1 or 4
+    bool relaxable;   // a rel32 jmp or jcc that has a rel8 form
+    size_t label;
+    int32_t addend = 0;
+  };
+
+  void
+  addFixup( const Fixup& fixup ) {
+    fixups.push_back( fixup );
+  }
+
+  // every label reference, at its final offset once resolve() has run
+  const vector< Fixup >&
+  references() const {
+    return fixups;
+  }
+
+  // Switch every jmp and jcc whose target is close enough to its 2 byte rel8 form,
+  // moving the code that follows down, place the constant pool after the code, then
+  // fill in every label reference. Offsets into the buffer taken before resolve()
+  // don't survive it, but labels do. Returns the number of bytes saved.
+  size_t
+  resolve();
+
+  // constant pool
+
+  // A RIP relative operand for a constant in this buffer's pool. Equal constants share
+  // an entry. resolve() places the pool after the code, 16 byte aligned, with the 16
+  // byte constants first so each of them is aligned too.
+  Mem
+  constant( double value );
+
+  Mem
+  constant( int64_t value );
+
+  // any other integer, so that constant( 1 ) isn't ambiguous
+  template< typename T, typename = enable_if_t< is_integral< T >::value > >
+  Mem
+  constant( T value ) {
+    return constant( static_cast< int64_t >( value ) );
+  }
+
+  Mem
+  constant( uint64_t low, uint64_t high );
+
+  // offset of the constant pool, or size() when there is none
+  size_t
+  poolOffset() const;
+
+  // The [start, end) ranges of data among the code, in the order they were added: each
+  // pool with the int3 padding before it, and anything passed to markData().
+  const vector< pair< size_t, size_t > >&
+  dataRanges() const {
+    return embedded;
+  }
+
+  // record that the bytes from start to end are data, for what was copied in with
+  // append() from another buffer's pool
+  void
+  markData( size_t start, size_t end ) {
+    embedded.emplace_back( start, end );
+  }
+
+  uint8_t* data() { return start; }
+  const uint8_t* data() const { return start; }
+
+  size_t size() const { return cursor - start; }
+  size_t capacity() const { return limit - start; }
+  bool empty() const { return cursor == start; }
+
+  uint8_t* begin() { return start; }
+  uint8_t* end() { return cursor; }
+  const uint8_t* begin() const { return start; }
+  const uint8_t* end() const { return cursor; }
+
+  uint8_t& operator[]( size_t i ) { return start[ i ]; }
+  uint8_t operator[]( size_t i ) const { return start[ i ]; }
+
+private:
+  void
+  grow( size_t room );
+
+  unique_ptr< uint8_t[] > storage;
+  uint8_t* start;
+  uint8_t* cursor;
+  uint8_t* limit;
+
+  Mem
+  addConstant( uint8_t size, uint64_t low, uint64_t high );
+
+  void
+  placeConstants();
+
+  struct Constant {
+    uint8_t size;
+    uint64_t low;
+    uint64_t high;
+    Label label;
+  };
+
+  vector< size_t > labels;
+  vector< Fixup > fixups;
+
+  vector< Constant > constants;
+  map< tuple< uint8_t, uint64_t, uint64_t >, size_t > constantIndex;
+  size_t pool = 0;
+  vector< pair< size_t, size_t > > embedded;
+
+  bool shortestForm = false;
+  size_t saved = 0;
+};
+
+using Code = CodeBuffer;
+
+// The width of an integer operation. A 32 bit result is zero extended into the whole
+// register and needs no REX prefix for rax - rdi; 8 and 16 bit results leave the rest of
+// the register alone.
+enum struct OpSize {
+  b8 = 0,
+  b16,
+  b32,
+  b64
+};
 
 // rax = rax op immediate
 size_t
-makeBasicIns( BasicOpClass, int32_t, Code& );
+makeBasicIns( BasicOpClass, int32_t, Code&, OpSize = OpSize::b64 );
 
 // destination = destination op immediate
 size_t
-makeBasicIns( BasicOpClass, Register, int32_t, Code& );
+makeBasicIns( BasicOpClass, Register, int32_t, Code&, OpSize = OpSize::b64 );
 
 // [destination] = [destination] op immediate
 size_t
-makeBasicIns( BasicOpClass, IndirectReg, int32_t, Code& );
+makeBasicIns( BasicOpClass, const Mem&, int32_t, Code&, OpSize = OpSize::b64 );
 
 /// destination = destination op source
 size_t
-makeBasicIns( BasicOpClass, Register, Register, Code& );
+makeBasicIns( BasicOpClass, Register, Register, Code&, OpSize = OpSize::b64 );
 
 // [destination] = [destination] op source
 size_t
-makeBasicIns( BasicOpClass, IndirectReg, Register, Code& );
+makeBasicIns( BasicOpClass, const Mem&, Register, Code&, OpSize = OpSize::b64 );
 
 // destination = destination op [source]
 size_t
-makeBasicIns( BasicOpClass, Register, IndirectReg, Code& );
+makeBasicIns( BasicOpClass, Register, const Mem&, Code&, OpSize = OpSize::b64 );
 
-// rdx:rax = rax * source
+// rdx:rax = rax * source; for a byte, ax = al * source
 size_t
-makeMul( Register, Code& );
+makeMul( Register, Code&, OpSize = OpSize::b64 );
 
-// rdx:rax = rax * [source]
+// rdx:rax = rax * [source]; for a byte, ax = al * [source]
 size_t
-makeMul( IndirectReg, Code& );
+makeMul( const Mem&, Code&, OpSize = OpSize::b64 );
 
 // destination = destination * source (note, result is truncated to fit one register)
 size_t
-makeMul( Register, Register, Code& );
+makeMul( Register, Register, Code&, OpSize = OpSize::b64 );
 
 // destination = source * immediate (signed)
 size_t
-makeMul( Register, Register, int32_t, Code& );
+makeMul( Register, Register, int32_t, Code&, OpSize = OpSize::b64 );
 
 // destination = destination * [source] (note, result is truncated to fit one register)
 size_t
-makeMul( Register, IndirectReg, Code& );
+makeMul( Register, const Mem&, Code&, OpSize = OpSize::b64 );
 
 // destination = [source] * immediate (signed)
 size_t
-makeMul( Register, IndirectReg, int32_t, Code& );
+makeMul( Register, const Mem&, int32_t, Code&, OpSize = OpSize::b64 );
 
 // rax = rdx:rax div source ; rdx = rdx:rax mod source (signed)
 size_t
-makeDiv( Register, Code& );
+makeDiv( Register, Code&, OpSize = OpSize::b64 );
 
 // rax = rdx:rax div [source] ; rdx = rdx:rax mod [source] (signed)
 size_t
-makeDiv( IndirectReg, Code& );
+makeDiv( const Mem&, Code&, OpSize = OpSize::b64 );
 
 size_t
 makeJcc( CondTest, uint32_t, Code& );
@@ -205,25 +561,43 @@ makeJmp( uint32_t, Code& );
 size_t
 makeJmp( Register, Code& );
 
+// jmp to the address held in memory
+size_t
+makeJmp( const Mem&, Code& );
+
+// jcc, jmp and call to a label. A jmp or jcc starts out in its rel8 form when the label
+// is already bound and near enough; otherwise resolve() picks the form.
+size_t
+makeJcc( CondTest, Label, Code& );
+
+size_t
+makeJmp( Label, Code& );
+
 // destination = source
 size_t
-makeMov( Register, Register, Code& );
+makeMov( Register, Register, Code&, OpSize = OpSize::b64 );
 
 // destination = [source]
 size_t
-makeMov( Register, IndirectReg, Code& );
+makeMov( Register, const Mem&, Code&, OpSize = OpSize::b64 );
 
 // [destination] = source
 size_t
-makeMov( IndirectReg, Register, Code& );
+makeMov( const Mem&, Register, Code&, OpSize = OpSize::b64 );
 
-// destination = imm64
+// destination = imm64; in shortest mode a value that fits uses mov r32, imm32 (zero
+// extended) or mov r/m64, simm32
 size_t
-makeMov( Register, int64_t, Code& );
+makeMov( Register, int64_t, Code&, OpSize = OpSize::b64 );
 
 // [destination] = imm32
 size_t
-makeMov( IndirectReg, int32_t, Code& );
+makeMov( const Mem&, int32_t, Code&, OpSize = OpSize::b64 );
+
+// destination = base + index * scale + disp, without setting the flags. Mem( r, r,
+// Scale::x2 ) multiplies r by 3, x4 by 5 and x8 by 9.
+size_t
+makeLea( Register, const Mem&, Code&, OpSize = OpSize::b64 );
 
 size_t
 makeCall( int32_t, Code& );
@@ -231,6 +605,13 @@ makeCall( int32_t, Code& );
 size_t
 makeCall( Register r, Code& where );
 
+// call the address held in memory
+size_t
+makeCall( const Mem&, Code& );
+
+size_t
+makeCall( Label, Code& );
+
 size_t
 makeRet( Code& );
 
@@ -246,17 +627,17 @@ enum struct IDecOp {
 
 // shl or shr by one
 size_t
-makeShift( ShiftOp, Register, Code& );
+makeShift( ShiftOp, Register, Code&, OpSize = OpSize::b64 );
 
 size_t
-makeShift( ShiftOp, Register, uint8_t, Code& );
+makeShift( ShiftOp, Register, uint8_t, Code&, OpSize = OpSize::b64 );
 
 // shl or shr by one
 size_t
-makeShift( ShiftOp, IndirectReg, Code& );
+makeShift( ShiftOp, const Mem&, Code&, OpSize = OpSize::b64 );
 
 size_t
-makeShift( ShiftOp, IndirectReg, uint8_t, Code& );
+makeShift( ShiftOp, const Mem&, uint8_t, Code&, OpSize = OpSize::b64 );
 
 enum struct ComplOp {
   _not = 2,
@@ -266,10 +647,10 @@ enum struct ComplOp {
 };
 
 size_t
-makeCompl( ComplOp, Register, Code& );
+makeCompl( ComplOp, Register, Code&, OpSize = OpSize::b64 );
 
 size_t
-makeCompl( ComplOp, IndirectReg, Code& );
+makeCompl( ComplOp, const Mem&, Code&, OpSize = OpSize::b64 );
 
 size_t
 makeSysCall( Code&);
@@ -278,7 +659,7 @@ size_t
 makePush( Register, Code& );
 
 size_t
-makePush( IndirectReg, Code& );
+makePush( const Mem&, Code& );
 
 size_t
 makePush( uint32_t, Code& );
@@ -287,20 +668,49 @@ size_t
 makePop( Register, Code& );
 
 size_t
-makePop( IndirectReg, Code& );
+makePop( const Mem&, Code& );
 
 size_t
-makeIDec( IDecOp, Register, Code& );
+makeIDec( IDecOp, Register, Code&, OpSize = OpSize::b64 );
 
 size_t
-makeIDec( IDecOp, IndirectReg, Code& );
+makeIDec( IDecOp, const Mem&, Code&, OpSize = OpSize::b64 );
 
+// String operations on [rdi] and [rsi], stepping rdi and rsi by the operand size.
+// rep repeats one rcx times; repe and repne also stop cmps and scas on the first
+// mismatch or match.
+
+// movs [rdi] = [rsi]
+size_t
+makeMovS( Code& where, OpSize = OpSize::b8 );
+
+// stos [rdi] = rax
+size_t
+makeStoS( Code& where, OpSize = OpSize::b8 );
+
+// lods rax = [rsi]
+size_t
+makeLodS( Code& where, OpSize = OpSize::b8 );
+
+// cmps compare [rsi] with [rdi]
+size_t
+makeCmpS( Code& where, OpSize = OpSize::b8 );
+
+// scas compare rax with [rdi]
 size_t
-makeMovS( Code& where );
+makeScaS( Code& where, OpSize = OpSize::b8 );
 
+// rep, or repe before cmps and scas
 size_t
 makeRep( Code& where );
 
+size_t
+makeRepNE( Code& where );
+
+// lock prefix: makes the read-modify-write memory instruction that follows atomic
+size_t
+makeLock( Code& where );
+
 size_t
 makeLoop( uint8_t disp, Code& where );
 
@@ -310,46 +720,56 @@ makeLoopE( uint8_t disp, Code& where );
 size_t
 makeLoopNE( uint8_t disp, Code& where );
 
+// loop to a label; the label must end up within a rel8 displacement
+size_t
+makeLoop( Label target, Code& where );
+
+size_t
+makeLoopE( Label target, Code& where );
+
+size_t
+makeLoopNE( Label target, Code& where );
+
 size_t
 makeMovSD( XmmReg destination, XmmReg source, Code& where  );
 
 size_t
-makeMovSD( XmmReg destination, IndirectReg source, Code& where );
+makeMovSD( XmmReg destination, const Mem& source, Code& where );
 
 // addsd
 size_t
 makeAddSD( XmmReg destination, XmmReg source, Code& where );
 
 size_t
-makeAddSD( XmmReg destination, IndirectReg source, Code& where );
+makeAddSD( XmmReg destination, const Mem& source, Code& where );
 
 // subsd
 size_t
 makeSubSD( XmmReg destination, XmmReg source, Code& where );
 
 size_t
-makeSubSD( XmmReg destination, IndirectReg source, Code& where );
+makeSubSD( XmmReg destination, const Mem& source, Code& where );
 
 // mulsd
 size_t
 makeMulSD( XmmReg destination, XmmReg source, Code& where );
 
 size_t
-makeMulSD( XmmReg destination, IndirectReg source, Code& where );
+makeMulSD( XmmReg destination, const Mem& source, Code& where );
 
 // divsd
 size_t
 makeDivSD( XmmReg destination, XmmReg source, Code& where );
 
 size_t
-makeDivSD( XmmReg destination, IndirectReg source, Code& where );
+makeDivSD( XmmReg destination, const Mem& source, Code& where );
 
 // sqrtsd square root of scalar double-precision float
 size_t
 makeSqrtSD( XmmReg destination, XmmReg source, Code& where );
 
 size_t
-makeSqrtSD( XmmReg destination, IndirectReg source, Code& where );
+makeSqrtSD( XmmReg destination, const Mem& source, Code& where );
 
 
 // maxsd return the larger of 2 double-precision values
@@ -357,14 +777,14 @@ size_t
 makeMaxSD( XmmReg destination, XmmReg source, Code& where );
 
 size_t
-makeMaxSD( XmmReg destination, IndirectReg source, Code& where );
+makeMaxSD( XmmReg destination, const Mem& source, Code& where );
 
 // minsd return the smaller of 2 double-precision values
 size_t
 makeMinSD( XmmReg destination, XmmReg source, Code& where );
 
 size_t
-makeMinSD( XmmReg destination, IndirectReg source, Code& where );
+makeMinSD( XmmReg destination, const Mem& source, Code& where );
 
 // cmpsd compare double-precision values with op determined by imm value and store
 //       true of false in destination register. Does not set EFLAGS
@@ -383,21 +803,1533 @@ size_t
 makeCmpSD( XmmReg destination, XmmReg source, SDcmp op, Code& where );
 
 size_t
-makeCmpSD( XmmReg destination, IndirectReg source, SDcmp op, Code& where );
+makeCmpSD( XmmReg destination, const Mem& source, SDcmp op, Code& where );
+
+// comisd compare double-precision values and set EFLAGS
+size_t
+makeComiSD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeComiSD( XmmReg destination, const Mem& source, Code& where );
 
+// cvtsi2sd convert a 32 or 64 bit integer to double precision; the memory form reads 32
+//          bits unless size says otherwise
 size_t
-makeCvtSi2Sd( XmmReg destination, XmmReg source, Code& where );
+makeCvtSi2Sd( XmmReg destination, Register source, Code& where, OpSize size = OpSize::b64 );
 
 size_t
-makeCvtSi2Sd( XmmReg destination, IndirectReg source, Code& where );
+makeCvtSi2Sd( XmmReg destination, const Mem& source, Code& where,
+              OpSize size = OpSize::b32 );
 
 // cvtsd2si convert a double precision value in an xmm register to an interger in a
 //          general purpose register
 size_t
-makeCvtSd2Si( XmmReg destination, XmmReg source, Code& where );
+makeCvtSd2Si( Register destination, XmmReg source, Code& where );
+
+size_t
+makeCvtSd2Si( Register destination, const Mem& source, Code& where );
+
+// movq move 64 bits between a general purpose register and the low half of an xmm
+// register; moving into the xmm register zeroes the high half
+size_t
+makeMovQ( XmmReg destination, Register source, Code& where );
+
+size_t
+makeMovQ( Register destination, XmmReg source, Code& where );
+
+// ----------------------------------------------------------------------
+// Packed double (pd), packed single (ps) and scalar single (ss) precision instructions
+
+// movsd store
+size_t
+makeMovSD( const Mem& destination, XmmReg source, Code& where );
+
+// movapd aligned packed double move; memory must be 16 byte aligned
+size_t
+makeMovAPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMovAPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMovAPD( const Mem& destination, XmmReg source, Code& where );
+
+// movupd unaligned packed double move
+size_t
+makeMovUPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMovUPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMovUPD( const Mem& destination, XmmReg source, Code& where );
+
+// movaps aligned packed single move; memory must be 16 byte aligned
+size_t
+makeMovAPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMovAPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMovAPS( const Mem& destination, XmmReg source, Code& where );
+
+// movups unaligned packed single move
+size_t
+makeMovUPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMovUPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMovUPS( const Mem& destination, XmmReg source, Code& where );
+
+// movss move scalar single-precision between memory and regs
+size_t
+makeMovSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMovSS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMovSS( const Mem& destination, XmmReg source, Code& where );
+
+// addpd, addps, addss
+size_t
+makeAddPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeAddPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeAddPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeAddPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeAddSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeAddSS( XmmReg destination, const Mem& source, Code& where );
+
+// subpd, subps, subss
+size_t
+makeSubPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeSubPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeSubPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeSubPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeSubSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeSubSS( XmmReg destination, const Mem& source, Code& where );
+
+// mulpd, mulps, mulss
+size_t
+makeMulPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMulPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMulPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMulPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMulSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMulSS( XmmReg destination, const Mem& source, Code& where );
+
+// divpd, divps, divss
+size_t
+makeDivPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeDivPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeDivPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeDivPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeDivSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeDivSS( XmmReg destination, const Mem& source, Code& where );
+
+// sqrtpd, sqrtps, sqrtss
+size_t
+makeSqrtPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeSqrtPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeSqrtPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeSqrtPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeSqrtSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeSqrtSS( XmmReg destination, const Mem& source, Code& where );
+
+// minpd, minps, minss
+size_t
+makeMinPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMinPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMinPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMinPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMinSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMinSS( XmmReg destination, const Mem& source, Code& where );
+
+// maxpd, maxps, maxss
+size_t
+makeMaxPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMaxPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMaxPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMaxPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeMaxSS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeMaxSS( XmmReg destination, const Mem& source, Code& where );
+
+// andpd, andnpd, orpd, xorpd and their ps forms: bitwise logic on whole registers
+size_t
+makeAndPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeAndPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeAndPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeAndPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeAndNPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeAndNPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeAndNPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeAndNPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeOrPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeOrPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeOrPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeOrPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeXorPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeXorPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeXorPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeXorPS( XmmReg destination, const Mem& source, Code& where );
+
+// unpcklpd, unpckhpd, unpcklps, unpckhps interleave the low or high halves of two regs
+size_t
+makeUnpckLPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeUnpckLPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeUnpckHPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeUnpckHPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeUnpckLPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeUnpckLPS( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeUnpckHPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeUnpckHPS( XmmReg destination, const Mem& source, Code& where );
+
+// cmppd, cmpps, cmpss compare lanes with op determined by imm value and store all ones
+//                    or all zeros in each lane of destination
+size_t
+makeCmpPD( XmmReg destination, XmmReg source, SDcmp op, Code& where );
+
+size_t
+makeCmpPD( XmmReg destination, const Mem& source, SDcmp op, Code& where );
+
+size_t
+makeCmpPS( XmmReg destination, XmmReg source, SDcmp op, Code& where );
+
+size_t
+makeCmpPS( XmmReg destination, const Mem& source, SDcmp op, Code& where );
+
+size_t
+makeCmpSS( XmmReg destination, XmmReg source, SDcmp op, Code& where );
+
+size_t
+makeCmpSS( XmmReg destination, const Mem& source, SDcmp op, Code& where );
+
+// shufpd, shufps pick lanes from destination (low half) and source (high half) by imm
+size_t
+makeShufPD( XmmReg destination, XmmReg source, uint8_t select, Code& where );
+
+size_t
+makeShufPD( XmmReg destination, const Mem& source, uint8_t select, Code& where );
+
+size_t
+makeShufPS( XmmReg destination, XmmReg source, uint8_t select, Code& where );
+
+size_t
+makeShufPS( XmmReg destination, const Mem& source, uint8_t select, Code& where );
+
+// cvtss2sd widen a single-precision value to double-precision
+size_t
+makeCvtSS2SD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeCvtSS2SD( XmmReg destination, const Mem& source, Code& where );
+
+// cvtsd2ss narrow a double-precision value to single-precision
+size_t
+makeCvtSD2SS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeCvtSD2SS( XmmReg destination, const Mem& source, Code& where );
+
+// cvtps2pd widen the low 2 single-precision lanes to double-precision
+size_t
+makeCvtPS2PD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeCvtPS2PD( XmmReg destination, const Mem& source, Code& where );
+
+// cvtpd2ps narrow 2 double-precision lanes to single-precision
+size_t
+makeCvtPD2PS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeCvtPD2PS( XmmReg destination, const Mem& source, Code& where );
+
+// ----------------------------------------------------------------------
+// VEX encoded AVX and AVX2 instructions. The scalar forms take a second source so the
+// destination isn't overwritten; the upper lanes of the destination come from source1.
+
+// vmovsd: the register form merges the low lane of source2 into source1
+size_t
+makeVMovSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVMovSD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVMovSD( const Mem& destination, XmmReg source, Code& where );
+
+// vaddsd
+size_t
+makeVAddSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVAddSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+// vsubsd
+size_t
+makeVSubSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVSubSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+// vmulsd
+size_t
+makeVMulSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVMulSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+// vdivsd
+size_t
+makeVDivSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVDivSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+// vsqrtsd
+size_t
+makeVSqrtSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVSqrtSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+// vmaxsd
+size_t
+makeVMaxSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVMaxSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+// vminsd
+size_t
+makeVMinSD( XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVMinSD( XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+// vcmpsd
+size_t
+makeVCmpSD( XmmReg destination, XmmReg source1, XmmReg source2, SDcmp op, Code& where );
+
+size_t
+makeVCmpSD( XmmReg destination, XmmReg source1, const Mem& source2, SDcmp op, Code& where );
+
+// vcomisd
+size_t
+makeVComiSD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeVComiSD( XmmReg destination, const Mem& source, Code& where );
+
+// vcvtsi2sd convert a 32 or 64 bit integer into the low lane of destination
+size_t
+makeVCvtSi2Sd( XmmReg destination, XmmReg source1, Register source2, Code& where,
+               OpSize size = OpSize::b64 );
+
+size_t
+makeVCvtSi2Sd( XmmReg destination, XmmReg source1, const Mem& source2, Code& where,
+               OpSize size = OpSize::b64 );
+
+// vcvtsd2si convert the low lane of source to a 64 bit integer
+size_t
+makeVCvtSd2Si( Register destination, XmmReg source, Code& where );
+
+size_t
+makeVCvtSd2Si( Register destination, const Mem& source, Code& where );
+
+// vzeroupper clear the upper halves of all ymm registers; emit before calling or
+// returning to code that uses the legacy SSE encodings
+size_t
+makeVZeroUpper( Code& where );
+
+// 256 bit packed floating point. Aligned moves need 32 byte aligned memory
+
+size_t
+makeVMovAPD( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVMovAPD( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVMovAPD( const Mem& destination, YmmReg source, Code& where );
+
+size_t
+makeVMovUPD( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVMovUPD( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVMovUPD( const Mem& destination, YmmReg source, Code& where );
+
+size_t
+makeVMovAPS( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVMovAPS( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVMovAPS( const Mem& destination, YmmReg source, Code& where );
+
+size_t
+makeVMovUPS( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVMovUPS( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVMovUPS( const Mem& destination, YmmReg source, Code& where );
+
+// vaddpd, vaddps
+size_t
+makeVAddPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVAddPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVAddPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVAddPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vsubpd, vsubps
+size_t
+makeVSubPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVSubPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVSubPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVSubPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vmulpd, vmulps
+size_t
+makeVMulPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVMulPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVMulPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVMulPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vdivpd, vdivps
+size_t
+makeVDivPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVDivPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVDivPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVDivPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vminpd, vminps
+size_t
+makeVMinPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVMinPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVMinPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVMinPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vmaxpd, vmaxps
+size_t
+makeVMaxPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVMaxPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVMaxPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVMaxPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vandpd, vandps
+size_t
+makeVAndPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVAndPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVAndPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVAndPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vandnpd, vandnps
+size_t
+makeVAndNPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVAndNPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVAndNPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVAndNPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vorpd, vorps
+size_t
+makeVOrPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVOrPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVOrPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVOrPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vxorpd, vxorps
+size_t
+makeVXorPD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVXorPD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVXorPS( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVXorPS( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vsqrtpd, vsqrtps
+size_t
+makeVSqrtPD( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVSqrtPD( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVSqrtPS( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVSqrtPS( YmmReg destination, const Mem& source, Code& where );
+
+// vcmppd, vcmpps
+size_t
+makeVCmpPD( YmmReg destination, YmmReg source1, YmmReg source2, SDcmp op, Code& where );
+
+size_t
+makeVCmpPD( YmmReg destination, YmmReg source1, const Mem& source2, SDcmp op, Code& where );
+
+size_t
+makeVCmpPS( YmmReg destination, YmmReg source1, YmmReg source2, SDcmp op, Code& where );
+
+size_t
+makeVCmpPS( YmmReg destination, YmmReg source1, const Mem& source2, SDcmp op, Code& where );
+
+// vbroadcastsd, vbroadcastss copy one scalar into every lane; the register forms are AVX2
+size_t
+makeVBroadcastSD( YmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeVBroadcastSD( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVBroadcastSS( YmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeVBroadcastSS( YmmReg destination, const Mem& source, Code& where );
+
+// AVX2 256 bit integer instructions. vmovdqa needs 32 byte aligned memory
+
+size_t
+makeVMovDQA( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVMovDQA( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVMovDQA( const Mem& destination, YmmReg source, Code& where );
+
+size_t
+makeVMovDQU( YmmReg destination, YmmReg source, Code& where );
+
+size_t
+makeVMovDQU( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVMovDQU( const Mem& destination, YmmReg source, Code& where );
+
+// vpaddd
+size_t
+makeVPAddD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPAddD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpaddq
+size_t
+makeVPAddQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPAddQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpsubd
+size_t
+makeVPSubD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPSubD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpsubq
+size_t
+makeVPSubQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPSubQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpmulld keep the low 32 bits of each product
+size_t
+makeVPMulLD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPMulLD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpmuludq multiply the even unsigned dwords into qwords
+size_t
+makeVPMulUDQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPMulUDQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpand
+size_t
+makeVPAnd( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPAnd( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpandn
+size_t
+makeVPAndN( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPAndN( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpor
+size_t
+makeVPOr( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPOr( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpxor
+size_t
+makeVPXor( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPXor( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpcmpeqd
+size_t
+makeVPCmpEqD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPCmpEqD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpcmpeqq
+size_t
+makeVPCmpEqQ( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPCmpEqQ( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpcmpgtd signed compare
+size_t
+makeVPCmpGtD( YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVPCmpGtD( YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// vpslld, vpsrld, vpsrad, vpsllq, vpsrlq shift each lane by an immediate count
+size_t
+makeVPSllD( YmmReg destination, YmmReg source, uint8_t count, Code& where );
+
+size_t
+makeVPSrlD( YmmReg destination, YmmReg source, uint8_t count, Code& where );
+
+size_t
+makeVPSraD( YmmReg destination, YmmReg source, uint8_t count, Code& where );
+
+size_t
+makeVPSllQ( YmmReg destination, YmmReg source, uint8_t count, Code& where );
+
+size_t
+makeVPSrlQ( YmmReg destination, YmmReg source, uint8_t count, Code& where );
+
+// vpbroadcastd, vpbroadcastq copy the low lane of source into every lane
+size_t
+makeVPBroadcastD( YmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeVPBroadcastD( YmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeVPBroadcastQ( YmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeVPBroadcastQ( YmmReg destination, const Mem& source, Code& where );
+
+// vpermq each 2 bit field of select picks the source qword for that lane
+size_t
+makeVPermQ( YmmReg destination, YmmReg source, uint8_t select, Code& where );
+
+size_t
+makeVPermQ( YmmReg destination, const Mem& source, uint8_t select, Code& where );
+
+// FMA3 fused multiply add with a single rounding. The digits name which operands are
+// multiplied and which is added, numbering destination 1, source1 2 and source2 3:
+//   132: destination = destination * source2 + source1
+//   213: destination = source1 * destination + source2
+//   231: destination = source1 * source2 + destination
+// msub subtracts the addend and nmadd negates the product.
+enum struct FmaOp {
+  madd132 = 0x98,
+  msub132 = 0x9a,
+  nmadd132 = 0x9c,
+  madd213 = 0xa8,
+  msub213 = 0xaa,
+  nmadd213 = 0xac,
+  madd231 = 0xb8,
+  msub231 = 0xba,
+  nmadd231 = 0xbc
+};
+
+size_t
+makeVFmaSD( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVFmaSD( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVFmaSS( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVFmaSS( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVFmaPD( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVFmaPD( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVFmaPD( FmaOp op, YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVFmaPD( FmaOp op, YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVFmaPS( FmaOp op, XmmReg destination, XmmReg source1, XmmReg source2, Code& where );
+
+size_t
+makeVFmaPS( FmaOp op, XmmReg destination, XmmReg source1, const Mem& source2, Code& where );
+
+size_t
+makeVFmaPS( FmaOp op, YmmReg destination, YmmReg source1, YmmReg source2, Code& where );
+
+size_t
+makeVFmaPS( FmaOp op, YmmReg destination, YmmReg source1, const Mem& source2, Code& where );
+
+// ----------------------------------------------------------------------
+// EVEX encoded AVX-512 instructions on zmm registers. Each takes an optional write mask,
+// and the memory forms of the lane-wise ops can broadcast one element to every lane.
+
+// vmovapd, vmovaps need 64 byte aligned memory
+size_t
+makeVMovAPD( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovAPD( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovAPD( const Mem& destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovUPD( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovUPD( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovUPD( const Mem& destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovAPS( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovAPS( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovAPS( const Mem& destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovUPS( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovUPS( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovUPS( const Mem& destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+// vmovdqu32, vmovdqu64 unaligned integer moves; the mask works on dword or qword lanes
+size_t
+makeVMovDQU32( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovDQU32( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovDQU32( const Mem& destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovDQU64( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovDQU64( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVMovDQU64( const Mem& destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+// vaddpd, vaddps
+size_t
+makeVAddPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVAddPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVAddPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVAddPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vsubpd, vsubps
+size_t
+makeVSubPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVSubPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVSubPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVSubPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vmulpd, vmulps
+size_t
+makeVMulPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVMulPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVMulPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVMulPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vdivpd, vdivps
+size_t
+makeVDivPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVDivPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVDivPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVDivPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vminpd, vminps
+size_t
+makeVMinPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVMinPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVMinPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVMinPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vmaxpd, vmaxps
+size_t
+makeVMaxPD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVMaxPD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVMaxPS( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVMaxPS( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vsqrtpd, vsqrtps
+size_t
+makeVSqrtPD( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVSqrtPD( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask(),
+             bool broadcast = false );
+
+size_t
+makeVSqrtPS( ZmmReg destination, ZmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVSqrtPS( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask(),
+             bool broadcast = false );
+
+// fused multiply add on 8 doubles or 16 singles
+size_t
+makeVFmaPD( FmaOp op, ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVFmaPD( FmaOp op, ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVFmaPS( FmaOp op, ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVFmaPS( FmaOp op, ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vcmppd, vcmpps set one bit of destination per lane; the mask must be a merging mask and
+// clears the lanes it leaves out
+size_t
+makeVCmpPD( KReg destination, ZmmReg source1, ZmmReg source2, SDcmp op, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVCmpPD( KReg destination, ZmmReg source1, const Mem& source2, SDcmp op, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVCmpPS( KReg destination, ZmmReg source1, ZmmReg source2, SDcmp op, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVCmpPS( KReg destination, ZmmReg source1, const Mem& source2, SDcmp op, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// vbroadcastsd, vbroadcastss copy one scalar into every lane
+size_t
+makeVBroadcastSD( ZmmReg destination, XmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVBroadcastSD( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVBroadcastSS( ZmmReg destination, XmmReg source, Code& where, Mask mask = Mask() );
+
+size_t
+makeVBroadcastSS( ZmmReg destination, const Mem& source, Code& where, Mask mask = Mask() );
+
+// integer lane-wise ops on dword (D) or qword (Q) lanes
+size_t
+makeVPAddD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPAddD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPAddQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPAddQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPSubD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPSubD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPSubQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPSubQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPAndD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPAndD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPAndQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPAndQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPOrD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+           Mask mask = Mask() );
+
+size_t
+makeVPOrD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+           Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPOrQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+           Mask mask = Mask() );
+
+size_t
+makeVPOrQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+           Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPXorD( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPXorD( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+size_t
+makeVPXorQ( ZmmReg destination, ZmmReg source1, ZmmReg source2, Code& where,
+            Mask mask = Mask() );
+
+size_t
+makeVPXorQ( ZmmReg destination, ZmmReg source1, const Mem& source2, Code& where,
+            Mask mask = Mask(), bool broadcast = false );
+
+// kmovb, kmovw, kmovd, kmovq move the low 8, 16, 32 or 64 bits between an opmask and a
+// general purpose register
+size_t
+makeKMovB( KReg destination, Register source, Code& where );
+
+size_t
+makeKMovB( Register destination, KReg source, Code& where );
+
+size_t
+makeKMovW( KReg destination, Register source, Code& where );
+
+size_t
+makeKMovW( Register destination, KReg source, Code& where );
+
+size_t
+makeKMovD( KReg destination, Register source, Code& where );
+
+size_t
+makeKMovD( Register destination, KReg source, Code& where );
+
+size_t
+makeKMovQ( KReg destination, Register source, Code& where );
+
+size_t
+makeKMovQ( Register destination, KReg source, Code& where );
+
+// ----------------------------------------------------------------------
+// Bit manipulation on 64 bit registers. The BMI instructions don't touch their sources and
+// most leave the flags they don't define alone.
+
+// andn destination = ~source1 & source2
+size_t
+makeAndN( Register destination, Register source1, Register source2, Code& where );
+
+size_t
+makeAndN( Register destination, Register source1, const Mem& source2, Code& where );
+
+// bextr extract a bit field from source; control bits 7:0 are the start, 15:8 the length
+size_t
+makeBExtr( Register destination, Register source, Register control, Code& where );
+
+size_t
+makeBExtr( Register destination, const Mem& source, Register control, Code& where );
+
+// blsr clear the lowest set bit; blsi keep only the lowest set bit; blsmsk set every bit
+// up to and including the lowest set bit
+size_t
+makeBlsR( Register destination, Register source, Code& where );
+
+size_t
+makeBlsR( Register destination, const Mem& source, Code& where );
+
+size_t
+makeBlsI( Register destination, Register source, Code& where );
+
+size_t
+makeBlsI( Register destination, const Mem& source, Code& where );
+
+size_t
+makeBlsMsk( Register destination, Register source, Code& where );
+
+size_t
+makeBlsMsk( Register destination, const Mem& source, Code& where );
+
+// bzhi clear the bits of source from bit index up
+size_t
+makeBzhi( Register destination, Register source, Register index, Code& where );
+
+size_t
+makeBzhi( Register destination, const Mem& source, Register index, Code& where );
+
+// pdep scatter the low bits of source1 to the set bit positions of the mask source2
+size_t
+makePDep( Register destination, Register source1, Register source2, Code& where );
+
+size_t
+makePDep( Register destination, Register source1, const Mem& source2, Code& where );
+
+// pext gather the bits of source1 at the set bit positions of the mask source2
+size_t
+makePExt( Register destination, Register source1, Register source2, Code& where );
+
+size_t
+makePExt( Register destination, Register source1, const Mem& source2, Code& where );
+
+// mulx high:low = rdx * source, unsigned, without touching the flags
+size_t
+makeMulX( Register high, Register low, Register source, Code& where );
+
+size_t
+makeMulX( Register high, Register low, const Mem& source, Code& where );
+
+// rorx rotate right by an immediate without touching the flags
+size_t
+makeRorX( Register destination, Register source, uint8_t count, Code& where );
+
+size_t
+makeRorX( Register destination, const Mem& source, uint8_t count, Code& where );
+
+// shlx, shrx, sarx shift by the count in a register without touching the flags
+size_t
+makeShlX( Register destination, Register source, Register count, Code& where );
+
+size_t
+makeShlX( Register destination, const Mem& source, Register count, Code& where );
+
+size_t
+makeShrX( Register destination, Register source, Register count, Code& where );
+
+size_t
+makeShrX( Register destination, const Mem& source, Register count, Code& where );
+
+size_t
+makeSarX( Register destination, Register source, Register count, Code& where );
+
+size_t
+makeSarX( Register destination, const Mem& source, Register count, Code& where );
+
+// popcnt count the set bits
+size_t
+makePopCnt( Register destination, Register source, Code& where );
+
+size_t
+makePopCnt( Register destination, const Mem& source, Code& where );
+
+// lzcnt count the leading zero bits; 64 when source is 0
+size_t
+makeLzCnt( Register destination, Register source, Code& where );
+
+size_t
+makeLzCnt( Register destination, const Mem& source, Code& where );
+
+// tzcnt count the trailing zero bits; 64 when source is 0
+size_t
+makeTzCnt( Register destination, Register source, Code& where );
+
+size_t
+makeTzCnt( Register destination, const Mem& source, Code& where );
+
+// ----------------------------------------------------------------------
+// Branchless selects
+
+// cmovcc destination = source when test holds; a memory source is always read
+size_t
+makeCmovcc( CondTest test, Register destination, Register source, Code& where );
+
+size_t
+makeCmovcc( CondTest test, Register destination, const Mem& source, Code& where );
+
+// setcc set the low byte of reg, or the byte at memory, to 1 when test holds and 0 when
+// it doesn't. The rest of reg is left alone.
+size_t
+makeSetcc( CondTest test, Register reg, Code& where );
+
+size_t
+makeSetcc( CondTest test, const Mem& reg, Code& where );
+
+// blendpd, blendps take lane i from source when bit i of select is set
+size_t
+makeBlendPD( XmmReg destination, XmmReg source, uint8_t select, Code& where );
+
+size_t
+makeBlendPD( XmmReg destination, const Mem& source, uint8_t select, Code& where );
+
+size_t
+makeBlendPS( XmmReg destination, XmmReg source, uint8_t select, Code& where );
+
+size_t
+makeBlendPS( XmmReg destination, const Mem& source, uint8_t select, Code& where );
+
+// blendvpd, blendvps take lane i from source when the sign bit of lane i of xmm0 is set,
+// as left by a cmppd or cmpps
+size_t
+makeBlendVPD( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeBlendVPD( XmmReg destination, const Mem& source, Code& where );
+
+size_t
+makeBlendVPS( XmmReg destination, XmmReg source, Code& where );
+
+size_t
+makeBlendVPS( XmmReg destination, const Mem& source, Code& where );
+
+// vblendvpd, vblendvps lane i of destination is lane i of source2 when the sign bit of
+// lane i of mask is set, and of source1 when it isn't
+size_t
+makeVBlendVPD( XmmReg destination, XmmReg source1, XmmReg source2, XmmReg mask,
+               Code& where );
+
+size_t
+makeVBlendVPD( XmmReg destination, XmmReg source1, const Mem& source2, XmmReg mask,
+               Code& where );
+
+size_t
+makeVBlendVPD( YmmReg destination, YmmReg source1, YmmReg source2, YmmReg mask,
+               Code& where );
+
+size_t
+makeVBlendVPD( YmmReg destination, YmmReg source1, const Mem& source2, YmmReg mask,
+               Code& where );
+
+size_t
+makeVBlendVPS( XmmReg destination, XmmReg source1, XmmReg source2, XmmReg mask,
+               Code& where );
+
+size_t
+makeVBlendVPS( XmmReg destination, XmmReg source1, const Mem& source2, XmmReg mask,
+               Code& where );
+
+size_t
+makeVBlendVPS( YmmReg destination, YmmReg source1, YmmReg source2, YmmReg mask,
+               Code& where );
+
+size_t
+makeVBlendVPS( YmmReg destination, YmmReg source1, const Mem& source2, YmmReg mask,
+               Code& where );
+
+// vblendpd, vblendps take lane i from source2 when bit i of select is set
+size_t
+makeVBlendPD( YmmReg destination, YmmReg source1, YmmReg source2, uint8_t select,
+              Code& where );
+
+size_t
+makeVBlendPD( YmmReg destination, YmmReg source1, const Mem& source2, uint8_t select,
+              Code& where );
+
+size_t
+makeVBlendPS( YmmReg destination, YmmReg source1, YmmReg source2, uint8_t select,
+              Code& where );
+
+size_t
+makeVBlendPS( YmmReg destination, YmmReg source1, const Mem& source2, uint8_t select,
+              Code& where );
+
+// ----------------------------------------------------------------------
+// Cache control for streaming kernels. Non-temporal stores go around the cache and are
+// weakly ordered, so follow a run of them with an sfence before publishing the data.
+
+enum struct PrefetchHint {
+  nta = 0,  // into a buffer close to the core, skipping the cache levels where it can
+  t0,       // into every level
+  t1,       // into level 2 and up
+  t2        // into level 3 and up
+};
+
+size_t
+makePrefetch( PrefetchHint hint, const Mem& memory, Code& where );
+
+// prefetchw fetch a cache line in a state ready to be written
+size_t
+makePrefetchW( const Mem& memory, Code& where );
+
+// movnti store a 64 bit register around the cache
+size_t
+makeMovNTI( const Mem& destination, Register source, Code& where );
+
+// movntpd, movntps, movntdq, and their ymm forms; memory must be aligned to the
+// register's size
+size_t
+makeMovNTPD( const Mem& destination, XmmReg source, Code& where );
+
+size_t
+makeMovNTPS( const Mem& destination, XmmReg source, Code& where );
+
+size_t
+makeMovNTDQ( const Mem& destination, XmmReg source, Code& where );
+
+size_t
+makeVMovNTPD( const Mem& destination, YmmReg source, Code& where );
+
+size_t
+makeVMovNTPS( const Mem& destination, YmmReg source, Code& where );
+
+size_t
+makeVMovNTDQ( const Mem& destination, YmmReg source, Code& where );
+
+// sfence order every earlier store before any later store
+size_t
+makeSFence( Code& where );
+
+// ----------------------------------------------------------------------
+// Atomics and fences. Put makeLock before xadd or cmpxchg, or before an add, sub, and,
+// or, xor, inc, dec, not or neg with a memory destination, to make it atomic. xchg with
+// memory is always atomic.
+
+// xchg swap two registers, or a register and memory
+size_t
+makeXchg( Register destination, Register source, Code& where );
+
+size_t
+makeXchg( const Mem& destination, Register source, Code& where );
+
+// xadd source = old destination, destination = old destination + source
+size_t
+makeXadd( Register destination, Register source, Code& where );
+
+size_t
+makeXadd( const Mem& destination, Register source, Code& where );
+
+// cmpxchg if rax equals destination then destination = source, else rax = destination;
+// ZF is set when the exchange happened
+size_t
+makeCmpXchg( Register destination, Register source, Code& where );
+
+size_t
+makeCmpXchg( const Mem& destination, Register source, Code& where );
+
+// cmpxchg16b compare rdx:rax with the 16 aligned bytes at destination; when they match
+// store rcx:rbx there, otherwise load them into rdx:rax
+size_t
+makeCmpXchg16B( const Mem& destination, Code& where );
+
+// mfence order every earlier load and store before any later one
+size_t
+makeMFence( Code& where );
+
+// lfence finish every earlier instruction before any later one starts
+size_t
+makeLFence( Code& where );
+
+// pause hint that this is a spin-wait loop
+size_t
+makePause( Code& where );
+
+// ----------------------------------------------------------------------
+// Block copy and fill, picking the sequence for cpu. A known size up to eight vectors is
+// unrolled into ymm moves with AVX or xmm moves without, and general purpose moves for
+// what's left; these use xmm0 or ymm0 and the first of rax, rcx and rdx that isn't an
+// operand. A larger size is done with rep movsb or rep stosb when the CPU has ERMS, and
+// with rep movsq or rep stosq plus one overlapping qword otherwise; these move the
+// operands into rdi and rsi and use rax and rcx. The ymm sequences leave the upper
+// half of ymm0 dirty and emit no vzeroupper, so they can sit inside an AVX kernel; emit
+// makeVZeroUpper() after them before calling or returning to SSE code.
+
+// copy size bytes from [source] to [destination]
+size_t
+makeMemCpy( Register destination, Register source, size_t size, Code& where,
+            const CpuFeatures& cpu = CpuFeatures::host() );
+
+// copy rcx bytes from [rsi] to [rdi]; rax is used without ERMS
+size_t
+makeMemCpy( Code& where, const CpuFeatures& cpu = CpuFeatures::host() );
+
+// fill size bytes at [destination] with value
+size_t
+makeMemSet( Register destination, uint8_t value, size_t size, Code& where,
+            const CpuFeatures& cpu = CpuFeatures::host() );
+
+// fill rcx bytes at [rdi] with al; rax and rdx are used without ERMS
+size_t
+makeMemSet( Code& where, const CpuFeatures& cpu = CpuFeatures::host() );
 
+// length bytes of the recommended multi-byte nops
 size_t
-makeCvtSd2Si( XmmReg destination, IndirectReg source, Code& where );
+makeNop( size_t length, Code& where );
 
 #endif
 